@@ -0,0 +1,591 @@
+#include "compressed_texture.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+
+static uint8_t constexpr ktx2Identifier[12] = { 0xAB, 0x4B, 0x54, 0x58, 0x20, 0x32, 0x30, 0xBB, 0x0D, 0x0A, 0x1A, 0x0A };
+static uint8_t constexpr ddsMagic[4] = { 'D', 'D', 'S', ' ' };
+
+static uint32_t constexpr make_four_cc(char const a, char const b, char const c, char const d)
+{
+	return static_cast<uint32_t>(a) | (static_cast<uint32_t>(b) << 8) | (static_cast<uint32_t>(c) << 16) | (static_cast<uint32_t>(d) << 24);
+}
+
+// Both containers are little endian, as is everything we run on
+template<typename T>
+static T read_field(std::span<uint8_t const> const bytes, size_t const offset)
+{
+	T value;
+	memcpy(&value, bytes.data() + offset, sizeof(T));
+	return value;
+}
+
+static uint32_t get_block_size(VkFormat const format)
+{
+	switch (format)
+	{
+	case VK_FORMAT_BC1_RGB_UNORM_BLOCK:
+	case VK_FORMAT_BC1_RGB_SRGB_BLOCK:
+	case VK_FORMAT_BC1_RGBA_UNORM_BLOCK:
+	case VK_FORMAT_BC1_RGBA_SRGB_BLOCK:
+	case VK_FORMAT_BC4_UNORM_BLOCK:
+	case VK_FORMAT_BC4_SNORM_BLOCK:
+		return 8;
+	case VK_FORMAT_BC2_UNORM_BLOCK:
+	case VK_FORMAT_BC2_SRGB_BLOCK:
+	case VK_FORMAT_BC3_UNORM_BLOCK:
+	case VK_FORMAT_BC3_SRGB_BLOCK:
+	case VK_FORMAT_BC5_UNORM_BLOCK:
+	case VK_FORMAT_BC5_SNORM_BLOCK:
+	case VK_FORMAT_BC7_UNORM_BLOCK:
+	case VK_FORMAT_BC7_SRGB_BLOCK:
+		return 16;
+	default:
+		return 0;
+	}
+}
+
+size_t get_compressed_level_size(VkFormat const format, uint32_t const width, uint32_t const height)
+{
+	size_t const blocksX = (std::max(width, 1u) + 3) / 4;
+	size_t const blocksY = (std::max(height, 1u) + 3) / 4;
+	return blocksX * blocksY * get_block_size(format);
+}
+
+uint32_t get_full_mip_count(uint32_t const width, uint32_t const height)
+{
+	return static_cast<uint32_t>(std::floor(std::log2(std::max({ width, height, 1u })))) + 1;
+}
+
+static VkBufferImageCopy make_level_region(VkDeviceSize const offset, uint32_t const level, VkExtent3D const size)
+{
+	return VkBufferImageCopy
+	{
+		.bufferOffset = offset,
+		.bufferRowLength = 0,
+		.bufferImageHeight = 0,
+		.imageSubresource
+		{
+			.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+			.mipLevel = level,
+			.baseArrayLayer = 0,
+			.layerCount = 1
+		},
+		.imageExtent
+		{
+			.width = std::max(size.width >> level, 1u),
+			.height = std::max(size.height >> level, 1u),
+			.depth = 1
+		}
+	};
+}
+
+static std::optional<CompressedTexture> parse_ktx2(std::vector<uint8_t>&& bytes)
+{
+	std::span<uint8_t const> const file(bytes);
+	if (file.size() < 80)
+	{
+		return {};
+	}
+
+	auto const format = static_cast<VkFormat>(read_field<uint32_t>(file, 12));
+	uint32_t const width = read_field<uint32_t>(file, 20);
+	uint32_t const height = read_field<uint32_t>(file, 24);
+	uint32_t const depth = read_field<uint32_t>(file, 28);
+	uint32_t const layerCount = read_field<uint32_t>(file, 32);
+	uint32_t const faceCount = read_field<uint32_t>(file, 36);
+	// zero means the loader is expected to generate mips, which we can't do for block formats
+	uint32_t const levelCount = std::max(read_field<uint32_t>(file, 40), 1u);
+	uint32_t const supercompression = read_field<uint32_t>(file, 44);
+	uint32_t const dfdOffset = read_field<uint32_t>(file, 48);
+
+	if (get_block_size(format) == 0 || supercompression != 0)
+	{
+		std::cerr << "Error when loading KTX2 texture: only uncompressed BC payloads are supported (format " << format
+			<< ", supercompression " << supercompression << ")\n";
+		return {};
+	}
+	if (depth > 1 || layerCount > 1 || faceCount != 1 || width == 0 || height == 0)
+	{
+		std::cerr << "Error when loading KTX2 texture: only single 2D images are supported\n";
+		return {};
+	}
+	// Also keeps width >> level defined below
+	if (levelCount > get_full_mip_count(width, height))
+	{
+		std::cerr << "Error when loading KTX2 texture: " << levelCount << " levels is more than a " << width << "x" << height << " image has\n";
+		return {};
+	}
+	// The level index sits between the header and the data format descriptor
+	size_t const levelIndexEnd = 80 + static_cast<size_t>(levelCount) * 24;
+	if (file.size() < levelIndexEnd || (dfdOffset != 0 && dfdOffset < levelIndexEnd))
+	{
+		std::cerr << "Error when loading KTX2 texture: level index is out of bounds\n";
+		return {};
+	}
+
+	CompressedTexture texture
+	{
+		.format = format,
+		.size = { width, height, 1 }
+	};
+
+	for (uint32_t level = 0; level < levelCount; level++)
+	{
+		uint64_t const offset = read_field<uint64_t>(file, 80 + level * 24);
+		uint64_t const length = read_field<uint64_t>(file, 80 + level * 24 + 8);
+		if (offset > file.size() || length > file.size() - offset || length < get_compressed_level_size(format, width >> level, height >> level))
+		{
+			std::cerr << "Error when loading KTX2 texture: level " << level << " is out of bounds\n";
+			return {};
+		}
+		// The file is staged as a whole, so levels are copied straight from their file offsets, which have to be block aligned
+		if (offset % get_block_size(format) != 0)
+		{
+			std::cerr << "Error when loading KTX2 texture: level " << level << " is not block aligned\n";
+			return {};
+		}
+		texture.regions.push_back(make_level_region(offset, level, texture.size));
+	}
+
+	texture.data = std::move(bytes);
+	return texture;
+}
+
+static VkFormat get_dxgi_format(uint32_t const dxgiFormat)
+{
+	switch (dxgiFormat)
+	{
+	case 71: return VK_FORMAT_BC1_RGBA_UNORM_BLOCK;
+	case 72: return VK_FORMAT_BC1_RGBA_SRGB_BLOCK;
+	case 74: return VK_FORMAT_BC2_UNORM_BLOCK;
+	case 75: return VK_FORMAT_BC2_SRGB_BLOCK;
+	case 77: return VK_FORMAT_BC3_UNORM_BLOCK;
+	case 78: return VK_FORMAT_BC3_SRGB_BLOCK;
+	case 80: return VK_FORMAT_BC4_UNORM_BLOCK;
+	case 81: return VK_FORMAT_BC4_SNORM_BLOCK;
+	case 83: return VK_FORMAT_BC5_UNORM_BLOCK;
+	case 84: return VK_FORMAT_BC5_SNORM_BLOCK;
+	case 98: return VK_FORMAT_BC7_UNORM_BLOCK;
+	case 99: return VK_FORMAT_BC7_SRGB_BLOCK;
+	default: return VK_FORMAT_UNDEFINED;
+	}
+}
+
+static VkFormat get_four_cc_format(uint32_t const fourCC)
+{
+	switch (fourCC)
+	{
+	case make_four_cc('D', 'X', 'T', '1'): return VK_FORMAT_BC1_RGBA_UNORM_BLOCK;
+	case make_four_cc('D', 'X', 'T', '3'): return VK_FORMAT_BC2_UNORM_BLOCK;
+	case make_four_cc('D', 'X', 'T', '5'): return VK_FORMAT_BC3_UNORM_BLOCK;
+	case make_four_cc('A', 'T', 'I', '1'):
+	case make_four_cc('B', 'C', '4', 'U'): return VK_FORMAT_BC4_UNORM_BLOCK;
+	case make_four_cc('A', 'T', 'I', '2'):
+	case make_four_cc('B', 'C', '5', 'U'): return VK_FORMAT_BC5_UNORM_BLOCK;
+	default: return VK_FORMAT_UNDEFINED;
+	}
+}
+
+static std::optional<CompressedTexture> parse_dds(std::vector<uint8_t>&& bytes)
+{
+	static size_t constexpr headerEnd = 128;
+	static size_t constexpr dx10HeaderEnd = headerEnd + 20;
+	static uint32_t constexpr mipCountFlag = 0x20000;
+	static uint32_t constexpr cubemapFlag = 0x200;
+	static uint32_t constexpr volumeFlag = 0x200000;
+
+	std::span<uint8_t const> const file(bytes);
+	if (file.size() < headerEnd || read_field<uint32_t>(file, 4) != 124)
+	{
+		return {};
+	}
+
+	uint32_t const flags = read_field<uint32_t>(file, 8);
+	uint32_t const height = read_field<uint32_t>(file, 12);
+	uint32_t const width = read_field<uint32_t>(file, 16);
+	uint32_t const mipCount = (flags & mipCountFlag) ? std::max(read_field<uint32_t>(file, 28), 1u) : 1u;
+	uint32_t const fourCC = read_field<uint32_t>(file, 84);
+	uint32_t const caps2 = read_field<uint32_t>(file, 112);
+
+	VkFormat format;
+	size_t dataOffset = headerEnd;
+	if (fourCC == make_four_cc('D', 'X', '1', '0'))
+	{
+		if (file.size() < dx10HeaderEnd)
+		{
+			return {};
+		}
+		format = get_dxgi_format(read_field<uint32_t>(file, 128));
+		if (read_field<uint32_t>(file, 140) > 1)
+		{
+			std::cerr << "Error when loading DDS texture: texture arrays are not supported\n";
+			return {};
+		}
+		dataOffset = dx10HeaderEnd;
+	}
+	else
+	{
+		format = get_four_cc_format(fourCC);
+	}
+
+	if (format == VK_FORMAT_UNDEFINED)
+	{
+		std::cerr << "Error when loading DDS texture: only BC1-BC5 and BC7 are supported\n";
+		return {};
+	}
+	if ((caps2 & (cubemapFlag | volumeFlag)) || width == 0 || height == 0)
+	{
+		std::cerr << "Error when loading DDS texture: only single 2D images are supported\n";
+		return {};
+	}
+	// Also keeps width >> level defined below
+	if (mipCount > get_full_mip_count(width, height))
+	{
+		std::cerr << "Error when loading DDS texture: " << mipCount << " mips is more than a " << width << "x" << height << " image has\n";
+		return {};
+	}
+
+	CompressedTexture texture
+	{
+		.format = format,
+		.size = { width, height, 1 }
+	};
+
+	// Regions are relative to the end of the header, which is dropped below. The data then starts on the staging
+	// alignment, and every level on a block boundary since level sizes are whole blocks. A DX10 header alone is 148 bytes.
+	size_t offset = 0;
+	for (uint32_t level = 0; level < mipCount; level++)
+	{
+		size_t const levelSize = get_compressed_level_size(format, width >> level, height >> level);
+		if (dataOffset + offset + levelSize > file.size())
+		{
+			std::cerr << "Error when loading DDS texture: level " << level << " is out of bounds\n";
+			return {};
+		}
+		texture.regions.push_back(make_level_region(offset, level, texture.size));
+		offset += levelSize;
+	}
+
+	bytes.erase(bytes.begin(), bytes.begin() + static_cast<std::ptrdiff_t>(dataOffset));
+	texture.data = std::move(bytes);
+	return texture;
+}
+
+// One 4x4 block, edge blocks repeat the last row and column
+struct BlockPixels
+{
+	uint8_t rgba[16][4];
+};
+
+static BlockPixels load_block(uint8_t const* rgba, uint32_t const width, uint32_t const height, uint32_t const blockX, uint32_t const blockY)
+{
+	BlockPixels block;
+	for (uint32_t y = 0; y < 4; y++)
+	{
+		uint32_t const sy = std::min(blockY * 4 + y, height - 1);
+		for (uint32_t x = 0; x < 4; x++)
+		{
+			uint32_t const sx = std::min(blockX * 4 + x, width - 1);
+			memcpy(block.rgba[y * 4 + x], rgba + (static_cast<size_t>(sy) * width + sx) * 4, 4);
+		}
+	}
+	return block;
+}
+
+static uint16_t pack_565(int const r, int const g, int const b)
+{
+	return static_cast<uint16_t>(((r * 31 + 127) / 255) << 11 | ((g * 63 + 127) / 255) << 5 | ((b * 31 + 127) / 255));
+}
+
+static void unpack_565(uint16_t const color, int* rgb)
+{
+	int const r = (color >> 11) & 31;
+	int const g = (color >> 5) & 63;
+	int const b = color & 31;
+	rgb[0] = (r << 3) | (r >> 2);
+	rgb[1] = (g << 2) | (g >> 4);
+	rgb[2] = (b << 3) | (b >> 2);
+}
+
+// Four-color mode only, which is also what BC3 expects from its color half
+static void encode_bc1_block(BlockPixels const& block, uint8_t* out)
+{
+	int minColor[3] = { 255, 255, 255 };
+	int maxColor[3] = { 0, 0, 0 };
+	for (auto const& pixel : block.rgba)
+	{
+		for (int c = 0; c < 3; c++)
+		{
+			minColor[c] = std::min(minColor[c], static_cast<int>(pixel[c]));
+			maxColor[c] = std::max(maxColor[c], static_cast<int>(pixel[c]));
+		}
+	}
+
+	// The bounding box diagonal is picked by how each channel correlates with the widest one
+	int widest = 0;
+	for (int c = 1; c < 3; c++)
+	{
+		if (maxColor[c] - minColor[c] > maxColor[widest] - minColor[widest])
+		{
+			widest = c;
+		}
+	}
+	for (int c = 0; c < 3; c++)
+	{
+		if (c == widest)
+		{
+			continue;
+		}
+		int covariance = 0;
+		for (auto const& pixel : block.rgba)
+		{
+			covariance += (2 * pixel[c] - minColor[c] - maxColor[c]) * (2 * pixel[widest] - minColor[widest] - maxColor[widest]);
+		}
+		if (covariance < 0)
+		{
+			std::swap(minColor[c], maxColor[c]);
+		}
+	}
+
+	// inset by 1/16 of the range so the endpoints sit inside the colors instead of on the outliers
+	for (int c = 0; c < 3; c++)
+	{
+		int const inset = (maxColor[c] - minColor[c]) / 16;
+		maxColor[c] -= inset;
+		minColor[c] += inset;
+	}
+
+	uint16_t color0 = pack_565(maxColor[0], maxColor[1], maxColor[2]);
+	uint16_t color1 = pack_565(minColor[0], minColor[1], minColor[2]);
+	if (color0 < color1)
+	{
+		std::swap(color0, color1);
+	}
+
+	uint32_t indices = 0;
+	if (color0 != color1)
+	{
+		int palette[4][3];
+		unpack_565(color0, palette[0]);
+		unpack_565(color1, palette[1]);
+		for (int c = 0; c < 3; c++)
+		{
+			palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+			palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+		}
+
+		for (int i = 0; i < 16; i++)
+		{
+			int bestIndex = 0;
+			int bestDistance = INT32_MAX;
+			for (int p = 0; p < 4; p++)
+			{
+				int distance = 0;
+				for (int c = 0; c < 3; c++)
+				{
+					int const d = block.rgba[i][c] - palette[p][c];
+					distance += d * d;
+				}
+				if (distance < bestDistance)
+				{
+					bestDistance = distance;
+					bestIndex = p;
+				}
+			}
+			indices |= static_cast<uint32_t>(bestIndex) << (i * 2);
+		}
+	}
+
+	memcpy(out, &color0, 2);
+	memcpy(out + 2, &color1, 2);
+	memcpy(out + 4, &indices, 4);
+}
+
+// Eight-value mode on one channel, shared by BC3 alpha, BC4 and BC5
+static void encode_bc4_block(BlockPixels const& block, int const channel, uint8_t* out)
+{
+	int minValue = 255;
+	int maxValue = 0;
+	for (auto const& pixel : block.rgba)
+	{
+		minValue = std::min(minValue, static_cast<int>(pixel[channel]));
+		maxValue = std::max(maxValue, static_cast<int>(pixel[channel]));
+	}
+
+	uint64_t indices = 0;
+	if (maxValue != minValue)
+	{
+		int palette[8] = { maxValue, minValue };
+		for (int p = 1; p < 7; p++)
+		{
+			palette[p + 1] = ((7 - p) * maxValue + p * minValue + 3) / 7;
+		}
+
+		for (int i = 0; i < 16; i++)
+		{
+			int bestIndex = 0;
+			int bestDistance = INT32_MAX;
+			for (int p = 0; p < 8; p++)
+			{
+				int const distance = std::abs(block.rgba[i][channel] - palette[p]);
+				if (distance < bestDistance)
+				{
+					bestDistance = distance;
+					bestIndex = p;
+				}
+			}
+			indices |= static_cast<uint64_t>(bestIndex) << (i * 3);
+		}
+	}
+
+	out[0] = static_cast<uint8_t>(maxValue);
+	out[1] = static_cast<uint8_t>(minValue);
+	for (int i = 0; i < 6; i++)
+	{
+		out[2 + i] = static_cast<uint8_t>(indices >> (i * 8));
+	}
+}
+
+static void encode_level(uint8_t const* rgba, uint32_t const width, uint32_t const height, VkFormat const format, uint8_t* out)
+{
+	uint32_t const blocksX = (width + 3) / 4;
+	uint32_t const blocksY = (height + 3) / 4;
+	for (uint32_t by = 0; by < blocksY; by++)
+	{
+		for (uint32_t bx = 0; bx < blocksX; bx++)
+		{
+			BlockPixels const block = load_block(rgba, width, height, bx, by);
+			switch (get_color_space_variant(format, false))
+			{
+			case VK_FORMAT_BC1_RGB_UNORM_BLOCK:
+			case VK_FORMAT_BC1_RGBA_UNORM_BLOCK:
+				encode_bc1_block(block, out);
+				break;
+			case VK_FORMAT_BC3_UNORM_BLOCK:
+				encode_bc4_block(block, 3, out);
+				encode_bc1_block(block, out + 8);
+				break;
+			case VK_FORMAT_BC4_UNORM_BLOCK:
+				encode_bc4_block(block, 0, out);
+				break;
+			case VK_FORMAT_BC5_UNORM_BLOCK:
+				encode_bc4_block(block, 0, out);
+				encode_bc4_block(block, 1, out + 8);
+				break;
+			default:
+				assert(false && "unsupported block format");
+				break;
+			}
+			out += get_block_size(format);
+		}
+	}
+}
+
+// 2x2 box filter, odd sizes fold the last row or column in with clamping
+static std::vector<uint8_t> downsample_rgba8(std::vector<uint8_t> const& src, uint32_t const width, uint32_t const height)
+{
+	uint32_t const dstWidth = std::max(width / 2, 1u);
+	uint32_t const dstHeight = std::max(height / 2, 1u);
+	std::vector<uint8_t> dst(static_cast<size_t>(dstWidth) * dstHeight * 4);
+
+	for (uint32_t y = 0; y < dstHeight; y++)
+	{
+		uint32_t const y0 = std::min(y * 2, height - 1);
+		uint32_t const y1 = std::min(y * 2 + 1, height - 1);
+		for (uint32_t x = 0; x < dstWidth; x++)
+		{
+			uint32_t const x0 = std::min(x * 2, width - 1);
+			uint32_t const x1 = std::min(x * 2 + 1, width - 1);
+			for (int c = 0; c < 4; c++)
+			{
+				int const sum = src[(static_cast<size_t>(y0) * width + x0) * 4 + c] + src[(static_cast<size_t>(y0) * width + x1) * 4 + c]
+					+ src[(static_cast<size_t>(y1) * width + x0) * 4 + c] + src[(static_cast<size_t>(y1) * width + x1) * 4 + c];
+				dst[(static_cast<size_t>(y) * dstWidth + x) * 4 + c] = static_cast<uint8_t>((sum + 2) / 4);
+			}
+		}
+	}
+	return dst;
+}
+
+CompressedTexture compress_texture(uint8_t const* rgba, uint32_t const width, uint32_t const height, VkFormat const format)
+{
+	CompressedTexture texture
+	{
+		.format = format,
+		.size = { width, height, 1 }
+	};
+
+	uint32_t const levelCount = get_full_mip_count(width, height);
+
+	size_t totalSize = 0;
+	for (uint32_t level = 0; level < levelCount; level++)
+	{
+		totalSize += get_compressed_level_size(format, width >> level, height >> level);
+	}
+	texture.data.resize(totalSize);
+
+	std::vector<uint8_t> levelPixels(rgba, rgba + static_cast<size_t>(width) * height * 4);
+	size_t offset = 0;
+	for (uint32_t level = 0; level < levelCount; level++)
+	{
+		uint32_t const levelWidth = std::max(width >> level, 1u);
+		uint32_t const levelHeight = std::max(height >> level, 1u);
+		if (level > 0)
+		{
+			levelPixels = downsample_rgba8(levelPixels, std::max(width >> (level - 1), 1u), std::max(height >> (level - 1), 1u));
+		}
+
+		encode_level(levelPixels.data(), levelWidth, levelHeight, format, texture.data.data() + offset);
+		texture.regions.push_back(make_level_region(offset, level, texture.size));
+		offset += get_compressed_level_size(format, levelWidth, levelHeight);
+	}
+
+	return texture;
+}
+
+bool is_compressed_texture_container(std::span<uint8_t const> const bytes)
+{
+	return (bytes.size() >= sizeof(ktx2Identifier) && memcmp(bytes.data(), ktx2Identifier, sizeof(ktx2Identifier)) == 0)
+		|| (bytes.size() >= sizeof(ddsMagic) && memcmp(bytes.data(), ddsMagic, sizeof(ddsMagic)) == 0);
+}
+
+std::optional<CompressedTexture> parse_compressed_texture(std::vector<uint8_t>&& bytes)
+{
+	if (bytes.size() >= sizeof(ktx2Identifier) && memcmp(bytes.data(), ktx2Identifier, sizeof(ktx2Identifier)) == 0)
+	{
+		return parse_ktx2(std::move(bytes));
+	}
+	if (bytes.size() >= sizeof(ddsMagic) && memcmp(bytes.data(), ddsMagic, sizeof(ddsMagic)) == 0)
+	{
+		return parse_dds(std::move(bytes));
+	}
+	return {};
+}
+
+VkFormat get_color_space_variant(VkFormat const format, bool const srgb)
+{
+	switch (format)
+	{
+	case VK_FORMAT_BC1_RGB_UNORM_BLOCK:
+	case VK_FORMAT_BC1_RGB_SRGB_BLOCK:
+		return srgb ? VK_FORMAT_BC1_RGB_SRGB_BLOCK : VK_FORMAT_BC1_RGB_UNORM_BLOCK;
+	case VK_FORMAT_BC1_RGBA_UNORM_BLOCK:
+	case VK_FORMAT_BC1_RGBA_SRGB_BLOCK:
+		return srgb ? VK_FORMAT_BC1_RGBA_SRGB_BLOCK : VK_FORMAT_BC1_RGBA_UNORM_BLOCK;
+	case VK_FORMAT_BC2_UNORM_BLOCK:
+	case VK_FORMAT_BC2_SRGB_BLOCK:
+		return srgb ? VK_FORMAT_BC2_SRGB_BLOCK : VK_FORMAT_BC2_UNORM_BLOCK;
+	case VK_FORMAT_BC3_UNORM_BLOCK:
+	case VK_FORMAT_BC3_SRGB_BLOCK:
+		return srgb ? VK_FORMAT_BC3_SRGB_BLOCK : VK_FORMAT_BC3_UNORM_BLOCK;
+	case VK_FORMAT_BC7_UNORM_BLOCK:
+	case VK_FORMAT_BC7_SRGB_BLOCK:
+		return srgb ? VK_FORMAT_BC7_SRGB_BLOCK : VK_FORMAT_BC7_UNORM_BLOCK;
+	default:
+		return format;
+	}
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <vector>
+
+#include <vulkan/vulkan.h>
+
+// Block-compressed 2D texture read from a KTX2 or DDS file, with the mips stored in the file.
+// Only BC1-BC5 and BC7 payloads are accepted. Basis Universal (BasisLZ/UASTC) and zstd supercompressed
+// KTX2 files need a transcoder we don't ship, so those are rejected and the caller falls back to another image.
+struct CompressedTexture
+{
+	VkFormat format;
+	VkExtent3D size;
+	std::vector<uint8_t> data;
+	// One per mip level, largest first, offsets into data
+	std::vector<VkBufferImageCopy> regions;
+};
+
+bool is_compressed_texture_container(std::span<uint8_t const> bytes);
+
+// Picks the container by its magic number
+std::optional<CompressedTexture> parse_compressed_texture(std::vector<uint8_t>&& bytes);
+
+// Builds the full box-filtered mip chain of an RGBA8 image and encodes every level. Supports BC1 (rgb), BC3 (rgba),
+// BC4 (r) and BC5 (rg) in either color space. Meant for offline cooking: a simple bounding-box fit, fast rather than best quality.
+CompressedTexture compress_texture(uint8_t const* rgba, uint32_t width, uint32_t height, VkFormat format);
+
+// Bytes of one mip level of a block-compressed format
+size_t get_compressed_level_size(VkFormat format, uint32_t width, uint32_t height);
+
+// Levels in a full mip chain down to 1x1, the most any texture of this size can have
+uint32_t get_full_mip_count(uint32_t width, uint32_t height);
+
+// Swaps between the UNORM and SRGB variants for formats that have both, other formats are returned unchanged
+VkFormat get_color_space_variant(VkFormat format, bool srgb);
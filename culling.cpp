@@ -0,0 +1,202 @@
+#include "culling.h"
+
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include <glm/glm.hpp>
+
+#if defined(_M_X64) || defined(_M_AMD64) || defined(__SSE2__)
+#define PORTAL_CULL_SSE 1
+#include <emmintrin.h>
+#else
+#define PORTAL_CULL_SSE 0
+#endif
+
+// Below this many objects a single thread is faster than waking the workers
+static size_t constexpr parallelCullThreshold = 4096;
+static size_t constexpr cullChunkSize = 1024;
+
+void CullingData::clear()
+{
+	resize(0);
+}
+
+void CullingData::resize(size_t const count)
+{
+	centerX.resize(count);
+	centerY.resize(count);
+	centerZ.resize(count);
+	extentX.resize(count);
+	extentY.resize(count);
+	extentZ.resize(count);
+	radius.resize(count);
+	visibility.resize(count);
+}
+
+void CullingData::setBounds(size_t const index, Bounds const& bounds, glm::mat4 const& transform)
+{
+	glm::vec4 const center = transform * glm::vec4(bounds.origin, 1.0f);
+	centerX[index] = center.x;
+	centerY[index] = center.y;
+	centerZ[index] = center.z;
+
+	// world space AABB of the transformed box
+	glm::mat3 const absRotScale = glm::mat3(glm::abs(glm::vec3(transform[0])), glm::abs(glm::vec3(transform[1])), glm::abs(glm::vec3(transform[2])));
+	glm::vec3 const extent = absRotScale * bounds.extents;
+	extentX[index] = extent.x;
+	extentY[index] = extent.y;
+	extentZ[index] = extent.z;
+
+	float const maxScale = glm::max(glm::length(glm::vec3(transform[0])), glm::max(glm::length(glm::vec3(transform[1])), glm::length(glm::vec3(transform[2]))));
+	radius[index] = bounds.sphereRadius * maxScale;
+}
+
+Frustum extract_frustum(glm::mat4 const& viewProj)
+{
+	// Gribb/Hartmann, with a [0, 1] depth range
+	glm::vec4 const row0 = { viewProj[0][0], viewProj[1][0], viewProj[2][0], viewProj[3][0] };
+	glm::vec4 const row1 = { viewProj[0][1], viewProj[1][1], viewProj[2][1], viewProj[3][1] };
+	glm::vec4 const row2 = { viewProj[0][2], viewProj[1][2], viewProj[2][2], viewProj[3][2] };
+	glm::vec4 const row3 = { viewProj[0][3], viewProj[1][3], viewProj[2][3], viewProj[3][3] };
+
+	Frustum frustum
+	{
+		.planes
+		{
+			row3 + row0,
+			row3 - row0,
+			row3 + row1,
+			row3 - row1,
+			row2,
+			row3 - row2
+		}
+	};
+
+	for (glm::vec4& plane : frustum.planes)
+	{
+		plane /= glm::length(glm::vec3(plane));
+	}
+
+	return frustum;
+}
+
+static bool is_visible_scalar(CullingData const& data, Frustum const& frustum, size_t const i)
+{
+	for (glm::vec4 const& plane : frustum.planes)
+	{
+		float const dist = plane.x * data.centerX[i] + plane.y * data.centerY[i] + plane.z * data.centerZ[i] + plane.w;
+		float const boxRadius = std::abs(plane.x) * data.extentX[i] + std::abs(plane.y) * data.extentY[i] + std::abs(plane.z) * data.extentZ[i];
+		// both the sphere and the box are conservative, so the tighter one decides
+		if (dist + std::min(boxRadius, data.radius[i]) < 0.0f)
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+static void cull_range(CullingData& data, Frustum const& frustum, size_t const begin, size_t const end)
+{
+	size_t i = begin;
+
+#if PORTAL_CULL_SSE
+	__m128 const signMask = _mm_set1_ps(-0.0f);
+
+	__m128 planeX[6], planeY[6], planeZ[6], planeW[6];
+	__m128 absPlaneX[6], absPlaneY[6], absPlaneZ[6];
+	for (int p = 0; p < 6; p++)
+	{
+		planeX[p] = _mm_set1_ps(frustum.planes[p].x);
+		planeY[p] = _mm_set1_ps(frustum.planes[p].y);
+		planeZ[p] = _mm_set1_ps(frustum.planes[p].z);
+		planeW[p] = _mm_set1_ps(frustum.planes[p].w);
+		absPlaneX[p] = _mm_andnot_ps(signMask, planeX[p]);
+		absPlaneY[p] = _mm_andnot_ps(signMask, planeY[p]);
+		absPlaneZ[p] = _mm_andnot_ps(signMask, planeZ[p]);
+	}
+
+	for (; i + 4 <= end; i += 4)
+	{
+		__m128 const cx = _mm_loadu_ps(&data.centerX[i]);
+		__m128 const cy = _mm_loadu_ps(&data.centerY[i]);
+		__m128 const cz = _mm_loadu_ps(&data.centerZ[i]);
+		__m128 const ex = _mm_loadu_ps(&data.extentX[i]);
+		__m128 const ey = _mm_loadu_ps(&data.extentY[i]);
+		__m128 const ez = _mm_loadu_ps(&data.extentZ[i]);
+		__m128 const rad = _mm_loadu_ps(&data.radius[i]);
+
+		__m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+		for (int p = 0; p < 6; p++)
+		{
+			__m128 const dist = _mm_add_ps(_mm_add_ps(_mm_mul_ps(planeX[p], cx), _mm_mul_ps(planeY[p], cy)), _mm_add_ps(_mm_mul_ps(planeZ[p], cz), planeW[p]));
+			__m128 const boxRadius = _mm_add_ps(_mm_add_ps(_mm_mul_ps(absPlaneX[p], ex), _mm_mul_ps(absPlaneY[p], ey)), _mm_mul_ps(absPlaneZ[p], ez));
+			__m128 const r = _mm_min_ps(boxRadius, rad);
+			inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(dist, r), _mm_setzero_ps()));
+		}
+
+		int const mask = _mm_movemask_ps(inside);
+		data.visibility[i + 0] = static_cast<uint8_t>(mask & 1);
+		data.visibility[i + 1] = static_cast<uint8_t>((mask >> 1) & 1);
+		data.visibility[i + 2] = static_cast<uint8_t>((mask >> 2) & 1);
+		data.visibility[i + 3] = static_cast<uint8_t>((mask >> 3) & 1);
+	}
+#endif
+
+	for (; i < end; i++)
+	{
+		data.visibility[i] = is_visible_scalar(data, frustum, i) ? 1 : 0;
+	}
+}
+
+void cull_frustum(CullingData& data, Frustum const& frustum, ThreadPool& pool, std::vector<uint32_t>& outVisible)
+{
+	size_t const count = data.size();
+
+	if (count < parallelCullThreshold)
+	{
+		cull_range(data, frustum, 0, count);
+	}
+	else
+	{
+		pool.parallelFor(count, cullChunkSize, [&](size_t const begin, size_t const end)
+			{
+				cull_range(data, frustum, begin, end);
+			});
+	}
+
+	outVisible.clear();
+	for (size_t i = 0; i < count; i++)
+	{
+		if (data.visibility[i])
+		{
+			outVisible.push_back(static_cast<uint32_t>(i));
+		}
+	}
+}
+
+uint32_t select_lod(CullingData const& data, size_t const index, LodSettings const& settings, std::span<SurfaceLod const> lods)
+{
+	if (lods.empty() || settings.errorScale <= 0.0f)
+	{
+		return 0;
+	}
+
+	glm::vec3 const center = { data.centerX[index], data.centerY[index], data.centerZ[index] };
+	float const radius = data.radius[index];
+	float const distance = glm::length(center - settings.cameraPosition) - radius;
+	if (distance <= 0.0f)
+	{
+		return 0;
+	}
+
+	// lod errors are relative to the sphere radius
+	float const allowedError = distance / (radius * settings.errorScale);
+	uint32_t level = 0;
+	while (level < lods.size() && lods[level].error <= allowedError)
+	{
+		level++;
+	}
+	return level;
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <span>
+
+#include "vk_loader.h"
+#include "vk_types.h"
+
+class ThreadPool;
+
+struct Frustum
+{
+	// xyz is the inward facing normal, w the distance, so dot(plane.xyz, p) + plane.w >= 0 is inside
+	glm::vec4 planes[6];
+};
+
+// World space bounds of every RenderObject, stored as structure-of-arrays in draw command order
+// so the culling kernel can test four objects per instruction.
+struct CullingData
+{
+	std::vector<float> centerX;
+	std::vector<float> centerY;
+	std::vector<float> centerZ;
+	std::vector<float> extentX;
+	std::vector<float> extentY;
+	std::vector<float> extentZ;
+	std::vector<float> radius;
+
+	std::vector<uint8_t> visibility;
+
+	void clear();
+	void resize(size_t count);
+	size_t size() const { return radius.size(); }
+
+	void setBounds(size_t index, Bounds const& bounds, glm::mat4 const& transform);
+};
+
+// What select_lod needs from the culling camera
+struct LodSettings
+{
+	glm::vec3 cameraPosition;
+	// Half the viewport height times the projection's y scale, over the allowed error in pixels. 0 keeps full detail.
+	float errorScale;
+};
+
+Frustum extract_frustum(glm::mat4 const& viewProj);
+
+// Tests every object against the frustum and writes the indices of the visible ones, in ascending order.
+void cull_frustum(CullingData& data, Frustum const& frustum, ThreadPool& pool, std::vector<uint32_t>& outVisible);
+
+// Picks the coarsest of an object's LODs whose error, projected at the nearest point of its bounding sphere, stays under
+// the allowed number of pixels. Returns 0 for the full surface, otherwise 1 + the index into lods.
+uint32_t select_lod(CullingData const& data, size_t index, LodSettings const& settings, std::span<SurfaceLod const> lods);
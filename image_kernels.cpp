@@ -0,0 +1,469 @@
+#include "image_kernels.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <vector>
+
+#if defined(_M_X64) || defined(_M_AMD64) || defined(__x86_64__) || defined(__i386__)
+#define PORTAL_KERNELS_X86 1
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#else
+#define PORTAL_KERNELS_X86 0
+#endif
+
+// MSVC lets any function use any intrinsic, GCC and Clang need the target spelled out per function
+#if PORTAL_KERNELS_X86 && !(defined(_MSC_VER) && !defined(__clang__))
+#define PORTAL_TARGET_SSE41 __attribute__((target("sse4.1")))
+#define PORTAL_TARGET_AVX2 __attribute__((target("avx2,f16c")))
+#else
+#define PORTAL_TARGET_SSE41
+#define PORTAL_TARGET_AVX2
+#endif
+
+static KernelLevel detect_kernel_level()
+{
+#if PORTAL_KERNELS_X86
+#if defined(_MSC_VER) && !defined(__clang__)
+	int info[4];
+	__cpuid(info, 0);
+	int const maxLeaf = info[0];
+
+	__cpuid(info, 1);
+	bool const sse41 = (info[2] & (1 << 19)) != 0;
+	bool const osxsave = (info[2] & (1 << 27)) != 0;
+	bool const avx = (info[2] & (1 << 28)) != 0;
+	bool const f16c = (info[2] & (1 << 29)) != 0;
+
+	bool avx2 = false;
+	if (maxLeaf >= 7)
+	{
+		__cpuidex(info, 7, 0);
+		avx2 = (info[1] & (1 << 5)) != 0;
+	}
+
+	// the OS also has to save the ymm registers
+	bool const osAvx = osxsave && avx && (_xgetbv(0) & 6) == 6;
+
+	if (osAvx && avx2 && f16c)
+	{
+		return KernelLevel::AVX2;
+	}
+	if (sse41)
+	{
+		return KernelLevel::SSE41;
+	}
+#else
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("f16c"))
+	{
+		return KernelLevel::AVX2;
+	}
+	if (__builtin_cpu_supports("sse4.1"))
+	{
+		return KernelLevel::SSE41;
+	}
+#endif
+#endif
+	return KernelLevel::Scalar;
+}
+
+KernelLevel get_kernel_level()
+{
+	static KernelLevel const level = detect_kernel_level();
+	return level;
+}
+
+char const* kernel_level_name(KernelLevel const level)
+{
+	switch (level)
+	{
+	case KernelLevel::Scalar:
+		return "scalar";
+	case KernelLevel::SSE41:
+		return "SSE4.1";
+	case KernelLevel::AVX2:
+		return "AVX2";
+	}
+	return "unknown";
+}
+
+// Scalar versions, also used for the tails of the vector loops
+
+static void premultiply_alpha_scalar(uint8_t* data, size_t const pixelCount)
+{
+	for (size_t i = 0; i < pixelCount * 4; i += 4)
+	{
+		uint16_t const a = data[i + 3];
+		data[i + 0] = static_cast<uint8_t>(data[i + 0] * a / 255);
+		data[i + 1] = static_cast<uint8_t>(data[i + 1] * a / 255);
+		data[i + 2] = static_cast<uint8_t>(data[i + 2] * a / 255);
+	}
+}
+
+static void expand_rgb_to_rgba_scalar(float const* src, float* dst, size_t const pixelCount)
+{
+	for (size_t i = 0; i < pixelCount; i++)
+	{
+		dst[4 * i + 0] = src[3 * i + 0];
+		dst[4 * i + 1] = src[3 * i + 1];
+		dst[4 * i + 2] = src[3 * i + 2];
+		dst[4 * i + 3] = 1.0f;
+	}
+}
+
+static uint16_t float_to_half(float const value)
+{
+	// Same steps as the vector version below: rebias normals with a rounding bias, let the FPU round subnormals
+	uint32_t bits;
+	memcpy(&bits, &value, sizeof(bits));
+
+	uint32_t const sign = bits & 0x80000000u;
+	bits ^= sign;
+
+	uint16_t result;
+	if (bits >= (127 + 16) << 23)
+	{
+		// too large for half, or inf/NaN
+		result = bits > 0x7f800000u ? 0x7e00 : 0x7c00;
+	}
+	else if (bits < (127 - 14) << 23)
+	{
+		uint32_t constexpr subnormalMagic = ((127 - 15) + (23 - 10) + 1) << 23;
+		float magic;
+		memcpy(&magic, &subnormalMagic, sizeof(magic));
+
+		float absValue;
+		memcpy(&absValue, &bits, sizeof(absValue));
+		absValue += magic;
+
+		uint32_t rounded;
+		memcpy(&rounded, &absValue, sizeof(rounded));
+		result = static_cast<uint16_t>(rounded - subnormalMagic);
+	}
+	else
+	{
+		uint32_t const mantissaOdd = (bits >> 13) & 1;
+		bits += (static_cast<uint32_t>(15 - 127) << 23) + 0xfff + mantissaOdd;
+		result = static_cast<uint16_t>(bits >> 13);
+	}
+
+	return static_cast<uint16_t>(result | (sign >> 16));
+}
+
+static void convert_f32_to_f16_scalar(float const* src, uint16_t* dst, size_t const count)
+{
+	for (size_t i = 0; i < count; i++)
+	{
+		dst[i] = float_to_half(src[i]);
+	}
+}
+
+#if PORTAL_KERNELS_X86
+
+PORTAL_TARGET_SSE41 static void premultiply_alpha_sse41(uint8_t* data, size_t const pixelCount)
+{
+	__m128i const alphaShuffle = _mm_setr_epi8(3, 3, 3, -1, 7, 7, 7, -1, 11, 11, 11, -1, 15, 15, 15, -1);
+	// alpha is multiplied by 255 so it comes back out unchanged
+	__m128i const alphaLane = _mm_set1_epi32(static_cast<int>(0xff000000u));
+	__m128i const zero = _mm_setzero_si128();
+	__m128i const one = _mm_set1_epi16(1);
+	__m128i const divMagic = _mm_set1_epi16(257);
+
+	size_t i = 0;
+	for (; i + 4 <= pixelCount; i += 4)
+	{
+		__m128i const pixels = _mm_loadu_si128(reinterpret_cast<__m128i const*>(data + 4 * i));
+		__m128i const alpha = _mm_or_si128(_mm_shuffle_epi8(pixels, alphaShuffle), alphaLane);
+
+		__m128i lo = _mm_mullo_epi16(_mm_unpacklo_epi8(pixels, zero), _mm_unpacklo_epi8(alpha, zero));
+		__m128i hi = _mm_mullo_epi16(_mm_unpackhi_epi8(pixels, zero), _mm_unpackhi_epi8(alpha, zero));
+
+		// x / 255 == ((x + 1) * 257) >> 16 for every product of two bytes
+		lo = _mm_mulhi_epu16(_mm_add_epi16(lo, one), divMagic);
+		hi = _mm_mulhi_epu16(_mm_add_epi16(hi, one), divMagic);
+
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(data + 4 * i), _mm_packus_epi16(lo, hi));
+	}
+
+	premultiply_alpha_scalar(data + 4 * i, pixelCount - i);
+}
+
+PORTAL_TARGET_SSE41 static void expand_rgb_to_rgba_sse41(float const* src, float* dst, size_t const pixelCount)
+{
+	__m128 const one = _mm_set1_ps(1.0f);
+
+	size_t i = 0;
+	for (; i + 4 <= pixelCount; i += 4)
+	{
+		__m128i const a = _mm_castps_si128(_mm_loadu_ps(src + 3 * i + 0)); // r0 g0 b0 r1
+		__m128i const b = _mm_castps_si128(_mm_loadu_ps(src + 3 * i + 4)); // g1 b1 r2 g2
+		__m128i const c = _mm_castps_si128(_mm_loadu_ps(src + 3 * i + 8)); // b2 r3 g3 b3
+
+		__m128 const p0 = _mm_castsi128_ps(a);
+		__m128 const p1 = _mm_castsi128_ps(_mm_alignr_epi8(b, a, 12));
+		__m128 const p2 = _mm_castsi128_ps(_mm_alignr_epi8(c, b, 8));
+		__m128 const p3 = _mm_castsi128_ps(_mm_alignr_epi8(c, c, 4));
+
+		_mm_storeu_ps(dst + 4 * i + 0, _mm_blend_ps(p0, one, 0x8));
+		_mm_storeu_ps(dst + 4 * i + 4, _mm_blend_ps(p1, one, 0x8));
+		_mm_storeu_ps(dst + 4 * i + 8, _mm_blend_ps(p2, one, 0x8));
+		_mm_storeu_ps(dst + 4 * i + 12, _mm_blend_ps(p3, one, 0x8));
+	}
+
+	expand_rgb_to_rgba_scalar(src + 3 * i, dst + 4 * i, pixelCount - i);
+}
+
+// float_to_half on four lanes, there is no F16C at this level. Each result is in the low 16 bits of its lane.
+PORTAL_TARGET_SSE41 static __m128i float4_to_half4_sse41(__m128 const value)
+{
+	__m128i const signMask = _mm_set1_epi32(static_cast<int>(0x80000000u));
+	__m128i const f16Max = _mm_set1_epi32((127 + 16) << 23);
+	__m128i const nanBit = _mm_set1_epi32(0x200);
+	__m128i const infinity = _mm_set1_epi32(0x7c00);
+	__m128i const minNormal = _mm_set1_epi32((127 - 14) << 23);
+	__m128i const subnormalMagic = _mm_set1_epi32(((127 - 15) + (23 - 10) + 1) << 23);
+	__m128i const normalBias = _mm_set1_epi32(0xfff - ((127 - 15) << 23));
+	__m128i const lowHalf = _mm_set1_epi32(0xffff);
+
+	__m128 const sign = _mm_and_ps(_mm_castsi128_ps(signMask), value);
+	__m128 const absValue = _mm_xor_ps(value, sign);
+	__m128i const absBits = _mm_castps_si128(absValue);
+
+	__m128i const isRegular = _mm_cmpgt_epi32(f16Max, absBits);
+	__m128i const isNan = _mm_castps_si128(_mm_cmpunord_ps(absValue, absValue));
+	__m128i const special = _mm_or_si128(_mm_and_si128(isNan, nanBit), infinity);
+
+	__m128i const isSubnormal = _mm_cmpgt_epi32(minNormal, absBits);
+	__m128i const subnormal = _mm_sub_epi32(_mm_castps_si128(_mm_add_ps(absValue, _mm_castsi128_ps(subnormalMagic))), subnormalMagic);
+
+	__m128i const mantissaOdd = _mm_srai_epi32(_mm_slli_epi32(absBits, 31 - 13), 31);
+	__m128i const normal = _mm_srli_epi32(_mm_sub_epi32(_mm_add_epi32(absBits, normalBias), mantissaOdd), 13);
+
+	__m128i const finite = _mm_blendv_epi8(normal, subnormal, isSubnormal);
+	__m128i const half = _mm_blendv_epi8(special, finite, isRegular);
+
+	return _mm_and_si128(_mm_or_si128(half, _mm_srli_epi32(_mm_castps_si128(sign), 16)), lowHalf);
+}
+
+PORTAL_TARGET_SSE41 static void convert_f32_to_f16_sse41(float const* src, uint16_t* dst, size_t const count)
+{
+	size_t i = 0;
+	for (; i + 8 <= count; i += 8)
+	{
+		__m128i const lo = float4_to_half4_sse41(_mm_loadu_ps(src + i));
+		__m128i const hi = float4_to_half4_sse41(_mm_loadu_ps(src + i + 4));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_packus_epi32(lo, hi));
+	}
+
+	convert_f32_to_f16_scalar(src + i, dst + i, count - i);
+}
+
+PORTAL_TARGET_AVX2 static void premultiply_alpha_avx2(uint8_t* data, size_t const pixelCount)
+{
+	__m256i const alphaShuffle = _mm256_setr_epi8(
+		3, 3, 3, -1, 7, 7, 7, -1, 11, 11, 11, -1, 15, 15, 15, -1,
+		3, 3, 3, -1, 7, 7, 7, -1, 11, 11, 11, -1, 15, 15, 15, -1);
+	__m256i const alphaLane = _mm256_set1_epi32(static_cast<int>(0xff000000u));
+	__m256i const zero = _mm256_setzero_si256();
+	__m256i const one = _mm256_set1_epi16(1);
+	__m256i const divMagic = _mm256_set1_epi16(257);
+
+	// unpack and pack both work per 128 bit lane, so the pixel order survives the round trip
+	size_t i = 0;
+	for (; i + 8 <= pixelCount; i += 8)
+	{
+		__m256i const pixels = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(data + 4 * i));
+		__m256i const alpha = _mm256_or_si256(_mm256_shuffle_epi8(pixels, alphaShuffle), alphaLane);
+
+		__m256i lo = _mm256_mullo_epi16(_mm256_unpacklo_epi8(pixels, zero), _mm256_unpacklo_epi8(alpha, zero));
+		__m256i hi = _mm256_mullo_epi16(_mm256_unpackhi_epi8(pixels, zero), _mm256_unpackhi_epi8(alpha, zero));
+
+		lo = _mm256_mulhi_epu16(_mm256_add_epi16(lo, one), divMagic);
+		hi = _mm256_mulhi_epu16(_mm256_add_epi16(hi, one), divMagic);
+
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(data + 4 * i), _mm256_packus_epi16(lo, hi));
+	}
+
+	premultiply_alpha_scalar(data + 4 * i, pixelCount - i);
+}
+
+PORTAL_TARGET_AVX2 static void expand_rgb_to_rgba_avx2(float const* src, float* dst, size_t const pixelCount)
+{
+	// Each load of 8 floats covers two pixels, the spare lanes are replaced by alpha
+	__m256i const spread = _mm256_setr_epi32(0, 1, 2, 0, 3, 4, 5, 0);
+	__m256 const one = _mm256_set1_ps(1.0f);
+
+	size_t i = 0;
+	// the last load of a block reads two floats past its eighth pixel
+	for (; i + 9 <= pixelCount; i += 8)
+	{
+		for (size_t pair = 0; pair < 4; pair++)
+		{
+			__m256 const rgb = _mm256_loadu_ps(src + 3 * (i + 2 * pair));
+			__m256 const rgba = _mm256_blend_ps(_mm256_permutevar8x32_ps(rgb, spread), one, 0x88);
+			_mm256_storeu_ps(dst + 4 * (i + 2 * pair), rgba);
+		}
+	}
+
+	expand_rgb_to_rgba_scalar(src + 3 * i, dst + 4 * i, pixelCount - i);
+}
+
+PORTAL_TARGET_AVX2 static void convert_f32_to_f16_avx2(float const* src, uint16_t* dst, size_t const count)
+{
+	size_t i = 0;
+	for (; i + 8 <= count; i += 8)
+	{
+		__m128i const half = _mm256_cvtps_ph(_mm256_loadu_ps(src + i), _MM_FROUND_TO_NEAREST_INT);
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), half);
+	}
+
+	convert_f32_to_f16_scalar(src + i, dst + i, count - i);
+}
+
+#endif
+
+void premultiply_alpha_rgba8(uint8_t* data, size_t const pixelCount, KernelLevel const level)
+{
+#if PORTAL_KERNELS_X86
+	switch (level)
+	{
+	case KernelLevel::AVX2:
+		premultiply_alpha_avx2(data, pixelCount);
+		return;
+	case KernelLevel::SSE41:
+		premultiply_alpha_sse41(data, pixelCount);
+		return;
+	default:
+		break;
+	}
+#endif
+	premultiply_alpha_scalar(data, pixelCount);
+}
+
+void expand_rgb_to_rgba_f32(float const* src, float* dst, size_t const pixelCount, KernelLevel const level)
+{
+#if PORTAL_KERNELS_X86
+	switch (level)
+	{
+	case KernelLevel::AVX2:
+		expand_rgb_to_rgba_avx2(src, dst, pixelCount);
+		return;
+	case KernelLevel::SSE41:
+		expand_rgb_to_rgba_sse41(src, dst, pixelCount);
+		return;
+	default:
+		break;
+	}
+#endif
+	expand_rgb_to_rgba_scalar(src, dst, pixelCount);
+}
+
+void convert_f32_to_f16(float const* src, uint16_t* dst, size_t const count, KernelLevel const level)
+{
+#if PORTAL_KERNELS_X86
+	switch (level)
+	{
+	case KernelLevel::AVX2:
+		convert_f32_to_f16_avx2(src, dst, count);
+		return;
+	case KernelLevel::SSE41:
+		convert_f32_to_f16_sse41(src, dst, count);
+		return;
+	default:
+		break;
+	}
+#endif
+	convert_f32_to_f16_scalar(src, dst, count);
+}
+
+void premultiply_alpha_rgba8(uint8_t* data, size_t const pixelCount)
+{
+	premultiply_alpha_rgba8(data, pixelCount, get_kernel_level());
+}
+
+void expand_rgb_to_rgba_f32(float const* src, float* dst, size_t const pixelCount)
+{
+	expand_rgb_to_rgba_f32(src, dst, pixelCount, get_kernel_level());
+}
+
+void convert_f32_to_f16(float const* src, uint16_t* dst, size_t const count)
+{
+	convert_f32_to_f16(src, dst, count, get_kernel_level());
+}
+
+void run_image_kernel_benchmark()
+{
+	uint32_t constexpr width = 3840;
+	uint32_t constexpr height = 2160;
+	size_t constexpr pixelCount = static_cast<size_t>(width) * height;
+	int constexpr iterations = 20;
+
+	std::mt19937 rng(1234);
+	std::uniform_int_distribution<int> byteDist(0, 255);
+	std::uniform_real_distribution<float> floatDist(0.0f, 64.0f);
+
+	std::vector<uint8_t> sourceRgba8(pixelCount * 4);
+	std::ranges::generate(sourceRgba8, [&]() { return static_cast<uint8_t>(byteDist(rng)); });
+	std::vector<float> sourceRgb32(pixelCount * 3);
+	std::ranges::generate(sourceRgb32, [&]() { return floatDist(rng); });
+
+	std::vector<uint8_t> rgba8(pixelCount * 4);
+	std::vector<float> rgba32(pixelCount * 4);
+	std::vector<uint16_t> rgba16(pixelCount * 4);
+
+	std::vector<KernelLevel> levels{ KernelLevel::Scalar };
+	if (get_kernel_level() >= KernelLevel::SSE41)
+	{
+		levels.push_back(KernelLevel::SSE41);
+	}
+	if (get_kernel_level() >= KernelLevel::AVX2)
+	{
+		levels.push_back(KernelLevel::AVX2);
+	}
+
+	// Best of several runs, bytes moved counts both the reads and the writes
+	auto measure = [&](char const* name, size_t const bytesMoved, auto&& reset, auto&& kernel)
+	{
+		double scalarSeconds = 0.0;
+		for (KernelLevel const level : levels)
+		{
+			double best = 1e30;
+			for (int i = 0; i < iterations; i++)
+			{
+				reset();
+				auto const start = std::chrono::high_resolution_clock::now();
+				kernel(level);
+				std::chrono::duration<double> const seconds = std::chrono::high_resolution_clock::now() - start;
+				best = std::min(best, seconds.count());
+			}
+			if (level == KernelLevel::Scalar)
+			{
+				scalarSeconds = best;
+			}
+
+			std::cout << "> " << name << " [" << kernel_level_name(level) << "]: "
+				<< static_cast<double>(bytesMoved) / best / 1e9 << " GB/s, "
+				<< best * 1000.0 << " ms, x" << scalarSeconds / best << std::endl;
+		}
+	};
+
+	std::cout << "Image kernels on " << width << "x" << height << ", using " << kernel_level_name(get_kernel_level()) << " by default" << std::endl;
+
+	measure("premultiply alpha RGBA8", pixelCount * 4 * 2,
+		[&]() { std::ranges::copy(sourceRgba8, rgba8.begin()); },
+		[&](KernelLevel const level) { premultiply_alpha_rgba8(rgba8.data(), pixelCount, level); });
+
+	measure("expand RGB32F to RGBA32F", pixelCount * (12 + 16),
+		[]() {},
+		[&](KernelLevel const level) { expand_rgb_to_rgba_f32(sourceRgb32.data(), rgba32.data(), pixelCount, level); });
+
+	measure("convert RGBA32F to RGBA16F", pixelCount * 4 * (4 + 2),
+		[]() {},
+		[&](KernelLevel const level) { convert_f32_to_f16(rgba32.data(), rgba16.data(), pixelCount * 4, level); });
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// CPU versions of the pixel conversions, for tools that need converted pixels on the CPU. Runtime uploads convert
+// on the GPU instead (see ImageConversion). Each has a scalar, SSE4.1 and AVX2 version, the widest one the CPU
+// supports is picked the first time any of them is called.
+
+enum class KernelLevel
+{
+	Scalar,
+	SSE41,
+	AVX2
+};
+
+KernelLevel get_kernel_level();
+char const* kernel_level_name(KernelLevel level);
+
+// RGBA8, rgb = rgb * a / 255 with the same truncation as the scalar loop
+void premultiply_alpha_rgba8(uint8_t* data, size_t pixelCount);
+
+// RGB32F to RGBA32F with alpha = 1, dst must not overlap src
+void expand_rgb_to_rgba_f32(float const* src, float* dst, size_t pixelCount);
+
+// IEEE half with round to nearest even, values out of range become infinity
+void convert_f32_to_f16(float const* src, uint16_t* dst, size_t count);
+
+// Same kernels at an explicit level, for the benchmark. The level must be supported by this CPU.
+void premultiply_alpha_rgba8(uint8_t* data, size_t pixelCount, KernelLevel level);
+void expand_rgb_to_rgba_f32(float const* src, float* dst, size_t pixelCount, KernelLevel level);
+void convert_f32_to_f16(float const* src, uint16_t* dst, size_t count, KernelLevel level);
+
+// Times every kernel at every supported level on a 4K image and prints the throughput
+void run_image_kernel_benchmark();
@@ -1,9 +1,32 @@
 #include "vk_engine.h"
 
+#include "image_kernels.h"
+
+#include <filesystem>
 #include <iostream>
+#include <string_view>
 
-int main()
+int main(int argc, char* argv[])
 {
+	// Micro-benchmarks run without creating a window or device
+	if (argc > 1 && std::string_view(argv[1]) == "--bench-image-kernels")
+	{
+		run_image_kernel_benchmark();
+		return EXIT_SUCCESS;
+	}
+
+	// Offline cooking of a glTF into a .pscn, output defaults to the input with the extension swapped
+	if (argc > 2 && std::string_view(argv[1]) == "--cook")
+	{
+		std::filesystem::path outputPath = argv[2];
+		outputPath.replace_extension(".pscn");
+		if (argc > 3)
+		{
+			outputPath = argv[3];
+		}
+		return cook_gltf(argv[2], outputPath.string()) ? EXIT_SUCCESS : EXIT_FAILURE;
+	}
+
 	try
 	{
 		VulkanEngine engine;
@@ -0,0 +1,120 @@
+#include "mapped_file.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifdef _WIN32
+
+bool MappedFile::open(std::string const& filePath)
+{
+	close();
+
+	fileHandle = CreateFileA(filePath.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (fileHandle == INVALID_HANDLE_VALUE)
+	{
+		fileHandle = nullptr;
+		return false;
+	}
+
+	LARGE_INTEGER fileSize;
+	if (!GetFileSizeEx(fileHandle, &fileSize) || fileSize.QuadPart == 0)
+	{
+		close();
+		return false;
+	}
+
+	mappingHandle = CreateFileMappingA(fileHandle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (!mappingHandle)
+	{
+		close();
+		return false;
+	}
+
+	data = MapViewOfFile(mappingHandle, FILE_MAP_READ, 0, 0, 0);
+	if (!data)
+	{
+		close();
+		return false;
+	}
+
+	size = static_cast<size_t>(fileSize.QuadPart);
+	return true;
+}
+
+void MappedFile::close()
+{
+	if (data)
+	{
+		UnmapViewOfFile(data);
+	}
+	if (mappingHandle)
+	{
+		CloseHandle(mappingHandle);
+	}
+	if (fileHandle)
+	{
+		CloseHandle(fileHandle);
+	}
+	data = nullptr;
+	size = 0;
+	mappingHandle = nullptr;
+	fileHandle = nullptr;
+}
+
+#else
+
+bool MappedFile::open(std::string const& filePath)
+{
+	close();
+
+	fileDescriptor = ::open(filePath.c_str(), O_RDONLY);
+	if (fileDescriptor < 0)
+	{
+		return false;
+	}
+
+	struct stat fileStat;
+	if (fstat(fileDescriptor, &fileStat) != 0 || fileStat.st_size == 0)
+	{
+		close();
+		return false;
+	}
+
+	void* const mapping = mmap(nullptr, static_cast<size_t>(fileStat.st_size), PROT_READ, MAP_PRIVATE, fileDescriptor, 0);
+	if (mapping == MAP_FAILED)
+	{
+		close();
+		return false;
+	}
+
+	data = mapping;
+	size = static_cast<size_t>(fileStat.st_size);
+	// everything is read front to back once
+	madvise(mapping, size, MADV_SEQUENTIAL);
+	return true;
+}
+
+void MappedFile::close()
+{
+	if (data)
+	{
+		munmap(const_cast<void*>(data), size);
+	}
+	if (fileDescriptor >= 0)
+	{
+		::close(fileDescriptor);
+	}
+	data = nullptr;
+	size = 0;
+	fileDescriptor = -1;
+}
+
+#endif
@@ -0,0 +1,650 @@
+#include "mesh_optimizer.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+
+#include <glm/geometric.hpp>
+#include <glm/vec3.hpp>
+
+// Forsyth's scoring constants, from "Linear-Speed Vertex Cache Optimisation"
+static uint32_t constexpr forsythCacheSize = 32;
+static float constexpr cacheDecayPower = 1.5f;
+static float constexpr lastTriangleScore = 0.75f;
+static float constexpr valenceBoostScale = 2.0f;
+static float constexpr valenceBoostPower = 0.5f;
+
+// Cache the overdraw pass measures its clusters with, a typical post-transform cache
+static uint32_t constexpr overdrawCacheSize = 16;
+
+// A collapse is rejected when it turns a triangle's normal by more than about 85 degrees
+static float constexpr simplifyMinNormalDot = 0.1f;
+
+static float get_vertex_score(int32_t const cachePosition, uint32_t const remainingValence)
+{
+	if (remainingValence == 0)
+	{
+		// no triangle left that could use it
+		return -1.0f;
+	}
+
+	float score = 0.0f;
+	if (cachePosition >= 0)
+	{
+		if (cachePosition < 3)
+		{
+			// used by the last triangle, a fixed score so the next one doesn't just repeat its edge
+			score = lastTriangleScore;
+		}
+		else
+		{
+			float const scaler = 1.0f / static_cast<float>(forsythCacheSize - 3);
+			score = std::pow(1.0f - static_cast<float>(cachePosition - 3) * scaler, cacheDecayPower);
+		}
+	}
+
+	// finish off vertices with few triangles left, so they don't linger
+	score += valenceBoostScale * std::pow(static_cast<float>(remainingValence), -valenceBoostPower);
+	return score;
+}
+
+// Cache misses of each triangle in the current order, for a FIFO cache
+static std::vector<uint32_t> get_triangle_misses(std::span<uint32_t const> const indices, size_t const vertexCount, uint32_t const cacheSize)
+{
+	// A vertex is in the cache while fewer than cacheSize misses happened since it was last loaded
+	std::vector<uint32_t> timestamps(vertexCount, 0);
+	uint32_t time = cacheSize + 1;
+
+	std::vector<uint32_t> misses(indices.size() / 3, 0);
+	for (size_t i = 0; i < misses.size() * 3; i++)
+	{
+		uint32_t const idx = indices[i];
+		if (time - timestamps[idx] > cacheSize)
+		{
+			timestamps[idx] = time++;
+			misses[i / 3]++;
+		}
+	}
+	return misses;
+}
+
+VertexCacheStats analyze_vertex_cache(std::span<uint32_t const> const indices, size_t const vertexCount, uint32_t const cacheSize)
+{
+	VertexCacheStats stats{ .triangleCount = indices.size() / 3 };
+
+	for (uint32_t const m : get_triangle_misses(indices, vertexCount, cacheSize))
+	{
+		stats.transformedCount += m;
+	}
+
+	std::vector<bool> referenced(vertexCount, false);
+	for (uint32_t const idx : indices)
+	{
+		if (!referenced[idx])
+		{
+			referenced[idx] = true;
+			stats.referencedCount++;
+		}
+	}
+
+	return stats;
+}
+
+void optimize_vertex_cache(std::span<uint32_t> const indices, size_t const vertexCount)
+{
+	size_t const triangleCount = indices.size() / 3;
+	if (triangleCount == 0)
+	{
+		return;
+	}
+
+	// Triangles of each vertex, the first remainingValence of them are the ones not emitted yet
+	std::vector<uint32_t> triangleOffsets(vertexCount + 1, 0);
+	for (uint32_t const idx : indices)
+	{
+		triangleOffsets[idx + 1]++;
+	}
+	for (size_t v = 0; v < vertexCount; v++)
+	{
+		triangleOffsets[v + 1] += triangleOffsets[v];
+	}
+
+	std::vector<uint32_t> remainingValence(vertexCount);
+	std::vector<uint32_t> vertexTriangles(triangleCount * 3);
+	std::vector<uint32_t> fill(triangleOffsets.begin(), triangleOffsets.end() - 1);
+	for (size_t i = 0; i < triangleCount * 3; i++)
+	{
+		vertexTriangles[fill[indices[i]]++] = static_cast<uint32_t>(i / 3);
+	}
+	for (size_t v = 0; v < vertexCount; v++)
+	{
+		remainingValence[v] = triangleOffsets[v + 1] - triangleOffsets[v];
+	}
+
+	std::vector<int32_t> cachePosition(vertexCount, -1);
+	std::vector<float> vertexScore(vertexCount);
+	for (size_t v = 0; v < vertexCount; v++)
+	{
+		vertexScore[v] = get_vertex_score(-1, remainingValence[v]);
+	}
+
+	std::vector<bool> emitted(triangleCount, false);
+	std::vector<uint32_t> output;
+	output.reserve(triangleCount * 3);
+
+	// room for a full cache plus the triangle pushed in front of it
+	std::array<uint32_t, forsythCacheSize + 3> cache;
+	std::array<uint32_t, forsythCacheSize + 3> newCache;
+	size_t cacheCount = 0;
+
+	int64_t bestTriangle = 0;
+	size_t cursor = 0;
+	while (output.size() < triangleCount * 3)
+	{
+		// Nothing in the cache has triangles left, restart from the first triangle not emitted yet
+		if (bestTriangle < 0)
+		{
+			while (emitted[cursor])
+			{
+				cursor++;
+			}
+			bestTriangle = static_cast<int64_t>(cursor);
+		}
+
+		std::array<uint32_t, 3> const triangle{ indices[bestTriangle * 3], indices[bestTriangle * 3 + 1], indices[bestTriangle * 3 + 2] };
+		emitted[bestTriangle] = true;
+		output.insert(output.end(), triangle.begin(), triangle.end());
+
+		for (uint32_t const v : triangle)
+		{
+			uint32_t* const triangles = &vertexTriangles[triangleOffsets[v]];
+			for (uint32_t i = 0; i < remainingValence[v]; i++)
+			{
+				if (triangles[i] == bestTriangle)
+				{
+					triangles[i] = triangles[remainingValence[v] - 1];
+					remainingValence[v]--;
+					break;
+				}
+			}
+		}
+
+		// The triangle's vertices move to the front, everything else shifts back
+		size_t newCount = 0;
+		for (uint32_t const v : triangle)
+		{
+			if (std::find(newCache.begin(), newCache.begin() + newCount, v) == newCache.begin() + newCount)
+			{
+				newCache[newCount++] = v;
+			}
+		}
+		for (size_t i = 0; i < cacheCount; i++)
+		{
+			if (std::find(triangle.begin(), triangle.end(), cache[i]) == triangle.end())
+			{
+				newCache[newCount++] = cache[i];
+			}
+		}
+
+		for (size_t i = forsythCacheSize; i < newCount; i++)
+		{
+			cachePosition[newCache[i]] = -1;
+			vertexScore[newCache[i]] = get_vertex_score(-1, remainingValence[newCache[i]]);
+		}
+
+		cacheCount = std::min<size_t>(newCount, forsythCacheSize);
+		for (size_t i = 0; i < cacheCount; i++)
+		{
+			cache[i] = newCache[i];
+			cachePosition[cache[i]] = static_cast<int32_t>(i);
+			vertexScore[cache[i]] = get_vertex_score(static_cast<int32_t>(i), remainingValence[cache[i]]);
+		}
+
+		// Only triangles touching the cache changed score, the best of them goes next
+		bestTriangle = -1;
+		float bestScore = -1.0f;
+		for (size_t i = 0; i < cacheCount; i++)
+		{
+			uint32_t const v = cache[i];
+			for (uint32_t j = 0; j < remainingValence[v]; j++)
+			{
+				uint32_t const t = vertexTriangles[triangleOffsets[v] + j];
+				float const score = vertexScore[indices[t * 3]] + vertexScore[indices[t * 3 + 1]] + vertexScore[indices[t * 3 + 2]];
+				if (score > bestScore)
+				{
+					bestScore = score;
+					bestTriangle = t;
+				}
+			}
+		}
+	}
+
+	std::ranges::copy(output, indices.begin());
+}
+
+void optimize_overdraw(std::span<uint32_t> const indices, std::span<Vertex const> const vertices, float const threshold)
+{
+	size_t const triangleCount = indices.size() / 3;
+	if (triangleCount < 2)
+	{
+		return;
+	}
+
+	std::vector<uint32_t> const misses = get_triangle_misses(indices, vertices.size(), overdrawCacheSize);
+
+	// A triangle that misses on all three vertices starts over anyway, so cutting there costs nothing
+	std::vector<size_t> hardBoundaries;
+	for (size_t t = 0; t < triangleCount; t++)
+	{
+		if (t == 0 || misses[t] == 3)
+		{
+			hardBoundaries.push_back(t);
+		}
+	}
+	hardBoundaries.push_back(triangleCount);
+
+	// Long clusters are cut further once their running ACMR gets close enough to the cluster's
+	std::vector<size_t> clusterStarts;
+	for (size_t h = 0; h + 1 < hardBoundaries.size(); h++)
+	{
+		size_t const begin = hardBoundaries[h];
+		size_t const end = hardBoundaries[h + 1];
+
+		uint32_t clusterMisses = 0;
+		for (size_t t = begin; t < end; t++)
+		{
+			clusterMisses += misses[t];
+		}
+		float const clusterAcmr = static_cast<float>(clusterMisses) / static_cast<float>(end - begin);
+
+		clusterStarts.push_back(begin);
+		size_t start = begin;
+		uint32_t runningMisses = 0;
+		for (size_t t = begin; t + 1 < end; t++)
+		{
+			runningMisses += misses[t];
+			if (static_cast<float>(runningMisses) <= clusterAcmr * threshold * static_cast<float>(t + 1 - start))
+			{
+				clusterStarts.push_back(t + 1);
+				start = t + 1;
+				runningMisses = 0;
+			}
+		}
+	}
+	clusterStarts.push_back(triangleCount);
+
+	auto const getPosition = [&](size_t const corner) { return vertices[indices[corner]].position; };
+
+	// Area weighted centroid and summed normal of each cluster and of the whole mesh
+	size_t const clusterCount = clusterStarts.size() - 1;
+	std::vector<glm::vec3> clusterCentroids(clusterCount, glm::vec3(0.0f));
+	std::vector<glm::vec3> clusterNormals(clusterCount, glm::vec3(0.0f));
+	glm::vec3 meshCentroid(0.0f);
+	float meshArea = 0.0f;
+	for (size_t c = 0; c < clusterCount; c++)
+	{
+		float clusterArea = 0.0f;
+		for (size_t t = clusterStarts[c]; t < clusterStarts[c + 1]; t++)
+		{
+			glm::vec3 const p0 = getPosition(t * 3);
+			glm::vec3 const p1 = getPosition(t * 3 + 1);
+			glm::vec3 const p2 = getPosition(t * 3 + 2);
+			glm::vec3 const normal = glm::cross(p1 - p0, p2 - p0);
+			float const area = glm::length(normal);
+
+			clusterCentroids[c] += (p0 + p1 + p2) * (area / 3.0f);
+			clusterNormals[c] += normal;
+			clusterArea += area;
+		}
+		meshCentroid += clusterCentroids[c];
+		meshArea += clusterArea;
+		clusterCentroids[c] = clusterArea > 0.0f ? clusterCentroids[c] / clusterArea : getPosition(clusterStarts[c] * 3);
+	}
+	meshCentroid = meshArea > 0.0f ? meshCentroid / meshArea : glm::vec3(0.0f);
+
+	// Clusters facing away from the middle of the mesh are on its outside and likely to occlude the rest
+	std::vector<float> sortKeys(clusterCount);
+	for (size_t c = 0; c < clusterCount; c++)
+	{
+		float const normalLength = glm::length(clusterNormals[c]);
+		sortKeys[c] = normalLength > 0.0f ? glm::dot(clusterCentroids[c] - meshCentroid, clusterNormals[c] / normalLength) : 0.0f;
+	}
+
+	std::vector<size_t> clusterOrder(clusterCount);
+	for (size_t c = 0; c < clusterCount; c++)
+	{
+		clusterOrder[c] = c;
+	}
+	std::ranges::stable_sort(clusterOrder, [&](size_t const a, size_t const b) { return sortKeys[a] > sortKeys[b]; });
+
+	std::vector<uint32_t> output;
+	output.reserve(indices.size());
+	for (size_t const c : clusterOrder)
+	{
+		output.insert(output.end(), indices.begin() + clusterStarts[c] * 3, indices.begin() + clusterStarts[c + 1] * 3);
+	}
+	std::ranges::copy(output, indices.begin());
+}
+
+void optimize_vertex_fetch(std::span<uint32_t> const indices, std::span<Vertex> const vertices)
+{
+	std::vector<uint32_t> remap(vertices.size(), UINT32_MAX);
+	uint32_t nextVertex = 0;
+	for (uint32_t& idx : indices)
+	{
+		if (remap[idx] == UINT32_MAX)
+		{
+			remap[idx] = nextVertex++;
+		}
+		idx = remap[idx];
+	}
+	for (uint32_t& r : remap)
+	{
+		if (r == UINT32_MAX)
+		{
+			r = nextVertex++;
+		}
+	}
+
+	std::vector<Vertex> reordered(vertices.size());
+	for (size_t v = 0; v < vertices.size(); v++)
+	{
+		reordered[remap[v]] = vertices[v];
+	}
+	std::ranges::copy(reordered, vertices.begin());
+}
+
+void optimize_mesh(std::span<uint32_t> const indices, std::span<Vertex> const vertices)
+{
+	// Leave broken meshes alone rather than indexing out of bounds
+	if (std::ranges::any_of(indices, [&](uint32_t const idx) { return idx >= vertices.size(); }))
+	{
+		return;
+	}
+
+	optimize_vertex_cache(indices, vertices.size());
+	optimize_overdraw(indices, vertices);
+	optimize_vertex_fetch(indices, vertices);
+}
+
+namespace
+{
+	// Sum of squared distances to a set of planes, weighted by triangle area. Kept in double since the terms cancel.
+	struct Quadric
+	{
+		double a2 = 0, ab = 0, ac = 0, ad = 0;
+		double b2 = 0, bc = 0, bd = 0;
+		double c2 = 0, cd = 0;
+		double d2 = 0;
+		double weight = 0;
+
+		static Quadric fromPlane(glm::dvec3 const& normal, double const distance, double const planeWeight)
+		{
+			return Quadric
+			{
+				.a2 = normal.x * normal.x * planeWeight, .ab = normal.x * normal.y * planeWeight, .ac = normal.x * normal.z * planeWeight, .ad = normal.x * distance * planeWeight,
+				.b2 = normal.y * normal.y * planeWeight, .bc = normal.y * normal.z * planeWeight, .bd = normal.y * distance * planeWeight,
+				.c2 = normal.z * normal.z * planeWeight, .cd = normal.z * distance * planeWeight,
+				.d2 = distance * distance * planeWeight,
+				.weight = planeWeight
+			};
+		}
+
+		Quadric& operator+=(Quadric const& other)
+		{
+			a2 += other.a2; ab += other.ab; ac += other.ac; ad += other.ad;
+			b2 += other.b2; bc += other.bc; bd += other.bd;
+			c2 += other.c2; cd += other.cd;
+			d2 += other.d2;
+			weight += other.weight;
+			return *this;
+		}
+
+		// Weighted mean squared distance of p to the planes
+		double evaluate(glm::dvec3 const& p) const
+		{
+			double const r = p.x * (a2 * p.x + 2 * (ab * p.y + ac * p.z + ad))
+				+ p.y * (b2 * p.y + 2 * (bc * p.z + bd))
+				+ p.z * (c2 * p.z + 2 * cd)
+				+ d2;
+			return weight > 0 ? std::abs(r) / weight : 0.0;
+		}
+	};
+
+	struct Collapse
+	{
+		uint32_t from;
+		uint32_t to;
+		double error;
+	};
+}
+
+std::vector<uint32_t> simplify_mesh(std::span<uint32_t const> const indices, std::span<Vertex const> const vertices, size_t const targetIndexCount,
+	float const targetError, float* const resultError)
+{
+	std::vector<uint32_t> result(indices.begin(), indices.end());
+	if (resultError)
+	{
+		*resultError = 0.0f;
+	}
+	if (vertices.empty() || std::ranges::any_of(indices, [&](uint32_t const idx) { return idx >= vertices.size(); }))
+	{
+		return result;
+	}
+
+	// Work in a unit box so the quadrics stay well conditioned whatever the mesh's scale
+	glm::vec3 minPos = vertices[0].position;
+	glm::vec3 maxPos = vertices[0].position;
+	for (Vertex const& vertex : vertices)
+	{
+		minPos = glm::min(minPos, vertex.position);
+		maxPos = glm::max(maxPos, vertex.position);
+	}
+	double const extent = std::max({ maxPos.x - minPos.x, maxPos.y - minPos.y, maxPos.z - minPos.z, 1e-12f });
+
+	std::vector<glm::dvec3> positions(vertices.size());
+	for (size_t v = 0; v < vertices.size(); v++)
+	{
+		positions[v] = (glm::dvec3(vertices[v].position) - glm::dvec3(minPos)) / extent;
+	}
+
+	std::vector<Quadric> quadrics(vertices.size());
+	for (size_t t = 0; t + 2 < result.size(); t += 3)
+	{
+		glm::dvec3 const& p0 = positions[result[t]];
+		glm::dvec3 normal = glm::cross(positions[result[t + 1]] - p0, positions[result[t + 2]] - p0);
+		double const area = glm::length(normal);
+		if (area == 0)
+		{
+			continue;
+		}
+		normal /= area;
+
+		Quadric const plane = Quadric::fromPlane(normal, -glm::dot(normal, p0), area);
+		for (size_t c = 0; c < 3; c++)
+		{
+			quadrics[result[t + c]] += plane;
+		}
+	}
+
+	double const errorLimit = static_cast<double>(targetError) / extent;
+	double const squaredErrorLimit = errorLimit * errorLimit;
+	double maxError = 0;
+
+	std::vector<uint64_t> edges;
+	std::vector<uint8_t> locked(vertices.size());
+	std::vector<uint8_t> touched(vertices.size());
+	std::vector<uint32_t> collapseTarget(vertices.size());
+	std::vector<uint32_t> triangleOffsets(vertices.size() + 1);
+	std::vector<uint32_t> vertexTriangles;
+	std::vector<Collapse> collapses;
+
+	auto const edgeKey = [](uint32_t const a, uint32_t const b) { return (static_cast<uint64_t>(a) << 32) | b; };
+
+	while (result.size() > targetIndexCount)
+	{
+		size_t const triangleCount = result.size() / 3;
+
+		// Only vertices whose every edge is shared with exactly one triangle going the other way may move. Anything
+		// else is on a border, a seam or non-manifold geometry. Collapses can change that, so it's redone every pass.
+		edges.clear();
+		for (size_t t = 0; t < triangleCount; t++)
+		{
+			for (size_t c = 0; c < 3; c++)
+			{
+				edges.push_back(edgeKey(result[t * 3 + c], result[t * 3 + (c + 1) % 3]));
+			}
+		}
+		std::ranges::sort(edges);
+
+		auto const countEdge = [&](uint32_t const a, uint32_t const b)
+		{
+			auto const range = std::ranges::equal_range(edges, edgeKey(a, b));
+			return range.size();
+		};
+
+		std::ranges::fill(locked, 0);
+		for (size_t t = 0; t < triangleCount; t++)
+		{
+			for (size_t c = 0; c < 3; c++)
+			{
+				uint32_t const a = result[t * 3 + c];
+				uint32_t const b = result[t * 3 + (c + 1) % 3];
+				if (countEdge(a, b) != 1 || countEdge(b, a) != 1)
+				{
+					locked[a] = 1;
+					locked[b] = 1;
+				}
+			}
+		}
+
+		// Triangles around each vertex
+		std::ranges::fill(triangleOffsets, 0);
+		for (uint32_t const idx : result)
+		{
+			triangleOffsets[idx + 1]++;
+		}
+		for (size_t v = 0; v < vertices.size(); v++)
+		{
+			triangleOffsets[v + 1] += triangleOffsets[v];
+		}
+		vertexTriangles.resize(result.size());
+		std::vector<uint32_t> fill(triangleOffsets.begin(), triangleOffsets.end() - 1);
+		for (size_t i = 0; i < result.size(); i++)
+		{
+			vertexTriangles[fill[result[i]]++] = static_cast<uint32_t>(i / 3);
+		}
+
+		// Every directed edge is one candidate, moving its first vertex onto its second
+		collapses.clear();
+		for (size_t t = 0; t < triangleCount; t++)
+		{
+			for (size_t c = 0; c < 3; c++)
+			{
+				uint32_t const from = result[t * 3 + c];
+				uint32_t const to = result[t * 3 + (c + 1) % 3];
+				if (locked[from])
+				{
+					continue;
+				}
+				double const error = quadrics[from].evaluate(positions[to]);
+				if (error <= squaredErrorLimit)
+				{
+					collapses.push_back(Collapse{ .from = from, .to = to, .error = error });
+				}
+			}
+		}
+		if (collapses.empty())
+		{
+			break;
+		}
+		std::ranges::sort(collapses, {}, &Collapse::error);
+
+		// Take the cheapest collapses whose neighbourhoods don't overlap, so each one's checks see final positions.
+		// Each interior collapse removes two triangles.
+		size_t const trianglesToRemove = triangleCount - targetIndexCount / 3;
+		size_t removed = 0;
+		std::ranges::fill(touched, 0);
+		for (size_t v = 0; v < vertices.size(); v++)
+		{
+			collapseTarget[v] = static_cast<uint32_t>(v);
+		}
+
+		for (Collapse const& collapse : collapses)
+		{
+			if (removed >= trianglesToRemove)
+			{
+				break;
+			}
+			if (touched[collapse.from] || touched[collapse.to])
+			{
+				continue;
+			}
+
+			bool flips = false;
+			size_t collapsedTriangles = 0;
+			for (uint32_t i = triangleOffsets[collapse.from]; i < triangleOffsets[collapse.from + 1] && !flips; i++)
+			{
+				uint32_t const* const triangle = &result[vertexTriangles[i] * 3];
+				if (triangle[0] == collapse.to || triangle[1] == collapse.to || triangle[2] == collapse.to)
+				{
+					collapsedTriangles++;
+					continue;
+				}
+
+				glm::dvec3 corners[3];
+				glm::dvec3 moved[3];
+				for (size_t c = 0; c < 3; c++)
+				{
+					corners[c] = positions[triangle[c]];
+					moved[c] = triangle[c] == collapse.from ? positions[collapse.to] : corners[c];
+				}
+				glm::dvec3 const before = glm::cross(corners[1] - corners[0], corners[2] - corners[0]);
+				glm::dvec3 const after = glm::cross(moved[1] - moved[0], moved[2] - moved[0]);
+				flips = glm::dot(before, after) <= simplifyMinNormalDot * glm::length(before) * glm::length(after);
+			}
+			if (flips)
+			{
+				continue;
+			}
+
+			collapseTarget[collapse.from] = collapse.to;
+			quadrics[collapse.to] += quadrics[collapse.from];
+			maxError = std::max(maxError, collapse.error);
+			removed += collapsedTriangles;
+
+			for (uint32_t i = triangleOffsets[collapse.from]; i < triangleOffsets[collapse.from + 1]; i++)
+			{
+				uint32_t const* const triangle = &result[vertexTriangles[i] * 3];
+				touched[triangle[0]] = touched[triangle[1]] = touched[triangle[2]] = 1;
+			}
+		}
+
+		if (removed == 0)
+		{
+			break;
+		}
+
+		// Drop the triangles that collapsed to a line
+		size_t write = 0;
+		for (size_t t = 0; t < triangleCount; t++)
+		{
+			uint32_t const a = collapseTarget[result[t * 3]];
+			uint32_t const b = collapseTarget[result[t * 3 + 1]];
+			uint32_t const c = collapseTarget[result[t * 3 + 2]];
+			if (a != b && b != c && c != a)
+			{
+				result[write++] = a;
+				result[write++] = b;
+				result[write++] = c;
+			}
+		}
+		result.resize(write);
+	}
+
+	if (resultError)
+	{
+		*resultError = static_cast<float>(std::sqrt(maxError) * extent);
+	}
+	return result;
+}
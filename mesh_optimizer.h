@@ -0,0 +1,54 @@
+#pragma once
+
+#include <span>
+#include <vector>
+
+#include "vk_types.h"
+
+// Triangle and vertex reordering for one indexed triangle list. Indices are relative to the start of vertices.
+// None of these change what is drawn, only the order triangles and vertices come in, except simplify_mesh.
+
+struct VertexCacheStats
+{
+	size_t triangleCount = 0;
+	size_t transformedCount = 0;
+	size_t referencedCount = 0;
+
+	// average cache miss ratio: transformed vertices per triangle, 0.5 at best for a regular grid, 3 at worst
+	float getAcmr() const { return triangleCount > 0 ? static_cast<float>(transformedCount) / static_cast<float>(triangleCount) : 0.0f; }
+	// average transform to vertex ratio: transformed vertices per referenced vertex, 1 is ideal
+	float getAtvr() const { return referencedCount > 0 ? static_cast<float>(transformedCount) / static_cast<float>(referencedCount) : 0.0f; }
+
+	VertexCacheStats& operator+=(VertexCacheStats const& other)
+	{
+		triangleCount += other.triangleCount;
+		transformedCount += other.transformedCount;
+		referencedCount += other.referencedCount;
+		return *this;
+	}
+};
+
+// Simulates a FIFO post-transform cache of cacheSize entries
+VertexCacheStats analyze_vertex_cache(std::span<uint32_t const> indices, size_t vertexCount, uint32_t cacheSize = 16);
+
+// Tom Forsyth's linear-speed vertex cache optimisation, reorders triangles to reuse recently transformed vertices
+void optimize_vertex_cache(std::span<uint32_t> indices, size_t vertexCount);
+
+// Splits the cache-optimised order into clusters and draws the outward facing ones first, so fewer fragments get
+// overwritten. Clusters are only cut where that costs at most threshold times their ACMR. Run after optimize_vertex_cache.
+void optimize_overdraw(std::span<uint32_t> indices, std::span<Vertex const> vertices, float threshold = 1.05f);
+
+// Renumbers vertices in the order the indices first use them, so fetches walk the vertex buffer linearly.
+// Vertices no index uses are moved to the end.
+void optimize_vertex_fetch(std::span<uint32_t> indices, std::span<Vertex> vertices);
+
+// The three passes above in order
+void optimize_mesh(std::span<uint32_t> indices, std::span<Vertex> vertices);
+
+// Garland-Heckbert quadric error simplification. Collapses edges onto existing vertices until at most
+// targetIndexCount indices are left or the next collapse would move the surface further than targetError, and
+// returns the new indices into the same vertices. Vertices on open edges, which includes UV and normal seams since
+// those split vertices, never move, so simplified meshes keep their outline and don't crack along seams.
+// resultError is set to the largest error of any collapse made. Errors are distances in the vertices' units.
+std::vector<uint32_t> simplify_mesh(std::span<uint32_t const> indices, std::span<Vertex const> vertices, size_t targetIndexCount,
+	float targetError, float* resultError = nullptr);
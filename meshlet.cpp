@@ -0,0 +1,140 @@
+#include "meshlet.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include <glm/geometric.hpp>
+
+static_assert(sizeof(Meshlet) == 48);
+
+// Triangle corners index the meshlet's vertices in 8 bits
+static_assert(maxMeshletVertices <= 256);
+
+static void finish_meshlet(std::span<uint32_t const> const meshletVertices, std::span<uint32_t const> const meshletTriangles,
+	uint32_t const firstTriangle, std::span<Vertex const> const vertices, MeshletData& out)
+{
+	glm::vec3 minPos = vertices[meshletVertices[0]].position;
+	glm::vec3 maxPos = minPos;
+	for (uint32_t const v : meshletVertices)
+	{
+		minPos = glm::min(minPos, vertices[v].position);
+		maxPos = glm::max(maxPos, vertices[v].position);
+	}
+
+	glm::vec3 const center = (minPos + maxPos) * 0.5f;
+	float radius = 0.0f;
+	for (uint32_t const v : meshletVertices)
+	{
+		radius = std::max(radius, glm::length(vertices[v].position - center));
+	}
+
+	// Face normals rather than vertex normals, the rasterizer culls by winding
+	std::vector<glm::vec3> normals;
+	normals.reserve(meshletTriangles.size());
+	glm::vec3 axis{ 0.0f };
+	for (uint32_t const triangle : meshletTriangles)
+	{
+		glm::vec3 const p0 = vertices[meshletVertices[triangle & 0xff]].position;
+		glm::vec3 const p1 = vertices[meshletVertices[(triangle >> 8) & 0xff]].position;
+		glm::vec3 const p2 = vertices[meshletVertices[(triangle >> 16) & 0xff]].position;
+
+		glm::vec3 const normal = glm::cross(p1 - p0, p2 - p0);
+		float const area = glm::length(normal);
+		// degenerate triangles are never drawn, so they don't limit the cone
+		if (area > 0.0f && std::isfinite(area))
+		{
+			normals.push_back(normal / area);
+			axis += normals.back();
+		}
+	}
+
+	glm::vec4 cone{ 0.0f, 0.0f, 0.0f, 1.0f };
+	if (float const axisLength = glm::length(axis); axisLength > 0.0f)
+	{
+		axis /= axisLength;
+		float minDot = 1.0f;
+		for (glm::vec3 const& normal : normals)
+		{
+			minDot = std::min(minDot, glm::dot(normal, axis));
+		}
+		// Past 90 degrees no view direction has every triangle facing away
+		if (minDot > 0.0f)
+		{
+			cone = glm::vec4(axis, std::sqrt(1.0f - minDot * minDot));
+		}
+	}
+
+	out.meshlets.push_back(Meshlet
+		{
+			.sphere = glm::vec4(center, radius),
+			.cone = cone,
+			.dataOffset = static_cast<uint32_t>(out.data.size()),
+			.vertexCount = static_cast<uint32_t>(meshletVertices.size()),
+			.triangleCount = static_cast<uint32_t>(meshletTriangles.size()),
+			.firstTriangle = firstTriangle
+		});
+	out.data.insert(out.data.end(), meshletVertices.begin(), meshletVertices.end());
+	out.data.insert(out.data.end(), meshletTriangles.begin(), meshletTriangles.end());
+}
+
+void build_meshlets(std::span<uint32_t const> const indices, std::span<Vertex const> const vertices, MeshletData& out)
+{
+	uint32_t constexpr unused = UINT32_MAX;
+
+	// Mesh vertex to meshlet vertex, reset for the vertices of each finished meshlet
+	std::vector<uint32_t> localIndices(vertices.size(), unused);
+	std::vector<uint32_t> meshletVertices;
+	std::vector<uint32_t> meshletTriangles;
+	meshletVertices.reserve(maxMeshletVertices);
+	meshletTriangles.reserve(maxMeshletTriangles);
+	uint32_t triangleCount = 0;
+
+	auto flush = [&]()
+	{
+		if (meshletTriangles.empty())
+		{
+			return;
+		}
+		finish_meshlet(meshletVertices, meshletTriangles, triangleCount, vertices, out);
+		triangleCount += static_cast<uint32_t>(meshletTriangles.size());
+		for (uint32_t const v : meshletVertices)
+		{
+			localIndices[v] = unused;
+		}
+		meshletVertices.clear();
+		meshletTriangles.clear();
+	};
+
+	for (size_t i = 0; i + 2 < indices.size(); i += 3)
+	{
+		uint32_t const a = indices[i];
+		uint32_t const b = indices[i + 1];
+		uint32_t const c = indices[i + 2];
+		if (a >= vertices.size() || b >= vertices.size() || c >= vertices.size())
+		{
+			continue;
+		}
+
+		uint32_t const newVertices = (localIndices[a] == unused) + (localIndices[b] == unused && b != a)
+			+ (localIndices[c] == unused && c != a && c != b);
+		if (meshletVertices.size() + newVertices > maxMeshletVertices || meshletTriangles.size() == maxMeshletTriangles)
+		{
+			flush();
+		}
+
+		uint32_t const corners[] = { a, b, c };
+		uint32_t triangle = 0;
+		for (uint32_t corner = 0; corner < 3; corner++)
+		{
+			uint32_t const v = corners[corner];
+			if (localIndices[v] == unused)
+			{
+				localIndices[v] = static_cast<uint32_t>(meshletVertices.size());
+				meshletVertices.push_back(v);
+			}
+			triangle |= localIndices[v] << (corner * 8);
+		}
+		meshletTriangles.push_back(triangle);
+	}
+	flush();
+}
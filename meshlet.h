@@ -0,0 +1,40 @@
+#pragma once
+
+#include <span>
+#include <vector>
+
+#include "vk_types.h"
+
+// Small clusters of a surface's triangles that are culled on their own, by cluster_cull.comp or meshlet.task.
+// The limits are the usual mesh shader output sizes, one workgroup of meshlet.mesh covers a whole meshlet.
+static uint32_t constexpr maxMeshletVertices = 64;
+static uint32_t constexpr maxMeshletTriangles = 124;
+// Clusters culled by one meshlet.task workgroup, TASK_WORKGROUP_SIZE in meshlet_structures.glsl
+static uint32_t constexpr meshletTaskWorkgroupSize = 32;
+
+// Matches Meshlet in meshlet_structures.glsl, bounds are in mesh space
+struct Meshlet
+{
+	glm::vec4 sphere; // w is the radius
+	// Every triangle's normal is within the cone's half angle of the axis. w is the sine of that angle, 1 when the
+	// normals spread too far for the meshlet to ever be backface culled.
+	glm::vec4 cone;
+	// Into the meshlet data: vertexCount vertex indices relative to the mesh, then triangleCount triangles
+	// of three 8-bit indices into those
+	uint32_t dataOffset;
+	uint32_t vertexCount;
+	uint32_t triangleCount;
+	// Triangles of the surface before this meshlet, cluster_cull.comp writes the surface's visible triangles in place
+	uint32_t firstTriangle;
+};
+
+struct MeshletData
+{
+	std::vector<Meshlet> meshlets;
+	std::vector<uint32_t> data;
+};
+
+// Splits a triangle list into meshlets, appending them to out. Triangles are taken in index order, so the vertex cache
+// order from optimize_mesh also gives compact meshlets. Indices are relative to vertices, triangles that index past
+// the end are dropped.
+void build_meshlets(std::span<uint32_t const> indices, std::span<Vertex const> vertices, MeshletData& out);
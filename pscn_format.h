@@ -0,0 +1,149 @@
+#pragma once
+
+#include <cstdint>
+
+#include <glm/mat4x4.hpp>
+#include <glm/vec4.hpp>
+
+// Layout of cooked scene files (.pscn). cook_gltf writes them and load_pscn reads them straight out of a mapped file:
+// every table is an array of the structs below at a 16-byte aligned offset from the start of the file, so loading is
+// a few bounds checks and pointer casts. Vertices are stored already encoded in the VertexFormat picked for their mesh,
+// meshlets as the Meshlet structs the geometry pool takes. LOD indices are stored in the mesh after their surface's.
+// Bump pscnVersion whenever one of these structs, Vertex or Meshlet changes, older files are rejected and have to be cooked again.
+
+static uint32_t constexpr pscnMagic = 0x4E435350; // "PSCN"
+static uint32_t constexpr pscnVersion = 5;
+static uint32_t constexpr pscnAlignment = 16;
+// Material texture or sampler slot that uses the engine default
+static uint32_t constexpr pscnNone = UINT32_MAX;
+
+// offset in bytes from the start of the file, count in elements of the table's struct (bytes for blobs)
+struct PscnRange
+{
+	uint64_t offset;
+	uint64_t count;
+};
+
+struct PscnHeader
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t vertexSize;
+	uint32_t pad0;
+
+	PscnRange strings; // null-terminated names, referenced by byte offset
+	PscnRange samplers;
+	PscnRange textures;
+	PscnRange mips;
+	PscnRange materials;
+	PscnRange meshes;
+	PscnRange surfaces;
+	PscnRange nodes;
+	PscnRange vertexData;
+	PscnRange indices;
+	PscnRange textureData;
+	PscnRange meshlets;
+	PscnRange meshletData;
+	PscnRange lods;
+};
+
+struct PscnSampler
+{
+	uint32_t magFilter; // VkFilter
+	uint32_t minFilter;
+	uint32_t mipmapMode; // VkSamplerMipmapMode
+	uint32_t anisotropic;
+};
+
+enum PscnTextureFlags : uint32_t
+{
+	// rgb was multiplied by alpha before mips were built
+	PSCN_TEXTURE_PREMULTIPLIED = 1 << 0
+};
+
+struct PscnTexture
+{
+	uint32_t name;
+	uint32_t format; // VkFormat, block-compressed
+	uint32_t width;
+	uint32_t height;
+	uint32_t firstMip;
+	uint32_t mipCount;
+	uint32_t flags;
+	uint32_t pad0;
+};
+
+struct PscnMip
+{
+	uint64_t offset; // relative to textureData
+	uint64_t size;
+};
+
+struct PscnMaterial
+{
+	uint32_t name;
+	uint32_t passType; // MaterialPass
+	uint32_t pad0[2];
+	glm::vec4 colorFactors;
+	glm::vec4 metalRoughFactors;
+	glm::vec4 emissiveFactor; // already scaled by the emissive strength, w unused
+
+	uint32_t albedoTexture;
+	uint32_t albedoSampler;
+	uint32_t normalTexture;
+	uint32_t normalSampler;
+	uint32_t metalRoughAOTexture;
+	uint32_t metalRoughAOSampler;
+	uint32_t pad1[2];
+};
+
+struct PscnMesh
+{
+	uint32_t name;
+	uint32_t firstSurface;
+	uint32_t surfaceCount;
+	uint32_t vertexFormat; // VertexFormat
+	// vertexCount vertices of the format at vertexDataOffset bytes into vertexData, indices are relative to them
+	uint64_t vertexDataOffset;
+	uint64_t vertexCount;
+	uint64_t firstIndex;
+	uint64_t indexCount;
+	// Meshlet dataOffsets are relative to the mesh's meshletDataOffset, in uint32s
+	uint32_t firstMeshlet;
+	uint32_t meshletCount;
+	uint64_t meshletDataOffset;
+	uint64_t meshletDataCount;
+};
+
+struct PscnSurface
+{
+	uint32_t startIndex;
+	uint32_t count;
+	uint32_t material; // pscnNone for the engine default material
+	float sphereRadius;
+	glm::vec4 boundsOrigin; // w unused
+	glm::vec4 boundsExtents; // w unused
+	// relative to the mesh's firstMeshlet
+	uint32_t firstMeshlet;
+	uint32_t meshletCount;
+	uint32_t firstLod;
+	uint32_t lodCount;
+};
+
+// Matches SurfaceLod
+struct PscnLod
+{
+	uint32_t indexOffset; // from the surface's startIndex
+	uint32_t count;
+	float error;
+	uint32_t pad0;
+};
+
+struct PscnNode
+{
+	uint32_t name;
+	uint32_t parent; // pscnNone for top nodes
+	uint32_t mesh; // pscnNone for plain nodes
+	uint32_t pad0;
+	glm::mat4 localTransform;
+};
@@ -1,5 +1,9 @@
 #pragma once
 
+#include <algorithm>
+#include <cstdint>
+#include <utility>
+
 #include "vk_loader.h"
 
 struct DirectionalLight
@@ -33,14 +37,75 @@ struct SpotLight
 	float intensity;
 };
 
+// One kind of scene light, with the range edited since the GPU copy was last updated. Reads are free, changes go
+// through edit, push_back, pop_back and clear so they're tracked, and every change bumps the version.
+template <typename T>
+class LightStore
+{
+public:
+	T const& operator[](size_t const index) const { return lights[index]; }
+	size_t size() const { return lights.size(); }
+	bool empty() const { return lights.empty(); }
+	std::span<T const> getLights() const { return lights; }
+
+	T& edit(size_t const index)
+	{
+		markDirty(index, index + 1);
+		return lights[index];
+	}
+
+	void push_back(T const& light)
+	{
+		lights.push_back(light);
+		markDirty(lights.size() - 1, lights.size());
+	}
+
+	// Nothing past the end needs uploading, the count shrinking is enough
+	void pop_back()
+	{
+		lights.pop_back();
+		version++;
+	}
+
+	void clear()
+	{
+		lights.clear();
+		version++;
+	}
+
+	uint64_t getVersion() const { return version; }
+
+	// The range changed since the last call, clamped to the current size. Empty when only the count changed.
+	std::pair<size_t, size_t> takeDirtyRange()
+	{
+		std::pair<size_t, size_t> const range = { std::min(dirtyBegin, lights.size()), std::min(dirtyEnd, lights.size()) };
+		dirtyBegin = SIZE_MAX;
+		dirtyEnd = 0;
+		return range.first < range.second ? range : std::pair<size_t, size_t>{ 0, 0 };
+	}
+
+private:
+	void markDirty(size_t const begin, size_t const end)
+	{
+		dirtyBegin = std::min(dirtyBegin, begin);
+		dirtyEnd = std::max(dirtyEnd, end);
+		version++;
+	}
+
+	std::vector<T> lights;
+	size_t dirtyBegin = SIZE_MAX;
+	size_t dirtyEnd = 0;
+	uint64_t version = 0;
+};
+
 class Scene 
 {
 public:
 	std::shared_ptr<LoadedGLTF> staticGeometry;
 
-	std::vector<DirectionalLight> directionalLights;
-	std::vector<PointLight> pointLights;
-	std::vector<SpotLight> spotLights;
+	LightStore<DirectionalLight> directionalLights;
+	LightStore<PointLight> pointLights;
+	LightStore<SpotLight> spotLights;
 
 	Skybox skybox;
 };
\ No newline at end of file
@@ -0,0 +1,39 @@
+// Material textures of the bindless pipelines, see BindlessMaterials. The constants come from material_structures.glsl.
+// Only included by the BINDLESS builds of mesh.vert, lit.frag and gbuffer.frag, after input_structures.glsl and object_structures.glsl.
+
+#extension GL_EXT_nonuniform_qualifier : require
+
+// Matches GPUBindlessTextures, indexed by ObjectData.materialIndex like MaterialData
+struct BindlessTextures
+{
+	uint albedoTexture;
+	uint albedoSampler;
+	uint normalTexture;
+	uint normalSampler;
+	uint metalRoughAOTexture;
+	uint metalRoughAOSampler;
+	uint pad0[2];
+};
+
+layout(buffer_reference, std430) readonly buffer BindlessTextureBuffer
+{
+	BindlessTextures textures[];
+};
+
+layout(set = 1, binding = 0) uniform sampler bindlessSamplers[];
+layout(set = 1, binding = 1) uniform texture2D bindlessTextures[];
+
+// Matches GPUBindlessPushConstants
+layout (push_constant) uniform PushConstants
+{
+	ObjectBuffer objectBuffer;
+	BindlessTextureBuffer materialTextures;
+} constants;
+
+// The material can differ between the invocations of a draw's fragment quads once draws are merged across materials
+#define BINDLESS_TEXTURE(textureIndex, samplerIndex) sampler2D(bindlessTextures[nonuniformEXT(textureIndex)], bindlessSamplers[nonuniformEXT(samplerIndex)])
+
+// The material's textures, the same macros as in input_structures.glsl
+#define MATERIAL_ALBEDO(materialIndex) BINDLESS_TEXTURE(constants.materialTextures.textures[materialIndex].albedoTexture, constants.materialTextures.textures[materialIndex].albedoSampler)
+#define MATERIAL_NORMAL(materialIndex) BINDLESS_TEXTURE(constants.materialTextures.textures[materialIndex].normalTexture, constants.materialTextures.textures[materialIndex].normalSampler)
+#define MATERIAL_METAL_ROUGH_AO(materialIndex) BINDLESS_TEXTURE(constants.materialTextures.textures[materialIndex].metalRoughAOTexture, constants.materialTextures.textures[materialIndex].metalRoughAOSampler)
@@ -58,12 +58,21 @@ else
     const exec = require('child_process').execFile;
     const path = require('path');
 
-    const validExts = ['.frag', '.vert', '.comp'];
+    const validExts = ['.frag', '.vert', '.comp', '.task', '.mesh'];
+    // Mesh shaders need SPIR-V 1.4, which glslc only targets for Vulkan 1.2 and up
+    const vulkan13Exts = ['.task', '.mesh'];
+
+    // Shaders compiled a second time with extra defines, into their own spv
+    const variants = [
+        { file: 'mesh.vert', output: 'bindless_mesh.vert', defines: ['BINDLESS'] },
+        { file: 'lit.frag', output: 'bindless_lit.frag', defines: ['BINDLESS'] },
+        { file: 'gbuffer.frag', output: 'bindless_gbuffer.frag', defines: ['BINDLESS'] }
+    ];
 
     // Resolve undefined if we skip file (either not a shader, or already up-to-date)
-    // Resolve with timestamp map entry (file, mtime) if shader compiled
+    // Resolve with timestamp map entry (output, mtime) if shader compiled
     // Reject if error (compilation failed)
-    function tryCompileShader(dir, file)
+    function tryCompileShader(dir, file, output = file, defines = [])
     {
         return new Promise((resolve, reject) =>
         {
@@ -81,22 +90,28 @@ else
                 var stats = fs.statSync(relFile);
                 var mtime = stats.mtime.getTime();
 
-                if (!useTimestamps || !timestampMap.has(file) || mtime != timestampMap.get(file))
+                if (!useTimestamps || !timestampMap.has(output) || mtime != timestampMap.get(output))
                 {
                     // Compile the shader to spv in output directory
-                    var spv = outputDir + file + '.spv';
-                    exec(glslc, [relFile, '-o', spv], function (err, data)
+                    var spv = outputDir + output + '.spv';
+                    var args = [relFile, '-o', spv];
+                    defines.forEach(define => args.push('-D' + define));
+                    if (vulkan13Exts.indexOf(path.extname(file)) >= 0)
+                    {
+                        args.push('--target-env=vulkan1.3');
+                    }
+                    exec(glslc, args, function (err, data)
                     {
                         if (err)
                         {
-                            console.error("Error compiling shader %s, reason: %s", file, err.message);
+                            console.error("Error compiling shader %s, reason: %s", output, err.message);
                             reject(err);
                             return;
                         }
 
-                        console.log("Compiled shader %s", file);
+                        console.log("Compiled shader %s", output);
 
-                        resolve([file, mtime]);
+                        resolve([output, mtime]);
                         return;
                     });
                 }
@@ -110,7 +125,9 @@ else
     }
 
     const files = fs.readdirSync(inputDir);
-    Promise.allSettled(files.map(file => tryCompileShader(inputDir, file))).then((results) =>
+    const compiles = files.map(file => tryCompileShader(inputDir, file))
+        .concat(variants.map(variant => tryCompileShader(inputDir, variant.file, variant.output, variant.defines)));
+    Promise.allSettled(compiles).then((results) =>
     {
         // SAVE NEW TIMESTAMPS TO FILE
         var anyModified = false;
@@ -0,0 +1,69 @@
+#version 450
+
+#extension GL_GOOGLE_include_directive : require
+
+// Set 1 is the G-buffer here
+#define NO_MATERIAL_SET
+#include "input_structures.glsl"
+#include "pbr_lighting.glsl"
+
+// Written by gbuffer.frag, read with texelFetch
+layout (set = 1, binding = 0) uniform sampler2D depthBuffer;
+layout (set = 1, binding = 1) uniform sampler2D gBufferAlbedo;
+layout (set = 1, binding = 2) uniform sampler2D gBufferNormal;
+layout (set = 1, binding = 3) uniform sampler2D gBufferMetalRoughAO;
+
+// Matches GPUDeferredLightingPushConstants
+layout (push_constant) uniform PushConstants
+{
+	LightClusters tiles;
+	uvec2 drawExtent;
+	uint tileCountX;
+} constants;
+
+// Matches deferredTileSize
+#define TILE_SIZE 16
+
+layout (location = 0) out vec4 outFragColor;
+
+void main() 
+{
+	ivec2 pixel = ivec2(gl_FragCoord.xy);
+
+	// Depth is reversed and cleared to 0, the skybox stays wherever nothing was drawn
+	float depth = texelFetch(depthBuffer, pixel, 0).r;
+	if (depth <= 0.0) discard;
+
+	// Back to world space through the view depth, which the reversed projection gives as P32 / (depth + P22)
+	float viewDepth = sceneData.proj[3][2] / (depth + sceneData.proj[2][2]);
+	vec2 ndc = gl_FragCoord.xy / vec2(constants.drawExtent) * 2.0 - 1.0;
+	vec3 viewPos = vec3(ndc.x * viewDepth / sceneData.proj[0][0], ndc.y * viewDepth / sceneData.proj[1][1], -viewDepth);
+	vec3 fragPos = vec3(sceneData.invView * vec4(viewPos, 1.0));
+
+	vec3 albedo = texelFetch(gBufferAlbedo, pixel, 0).rgb;
+	vec3 N = normalize(texelFetch(gBufferNormal, pixel, 0).xyz);
+	vec4 mrao = texelFetch(gBufferMetalRoughAO, pixel, 0);
+	float metallic = mrao.b;
+	float roughness = mrao.g;
+	float ao = mrao.r;
+
+	vec3 V = normalize(vec3(sceneData.invView[3]) - fragPos);
+
+	vec3 F0 = vec3(0.04);
+	F0 = mix(F0, albedo, metallic);
+
+	vec3 Lo = ShadeDirectionalLights(N, V, F0, albedo, metallic, roughness);
+
+	// Point and spot lights come from the pixel's tile, see tile_light_cull.comp
+	uvec2 tile = uvec2(pixel) / TILE_SIZE;
+	uint tileIndex = tile.x + tile.y * constants.tileCountX;
+	uint tileLightCount = constants.tiles.clusters[tileIndex].count;
+	for (uint i = 0; i < tileLightCount; i++)
+	{
+		Lo += ShadeClusterLight(constants.tiles.clusters[tileIndex].lights[i], fragPos, N, V, F0, albedo, metallic, roughness);
+	}
+
+	vec3 ambient = AmbientLight(N, V, F0, albedo, metallic, roughness, ao);
+
+	outFragColor = vec4(ambient + Lo, 1.0);
+}
@@ -0,0 +1,14 @@
+#version 450
+
+#extension GL_GOOGLE_include_directive : require
+#include "input_structures.glsl"
+
+layout (location = 0) in vec2 inUV;
+
+// Writes depth only, clipping the same texels lit.frag does so the lit pass never finds depth it can't match
+void main() 
+{
+	vec4 texel = texture(albedoMap, inUV);
+	float scaledAlpha = texel.a * (1 + textureQueryLod(albedoMap, inUV).x * 0.25);
+	if (scaledAlpha < 0.5) discard;
+}
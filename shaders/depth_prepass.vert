@@ -0,0 +1,29 @@
+#version 450
+
+#extension GL_GOOGLE_include_directive : require
+
+#include "input_structures.glsl"
+#include "object_structures.glsl"
+
+// Same position as mesh.vert, so the lit pass can test for equal depth
+invariant gl_Position;
+
+layout (location = 0) out vec2 outUV;
+
+layout (push_constant) uniform PushConstants 
+{
+	ObjectBuffer objectBuffer;
+} constants;
+
+void main() 
+{
+	ObjectData object = constants.objectBuffer.objects[gl_InstanceIndex];
+	Vertex v = load_vertex(object, gl_VertexIndex);
+	
+	vec4 position = vec4(v.position, 1.0f);
+
+	gl_Position =  sceneData.viewProj * object.modelMat * position;
+
+	outUV.x = v.uv_x;
+	outUV.y = v.uv_y;
+}
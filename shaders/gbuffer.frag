@@ -0,0 +1,50 @@
+#version 450
+
+#extension GL_GOOGLE_include_directive : require
+#include "input_structures.glsl"
+// Also built with BINDLESS defined, as bindless_gbuffer.frag, for the bindless material pipelines
+#ifdef BINDLESS
+#include "object_structures.glsl"
+#include "bindless_structures.glsl"
+#endif
+
+layout (location = 0) in vec3 inNormal;
+layout (location = 1) in vec3 inColor;
+layout (location = 2) in vec2 inUV;
+layout (location = 3) in vec3 inFragPos;
+layout (location = 4) in mat3 inTangentMat;
+layout (location = 7) flat in uint inMaterialIndex;
+
+// Matches gBufferFormats, deferred_lighting.frag shades from these
+layout (location = 0) out vec4 outAlbedo;
+layout (location = 1) out vec4 outNormal;
+layout (location = 2) out vec4 outMetalRoughAO;
+
+vec3 GetNormalFromNormalMap()
+{
+	vec3 normal = UnpackNormal(texture(MATERIAL_NORMAL(inMaterialIndex), inUV).rg);
+	return normalize(inTangentMat * normal);
+}
+
+void main() 
+{
+	MaterialData materialData = LoadMaterial(inMaterialIndex);
+
+	// Mip-corrected alpha clip, same as lit.frag
+	vec4 texel = texture(MATERIAL_ALBEDO(inMaterialIndex), inUV);
+	float scaledAlpha = texel.a * (1 + textureQueryLod(MATERIAL_ALBEDO(inMaterialIndex), inUV).x * 0.25);
+	if (scaledAlpha < 0.5) discard;
+
+	vec4 mrao = texture(MATERIAL_METAL_ROUGH_AO(inMaterialIndex), inUV);
+
+	vec3 albedo = texel.rgb;
+	if ((materialData.flags & MATERIAL_FLAG_STRAIGHT_ALPHA) == 0)
+	{
+		albedo /= texel.a; // un-premultiply alpha
+	}
+	albedo *= materialData.colorFactors.rgb * inColor;
+
+	outAlbedo = vec4(albedo, 1.0);
+	outNormal = vec4(GetNormalFromNormalMap(), 0.0);
+	outMetalRoughAO = vec4(mrao.r, mrao.g * materialData.metalRoughFactors.g, mrao.b * materialData.metalRoughFactors.r, 0.0);
+}
@@ -1,5 +1,8 @@
 #extension GL_EXT_buffer_reference : require
 
+#include "light_structures.glsl"
+#include "material_structures.glsl"
+
 layout(set = 0, binding = 0) uniform SceneData
 {   
 	mat4 view;
@@ -7,53 +10,29 @@ layout(set = 0, binding = 0) uniform SceneData
 	mat4 proj;
 	mat4 viewProj;
 	mat4 cullViewProj;
+	MaterialBuffer materials;
+	MaterialExtensionBuffer materialExtensions;
 } sceneData;
 
-struct DirectionalLight
-{
-	vec3 direction;
-	float intensity;
-	vec3 color;
-	float pad0;
-};
-
-layout (buffer_reference) readonly buffer DirectionalLights
-{
-	DirectionalLight lights[];
-};
-
-struct PointLight
+MaterialData LoadMaterial(uint materialIndex)
 {
-	vec3 position;
-	float pad0;
-	vec3 color;
-	
-	float constant;
-	float linear;
-	float quadratic;
-
-	float pad1, pad2;
-};
-
-layout (buffer_reference) readonly buffer PointLights
-{
-	PointLight lights[];
-};
+	return sceneData.materials.materials[materialIndex];
+}
 
-struct SpotLight
+// Black for materials without an extension
+vec3 MaterialEmissive(MaterialData material)
 {
-	vec3 position;
-	float innerCutOff;
-	vec3 direction;
-	float outerCutOff;
-	vec3 color;
-	float intensity;
-};
+	return material.extension == NO_MATERIAL_EXTENSION ? vec3(0.0) : sceneData.materialExtensions.extensions[material.extension].emissive.rgb;
+}
 
-layout (buffer_reference) readonly buffer SpotLights
+// Tangent space normal from a normal map's rg, z is rebuilt so two-channel (BC5) normal maps work too
+vec3 UnpackNormal(vec2 rg)
 {
-	SpotLight lights[];
-};
+	vec3 normal;
+	normal.xy = rg * 2.0 - 1.0;
+	normal.z = sqrt(max(1.0 - dot(normal.xy, normal.xy), 0.0));
+	return normal;
+}
 
 layout (set = 0, binding = 1) uniform LightData
 {
@@ -64,6 +43,10 @@ layout (set = 0, binding = 1) uniform LightData
 	DirectionalLights directionalLights;
 	PointLights pointLights;
 	SpotLights spotLights;
+	LightClusters lightClusters;
+	vec2 clusterTileSize;
+	float clusterDepthScale;
+	float clusterDepthBias;
 } lightData;
 
 layout (set = 0, binding = 2) uniform samplerCube environmentMap;
@@ -71,12 +54,17 @@ layout (set = 0, binding = 3) uniform samplerCube irradianceMap;
 layout (set = 0, binding = 4) uniform samplerCube prefilterMap;
 layout (set = 0, binding = 5) uniform sampler2D brdfLUT;
 
-layout(set = 1, binding = 0) uniform PBRMaterialData
-{  
-	vec4 colorFactors;
-	vec4 metalRoughFactors;
-} materialData;
+// Passes that bind something else to set 1 define NO_MATERIAL_SET before including this. The BINDLESS builds of
+// the material shaders bind the bindless set there, see bindless_structures.glsl.
+#if !defined(NO_MATERIAL_SET) && !defined(BINDLESS)
+
+layout(set = 1, binding = 0) uniform sampler2D albedoMap;
+layout(set = 1, binding = 1) uniform sampler2D normalMap;
+layout(set = 1, binding = 2) uniform sampler2D metalRoughAOMap;
+
+// The material's textures, the same macros as in bindless_structures.glsl. Here they're the bound material's set.
+#define MATERIAL_ALBEDO(materialIndex) albedoMap
+#define MATERIAL_NORMAL(materialIndex) normalMap
+#define MATERIAL_METAL_ROUGH_AO(materialIndex) metalRoughAOMap
 
-layout(set = 1, binding = 1) uniform sampler2D albedoMap;
-layout(set = 1, binding = 2) uniform sampler2D normalMap;
-layout(set = 1, binding = 3) uniform sampler2D metalRoughAOMap;
+#endif
@@ -0,0 +1,140 @@
+// Scene lights and the light clusters built by light_cull.comp, shared with lit.frag through input_structures.glsl.
+// Requires GL_EXT_buffer_reference.
+
+struct DirectionalLight
+{
+	vec3 direction;
+	float intensity;
+	vec3 color;
+	float pad0;
+};
+
+layout (buffer_reference) readonly buffer DirectionalLights
+{
+	DirectionalLight lights[];
+};
+
+struct PointLight
+{
+	vec3 position;
+	float pad0;
+	vec3 color;
+	
+	float constant;
+	float linear;
+	float quadratic;
+
+	float pad1, pad2;
+};
+
+layout (buffer_reference) readonly buffer PointLights
+{
+	PointLight lights[];
+};
+
+struct SpotLight
+{
+	vec3 position;
+	float innerCutOff;
+	vec3 direction;
+	float outerCutOff;
+	vec3 color;
+	float intensity;
+};
+
+layout (buffer_reference) readonly buffer SpotLights
+{
+	SpotLight lights[];
+};
+
+// Point lights stop where they'd add less than this to the brightest channel, which gives them a radius to cull with
+#define LIGHT_CUTOFF (1.0 / 256.0)
+
+float PointLightRange(PointLight light)
+{
+	float c = light.constant - max(light.color.r, max(light.color.g, light.color.b)) / LIGHT_CUTOFF;
+	if (c >= 0.0)
+	{
+		return 0.0;
+	}
+	if (light.quadratic > 0.0)
+	{
+		return (-light.linear + sqrt(light.linear * light.linear - 4.0 * light.quadratic * c)) / (2.0 * light.quadratic);
+	}
+	if (light.linear > 0.0)
+	{
+		return -c / light.linear;
+	}
+	return 1e30; // never falls off
+}
+
+// Matches lightClusterCountX, lightClusterCountY, lightClusterCountZ and maxLightsPerCluster
+#define LIGHT_CLUSTER_X 16
+#define LIGHT_CLUSTER_Y 9
+#define LIGHT_CLUSTER_Z 24
+#define MAX_LIGHTS_PER_CLUSTER 256
+
+// Set on cluster entries that index spot lights, the rest index point lights
+#define LIGHT_CLUSTER_SPOT_BIT 0x80000000u
+
+// Matches GPULightCluster
+struct LightCluster
+{
+	uint count;
+	uint lights[MAX_LIGHTS_PER_CLUSTER];
+};
+
+layout (buffer_reference, std430) buffer LightClusters
+{
+	LightCluster clusters[];
+};
+
+// View space bounds of a screen tile between two view depths, the camera looks down -z. projScale is P00 and P11.
+void TileViewBounds(vec2 ndcMin, vec2 ndcMax, vec2 projScale, float near, float far, out vec3 boundsMin, out vec3 boundsMax)
+{
+	// A tile's view space xy grows linearly with depth
+	vec2 minSlope = ndcMin / projScale;
+	vec2 maxSlope = ndcMax / projScale;
+	vec2 xyMin = min(min(minSlope * near, minSlope * far), min(maxSlope * near, maxSlope * far));
+	vec2 xyMax = max(max(minSlope * near, minSlope * far), max(maxSlope * near, maxSlope * far));
+
+	boundsMin = vec3(xyMin, -far);
+	boundsMax = vec3(xyMax, -near);
+}
+
+bool PointLightTouchesBounds(PointLight light, mat4 view, vec3 boundsMin, vec3 boundsMax)
+{
+	vec3 center = vec3(view * vec4(light.position, 1.0));
+	float range = PointLightRange(light);
+
+	vec3 offset = center - clamp(center, boundsMin, boundsMax);
+	return range > 0.0 && dot(offset, offset) <= range * range;
+}
+
+// Spot lights don't fall off with distance, so only their cone is tested, against a bounding sphere of the bounds.
+// Cones of 90 degrees and wider are always kept.
+bool SpotLightTouchesBounds(SpotLight light, mat4 view, vec3 boundsMin, vec3 boundsMax)
+{
+	if (light.outerCutOff <= 0.0)
+	{
+		return true;
+	}
+
+	vec3 boundsCenter = (boundsMin + boundsMax) * 0.5;
+	float boundsRadius = length(boundsMax - boundsMin) * 0.5;
+
+	vec3 position = vec3(view * vec4(light.position, 1.0));
+	vec3 direction = normalize(mat3(view) * light.direction);
+
+	vec3 toCenter = boundsCenter - position;
+	float axisDistance = dot(toCenter, direction);
+	float sinAngle = sqrt(1.0 - light.outerCutOff * light.outerCutOff);
+	float coneDistance = light.outerCutOff * sqrt(max(dot(toCenter, toCenter) - axisDistance * axisDistance, 0.0)) - axisDistance * sinAngle;
+	return coneDistance <= boundsRadius && axisDistance >= -boundsRadius;
+}
+
+// Depth slices are spaced exponentially, so clusters keep roughly the same shape all the way out
+uint LightClusterSlice(float viewDepth, float depthScale, float depthBias)
+{
+	return uint(clamp(floor(log(viewDepth) * depthScale + depthBias), 0.0, float(LIGHT_CLUSTER_Z - 1)));
+}
@@ -2,16 +2,28 @@
 
 #extension GL_GOOGLE_include_directive : require
 #include "input_structures.glsl"
+// Also built with BINDLESS defined, as bindless_lit.frag, for the bindless material pipelines
+#ifdef BINDLESS
+#include "object_structures.glsl"
+#include "bindless_structures.glsl"
+#endif
+#include "pbr_lighting.glsl"
 
 layout (location = 0) in vec3 inNormal;
 layout (location = 1) in vec3 inColor;
 layout (location = 2) in vec2 inUV;
 layout (location = 3) in vec3 inFragPos;
 layout (location = 4) in mat3 inTangentMat;
+layout (location = 7) flat in uint inMaterialIndex;
 
 layout (location = 0) out vec4 outFragColor;
 
-#define PI 3.14159265358979
+uint LightClusterIndex(vec2 fragCoord, float viewDepth)
+{
+	uvec2 tile = min(uvec2(fragCoord / lightData.clusterTileSize), uvec2(LIGHT_CLUSTER_X - 1, LIGHT_CLUSTER_Y - 1));
+	uint slice = LightClusterSlice(viewDepth, lightData.clusterDepthScale, lightData.clusterDepthBias);
+	return tile.x + tile.y * LIGHT_CLUSTER_X + slice * LIGHT_CLUSTER_X * LIGHT_CLUSTER_Y;
+}
 
 float CalcMipLevel(vec2 texCoord)
 {
@@ -24,87 +36,26 @@ float CalcMipLevel(vec2 texCoord)
 
 vec3 GetNormalFromNormalMap()
 {
-	vec3 normal = texture(normalMap, inUV).rgb;
-	normal = normal * 2.0 - 1.0;
+	vec3 normal = UnpackNormal(texture(MATERIAL_NORMAL(inMaterialIndex), inUV).rg);
 	return normalize(inTangentMat * normal);
 }
 
-vec3 FresnelSchlick(float cosTheta, vec3 F0)
-{
-	return F0 + (1.0 - F0) * pow(clamp(1.0 - cosTheta, 0, 1.0), 5.0);
-}
-
-vec3 FresnelSchlickRoughness(float cosTheta, vec3 F0, float roughness)
-{
-	return F0 + (max(vec3(1.0 - roughness), F0) - F0) * pow(clamp(1.0 - cosTheta, 0, 1.0), 5.0);
-}
-
-float DistributionGGX(vec3 N, vec3 H, float roughness) 
-{
-	float a = roughness * roughness;
-	float a2 = a * a;
-	float NdotH = max(dot(N, H), 0);
-	float NdotH2 = NdotH * NdotH;
-
-	float num = a2;
-	float denom = (NdotH * (a2 - 1.0) + 1.0);
-	denom = PI * denom * denom;
-
-	return num / denom;
-}
-
-float GeometrySchlickGGX(float NdotV, float roughness)
-{
-	float r = (roughness + 1.0);
-	float k = (r * r) / 8.0;
-
-	float num = NdotV;
-	float denom = NdotV * (1.0 - k) + k;
-
-	return num / denom;
-}
-
-float GeometrySmith(vec3 N, vec3 V, vec3 L, float roughness)
-{
-	float NdotV = max(dot(N, V), 0);
-	float NdotL = max(dot(N, L), 0);
-	float ggx2 = GeometrySchlickGGX(NdotV, roughness);
-	float ggx1 = GeometrySchlickGGX(NdotL, roughness);
-
-	return ggx1 * ggx2;
-}
-
-vec3 AddLight(vec3 N, vec3 V, vec3 L, vec3 F0, vec3 radiance, vec3 albedo, float metallic, float roughness)
-{
-	vec3 H = normalize(V + L);
-
-	vec3 F = FresnelSchlick(max(dot(H, V), 0), F0);
-	float NDF = DistributionGGX(N, H, roughness);
-	float G = GeometrySmith(N, V, L, roughness);
-
-	vec3 numerator = NDF * G * F;
-	float denominator = 4.0 * max(dot(N, V), 0) * max(dot(N, L), 0) + 0.0001;
-	vec3 specular = numerator / denominator;
-
-	vec3 kS = F;
-	vec3 kD = vec3(1.0) - kS;
-
-	kD *= 1.0 - metallic;
-
-	float NdotL = max(dot(N, L), 0);
-	return (kD * albedo / PI + specular) * radiance * NdotL;
-}
-
 void main() 
 {
+	MaterialData materialData = LoadMaterial(inMaterialIndex);
+
 	// Mip-corrected alpha clip
-	vec4 texel = texture(albedoMap, inUV);
-	float scaledAlpha = texel.a * (1 + textureQueryLod(albedoMap, inUV).x * 0.25);
+	vec4 texel = texture(MATERIAL_ALBEDO(inMaterialIndex), inUV);
+	float scaledAlpha = texel.a * (1 + textureQueryLod(MATERIAL_ALBEDO(inMaterialIndex), inUV).x * 0.25);
 	if (scaledAlpha < 0.5) discard;
 
-	vec4 mrao = texture(metalRoughAOMap, inUV);
+	vec4 mrao = texture(MATERIAL_METAL_ROUGH_AO(inMaterialIndex), inUV);
 
-	vec3 albedo = texel.rgb / texel.a; // un-premultiply alpha
+	vec3 albedo = texel.rgb;
+	if ((materialData.flags & MATERIAL_FLAG_STRAIGHT_ALPHA) == 0)
+	{
+		albedo /= texel.a; // un-premultiply alpha
+	}
 	albedo *= materialData.colorFactors.rgb * inColor;
 	vec3 N = GetNormalFromNormalMap();
 	float metallic = mrao.b * materialData.metalRoughFactors.r;
@@ -114,69 +65,22 @@ void main()
 	vec3 viewPos = vec3(sceneData.invView[3]);
 	vec3 V = normalize(viewPos - inFragPos);
 
-	vec3 R = reflect(-V, N);
-
 	vec3 F0 = vec3(0.04);
 	F0 = mix(F0, albedo, metallic);
 
 	// integrate all light sources
-	vec3 Lo = vec3(0);
-	for (int i = 0; i < lightData.directionalLightCount; i++) 
-	{
-		DirectionalLight light = lightData.directionalLights.lights[i];
-
-		vec3 L = normalize(-light.direction);
+	vec3 Lo = ShadeDirectionalLights(N, V, F0, albedo, metallic, roughness);
 
-		vec3 radiance = light.color * light.intensity;
-
-		Lo += AddLight(N, V, L, F0, radiance, albedo, metallic, roughness);
-	}
-	for (int i = 0; i < lightData.pointLightCount; i++)
+	// Point and spot lights only come from the fragment's cluster, see light_cull.comp
+	uint clusterIndex = LightClusterIndex(gl_FragCoord.xy, -(sceneData.view * vec4(inFragPos, 1.0)).z);
+	uint clusterLightCount = lightData.lightClusters.clusters[clusterIndex].count;
+	for (uint i = 0; i < clusterLightCount; i++)
 	{
-		PointLight light = lightData.pointLights.lights[i];
-
-		vec3 L = normalize(light.position - inFragPos);
-
-		float dist = length(light.position - inFragPos);
-		float attenuation = 1.0 / (light.constant + light.linear * dist + light.quadratic * (dist * dist));
-		vec3 radiance = light.color * attenuation;
-
-		Lo += AddLight(N, V, L, F0, radiance, albedo, metallic, roughness);
-	}
-	for (int i = 0; i < lightData.spotLightCount; i++)
-	{
-		SpotLight light = lightData.spotLights.lights[i];
-
-		vec3 L = normalize(light.position - inFragPos);
-
-		float theta = dot(L, normalize(-light.direction));
-		if (theta > light.outerCutOff)
-		{
-			float epsilon = light.innerCutOff - light.outerCutOff;
-			float intensity = clamp((theta - light.outerCutOff) / epsilon, 0.0, 1.0);
-
-			vec3 radiance = light.color * light.intensity;
-
-			Lo += AddLight(N, V, L, F0, radiance, albedo, metallic, roughness);
-		}
+		Lo += ShadeClusterLight(lightData.lightClusters.clusters[clusterIndex].lights[i], inFragPos, N, V, F0, albedo, metallic, roughness);
 	}
 
-	// ambient (IBL)
-	vec3 F = FresnelSchlickRoughness(max(dot(N, V), 0.0), F0, roughness);
-	vec3 kS = F;
-	vec3 kD = 1.0 - kS;
-	kD *= 1.0 - metallic;
-
-	vec3 irradiance = texture(irradianceMap, N).rgb;
-	vec3 diffuse = irradiance * albedo;
+	vec3 ambient = AmbientLight(N, V, F0, albedo, metallic, roughness, ao);
 
-	const float MAX_REFLECTION_LOD = 4.0; // could instead calc dynamically (which is how it is constructed) or at least ensure consistent
-	vec3 prefilteredColor = textureLod(prefilterMap, R, roughness * MAX_REFLECTION_LOD).rgb;
-	vec2 envBRDF = texture(brdfLUT, vec2(max(dot(N, V), 0.0), roughness)).rg;
-	vec3 specular = prefilteredColor * (F * envBRDF.x + envBRDF.y);
-
-	vec3 ambient = (kD * diffuse + specular) * ao;
-
-	vec3 color = ambient + Lo;
+	vec3 color = ambient + Lo + MaterialEmissive(materialData);
 	outFragColor = vec4(color, texel.w * materialData.colorFactors.w);
-}
\ No newline at end of file
+}
@@ -0,0 +1,33 @@
+// Material records every mesh pipeline reads by ObjectData.materialIndex, see BindlessMaterials.
+// Included by input_structures.glsl, whose scene data holds the buffers.
+
+// Matches PBRMaterial::MaterialFlags
+#define MATERIAL_FLAG_STRAIGHT_ALPHA 1
+
+// Matches noMaterialExtension
+#define NO_MATERIAL_EXTENSION 0xffffffffu
+
+// Matches GPUMaterialConstants, 32 bytes
+struct MaterialData
+{
+	vec4 colorFactors;
+	vec2 metalRoughFactors;
+	uint flags;
+	uint extension;
+};
+
+layout(buffer_reference, std430) readonly buffer MaterialBuffer
+{
+	MaterialData materials[];
+};
+
+// Matches GPUMaterialExtension, only for materials whose extension isn't NO_MATERIAL_EXTENSION
+struct MaterialExtension
+{
+	vec4 emissive;
+};
+
+layout(buffer_reference, std430) readonly buffer MaterialExtensionBuffer
+{
+	MaterialExtension extensions[];
+};
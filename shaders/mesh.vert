@@ -3,34 +3,28 @@
 #extension GL_GOOGLE_include_directive : require
 
 #include "input_structures.glsl"
+#include "object_structures.glsl"
+// Also built with BINDLESS defined, as bindless_mesh.vert, which takes the bindless push constants
+#ifdef BINDLESS
+#include "bindless_structures.glsl"
+#endif
+
+// Matches depth_prepass.vert, whose depth the lit pass tests for equality
+invariant gl_Position;
 
 layout (location = 0) out vec3 outNormal;
 layout (location = 1) out vec3 outColor;
 layout (location = 2) out vec2 outUV;
 layout (location = 3) out vec3 outFragPos;
 layout (location = 4) out mat3 outTangentMat;
+layout (location = 7) flat out uint outMaterialIndex;
 
-struct Vertex 
-{
-	vec3 position;
-	float uv_x;
-	vec3 normal;
-	float uv_y;
-	vec4 color;
-	vec4 tangent;
-}; 
-
-layout(buffer_reference, std430) readonly buffer VertexBuffer 
-{ 
-	Vertex vertices[];
-};
-
+#ifndef BINDLESS
 layout (push_constant) uniform PushConstants 
 {
-	mat4 modelMat;
-	mat4 normalMat;
-	VertexBuffer vertexBuffer;
+	ObjectBuffer objectBuffer;
 } constants;
+#endif
 
 mat3 CalculateTangentMatrix(vec3 normal, vec3 tangent)
 {
@@ -42,18 +36,20 @@ mat3 CalculateTangentMatrix(vec3 normal, vec3 tangent)
 
 void main() 
 {
-	Vertex v = constants.vertexBuffer.vertices[gl_VertexIndex];
+	ObjectData object = constants.objectBuffer.objects[gl_InstanceIndex];
+	Vertex v = load_vertex(object, gl_VertexIndex);
 	
 	vec4 position = vec4(v.position, 1.0f);
 
-	gl_Position =  sceneData.viewProj * constants.modelMat * position;
+	gl_Position =  sceneData.viewProj * object.modelMat * position;
 
-	vec3 tangent = normalize(vec3(constants.modelMat * vec4(v.tangent.xyz, 0)));
+	vec3 tangent = normalize(vec3(object.modelMat * vec4(v.tangent.xyz, 0)));
 
-	outNormal = normalize(mat3(constants.normalMat) * v.normal);
-	outColor = v.color.xyz * materialData.colorFactors.xyz;
+	outNormal = normalize(mat3(object.normalMat) * v.normal);
+	outColor = v.color.xyz * LoadMaterial(object.materialIndex).colorFactors.xyz;
 	outUV.x = v.uv_x;
 	outUV.y = v.uv_y;
-	outFragPos = vec3(constants.modelMat * position);
+	outFragPos = vec3(object.modelMat * position);
 	outTangentMat = CalculateTangentMatrix(outNormal, tangent);
+	outMaterialIndex = object.materialIndex;
 }
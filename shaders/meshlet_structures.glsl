@@ -0,0 +1,132 @@
+// Meshlets and the cluster cull data shared by cluster_cull.comp, meshlet.task and meshlet.mesh.
+// Include after object_structures.glsl.
+
+// Matches maxMeshletVertices and maxMeshletTriangles
+#define MAX_MESHLET_VERTICES 64
+#define MAX_MESHLET_TRIANGLES 124
+
+// Matches Meshlet, bounds are in mesh space
+struct Meshlet
+{
+	vec4 sphere; // w is the radius
+	vec4 cone; // normal cone axis, w is the sine of its half angle, 1 when it can't be culled
+	uint dataOffset; // vertexCount vertex indices, then triangleCount packed triangles
+	uint vertexCount;
+	uint triangleCount;
+	uint firstTriangle;
+};
+
+layout(buffer_reference, std430) readonly buffer MeshletBuffer
+{
+	Meshlet meshlets[];
+};
+
+layout(buffer_reference, std430) readonly buffer MeshletDataBuffer
+{
+	uint data[];
+};
+
+// Matches GPUCluster, one per meshlet of every object
+struct Cluster
+{
+	uint objectIndex;
+	uint meshletIndex;
+	uint firstIndex; // where the object's triangles go in the per-frame cluster index buffer
+};
+
+layout(buffer_reference, std430) readonly buffer ClusterBuffer
+{
+	Cluster clusters[];
+};
+
+// Matches VkDrawIndexedIndirectCommand
+struct DrawCommand
+{
+	uint indexCount;
+	uint instanceCount;
+	uint firstIndex;
+	int vertexOffset;
+	uint firstInstance;
+};
+
+layout(buffer_reference, std430) writeonly buffer DrawCommands
+{
+	DrawCommand commands[];
+};
+
+// Matches GPUDrawCountHeader, then the batches' draw counts
+layout(buffer_reference, std430) buffer DrawCounts
+{
+	uint visibleCount;
+	uint triangleCount;
+	uint lodSavedTriangleCount;
+	uint occludedCount;
+	uint batchCounts[];
+};
+
+layout(buffer_reference, std430) writeonly buffer IndexBuffer
+{
+	uint indices[];
+};
+
+// Matches GPUClusterCullData, written once per frame
+layout(buffer_reference, std430) readonly buffer ClusterCullData
+{
+	vec4 frustumPlanes[6];
+	vec4 cameraPosition; // of the culling camera, w unused
+	ObjectBuffer objectBuffer;
+	MeshletBuffer meshletBuffer;
+	MeshletDataBuffer meshletData;
+	ClusterBuffer clusterBuffer;
+	DrawCommands drawCommandBuffer;
+	DrawCounts drawCounts;
+	IndexBuffer indexBuffer;
+	uint clusterCount;
+	uint cullingEnabled;
+};
+
+// Clusters culled by one meshlet.task workgroup, matches meshletTaskWorkgroupSize
+#define TASK_WORKGROUP_SIZE 32
+
+// Indices of the visible clusters, one meshlet.mesh workgroup is launched per entry
+struct TaskPayload
+{
+	uint clusters[TASK_WORKGROUP_SIZE];
+};
+
+uvec3 unpack_meshlet_triangle(uint packed)
+{
+	return uvec3(packed & 0xffu, (packed >> 8) & 0xffu, (packed >> 16) & 0xffu);
+}
+
+bool IsClusterVisible(ObjectData object, Meshlet meshlet, ClusterCullData cullData)
+{
+	vec3 center = vec3(object.modelMat * vec4(meshlet.sphere.xyz, 1.0f));
+	float maxScale = max(length(object.modelMat[0].xyz), max(length(object.modelMat[1].xyz), length(object.modelMat[2].xyz)));
+	float radius = meshlet.sphere.w * maxScale;
+
+	for (int i = 0; i < 6; i++)
+	{
+		vec4 plane = cullData.frustumPlanes[i];
+		if (dot(plane.xyz, center) + plane.w + radius < 0.0f)
+		{
+			return false;
+		}
+	}
+
+	// Whether a triangle faces the camera doesn't change under an affine transform, so the camera is moved into mesh
+	// space rather than the cone out of it, which stays correct for non-uniform scale. Mirrored objects flip winding
+	// and the rasterizer culls their other side, so they're left alone.
+	if (meshlet.cone.w < 1.0f && determinant(mat3(object.modelMat)) > 0.0f)
+	{
+		// normalMat is the inverse transpose of the model matrix
+		vec3 camera = transpose(mat3(object.normalMat)) * (cullData.cameraPosition.xyz - object.modelMat[3].xyz);
+		vec3 toCenter = meshlet.sphere.xyz - camera;
+		// Every point of the sphere sees all of the meshlet's triangles from behind
+		if (dot(toCenter, meshlet.cone.xyz) >= meshlet.cone.w * length(toCenter) + meshlet.sphere.w * (1.0f + meshlet.cone.w))
+		{
+			return false;
+		}
+	}
+	return true;
+}
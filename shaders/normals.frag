@@ -22,8 +22,7 @@ float CalcMipLevel(vec2 texCoord)
 
 vec3 GetNormalFromNormalMap()
 {
-	vec3 normal = texture(normalMap, inUV).rgb;
-	normal = normal * 2.0 - 1.0;
+	vec3 normal = UnpackNormal(texture(normalMap, inUV).rg);
 	return (normalize(inTangentMat * normal) + 1.0) / 2.0;
 }
 
@@ -0,0 +1,108 @@
+struct Vertex 
+{
+	vec3 position;
+	float uv_x;
+	vec3 normal;
+	float uv_y;
+	vec4 color;
+	vec4 tangent;
+}; 
+
+layout(buffer_reference, std430) readonly buffer VertexBuffer 
+{ 
+	Vertex vertices[];
+};
+
+// Matches VertexFormat
+#define VERTEX_FORMAT_FULL 0
+#define VERTEX_FORMAT_PACKED 1
+#define VERTEX_FORMAT_PACKED_COLOR 2
+
+// Matches PackedVertex, floats instead of a vec3 to keep the 24 byte stride
+struct PackedVertex
+{
+	float positionX, positionY, positionZ;
+	uint normal; // octahedral snorm16x2
+	uint tangent; // same, lowest bit of y is the bitangent sign
+	uint uv; // half2
+};
+
+layout(buffer_reference, std430) readonly buffer PackedVertexBuffer
+{
+	PackedVertex vertices[];
+};
+
+struct PackedColorVertex
+{
+	PackedVertex vertex;
+	uint color; // rgba8
+};
+
+layout(buffer_reference, std430) readonly buffer PackedColorVertexBuffer
+{
+	PackedColorVertex vertices[];
+};
+
+// Matches GPUObjectData, indexed by gl_InstanceIndex (firstInstance of each draw command)
+struct ObjectData
+{
+	mat4 modelMat;
+	mat4 normalMat;
+	VertexBuffer vertexBuffer;
+	uint materialIndex;
+	uint batchIndex;
+	vec4 boundsOrigin; // w is the bounding sphere radius
+	vec4 boundsExtents;
+	uint indexCount;
+	uint firstIndex;
+	uint batchFirstObject;
+	int vertexOffset;
+	uint vertexFormat;
+	uint batchFirstCluster;
+	uint firstLod;
+	uint lodCount;
+};
+
+layout(buffer_reference, std430) readonly buffer ObjectBuffer
+{
+	ObjectData objects[];
+};
+
+vec3 decode_octahedral(vec2 e)
+{
+	vec3 v = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+	float t = max(-v.z, 0.0);
+	v.x += v.x >= 0.0 ? -t : t;
+	v.y += v.y >= 0.0 ? -t : t;
+	return normalize(v);
+}
+
+Vertex unpack_vertex(PackedVertex packed)
+{
+	Vertex v;
+	v.position = vec3(packed.positionX, packed.positionY, packed.positionZ);
+	v.normal = decode_octahedral(unpackSnorm2x16(packed.normal));
+	v.tangent = vec4(decode_octahedral(unpackSnorm2x16(packed.tangent)), (packed.tangent & 0x10000u) != 0 ? -1.0 : 1.0);
+	vec2 uv = unpackHalf2x16(packed.uv);
+	v.uv_x = uv.x;
+	v.uv_y = uv.y;
+	v.color = vec4(1.0);
+	return v;
+}
+
+// Reads a vertex of the object's mesh, whatever format the mesh was stored in
+Vertex load_vertex(ObjectData object, uint index)
+{
+	if (object.vertexFormat == VERTEX_FORMAT_PACKED)
+	{
+		return unpack_vertex(PackedVertexBuffer(object.vertexBuffer).vertices[index]);
+	}
+	if (object.vertexFormat == VERTEX_FORMAT_PACKED_COLOR)
+	{
+		PackedColorVertex packed = PackedColorVertexBuffer(object.vertexBuffer).vertices[index];
+		Vertex v = unpack_vertex(packed.vertex);
+		v.color = unpackUnorm4x8(packed.color);
+		return v;
+	}
+	return object.vertexBuffer.vertices[index];
+}
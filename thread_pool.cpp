@@ -0,0 +1,114 @@
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+
+void ThreadPool::init(unsigned int const threadCount)
+{
+	stopping = false;
+	for (unsigned int i = 0; i < threadCount; i++)
+	{
+		workers.emplace_back([this]() { workerLoop(); });
+	}
+}
+
+void ThreadPool::shutdown()
+{
+	{
+		std::scoped_lock lock(jobMutex);
+		stopping = true;
+	}
+	jobCondition.notify_all();
+
+	for (auto& w : workers)
+	{
+		w.join();
+	}
+	workers.clear();
+	jobs.clear();
+}
+
+void ThreadPool::pushJob(std::function<void()>&& job)
+{
+	{
+		std::scoped_lock lock(jobMutex);
+		jobs.push_back(std::move(job));
+	}
+	jobCondition.notify_one();
+}
+
+void ThreadPool::parallelFor(size_t const count, size_t const minChunkSize, std::function<void(size_t begin, size_t end)> const& function)
+{
+	if (count == 0)
+	{
+		return;
+	}
+
+	size_t const maxChunks = (count + minChunkSize - 1) / std::max<size_t>(minChunkSize, 1);
+	size_t const chunkCount = std::min<size_t>(maxChunks, workers.size() + 1);
+	if (chunkCount <= 1)
+	{
+		function(0, count);
+		return;
+	}
+
+	size_t const chunkSize = (count + chunkCount - 1) / chunkCount;
+
+	// Helpers can start after the caller has already returned (the queue may be busy with other jobs),
+	// so everything they touch lives in shared state and they only call the function for chunks they claim.
+	struct ForState
+	{
+		std::atomic<size_t> nextChunk = 0;
+		std::atomic<size_t> chunksDone = 0;
+		std::mutex doneMutex;
+		std::condition_variable doneCondition;
+	};
+	auto const state = std::make_shared<ForState>();
+
+	auto runChunks = [state, chunkCount, chunkSize, count, &function]()
+	{
+		for (size_t chunk = state->nextChunk++; chunk < chunkCount; chunk = state->nextChunk++)
+		{
+			size_t const begin = chunk * chunkSize;
+			size_t const end = std::min(begin + chunkSize, count);
+			function(begin, end);
+
+			if (++state->chunksDone == chunkCount)
+			{
+				std::scoped_lock lock(state->doneMutex);
+				state->doneCondition.notify_all();
+			}
+		}
+	};
+
+	for (size_t i = 0; i < chunkCount - 1; i++)
+	{
+		pushJob([state, runChunks]() { runChunks(); });
+	}
+
+	runChunks();
+
+	std::unique_lock lock(state->doneMutex);
+	state->doneCondition.wait(lock, [&]() { return state->chunksDone == chunkCount; });
+}
+
+void ThreadPool::workerLoop()
+{
+	while (true)
+	{
+		std::function<void()> job;
+		{
+			std::unique_lock lock(jobMutex);
+			jobCondition.wait(lock, [this]() { return stopping || !jobs.empty(); });
+			if (stopping && jobs.empty())
+			{
+				return;
+			}
+			job = std::move(jobs.front());
+			jobs.pop_front();
+		}
+
+		job();
+	}
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class ThreadPool
+{
+public:
+	void init(unsigned int threadCount);
+	void shutdown();
+
+	void pushJob(std::function<void()>&& job);
+
+	// Splits [0, count) into chunks of at least minChunkSize and runs them on the workers.
+	// The calling thread works on chunks too, and only returns once every chunk is done.
+	void parallelFor(size_t count, size_t minChunkSize, std::function<void(size_t begin, size_t end)> const& function);
+
+	unsigned int getThreadCount() const { return static_cast<unsigned int>(workers.size()); }
+
+private:
+	void workerLoop();
+
+	std::vector<std::thread> workers;
+	std::deque<std::function<void()>> jobs;
+	std::mutex jobMutex;
+	std::condition_variable jobCondition;
+	bool stopping = false;
+};
@@ -0,0 +1,110 @@
+#include "vertex_format.h"
+
+#include <cmath>
+#include <cstring>
+
+#include <glm/common.hpp>
+#include <glm/vec2.hpp>
+#include <glm/packing.hpp>
+
+static_assert(sizeof(PackedVertex) == 24);
+static_assert(sizeof(PackedColorVertex) == 28);
+
+// Folds the lower hemisphere over the diagonals, decoded by decode_octahedral in object_structures.glsl
+static glm::vec2 encode_octahedral(glm::vec3 n)
+{
+	float const length = std::abs(n.x) + std::abs(n.y) + std::abs(n.z);
+	if (length == 0.0f || !std::isfinite(length))
+	{
+		return { 0.0f, 0.0f };
+	}
+	n /= length;
+
+	glm::vec2 encoded{ n.x, n.y };
+	if (n.z < 0.0f)
+	{
+		encoded = (1.0f - glm::abs(glm::vec2(n.y, n.x))) * glm::vec2(n.x >= 0.0f ? 1.0f : -1.0f, n.y >= 0.0f ? 1.0f : -1.0f);
+	}
+	return encoded;
+}
+
+static PackedVertex pack_vertex(Vertex const& vertex)
+{
+	uint32_t tangent = glm::packSnorm2x16(encode_octahedral(glm::vec3(vertex.surfaceTangent)));
+	tangent = (tangent & ~(1u << 16)) | (vertex.surfaceTangent.w < 0.0f ? 1u << 16 : 0u);
+
+	return PackedVertex
+	{
+		.position = vertex.position,
+		.normal = glm::packSnorm2x16(encode_octahedral(vertex.normal)),
+		.tangent = tangent,
+		.uv = glm::packHalf2x16(glm::vec2(vertex.uv_x, vertex.uv_y))
+	};
+}
+
+size_t get_vertex_stride(VertexFormat const format)
+{
+	switch (format)
+	{
+	case VertexFormat::Packed:
+		return sizeof(PackedVertex);
+	case VertexFormat::PackedColor:
+		return sizeof(PackedColorVertex);
+	case VertexFormat::Full:
+	default:
+		return sizeof(Vertex);
+	}
+}
+
+VertexFormat choose_vertex_format(std::span<Vertex const> const vertices)
+{
+	bool hasColor = false;
+	for (Vertex const& vertex : vertices)
+	{
+		// NaN fails the comparison too
+		if (!(std::abs(vertex.uv_x) <= maxPackedUv && std::abs(vertex.uv_y) <= maxPackedUv))
+		{
+			return VertexFormat::Full;
+		}
+		// Primitives without COLOR_0 are loaded as white
+		hasColor = hasColor || vertex.color != glm::vec4(1.0f);
+	}
+	return hasColor ? VertexFormat::PackedColor : VertexFormat::Packed;
+}
+
+std::vector<uint8_t> encode_vertices(std::span<Vertex const> const vertices, VertexFormat const format)
+{
+	std::vector<uint8_t> data(vertices.size() * get_vertex_stride(format));
+
+	switch (format)
+	{
+	case VertexFormat::Packed:
+	{
+		PackedVertex* const packed = reinterpret_cast<PackedVertex*>(data.data());
+		for (size_t i = 0; i < vertices.size(); i++)
+		{
+			packed[i] = pack_vertex(vertices[i]);
+		}
+		break;
+	}
+	case VertexFormat::PackedColor:
+	{
+		PackedColorVertex* const packed = reinterpret_cast<PackedColorVertex*>(data.data());
+		for (size_t i = 0; i < vertices.size(); i++)
+		{
+			packed[i] =
+			{
+				.vertex = pack_vertex(vertices[i]),
+				.color = glm::packUnorm4x8(glm::clamp(vertices[i].color, 0.0f, 1.0f))
+			};
+		}
+		break;
+	}
+	case VertexFormat::Full:
+	default:
+		memcpy(data.data(), vertices.data(), vertices.size_bytes());
+		break;
+	}
+
+	return data;
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <span>
+#include <vector>
+
+#include "vk_types.h"
+
+// How a mesh's vertices are laid out in the geometry pool, picked per mesh when it is loaded.
+// Matches the VERTEX_FORMAT_ defines in object_structures.glsl, load_vertex there decodes all of them.
+enum class VertexFormat : uint32_t
+{
+	// Vertex as is, 64 bytes
+	Full = 0,
+	// PackedVertex, 24 bytes: float position, octahedral normal and tangent in snorm16x2, half-float uv. Color is white.
+	Packed = 1,
+	// PackedColorVertex, Packed plus rgba8 color, 28 bytes
+	PackedColor = 2
+};
+
+struct PackedVertex
+{
+	glm::vec3 position;
+	uint32_t normal;
+	// lowest bit of the y half is the bitangent sign (tangent.w < 0)
+	uint32_t tangent;
+	uint32_t uv;
+};
+
+struct PackedColorVertex
+{
+	PackedVertex vertex;
+	uint32_t color;
+};
+
+// Half floats only keep about a texel of precision at 1024 up to this uv, meshes that tile further stay Full
+static float constexpr maxPackedUv = 2.0f;
+
+size_t get_vertex_stride(VertexFormat format);
+
+// Smallest format that holds the vertices without visible loss
+VertexFormat choose_vertex_format(std::span<Vertex const> vertices);
+
+std::vector<uint8_t> encode_vertices(std::span<Vertex const> vertices, VertexFormat format);
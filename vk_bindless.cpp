@@ -0,0 +1,273 @@
+#include "vk_bindless.h"
+
+#include <algorithm>
+#include <iostream>
+
+#include "vk_engine.h"
+
+void BindlessMaterials::init(VulkanEngine* engine, uint32_t maxTextures, uint32_t maxSamplers, uint32_t const maxMaterials, uint32_t const maxExtensions)
+{
+	this->engine = engine;
+	this->maxMaterials = maxMaterials;
+	this->maxExtensions = maxExtensions;
+
+	VkPhysicalDeviceVulkan12Properties properties12{ .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_PROPERTIES };
+	VkPhysicalDeviceProperties2 properties{ .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2, .pNext = &properties12 };
+	vkGetPhysicalDeviceProperties2(engine->selectedGPU, &properties);
+
+	// The per-stage limits count set 0's samplers as well
+	uint32_t constexpr reservedSamplers = 16;
+	maxTextures = std::min({ maxTextures, properties12.maxDescriptorSetUpdateAfterBindSampledImages, properties12.maxPerStageDescriptorUpdateAfterBindSampledImages - reservedSamplers });
+	maxSamplers = std::min({ maxSamplers, properties12.maxDescriptorSetUpdateAfterBindSamplers, properties12.maxPerStageDescriptorUpdateAfterBindSamplers - reservedSamplers });
+
+	textures.init(maxTextures);
+	samplers.init(maxSamplers);
+	materialSlots.resize(maxMaterials);
+
+	VkDescriptorSetLayoutBinding const bindings[] =
+	{
+		{
+			.binding = 0,
+			.descriptorType = VK_DESCRIPTOR_TYPE_SAMPLER,
+			.descriptorCount = maxSamplers,
+			.stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT
+		},
+		{
+			.binding = 1,
+			.descriptorType = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE,
+			.descriptorCount = maxTextures,
+			.stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT
+		}
+	};
+
+	// Slots past the last material are never written, and are written while earlier frames still read other slots
+	VkDescriptorBindingFlags constexpr arrayFlags = VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT | VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT | VK_DESCRIPTOR_BINDING_UPDATE_UNUSED_WHILE_PENDING_BIT;
+	VkDescriptorBindingFlags const bindingFlags[] = { arrayFlags, arrayFlags | VK_DESCRIPTOR_BINDING_VARIABLE_DESCRIPTOR_COUNT_BIT };
+
+	VkDescriptorSetLayoutBindingFlagsCreateInfo const bindingFlagsInfo
+	{
+		.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO,
+		.bindingCount = 2,
+		.pBindingFlags = bindingFlags
+	};
+
+	VkDescriptorSetLayoutCreateInfo const layoutInfo
+	{
+		.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+		.pNext = &bindingFlagsInfo,
+		.flags = VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT,
+		.bindingCount = 2,
+		.pBindings = bindings
+	};
+	VK_CHECK(vkCreateDescriptorSetLayout(engine->device, &layoutInfo, nullptr, &layout));
+
+	VkDescriptorPoolSize const poolSizes[] =
+	{
+		{ .type = VK_DESCRIPTOR_TYPE_SAMPLER, .descriptorCount = maxSamplers },
+		{ .type = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE, .descriptorCount = maxTextures }
+	};
+
+	VkDescriptorPoolCreateInfo const poolInfo
+	{
+		.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
+		.flags = VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT,
+		.maxSets = 1,
+		.poolSizeCount = 2,
+		.pPoolSizes = poolSizes
+	};
+	VK_CHECK(vkCreateDescriptorPool(engine->device, &poolInfo, nullptr, &pool));
+
+	VkDescriptorSetVariableDescriptorCountAllocateInfo const variableCountInfo
+	{
+		.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_VARIABLE_DESCRIPTOR_COUNT_ALLOCATE_INFO,
+		.descriptorSetCount = 1,
+		.pDescriptorCounts = &maxTextures
+	};
+
+	VkDescriptorSetAllocateInfo const allocateInfo
+	{
+		.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+		.pNext = &variableCountInfo,
+		.descriptorPool = pool,
+		.descriptorSetCount = 1,
+		.pSetLayouts = &layout
+	};
+	VK_CHECK(vkAllocateDescriptorSets(engine->device, &allocateInfo, &set));
+
+	auto const createRecordBuffer = [engine](size_t const size, VkDeviceAddress& address)
+	{
+		AllocatedBuffer const buffer = engine->createBuffer(size, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
+		VkBufferDeviceAddressInfo const deviceAddressInfo{ .sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO, .buffer = buffer.buffer };
+		address = vkGetBufferDeviceAddress(engine->device, &deviceAddressInfo);
+		return buffer;
+	};
+	materialBuffer = createRecordBuffer(sizeof(GPUMaterialConstants) * maxMaterials, materialBufferAddress);
+	extensionBuffer = createRecordBuffer(sizeof(GPUMaterialExtension) * maxExtensions, extensionBufferAddress);
+	textureBuffer = createRecordBuffer(sizeof(GPUBindlessTextures) * maxMaterials, textureBufferAddress);
+
+	std::cout << "Bindless materials: " << maxMaterials << " materials, " << maxExtensions << " extensions, " << maxTextures << " textures, "
+		<< maxSamplers << " samplers." << std::endl;
+}
+
+void BindlessMaterials::cleanup()
+{
+	engine->destroyBuffer(materialBuffer);
+	engine->destroyBuffer(extensionBuffer);
+	engine->destroyBuffer(textureBuffer);
+	vkDestroyDescriptorPool(engine->device, pool, nullptr);
+	vkDestroyDescriptorSetLayout(engine->device, layout, nullptr);
+}
+
+uint32_t BindlessMaterials::addMaterial(GPUMaterialConstants constants, std::optional<GPUMaterialExtension> const& extension, std::array<BindlessTexture, 3> const& materialTextures)
+{
+	std::scoped_lock lock(mutex);
+
+	uint32_t index;
+	if (!freeMaterials.empty())
+	{
+		index = freeMaterials.back();
+		freeMaterials.pop_back();
+	}
+	else if (nextMaterial < maxMaterials)
+	{
+		index = nextMaterial++;
+	}
+	else
+	{
+		std::cerr << "Bindless material buffer is full, using the default material" << std::endl;
+		return 0;
+	}
+	materialCount++;
+
+	MaterialSlots& slots = materialSlots[index];
+
+	// When the extension buffer is full the material is drawn without its extension
+	slots.extension = noMaterialExtension;
+	if (extension.has_value())
+	{
+		if (!freeExtensions.empty())
+		{
+			slots.extension = freeExtensions.back();
+			freeExtensions.pop_back();
+		}
+		else if (nextExtension < maxExtensions)
+		{
+			slots.extension = nextExtension++;
+		}
+		else
+		{
+			std::cerr << "Material extension buffer is full, dropping the material's extension" << std::endl;
+		}
+
+		if (slots.extension != noMaterialExtension)
+		{
+			static_cast<GPUMaterialExtension*>(extensionBuffer.info.pMappedData)[slots.extension] = *extension;
+			extensionCount++;
+		}
+	}
+	constants.extension = slots.extension;
+	static_cast<GPUMaterialConstants*>(materialBuffer.info.pMappedData)[index] = constants;
+
+	std::array<VkDescriptorImageInfo, 6> imageInfos;
+	std::array<VkWriteDescriptorSet, 6> writes;
+	uint32_t writeCount = 0;
+
+	for (size_t i = 0; i < materialTextures.size(); i++)
+	{
+		bool isNew;
+		std::optional<uint32_t> const textureSlot = textures.acquire(materialTextures[i].imageView, isNew);
+		slots.textures[i] = textureSlot.value_or(noSlot);
+		if (isNew)
+		{
+			imageInfos[writeCount] = VkDescriptorImageInfo{ .imageView = materialTextures[i].imageView, .imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL };
+			writes[writeCount] = VkWriteDescriptorSet
+			{
+				.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+				.dstSet = set,
+				.dstBinding = 1,
+				.dstArrayElement = *textureSlot,
+				.descriptorCount = 1,
+				.descriptorType = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE,
+				.pImageInfo = &imageInfos[writeCount]
+			};
+			writeCount++;
+		}
+
+		std::optional<uint32_t> const samplerSlot = samplers.acquire(materialTextures[i].sampler, isNew);
+		slots.samplers[i] = samplerSlot.value_or(noSlot);
+		if (isNew)
+		{
+			imageInfos[writeCount] = VkDescriptorImageInfo{ .sampler = materialTextures[i].sampler };
+			writes[writeCount] = VkWriteDescriptorSet
+			{
+				.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+				.dstSet = set,
+				.dstBinding = 0,
+				.dstArrayElement = *samplerSlot,
+				.descriptorCount = 1,
+				.descriptorType = VK_DESCRIPTOR_TYPE_SAMPLER,
+				.pImageInfo = &imageInfos[writeCount]
+			};
+			writeCount++;
+		}
+
+		if (!textureSlot.has_value() || !samplerSlot.has_value())
+		{
+			std::cerr << "Bindless " << (textureSlot.has_value() ? "sampler" : "texture") << " slots are full, falling back to the first slot" << std::endl;
+		}
+	}
+
+	if (writeCount > 0)
+	{
+		vkUpdateDescriptorSets(engine->device, writeCount, writes.data(), 0, nullptr);
+	}
+
+	// The first slots belong to the default material's textures, which stay loaded
+	auto const slotOrFirst = [](uint32_t const slot) { return slot == noSlot ? 0 : slot; };
+
+	static_cast<GPUBindlessTextures*>(textureBuffer.info.pMappedData)[index] = GPUBindlessTextures
+	{
+		.albedoTexture = slotOrFirst(slots.textures[0]),
+		.albedoSampler = slotOrFirst(slots.samplers[0]),
+		.normalTexture = slotOrFirst(slots.textures[1]),
+		.normalSampler = slotOrFirst(slots.samplers[1]),
+		.metalRoughAOTexture = slotOrFirst(slots.textures[2]),
+		.metalRoughAOSampler = slotOrFirst(slots.samplers[2]),
+		.pad0 = { 0, 0 }
+	};
+
+	return index;
+}
+
+void BindlessMaterials::removeMaterial(uint32_t const index)
+{
+	// The default material lives as long as the engine, and is what addMaterial hands out when full
+	if (index == 0)
+	{
+		return;
+	}
+
+	std::scoped_lock lock(mutex);
+
+	MaterialSlots const& slots = materialSlots[index];
+	for (size_t i = 0; i < slots.textures.size(); i++)
+	{
+		if (slots.textures[i] != noSlot)
+		{
+			textures.release(slots.textures[i]);
+		}
+		if (slots.samplers[i] != noSlot)
+		{
+			samplers.release(slots.samplers[i]);
+		}
+	}
+
+	if (slots.extension != noMaterialExtension)
+	{
+		freeExtensions.push_back(slots.extension);
+		extensionCount--;
+	}
+
+	freeMaterials.push_back(index);
+	materialCount--;
+}
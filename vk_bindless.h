@@ -0,0 +1,152 @@
+#pragma once
+
+#include <mutex>
+#include <unordered_map>
+
+#include "vk_types.h"
+
+class VulkanEngine;
+
+struct BindlessTexture
+{
+	VkImageView imageView;
+	VkSampler sampler;
+};
+
+// Every loaded material's constants in one storage buffer, and every image and sampler they use in one descriptor set.
+// Objects find their material through GPUObjectData::materialIndex, which every pipeline reads the constants with.
+// The bindless pipelines also bind the set once and take the material's texture and sampler slots from a second
+// buffer, so draws no longer have to be split by material. Extensions are only stored for materials that have them.
+// Images and samplers shared between materials share a slot. Slots are refcounted and reused once released.
+// Materials are added from the loading thread while the render thread draws, which the set allows since it's
+// update-after-bind and only unused slots are ever written.
+class BindlessMaterials
+{
+public:
+	void init(VulkanEngine* engine, uint32_t maxTextures, uint32_t maxSamplers, uint32_t maxMaterials, uint32_t maxExtensions);
+	void cleanup();
+
+	// Albedo, normal and metal/rough/AO. constants.extension is filled in here.
+	// Returns the material's index, or 0 (the engine's default material) when full.
+	uint32_t addMaterial(GPUMaterialConstants constants, std::optional<GPUMaterialExtension> const& extension, std::array<BindlessTexture, 3> const& textures);
+	// Only once nothing in flight draws with the material, its slots may be reused straight away
+	void removeMaterial(uint32_t index);
+
+	VkDescriptorSetLayout getLayout() const { return layout; }
+	VkDescriptorSet getSet() const { return set; }
+	VkDeviceAddress getMaterialBufferAddress() const { return materialBufferAddress; }
+	VkDeviceAddress getExtensionBufferAddress() const { return extensionBufferAddress; }
+	VkDeviceAddress getTextureBufferAddress() const { return textureBufferAddress; }
+
+	uint32_t getMaterialCount() const { std::scoped_lock lock(mutex); return materialCount; }
+	uint32_t getMaterialCapacity() const { return maxMaterials; }
+	uint32_t getTextureCount() const { std::scoped_lock lock(mutex); return textures.count; }
+	uint32_t getTextureCapacity() const { return textures.capacity; }
+	uint32_t getExtensionCount() const { std::scoped_lock lock(mutex); return extensionCount; }
+
+private:
+	// Refcounted slots of one descriptor array
+	template <typename Handle>
+	struct SlotTable
+	{
+		struct Slot
+		{
+			uint32_t index;
+			uint32_t refCount;
+		};
+
+		std::unordered_map<Handle, Slot> slots;
+		std::vector<Handle> handles; // by slot index
+		std::vector<uint32_t> freeSlots;
+		uint32_t capacity = 0;
+		uint32_t next = 0;
+		uint32_t count = 0;
+
+		void init(uint32_t slotCapacity)
+		{
+			capacity = slotCapacity;
+			handles.assign(capacity, Handle{});
+		}
+
+		// isNew is set when the slot's descriptor still has to be written
+		std::optional<uint32_t> acquire(Handle const handle, bool& isNew)
+		{
+			isNew = false;
+			if (auto const it = slots.find(handle); it != slots.end())
+			{
+				it->second.refCount++;
+				return it->second.index;
+			}
+
+			uint32_t index;
+			if (!freeSlots.empty())
+			{
+				index = freeSlots.back();
+				freeSlots.pop_back();
+			}
+			else if (next < capacity)
+			{
+				index = next++;
+			}
+			else
+			{
+				return std::nullopt;
+			}
+
+			slots[handle] = Slot{ .index = index, .refCount = 1 };
+			handles[index] = handle;
+			count++;
+			isNew = true;
+			return index;
+		}
+
+		void release(uint32_t const index)
+		{
+			auto const it = slots.find(handles[index]);
+			if (--it->second.refCount == 0)
+			{
+				slots.erase(it);
+				handles[index] = VK_NULL_HANDLE;
+				freeSlots.push_back(index);
+				count--;
+			}
+		}
+	};
+
+	static uint32_t constexpr noSlot = ~0u;
+
+	// What a material holds on to, in GPUBindlessTextures order
+	struct MaterialSlots
+	{
+		std::array<uint32_t, 3> textures;
+		std::array<uint32_t, 3> samplers;
+		uint32_t extension;
+	};
+
+	VulkanEngine* engine = nullptr;
+
+	VkDescriptorPool pool = VK_NULL_HANDLE;
+	VkDescriptorSetLayout layout = VK_NULL_HANDLE;
+	VkDescriptorSet set = VK_NULL_HANDLE;
+
+	// Persistently mapped, a material's records are written once when it's added
+	AllocatedBuffer materialBuffer{};
+	VkDeviceAddress materialBufferAddress = 0;
+	AllocatedBuffer extensionBuffer{};
+	VkDeviceAddress extensionBufferAddress = 0;
+	AllocatedBuffer textureBuffer{};
+	VkDeviceAddress textureBufferAddress = 0;
+
+	mutable std::mutex mutex;
+	SlotTable<VkImageView> textures;
+	SlotTable<VkSampler> samplers;
+	std::vector<MaterialSlots> materialSlots;
+	std::vector<uint32_t> freeMaterials;
+	uint32_t maxMaterials = 0;
+	uint32_t nextMaterial = 0;
+	uint32_t materialCount = 0;
+	std::vector<uint32_t> freeExtensions;
+	uint32_t maxExtensions = 0;
+	uint32_t nextExtension = 0;
+	uint32_t extensionCount = 0;
+};
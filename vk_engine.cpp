@@ -19,6 +19,8 @@
 
 #include <chrono>
 #include <iostream>
+#include <limits>
+#include <random>
 #include <thread>
 
 #include "glm/gtx/transform.hpp"
@@ -29,47 +31,23 @@ bool constexpr bUseValidationLayers = true;
 bool constexpr bUseValidationLayers = false;
 #endif
 
-bool is_visible(const RenderObject& obj, const glm::mat4& viewProj) {
-	std::array<glm::vec3, 8> const corners
+static GPUObjectData make_object_data(RenderObject const& object, VkDeviceAddress const vertexBuffer)
+{
+	return GPUObjectData
 	{
-		glm::vec3 { 1, 1, 1 },
-		glm::vec3 { 1, 1, -1 },
-		glm::vec3 { 1, -1, 1 },
-		glm::vec3 { 1, -1, -1 },
-		glm::vec3 { -1, 1, 1 },
-		glm::vec3 { -1, 1, -1 },
-		glm::vec3 { -1, -1, 1 },
-		glm::vec3 { -1, -1, -1 },
+		.modelMatrix = object.transform,
+		.normalMatrix = glm::transpose(glm::inverse(glm::mat3(object.transform))),
+		.vertexBuffer = vertexBuffer + object.meshData.vertexDataOffset,
+		.materialIndex = object.material->materialIndex,
+		.boundsOrigin = glm::vec4(object.bounds.origin, object.bounds.sphereRadius),
+		.boundsExtents = glm::vec4(object.bounds.extents, 0.0f),
+		.indexCount = object.meshData.indexCount,
+		.firstIndex = object.meshData.firstIndex,
+		.vertexOffset = object.meshData.vertexOffset,
+		.vertexFormat = static_cast<uint32_t>(object.meshData.vertexFormat)
 	};
-
-	glm::mat4 const matrix = viewProj * obj.transform;
-
-	glm::vec3 min = { 1.5, 1.5, 1.5 };
-	glm::vec3 max = { -1.5, -1.5, -1.5 };
-
-	for (int c = 0; c < 8; c++) {
-		// project each corner into clip space
-		glm::vec4 v = matrix * glm::vec4(obj.bounds.origin + (corners[c] * obj.bounds.extents), 1.f);
-
-		// perspective correction
-		v.x = v.x / v.w;
-		v.y = v.y / v.w;
-		v.z = v.z / v.w;
-
-		min = glm::min(glm::vec3{ v.x, v.y, v.z }, min);
-		max = glm::max(glm::vec3{ v.x, v.y, v.z }, max);
-	}
-
-	// check the clip space box is within the view
-	if (min.z > 1.f || max.z < 0.f || min.x > 1.f || max.x < -1.f || min.y > 1.f || max.y < -1.f) {
-		return false;
-	}
-	else {
-		return true;
-	}
 }
 
-
 void MeshNode::draw(glm::mat4 const& topMatrix, DrawContext& ctx)
 {
 	glm::mat4 const nodeMatrix = topMatrix * worldTransform;
@@ -81,13 +59,20 @@ void MeshNode::draw(glm::mat4 const& topMatrix, DrawContext& ctx)
 			.meshData 
 			{
 				.indexCount = s.count,
-				.firstIndex = s.startIndex,
-				.indexBuffer = mesh->meshBuffers.indexBuffer.buffer,
-				.vertexBufferAddress = mesh->meshBuffers.vertexBufferAddress
+				.firstIndex = mesh->geometry.indices.offset + s.startIndex,
+				.vertexOffset = 0,
+				.vertexDataOffset = mesh->geometry.getVertexDataOffset(),
+				.vertexFormat = mesh->geometry.vertexFormat,
+				.indexBuffer = VK_NULL_HANDLE,
+				.vertexBufferAddress = 0,
+				.firstMeshlet = mesh->geometry.meshlets.offset + s.firstMeshlet,
+				.meshletCount = s.meshletCount,
+				.lods = s.lods
 			},
 			.material = &s.material->data,
 			.bounds = s.bounds,
 			.transform = nodeMatrix,
+			.node = this
 		};
 
 		if (s.material->data.passType == MaterialPass::Transparent)
@@ -123,20 +108,38 @@ void PBRMaterial::buildPipelines(VulkanEngine* engine)
 		std::cerr << "Error when building normals fragment shader module";
 	}
 
+	VkShaderModule gBufferFragShader;
+	if (!vkUtil::load_shader_module((engine->baseAppPath + "shaders/gbuffer.frag.spv").c_str(), engine->device, &gBufferFragShader))
+	{
+		std::cerr << "Error when building G-buffer fragment shader module";
+	}
+
+	VkShaderModule depthPrepassVertShader;
+	if (!vkUtil::load_shader_module((engine->baseAppPath + "shaders/depth_prepass.vert.spv").c_str(), engine->device, &depthPrepassVertShader))
+	{
+		std::cerr << "Error when building depth pre-pass vertex shader module";
+	}
+
+	VkShaderModule depthPrepassFragShader;
+	if (!vkUtil::load_shader_module((engine->baseAppPath + "shaders/depth_prepass.frag.spv").c_str(), engine->device, &depthPrepassFragShader))
+	{
+		std::cerr << "Error when building depth pre-pass fragment shader module";
+	}
+
 	VkPushConstantRange matrixRange
 	{
 		.stageFlags = VK_SHADER_STAGE_VERTEX_BIT,
 		.offset = 0,
-		.size = sizeof(GPUDrawPushConstants)
+		.size = sizeof(GPUMeshPushConstants)
 	};
 
+	// Only the textures, material constants are read from the material buffer by materialIndex
 	DescriptorLayoutBuilder layoutBuilder;
-	layoutBuilder.addBinding(0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER);
+	layoutBuilder.addBinding(0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
 	layoutBuilder.addBinding(1, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
 	layoutBuilder.addBinding(2, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
-	layoutBuilder.addBinding(3, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
 
-	materialLayout = layoutBuilder.build(engine->device, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT);
+	materialLayout = layoutBuilder.build(engine->device, VK_SHADER_STAGE_FRAGMENT_BIT);
 
 	VkDescriptorSetLayout layouts[] = { engine->gpuSceneDataDescriptorLayout, materialLayout };
 
@@ -152,6 +155,9 @@ void PBRMaterial::buildPipelines(VulkanEngine* engine)
 	opaquePipeline.layout = newLayout;
 	transparentPipeline.layout = newLayout;
 	normalsPipeline.layout = newLayout;
+	depthPrepassPipeline.layout = newLayout;
+	opaqueDepthEqualPipeline.layout = newLayout;
+	gBufferPipeline.layout = newLayout;
 
 	PipelineBuilder pipelineBuilder;
 	pipelineBuilder.setShaders(meshVertShader, meshFragShader);
@@ -180,9 +186,155 @@ void PBRMaterial::buildPipelines(VulkanEngine* engine)
 
 	normalsPipeline.pipeline = pipelineBuilder.buildPipeline(engine->device);
 
+	pipelineBuilder.setShaders(meshVertShader, meshFragShader);
+	pipelineBuilder.enableDepthTest(false, VK_COMPARE_OP_EQUAL);
+
+	opaqueDepthEqualPipeline.pipeline = pipelineBuilder.buildPipeline(engine->device);
+
+	pipelineBuilder.setShaders(meshVertShader, gBufferFragShader);
+	pipelineBuilder.setColorAttachmentFormats(gBufferFormats);
+	pipelineBuilder.enableDepthTest(true, VK_COMPARE_OP_GREATER_OR_EQUAL);
+
+	gBufferPipeline.pipeline = pipelineBuilder.buildPipeline(engine->device);
+
+	pipelineBuilder.setColorAttachmentFormat(engine->drawImage.imageFormat);
+
+	// The color attachment stays bound through the pre-pass, it just isn't written
+	pipelineBuilder.setShaders(depthPrepassVertShader, depthPrepassFragShader);
+	pipelineBuilder.disableColorWrite();
+	pipelineBuilder.enableDepthTest(true, VK_COMPARE_OP_GREATER_OR_EQUAL);
+
+	depthPrepassPipeline.pipeline = pipelineBuilder.buildPipeline(engine->device);
+
+	pipelineBuilder.disableBlending();
+
+	{
+		// mesh.vert, lit.frag and gbuffer.frag built with BINDLESS defined, see CompileShaders.js
+		VkShaderModule bindlessVertShader;
+		if (!vkUtil::load_shader_module((engine->baseAppPath + "shaders/bindless_mesh.vert.spv").c_str(), engine->device, &bindlessVertShader))
+		{
+			std::cerr << "Error when building bindless mesh vertex shader module";
+		}
+
+		VkShaderModule bindlessFragShader;
+		if (!vkUtil::load_shader_module((engine->baseAppPath + "shaders/bindless_lit.frag.spv").c_str(), engine->device, &bindlessFragShader))
+		{
+			std::cerr << "Error when building bindless lit fragment shader module";
+		}
+
+		VkShaderModule bindlessGBufferFragShader;
+		if (!vkUtil::load_shader_module((engine->baseAppPath + "shaders/bindless_gbuffer.frag.spv").c_str(), engine->device, &bindlessGBufferFragShader))
+		{
+			std::cerr << "Error when building bindless G-buffer fragment shader module";
+		}
+
+		// The fragment shaders look their material up too
+		VkPushConstantRange const bindlessRange
+		{
+			.stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT,
+			.offset = 0,
+			.size = sizeof(GPUBindlessPushConstants)
+		};
+
+		VkDescriptorSetLayout const bindlessLayouts[] = { engine->gpuSceneDataDescriptorLayout, engine->bindlessMaterials.getLayout() };
+
+		VkPipelineLayoutCreateInfo bindlessLayoutInfo = vkInit::pipeline_layout_create_info();
+		bindlessLayoutInfo.setLayoutCount = 2;
+		bindlessLayoutInfo.pSetLayouts = bindlessLayouts;
+		bindlessLayoutInfo.pPushConstantRanges = &bindlessRange;
+		bindlessLayoutInfo.pushConstantRangeCount = 1;
+
+		VkPipelineLayout bindlessLayout;
+		VK_CHECK(vkCreatePipelineLayout(engine->device, &bindlessLayoutInfo, nullptr, &bindlessLayout));
+
+		bindlessOpaquePipeline.layout = bindlessLayout;
+		bindlessTransparentPipeline.layout = bindlessLayout;
+		bindlessGBufferPipeline.layout = bindlessLayout;
+
+		pipelineBuilder.pipelineLayout = bindlessLayout;
+		pipelineBuilder.setShaders(bindlessVertShader, bindlessFragShader);
+
+		bindlessOpaquePipeline.pipeline = pipelineBuilder.buildPipeline(engine->device);
+
+		pipelineBuilder.enableBlendingAlphaBlend();
+		pipelineBuilder.enableDepthTest(false, VK_COMPARE_OP_GREATER_OR_EQUAL);
+
+		bindlessTransparentPipeline.pipeline = pipelineBuilder.buildPipeline(engine->device);
+
+		pipelineBuilder.disableBlending();
+		pipelineBuilder.enableDepthTest(true, VK_COMPARE_OP_GREATER_OR_EQUAL);
+		pipelineBuilder.setShaders(bindlessVertShader, bindlessGBufferFragShader);
+		pipelineBuilder.setColorAttachmentFormats(gBufferFormats);
+
+		bindlessGBufferPipeline.pipeline = pipelineBuilder.buildPipeline(engine->device);
+
+		pipelineBuilder.setColorAttachmentFormat(engine->drawImage.imageFormat);
+
+		vkDestroyShaderModule(engine->device, bindlessVertShader, nullptr);
+		vkDestroyShaderModule(engine->device, bindlessFragShader, nullptr);
+		vkDestroyShaderModule(engine->device, bindlessGBufferFragShader, nullptr);
+	}
+
+	if (engine->meshShadingSupported)
+	{
+		VkShaderModule meshletTaskShader;
+		if (!vkUtil::load_shader_module((engine->baseAppPath + "shaders/meshlet.task.spv").c_str(), engine->device, &meshletTaskShader))
+		{
+			std::cerr << "Error when building meshlet task shader module";
+		}
+
+		VkShaderModule meshletMeshShader;
+		if (!vkUtil::load_shader_module((engine->baseAppPath + "shaders/meshlet.mesh.spv").c_str(), engine->device, &meshletMeshShader))
+		{
+			std::cerr << "Error when building meshlet mesh shader module";
+		}
+
+		VkPushConstantRange const meshletRange
+		{
+			.stageFlags = VK_SHADER_STAGE_TASK_BIT_EXT | VK_SHADER_STAGE_MESH_BIT_EXT,
+			.offset = 0,
+			.size = sizeof(GPUMeshletPushConstants)
+		};
+
+		VkPipelineLayoutCreateInfo meshletLayoutInfo = vkInit::pipeline_layout_create_info();
+		meshletLayoutInfo.setLayoutCount = 2;
+		meshletLayoutInfo.pSetLayouts = layouts;
+		meshletLayoutInfo.pPushConstantRanges = &meshletRange;
+		meshletLayoutInfo.pushConstantRangeCount = 1;
+
+		VkPipelineLayout meshletLayout;
+		VK_CHECK(vkCreatePipelineLayout(engine->device, &meshletLayoutInfo, nullptr, &meshletLayout));
+
+		meshletOpaquePipeline.layout = meshletLayout;
+		meshletTransparentPipeline.layout = meshletLayout;
+		meshletNormalsPipeline.layout = meshletLayout;
+
+		pipelineBuilder.pipelineLayout = meshletLayout;
+		pipelineBuilder.setMeshShaders(meshletTaskShader, meshletMeshShader, meshFragShader);
+
+		meshletOpaquePipeline.pipeline = pipelineBuilder.buildPipeline(engine->device);
+
+		pipelineBuilder.enableBlendingAlphaBlend();
+		pipelineBuilder.enableDepthTest(false, VK_COMPARE_OP_GREATER_OR_EQUAL);
+
+		meshletTransparentPipeline.pipeline = pipelineBuilder.buildPipeline(engine->device);
+
+		pipelineBuilder.disableBlending();
+		pipelineBuilder.enableDepthTest(true, VK_COMPARE_OP_GREATER_OR_EQUAL);
+		pipelineBuilder.setMeshShaders(meshletTaskShader, meshletMeshShader, normalsFragShader);
+
+		meshletNormalsPipeline.pipeline = pipelineBuilder.buildPipeline(engine->device);
+
+		vkDestroyShaderModule(engine->device, meshletTaskShader, nullptr);
+		vkDestroyShaderModule(engine->device, meshletMeshShader, nullptr);
+	}
+
 	vkDestroyShaderModule(engine->device, meshVertShader, nullptr);
 	vkDestroyShaderModule(engine->device, meshFragShader, nullptr);
 	vkDestroyShaderModule(engine->device, normalsFragShader, nullptr);
+	vkDestroyShaderModule(engine->device, gBufferFragShader, nullptr);
+	vkDestroyShaderModule(engine->device, depthPrepassVertShader, nullptr);
+	vkDestroyShaderModule(engine->device, depthPrepassFragShader, nullptr);
 }
 
 void PBRMaterial::clearResources(VkDevice device)
@@ -193,6 +345,32 @@ void PBRMaterial::clearResources(VkDevice device)
 	vkDestroyPipeline(device, normalsPipeline.pipeline, nullptr);
 	vkDestroyPipeline(device, transparentPipeline.pipeline, nullptr);
 	vkDestroyPipeline(device, opaquePipeline.pipeline, nullptr);
+	vkDestroyPipeline(device, depthPrepassPipeline.pipeline, nullptr);
+	vkDestroyPipeline(device, opaqueDepthEqualPipeline.pipeline, nullptr);
+	vkDestroyPipeline(device, gBufferPipeline.pipeline, nullptr);
+
+	vkDestroyPipelineLayout(device, bindlessOpaquePipeline.layout, nullptr);
+	vkDestroyPipeline(device, bindlessOpaquePipeline.pipeline, nullptr);
+	vkDestroyPipeline(device, bindlessTransparentPipeline.pipeline, nullptr);
+	vkDestroyPipeline(device, bindlessGBufferPipeline.pipeline, nullptr);
+
+	if (meshletOpaquePipeline.pipeline != VK_NULL_HANDLE)
+	{
+		vkDestroyPipelineLayout(device, meshletOpaquePipeline.layout, nullptr);
+
+		vkDestroyPipeline(device, meshletNormalsPipeline.pipeline, nullptr);
+		vkDestroyPipeline(device, meshletTransparentPipeline.pipeline, nullptr);
+		vkDestroyPipeline(device, meshletOpaquePipeline.pipeline, nullptr);
+	}
+}
+
+MaterialPipeline* PBRMaterial::getMeshletPipeline(MaterialPipeline const* pipeline)
+{
+	if (pipeline == &normalsPipeline)
+	{
+		return &meshletNormalsPipeline;
+	}
+	return pipeline == &transparentPipeline ? &meshletTransparentPipeline : &meshletOpaquePipeline;
 }
 
 MaterialInstance PBRMaterial::writeMaterial(VkDevice device, MaterialPass pass, MaterialResources const& resources, DescriptorAllocatorGrowable& descriptorAllocator)
@@ -210,17 +388,28 @@ MaterialInstance PBRMaterial::writeMaterial(VkDevice device, MaterialPass pass,
 
 	matData.materialSet = descriptorAllocator.allocate(device, materialLayout);
 
-	writer.clear();
-	writer.writeBuffer(0, resources.dataBuffer, sizeof(MaterialConstants), resources.dataBufferOffset, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER);
-	writer.writeImage(1, resources.albedoImage.imageView, resources.albedoSampler, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
-	writer.writeImage(2, resources.normalImage.imageView, resources.normalSampler, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
-	writer.writeImage(3, resources.metalRoughAOImage.imageView, resources.metalRoughAOSampler, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
+	// Local so materials can be written from the loading thread
+	DescriptorWriter writer;
+	writer.writeImage(0, resources.albedoImage.imageView, resources.albedoSampler, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
+	writer.writeImage(1, resources.normalImage.imageView, resources.normalSampler, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
+	writer.writeImage(2, resources.metalRoughAOImage.imageView, resources.metalRoughAOSampler, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
 
 	writer.updateSet(device, matData.materialSet);
 
 	return matData;
 }
 
+uint32_t PBRMaterial::writeBindlessMaterial(BindlessMaterials& bindlessMaterials, MaterialConstants const& constants,
+	std::optional<GPUMaterialExtension> const& extension, MaterialResources const& resources)
+{
+	return bindlessMaterials.addMaterial(constants, extension,
+		{
+			BindlessTexture{ .imageView = resources.albedoImage.imageView, .sampler = resources.albedoSampler },
+			BindlessTexture{ .imageView = resources.normalImage.imageView, .sampler = resources.normalSampler },
+			BindlessTexture{ .imageView = resources.metalRoughAOImage.imageView, .sampler = resources.metalRoughAOSampler }
+		});
+}
+
 void VulkanEngine::init()
 {
 	SDL_Init(SDL_INIT_VIDEO);
@@ -243,11 +432,24 @@ void VulkanEngine::init()
 	initCommands();
 	initSyncStructs();
 	initDescriptors();
+	initUploadArenas();
+	initBindlessMaterials();
+	initDepthPyramid();
+	initLightClusters();
+	initGBuffer();
 	// at some point when materials are scene-dependent this needs to be moved to initScene
 	initPipelines();
 	initDefaultData();
 	initImgui();
 
+	// Leave one core for the main thread, which also takes part in parallel jobs
+	unsigned int const hardwareThreads = std::thread::hardware_concurrency();
+	workerPool.init(hardwareThreads > 1 ? hardwareThreads - 1 : 1);
+	loaderPool.init(1);
+
+	// Default images and meshes have to land before the first frame
+	frameUploadValue = uploader.flush();
+
 	isInitialized = true;
 
 	mainCamera.velocity = glm::vec3(0.0f);
@@ -263,8 +465,19 @@ void VulkanEngine::cleanup()
 {
 	if (isInitialized)
 	{
+		// Lets a load in progress finish, its results are thrown away below
+		loaderPool.shutdown();
+
 		vkDeviceWaitIdle(device);
 
+		workerPool.shutdown();
+
+		pendingScene.reset();
+		if (pendingSkybox.has_value())
+		{
+			destroySkybox(*pendingSkybox);
+		}
+
 		cleanupScene();
 
 		for (unsigned int i = 0; i < FRAME_OVERLAP; i++)
@@ -296,64 +509,151 @@ void VulkanEngine::cleanup()
 
 void VulkanEngine::queueLoadScene(std::string const filePath) 
 {
-	getCurrentFrame().postFrameQueue.pushFunction([this, filePath]()
+	loadsInFlight++;
+	loaderPool.pushJob([this, filePath]()
 		{
-			// TODO make loading async and wait for just end of frame to init
-			vkQueueWaitIdle(graphicsQueue);
 			loadScene(filePath);
+			loadsInFlight--;
 		});
 }
 
 void VulkanEngine::loadScene(std::string_view const filePath)
 {
+	{
+		std::scoped_lock lock(pendingLoadMutex);
+		currentLoadName = filePath;
+	}
+
 	std::optional<std::shared_ptr<LoadedGLTF>> newScene;
 	std::filesystem::path path = filePath;
 	// REPLACE THIS LATER WITH BETTER FILE CHECKING
 	if (path.extension() == ".glb" || path.extension() == ".gltf") {
-		newScene = load_gltf(this, filePath);
+		newScene = load_gltf(this, filePath, &loadProgress);
+	}
+	else if (path.extension() == ".pscn") {
+		newScene = load_pscn(this, filePath, &loadProgress);
+	}
+	if (!newScene.has_value())
+	{
+		std::cerr << "Error when loading scene " << filePath << std::endl;
+		return;
+	}
+
+	// Waiting here keeps the render thread from ever stalling on this scene's uploads
+	uploader.wait(uploader.flush());
+
+	std::scoped_lock lock(pendingLoadMutex);
+	// A scene that was replaced before it was ever drawn can go right away
+	pendingScene = newScene;
+	pendingSceneName = path.filename().string();
+}
+
+void VulkanEngine::saveScene(std::shared_ptr<LoadedGLTF> const scene)
+{
+	if (!scene)
+	{
+		return;
+	}
+
+	// Cooking reads the source glTF again, what is already on the GPU can't be read back
+	std::filesystem::path const sourcePath = scene->sourcePath;
+	if (sourcePath.extension() != ".glb" && sourcePath.extension() != ".gltf")
+	{
+		std::cerr << "Error when saving scene: " << scene->sourcePath << " is not a glTF file" << std::endl;
+		return;
 	}
-	/*else if (path.extension() == ".pscn") {
-		newScene = load_pscn(this, filePath);
-	}*/
-	assert(newScene.has_value());
-	cleanupScene();
-	initScene(*newScene);
+
+	loaderPool.pushJob([sourcePath]()
+		{
+			std::filesystem::path pscnPath = sourcePath;
+			pscnPath.replace_extension(".pscn");
+			if (!cook_gltf(sourcePath.string(), pscnPath.string()))
+			{
+				std::cerr << "Error when cooking scene " << sourcePath << std::endl;
+			}
+		});
 }
 
 void VulkanEngine::queueLoadHDRI(std::string const filePath)
 {
-	getCurrentFrame().postFrameQueue.pushFunction([this, filePath]()
+	loadsInFlight++;
+	loaderPool.pushJob([this, filePath]()
 		{
-			// TODO make loading async and wait for just end of frame to init
-			vkQueueWaitIdle(graphicsQueue);
 			loadHDRI(filePath);
+			loadsInFlight--;
 		});
 }
 
 void VulkanEngine::loadHDRI(std::string_view const filePath)
 {
-	std::optional<Skybox> newSkyboxImage = load_cubemap_from_hdri(this, filePath);
-	assert(newSkyboxImage.has_value());
+	{
+		std::scoped_lock lock(pendingLoadMutex);
+		currentLoadName = filePath;
+	}
+
+	std::optional<Skybox> newSkybox = load_cubemap_from_hdri(this, filePath, &loadProgress);
+	if (!newSkybox.has_value())
+	{
+		std::cerr << "Error when loading HDRI " << filePath << std::endl;
+		return;
+	}
+
+	std::scoped_lock lock(pendingLoadMutex);
+	if (pendingSkybox.has_value())
+	{
+		destroySkybox(*pendingSkybox);
+	}
+	pendingSkybox = newSkybox;
+}
 
-	if (scene.skybox.environmentMap.has_value())
+void VulkanEngine::applyPendingLoads()
+{
+	std::optional<std::shared_ptr<LoadedGLTF>> newScene;
+	std::optional<Skybox> newSkybox;
 	{
-		destroyImage(*scene.skybox.environmentMap);
-		scene.skybox.environmentMap = std::nullopt;
+		std::scoped_lock lock(pendingLoadMutex);
+		newScene = std::exchange(pendingScene, std::nullopt);
+		newSkybox = std::exchange(pendingSkybox, std::nullopt);
+		if (newScene.has_value())
+		{
+			currentSceneName = pendingSceneName;
+		}
 	}
-	if (scene.skybox.irradianceMap.has_value())
+
+	if (newScene.has_value())
 	{
-		destroyImage(*scene.skybox.irradianceMap);
-		scene.skybox.irradianceMap = std::nullopt;
+		retireScene();
+		initScene(*newScene);
 	}
-	if (scene.skybox.prefilterEnvironmentMap.has_value())
+
+	if (newSkybox.has_value())
 	{
-		destroyImage(*scene.skybox.prefilterEnvironmentMap);
-		scene.skybox.prefilterEnvironmentMap = std::nullopt;
+		Skybox oldSkybox = std::exchange(scene.skybox, *newSkybox);
+		deferDestruction([this, oldSkybox]() mutable
+			{
+				destroySkybox(oldSkybox);
+			});
 	}
+}
+
+namespace
+{
+	struct DeferredCallback
+	{
+		std::function<void()> function;
+
+		~DeferredCallback() { function(); }
+	};
+}
 
-	scene.skybox.environmentMap = newSkyboxImage->environmentMap;
-	scene.skybox.irradianceMap = newSkyboxImage->irradianceMap;
-	scene.skybox.prefilterEnvironmentMap = newSkyboxImage->prefilterEnvironmentMap;
+void VulkanEngine::deferDestruction(std::function<void()>&& function)
+{
+	// Every frame's deletion queue holds a reference, so the callback runs when the last of them is flushed
+	auto const deferred = std::make_shared<DeferredCallback>(std::move(function));
+	for (FrameData& frame : frames)
+	{
+		frame.deletionQueue.pushFunction([deferred]() {});
+	}
 }
 
 void VulkanEngine::draw()
@@ -362,6 +662,7 @@ void VulkanEngine::draw()
 
 	getCurrentFrame().deletionQueue.flush();
 	getCurrentFrame().frameDescriptors.clearPools(device);
+	getCurrentFrame().uploadArena.reset();
 
 	VK_CHECK(vkResetFences(device, 1, &getCurrentFrame().renderFence));
 
@@ -398,8 +699,15 @@ void VulkanEngine::draw()
 	vkUtil::transition_image(cmd, drawImage.image, VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
 	vkUtil::transition_image(cmd, depthImage.image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL);
 
+	uploadDirtyObjects(cmd);
+	uploadDirtyLights(cmd);
+	cullGeometry(cmd);
 	drawGeometry(cmd);
 
+	stats.uploadAllocationCount = getCurrentFrame().uploadArena.getAllocationCount();
+	stats.uploadBytes = getCurrentFrame().uploadArena.getUsed();
+	stats.uploadCapacity = getCurrentFrame().uploadArena.getCapacity();
+
 	vkUtil::transition_image(cmd, drawImage.image, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL);
 	vkUtil::transition_image(cmd, swapchainImages[swapchainImageIndex], VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
 	
@@ -415,10 +723,21 @@ void VulkanEngine::draw()
 
 	VkCommandBufferSubmitInfo const cmdInfo = vkInit::command_buffer_submit_info(cmd);
 
-	VkSemaphoreSubmitInfo const waitInfo = vkInit::semaphore_submit_info(VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT_KHR, getCurrentFrame().swapchainSemaphore);
+	// Also wait for the uploads this frame reads, loads in progress on the loader thread are not waited on
+	VkSemaphoreSubmitInfo uploadWaitInfo = vkInit::semaphore_submit_info(VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT, uploader.getTimelineSemaphore());
+	uploadWaitInfo.value = frameUploadValue;
+
+	VkSemaphoreSubmitInfo const waitInfos[] =
+	{
+		vkInit::semaphore_submit_info(VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT_KHR, getCurrentFrame().swapchainSemaphore),
+		uploadWaitInfo
+	};
 	VkSemaphoreSubmitInfo const signalInfo = vkInit::semaphore_submit_info(VK_PIPELINE_STAGE_2_ALL_GRAPHICS_BIT, getCurrentFrame().renderSemaphore);
 
-	VkSubmitInfo2 const submit = vkInit::submit_info(&cmdInfo, &signalInfo, &waitInfo);
+	VkSubmitInfo2 submit = vkInit::submit_info(&cmdInfo, &signalInfo, waitInfos);
+	submit.waitSemaphoreInfoCount = uploadWaitInfo.value > 0 ? 2 : 1;
+
+	std::unique_lock queueLock(graphicsQueueMutex);
 
 	VK_CHECK(vkQueueSubmit2(graphicsQueue, 1, &submit, getCurrentFrame().renderFence));
 
@@ -438,6 +757,8 @@ void VulkanEngine::draw()
 		recreateSwapchainRequested = true;
 	}
 
+	queueLock.unlock();
+
 	frameNumber++;
 }
 
@@ -445,22 +766,46 @@ void VulkanEngine::updateScene(float const delta)
 {
 	auto const start = std::chrono::high_resolution_clock::now();
 
+	// The geometry pool grew on the loading thread, everything holding the old vertex address is rebuilt
+	if (std::vector<AllocatedBuffer> retiredGeometry = geometryPool.takeRetiredBuffers(); !retiredGeometry.empty())
+	{
+		deferDestruction([this, retiredGeometry]()
+			{
+				for (AllocatedBuffer const& buffer : retiredGeometry)
+				{
+					destroyBuffer(buffer);
+				}
+			});
+		indirectDrawInitialized = false;
+	}
+
+	// Batches for the bindless pipelines only split by pass, everything else binds one material per batch
+	bool const bindlessActive = bindlessMaterialsEnabled && cullingMode != MeshShading && !debugDrawNormals;
+	if (bindlessActive != batchesBindless)
+	{
+		indirectDrawInitialized = false;
+	}
+
 	if (!indirectDrawInitialized)
 	{
+		retireSceneBuffers();
+		batchesBindless = bindlessActive;
+
 		mainDrawContext.OpaqueSurfaces.clear();
 		mainDrawContext.TransparentSurfaces.clear();
+		dirtyObjects.clear();
 
 		if (scene.staticGeometry) 
 		{
 			scene.staticGeometry->draw(glm::mat4{ 1.0f }, mainDrawContext);
 		}
 
-		// Sort opaques by material and mesh
+		// Sort opaques by material, then by position in the geometry pool
 		std::ranges::sort(mainDrawContext.OpaqueSurfaces, [&](const auto& a, const auto& b)
 			{
 				if (a.material == b.material)
 				{
-					return a.meshData.indexBuffer < b.meshData.indexBuffer;
+					return a.meshData.firstIndex < b.meshData.firstIndex;
 				}
 				else
 				{
@@ -468,15 +813,27 @@ void VulkanEngine::updateScene(float const delta)
 				}
 			});
 
+		// Bounds are stored in draw command order: opaques, then transparents
+		cullingData.resize(mainDrawContext.OpaqueSurfaces.size() + mainDrawContext.TransparentSurfaces.size());
+		size_t boundsIdx = 0;
+		for (auto const& r : mainDrawContext.OpaqueSurfaces)
+		{
+			cullingData.setBounds(boundsIdx++, r.bounds, r.transform);
+		}
+		for (auto const& r : mainDrawContext.TransparentSurfaces)
+		{
+			cullingData.setBounds(boundsIdx++, r.bounds, r.transform);
+		}
+
 		// Make draw indirect buffer once
 
 		size_t const drawIndirectBufferSize = sizeof(VkDrawIndexedIndirectCommand) * (mainDrawContext.OpaqueSurfaces.size() + mainDrawContext.TransparentSurfaces.size());
 		if (drawIndirectBufferSize != 0)
 		{
 			drawIndirectCommandBuffer = createBuffer(drawIndirectBufferSize, VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
-			sceneDeletionQueue.pushFunction([=, this]()
+			sceneDeletionQueue.pushFunction([this, commandBuffer = drawIndirectCommandBuffer]()
 				{
-					destroyBuffer(drawIndirectCommandBuffer);
+					destroyBuffer(commandBuffer);
 				});
 
 			VkDrawIndexedIndirectCommand* drawIndirectCommands = static_cast<VkDrawIndexedIndirectCommand*>(drawIndirectCommandBuffer.allocation->GetMappedData());
@@ -486,8 +843,8 @@ void VulkanEngine::updateScene(float const delta)
 				drawIndirectCommands[cmdIdx].indexCount = r.meshData.indexCount;
 				drawIndirectCommands[cmdIdx].instanceCount = 1;
 				drawIndirectCommands[cmdIdx].firstIndex = r.meshData.firstIndex;
-				drawIndirectCommands[cmdIdx].vertexOffset = 0;
-				drawIndirectCommands[cmdIdx].firstInstance = 0;
+				drawIndirectCommands[cmdIdx].vertexOffset = r.meshData.vertexOffset;
+				drawIndirectCommands[cmdIdx].firstInstance = static_cast<uint32_t>(cmdIdx);
 				++cmdIdx;
 			}
 			for (auto const& r : mainDrawContext.TransparentSurfaces)
@@ -495,10 +852,162 @@ void VulkanEngine::updateScene(float const delta)
 				drawIndirectCommands[cmdIdx].indexCount = r.meshData.indexCount;
 				drawIndirectCommands[cmdIdx].instanceCount = 1;
 				drawIndirectCommands[cmdIdx].firstIndex = r.meshData.firstIndex;
-				drawIndirectCommands[cmdIdx].vertexOffset = 0;
-				drawIndirectCommands[cmdIdx].firstInstance = 0;
+				drawIndirectCommands[cmdIdx].vertexOffset = r.meshData.vertexOffset;
+				drawIndirectCommands[cmdIdx].firstInstance = static_cast<uint32_t>(cmdIdx);
 				++cmdIdx;
 			}
+
+			// Object data is indexed by firstInstance, so it follows the same order as the commands
+			// Consecutive objects that share a material are drawn with one multi-draw, all geometry lives in the same pool.
+			// Bindless materials are looked up per object, so only a change of pipeline starts a new batch there.
+			drawBatches.clear();
+			size_t const opaqueCount = mainDrawContext.OpaqueSurfaces.size();
+			for (size_t i = 0; i < mainDrawContext.surfaceCount(); i++)
+			{
+				RenderObject const& r = mainDrawContext.getSurface(i);
+				bool const materialChanged = !drawBatches.empty() &&
+					(batchesBindless ? drawBatches.back().material->pipeline != r.material->pipeline : drawBatches.back().material != r.material);
+				if (drawBatches.empty() || materialChanged || i == opaqueCount)
+				{
+					if (i == opaqueCount)
+					{
+						opaqueBatchCount = drawBatches.size();
+					}
+					drawBatches.push_back(DrawBatch
+						{
+							.material = r.material,
+							.firstObject = static_cast<uint32_t>(i),
+							.objectCount = 0,
+							.indexCount = 0,
+							.firstCluster = 0,
+							.clusterCount = 0
+						});
+				}
+				drawBatches.back().objectCount++;
+				drawBatches.back().indexCount += r.meshData.indexCount;
+			}
+			if (opaqueCount == mainDrawContext.surfaceCount())
+			{
+				opaqueBatchCount = drawBatches.size();
+			}
+
+			// Every meshlet of every object is a cluster, in the same batch order so a batch's visible clusters can be
+			// compacted into its own range of cluster draw commands. Each object owns indexCount indices of the
+			// per-frame cluster index buffer, which the cull shader fills with only the visible triangles.
+			std::vector<GPUCluster> clusters;
+			uint32_t clusterIndexCount = 0;
+			for (DrawBatch& batch : drawBatches)
+			{
+				batch.firstCluster = static_cast<uint32_t>(clusters.size());
+				for (uint32_t i = batch.firstObject; i < batch.firstObject + batch.objectCount; i++)
+				{
+					RenderObject const& r = mainDrawContext.getSurface(i);
+					for (uint32_t m = 0; m < r.meshData.meshletCount; m++)
+					{
+						clusters.push_back(GPUCluster
+							{
+								.objectIndex = i,
+								.meshletIndex = r.meshData.firstMeshlet + m,
+								.firstIndex = clusterIndexCount
+							});
+					}
+					clusterIndexCount += r.meshData.indexCount;
+				}
+				batch.clusterCount = static_cast<uint32_t>(clusters.size()) - batch.firstCluster;
+			}
+			clusterCount = static_cast<uint32_t>(clusters.size());
+
+			std::vector<GPUObjectData> objects;
+			objects.reserve(mainDrawContext.surfaceCount());
+			// LOD index ranges are stored after the surface in the mesh's pool allocation
+			std::vector<GPUSurfaceLod> lods;
+			objectFirstLods.assign(mainDrawContext.surfaceCount(), 0);
+			for (size_t i = 0; i < mainDrawContext.surfaceCount(); i++)
+			{
+				mainDrawContext.getSurface(i).node->objectIndices.clear();
+			}
+			for (size_t batchIdx = 0; batchIdx < drawBatches.size(); batchIdx++)
+			{
+				DrawBatch const& batch = drawBatches[batchIdx];
+				for (uint32_t i = batch.firstObject; i < batch.firstObject + batch.objectCount; i++)
+				{
+					RenderObject const& r = mainDrawContext.getSurface(i);
+					r.node->objectIndices.push_back(i);
+
+					GPUObjectData object = make_object_data(r, geometryPool.getVertexBufferAddress());
+					object.batchIndex = static_cast<uint32_t>(batchIdx);
+					object.batchFirstObject = batch.firstObject;
+					object.batchFirstCluster = batch.firstCluster;
+					object.firstLod = static_cast<uint32_t>(lods.size());
+					object.lodCount = static_cast<uint32_t>(r.meshData.lods.size());
+					objects.push_back(object);
+
+					objectFirstLods[i] = object.firstLod;
+					for (SurfaceLod const& lod : r.meshData.lods)
+					{
+						lods.push_back(GPUSurfaceLod
+							{
+								.firstIndex = r.meshData.firstIndex + lod.indexOffset,
+								.indexCount = lod.count,
+								.error = lod.error,
+								.pad0 = 0
+							});
+					}
+				}
+			}
+
+			size_t const objectBufferSize = objects.size() * sizeof(GPUObjectData);
+			objectBuffer = uploader.createBuffer(objectBufferSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT);
+			VkBufferDeviceAddressInfo const objectAddressInfo{ .sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO, .buffer = objectBuffer.buffer };
+			objectBufferAddress = vkGetBufferDeviceAddress(device, &objectAddressInfo);
+
+			uploader.uploadBuffer(objectBuffer.buffer, 0, objects.data(), objectBufferSize);
+
+			// Buffers can't be empty, a scene without meshlets still gets one of each that is never read
+			size_t const clusterBufferSize = std::max<size_t>(clusters.size(), 1) * sizeof(GPUCluster);
+			clusterBuffer = uploader.createBuffer(clusterBufferSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT);
+			VkBufferDeviceAddressInfo const clusterAddressInfo{ .sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO, .buffer = clusterBuffer.buffer };
+			clusterBufferAddress = vkGetBufferDeviceAddress(device, &clusterAddressInfo);
+
+			uploader.uploadBuffer(clusterBuffer.buffer, 0, clusters.data(), clusters.size() * sizeof(GPUCluster));
+
+			size_t const lodBufferSize = std::max<size_t>(lods.size(), 1) * sizeof(GPUSurfaceLod);
+			lodBuffer = uploader.createBuffer(lodBufferSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT);
+			VkBufferDeviceAddressInfo const lodAddressInfo{ .sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO, .buffer = lodBuffer.buffer };
+			lodBufferAddress = vkGetBufferDeviceAddress(device, &lodAddressInfo);
+
+			uploader.uploadBuffer(lodBuffer.buffer, 0, lods.data(), lods.size() * sizeof(GPUSurfaceLod));
+			frameUploadValue = uploader.flush();
+
+			drawnEarlyBuffer = createBuffer(objects.size() * sizeof(uint32_t), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT, VMA_MEMORY_USAGE_GPU_ONLY);
+			VkBufferDeviceAddressInfo const drawnEarlyAddressInfo{ .sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO, .buffer = drawnEarlyBuffer.buffer };
+			drawnEarlyBufferAddress = vkGetBufferDeviceAddress(device, &drawnEarlyAddressInfo);
+
+			for (FrameData& frame : frames)
+			{
+				// The late occlusion pass writes its own commands and counts after the early pass's
+				frame.drawCommandBuffer = createBuffer(drawIndirectBufferSize * 2, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT, VMA_MEMORY_USAGE_GPU_ONLY);
+				frame.visibleCommandBuffer = createBuffer(drawIndirectBufferSize, VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
+				frame.drawCountBuffer = createBuffer(sizeof(GPUDrawCountHeader) + drawBatches.size() * 2 * sizeof(uint32_t), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT, VMA_MEMORY_USAGE_GPU_ONLY);
+				frame.cullStatsBuffer = createBuffer(sizeof(GPUDrawCountHeader), VK_BUFFER_USAGE_TRANSFER_DST_BIT, VMA_MEMORY_USAGE_GPU_TO_CPU);
+				memset(frame.cullStatsBuffer.allocation->GetMappedData(), 0, sizeof(GPUDrawCountHeader));
+				frame.clusterCommandBuffer = createBuffer(std::max<size_t>(clusters.size(), 1) * sizeof(VkDrawIndexedIndirectCommand), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT, VMA_MEMORY_USAGE_GPU_ONLY);
+				frame.clusterIndexBuffer = createBuffer(std::max<size_t>(clusterIndexCount, 1) * sizeof(uint32_t), VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT, VMA_MEMORY_USAGE_GPU_ONLY);
+			}
+
+			// Captured by value, the members are replaced when the scene is rebuilt before these are destroyed
+			std::vector<AllocatedBuffer> sceneBuffers{ objectBuffer, clusterBuffer, lodBuffer, drawnEarlyBuffer };
+			for (FrameData const& frame : frames)
+			{
+				sceneBuffers.insert(sceneBuffers.end(), { frame.drawCommandBuffer, frame.visibleCommandBuffer, frame.drawCountBuffer, frame.cullStatsBuffer, frame.clusterCommandBuffer, frame.clusterIndexBuffer });
+			}
+			sceneDeletionQueue.pushFunction([this, sceneBuffers]()
+				{
+					for (AllocatedBuffer const& buffer : sceneBuffers)
+					{
+						destroyBuffer(buffer);
+					}
+				});
 		}
 		
 		indirectDrawInitialized = true;
@@ -524,9 +1033,39 @@ void VulkanEngine::updateScene(float const delta)
 	sceneData.viewProj = sceneData.proj * sceneData.view;
 	sceneData.cullViewProj = sceneData.proj * mainCamView;
 
+	sceneData.materials = bindlessMaterials.getMaterialBufferAddress();
+	sceneData.materialExtensions = bindlessMaterials.getExtensionBufferAddress();
+
 	auto const end = std::chrono::high_resolution_clock::now();
 	auto const elapsed = std::chrono::duration_cast<std::chrono::microseconds>(end - start);
-	stats.meshDrawTime = static_cast<float>(elapsed.count()) / 1000.0f;
+	stats.sceneUpdateTime = static_cast<float>(elapsed.count()) / 1000.0f;
+}
+
+void VulkanEngine::updateNodeTransform(Node& node, glm::mat4 const& localTransform)
+{
+	node.localTransform = localTransform;
+	std::shared_ptr<Node> const parent = node.parent.lock();
+	node.refreshTransform(parent ? parent->worldTransform : glm::mat4{ 1.0f });
+
+	// Static geometry is drawn with an identity top matrix, so object transforms are just world transforms
+	std::function<void(Node&)> markDirty = [&](Node& n)
+	{
+		if (MeshNode* meshNode = dynamic_cast<MeshNode*>(&n))
+		{
+			for (uint32_t const objectIdx : meshNode->objectIndices)
+			{
+				RenderObject& r = mainDrawContext.getSurface(objectIdx);
+				r.transform = meshNode->worldTransform;
+				cullingData.setBounds(objectIdx, r.bounds, r.transform);
+				dirtyObjects.push_back(objectIdx);
+			}
+		}
+		for (auto const& c : n.children)
+		{
+			markDirty(*c);
+		}
+	};
+	markDirty(node);
 }
 
 static void SDLCALL openSceneFile(void* userData, char const* const* fileList, int filter)
@@ -637,9 +1176,16 @@ void VulkanEngine::run()
 			ImGui::Text("%f fps", static_cast<double>(stats.fps));
 			ImGui::Text("frame time %f ms", static_cast<double>(stats.frameTime));
 			ImGui::Text("draw time %f ms", static_cast<double>(stats.meshDrawTime));
+			ImGui::Text("skybox time %f ms", static_cast<double>(stats.skyboxDrawTime));
 			ImGui::Text("update time %f ms", static_cast<double>(stats.sceneUpdateTime));
-			ImGui::Text("triangles %i", stats.triangleCount);
-			ImGui::Text("draws %i", stats.drawCallCount);
+			ImGui::Text("triangles %i (%i saved by LOD)", stats.triangleCount, stats.lodSavedTriangleCount);
+			ImGui::Text("draws %i for %i surfaces", stats.drawCallCount, stats.surfaceCount);
+			ImGui::Text("occluded %i", stats.occludedCount);
+			ImGui::Text("uploads %u, %zu / %zu KiB", stats.uploadAllocationCount, stats.uploadBytes / 1024, stats.uploadCapacity / 1024);
+			ImGui::Text("geometry pool %zu / %zu KiB vertices, %u / %u indices, %u meshlets", geometryPool.getVertexDataUsed() / 1024, geometryPool.getVertexDataCapacity() / 1024, geometryPool.getIndicesUsed(), geometryPool.getIndexCapacity(), geometryPool.getMeshletsUsed());
+			ImGui::Text("cull time %f ms", static_cast<double>(stats.cullTime));
+			ImGui::Text("materials %u / %u (%u extended), %u / %u textures", bindlessMaterials.getMaterialCount(), bindlessMaterials.getMaterialCapacity(), bindlessMaterials.getExtensionCount(), bindlessMaterials.getTextureCount(), bindlessMaterials.getTextureCapacity());
+			ImGui::Text("visible %i, culled %i%s", stats.visibleCount, stats.culledCount, cullingMode == ClusterCulling || cullingMode == MeshShading ? " meshlets" : "");
 		}
 		ImGui::End();
 
@@ -668,6 +1214,20 @@ void VulkanEngine::run()
 		{
 			ImGui::SliderFloat("Render Scale", &renderScale, 0.3f, 1.0f);
 
+			int cullingModeInt = cullingMode;
+			ImGui::Combo("Culling", &cullingModeInt, meshShadingSupported ? "None\0CPU\0GPU\0GPU Meshlets\0Mesh Shaders\0" : "None\0CPU\0GPU\0GPU Meshlets\0");
+			cullingMode = static_cast<CullingMode>(cullingModeInt);
+
+			ImGui::Checkbox("Occlusion Culling (GPU)", &occlusionCulling);
+			ImGui::Checkbox("Depth Pre-pass", &depthPrepass);
+			ImGui::Checkbox("Bindless Materials", &bindlessMaterialsEnabled);
+
+			int renderPathInt = renderPath;
+			ImGui::Combo("Render Path", &renderPathInt, "Forward\0Deferred\0");
+			renderPath = static_cast<RenderPath>(renderPathInt);
+			ImGui::Checkbox("LOD", &lodEnabled);
+			ImGui::SliderFloat("LOD Error (px)", &lodErrorPixels, 0.25f, 8.0f);
+
 			bool newVSyncEnabled;
 			ImGui::Checkbox("VSync Enabled", &newVSyncEnabled);
 			if (newVSyncEnabled != vSyncEnabled)
@@ -698,15 +1258,41 @@ void VulkanEngine::run()
 		
 		if (ImGui::Begin("Scene"))
 		{
-			ImGui::Text("Current scene: %s", "default");
+			ImGui::Text("Current scene: %s", currentSceneName.c_str());
+			if (loadsInFlight > 0)
+			{
+				std::string loadName;
+				{
+					std::scoped_lock lock(pendingLoadMutex);
+					loadName = std::filesystem::path(currentLoadName).filename().string();
+				}
+				ImGui::Text("Loading %s: %s", loadName.c_str(), loadProgress.stage.load());
+				ImGui::ProgressBar(loadProgress.fraction);
+			}
 			if (ImGui::Button("Open Scene File"))
 			{
 				static const SDL_DialogFileFilter dialogFileFilters[] = {
-					{ "GLTF files",  "gltf;glb" }
+					{ "Scene files",  "gltf;glb;pscn" }
 				};
 				SDL_ShowOpenFileDialog(openSceneFile, this, nullptr, dialogFileFilters, 1, baseAppPath.c_str(), false);
 			}
 
+			bool optimize = optimizeMeshes;
+			if (ImGui::Checkbox("Optimize Meshes On Load", &optimize))
+			{
+				optimizeMeshes = optimize;
+			}
+			bool lods = generateLods;
+			if (ImGui::Checkbox("Generate LODs On Load", &lods))
+			{
+				generateLods = lods;
+			}
+
+			if (scene.staticGeometry && ImGui::Button("Cook Scene"))
+			{
+				saveScene(scene.staticGeometry);
+			}
+
 			if (ImGui::Button("Open HDRI"))
 			{
 				static const SDL_DialogFileFilter dialogFileFilters[] = {
@@ -715,19 +1301,47 @@ void VulkanEngine::run()
 				SDL_ShowOpenFileDialog(openHDRIFile, this, nullptr, dialogFileFilters, 1, baseAppPath.c_str(), false);
 			}
 
+			if (scene.staticGeometry && ImGui::BeginCombo("Node", selectedNodeName.empty() ? "None" : selectedNodeName.c_str()))
+			{
+				for (auto const& [name, node] : scene.staticGeometry->nodes)
+				{
+					if (ImGui::Selectable(name.c_str(), name == selectedNodeName))
+					{
+						selectedNodeName = name;
+					}
+				}
+				ImGui::EndCombo();
+			}
+			if (scene.staticGeometry)
+			{
+				if (auto const it = scene.staticGeometry->nodes.find(selectedNodeName); it != scene.staticGeometry->nodes.end())
+				{
+					// Only the moved node's objects are re-uploaded, the draw batches stay as they are
+					Node& node = *it->second;
+					float newNodePos[] = { node.localTransform[3].x, node.localTransform[3].y, node.localTransform[3].z };
+					if (ImGui::DragFloat3("Node Position", newNodePos, 0.05f))
+					{
+						glm::mat4 localTransform = node.localTransform;
+						localTransform[3] = glm::vec4(newNodePos[0], newNodePos[1], newNodePos[2], 1.0f);
+						updateNodeTransform(node, localTransform);
+					}
+				}
+			}
+
 			if (!scene.directionalLights.empty())
 			{
 				float newSunColor[] = { scene.directionalLights[0].color.r, scene.directionalLights[0].color.g, scene.directionalLights[0].color.b};
 				if (ImGui::ColorPicker3("Sun Color", newSunColor))
 				{
-					scene.directionalLights[0].color = glm::vec3(newSunColor[0], newSunColor[1], newSunColor[2]);
+					scene.directionalLights.edit(0).color = glm::vec3(newSunColor[0], newSunColor[1], newSunColor[2]);
 				}
 
 				float newSunDir[] = { scene.directionalLights[0].direction.x, scene.directionalLights[0].direction.y, scene.directionalLights[0].direction.z, scene.directionalLights[0].intensity };
 				if (ImGui::InputFloat4("Sun Direction", newSunDir))
 				{
-					scene.directionalLights[0].direction = glm::vec3(newSunDir[0], newSunDir[1], newSunDir[2]);
-					scene.directionalLights[0].intensity = newSunDir[3];
+					DirectionalLight& sun = scene.directionalLights.edit(0);
+					sun.direction = glm::vec3(newSunDir[0], newSunDir[1], newSunDir[2]);
+					sun.intensity = newSunDir[3];
 				}
 			}
 
@@ -736,28 +1350,43 @@ void VulkanEngine::run()
 				float newPlColor[] = { scene.pointLights[0].color.r, scene.pointLights[0].color.g, scene.pointLights[0].color.b };
 				if (ImGui::ColorPicker3("Point Light Color", newPlColor))
 				{
-					scene.pointLights[0].color = glm::vec3(newPlColor[0], newPlColor[1], newPlColor[2]);
+					scene.pointLights.edit(0).color = glm::vec3(newPlColor[0], newPlColor[1], newPlColor[2]);
 				}
 
 				float newPlPos[] = { scene.pointLights[0].position.x, scene.pointLights[0].position.y, scene.pointLights[0].position.z };
 				if (ImGui::InputFloat3("Point Light Position", newPlPos))
 				{
-					scene.pointLights[0].position = glm::vec3(newPlPos[0], newPlPos[1], newPlPos[2]);
+					scene.pointLights.edit(0).position = glm::vec3(newPlPos[0], newPlPos[1], newPlPos[2]);
 				}
 
 				float newPlParam[] = { scene.pointLights[0].constant, scene.pointLights[0].linear, scene.pointLights[0].quadratic };
 				if (ImGui::InputFloat3("Constant/Linear/Quadratic", newPlParam))
 				{
-					scene.pointLights[0].constant = newPlParam[0];
-					scene.pointLights[0].linear = newPlParam[1];
-					scene.pointLights[0].quadratic = newPlParam[2];
+					PointLight& pl = scene.pointLights.edit(0);
+					pl.constant = newPlParam[0];
+					pl.linear = newPlParam[1];
+					pl.quadratic = newPlParam[2];
 				}
 			}
+
+			ImGui::Text("Point lights: %zu (%zu spawned)", scene.pointLights.size(), spawnedBenchmarkLights);
+			ImGui::InputInt("Benchmark Lights", &benchmarkLightCount);
+			benchmarkLightCount = std::max(benchmarkLightCount, 0);
+			if (ImGui::Button("Spawn Benchmark Lights"))
+			{
+				spawnBenchmarkLights(benchmarkLightCount);
+			}
+			if (spawnedBenchmarkLights > 0 && ImGui::Button("Remove Benchmark Lights"))
+			{
+				removeBenchmarkLights();
+			}
 		}
 		ImGui::End();
 
 		ImGui::Render();
 
+		applyPendingLoads();
+
 		updateScene(elapsed);
 
 		draw();
@@ -766,8 +1395,13 @@ void VulkanEngine::run()
 	}
 }
 
-void VulkanEngine::immediateSubmit(std::function<void(VkCommandBuffer cmd)>&& function) const
+void VulkanEngine::immediateSubmit(std::function<void(VkCommandBuffer cmd)>&& function)
 {
+	std::scoped_lock lock(immediateSubmitMutex);
+
+	// Work recorded here usually reads something that was just handed to the uploader
+	uint64_t const uploadValue = uploader.flush();
+
 	VK_CHECK(vkResetFences(device, 1, &immFence));
 	VK_CHECK(vkResetCommandBuffer(immCommandBuffer, 0));
 
@@ -782,9 +1416,14 @@ void VulkanEngine::immediateSubmit(std::function<void(VkCommandBuffer cmd)>&& fu
 	VK_CHECK(vkEndCommandBuffer(cmd));
 
 	VkCommandBufferSubmitInfo const cmdInfo = vkInit::command_buffer_submit_info(cmd);
-	VkSubmitInfo2 const submit = vkInit::submit_info(&cmdInfo, nullptr, nullptr);
+	VkSemaphoreSubmitInfo uploadWaitInfo = vkInit::semaphore_submit_info(VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT, uploader.getTimelineSemaphore());
+	uploadWaitInfo.value = uploadValue;
+	VkSubmitInfo2 const submit = vkInit::submit_info(&cmdInfo, nullptr, uploadValue > 0 ? &uploadWaitInfo : nullptr);
 
-	VK_CHECK(vkQueueSubmit2(graphicsQueue, 1, &submit, immFence));
+	{
+		std::scoped_lock queueLock(graphicsQueueMutex);
+		VK_CHECK(vkQueueSubmit2(graphicsQueue, 1, &submit, immFence));
+	}
 
 	VK_CHECK(vkWaitForFences(device, 1, &immFence, true, 9999999999));
 }
@@ -856,27 +1495,122 @@ void VulkanEngine::initScene(std::shared_ptr<LoadedGLTF> const newScene)
 void VulkanEngine::cleanupScene() 
 {
 	sceneDeletionQueue.flush();
-	if (scene.skybox.environmentMap.has_value())
+	destroySkybox(scene.skybox);
+	scene.directionalLights.clear();
+	scene.pointLights.clear();
+	scene.spotLights.clear();
+	spawnedBenchmarkLights = 0;
+
+	scene.staticGeometry = nullptr;
+	indirectDrawInitialized = false;
+	cullingData.clear();
+	visibleDraws.clear();
+	drawBatches.clear();
+	batchDrawCounts.clear();
+	objectFirstLods.clear();
+	opaqueBatchCount = 0;
+	clusterCount = 0;
+}
+
+void VulkanEngine::retireScene()
+{
+	// Frames in flight may still draw the old scene, so its resources go through deferDestruction.
+	// The skybox stays, it is loaded separately from the scene.
+	retireSceneBuffers();
+	deferDestruction([oldGeometry = std::move(scene.staticGeometry)]() {});
+	scene.staticGeometry = nullptr;
+
+	scene.directionalLights.clear();
+	scene.pointLights.clear();
+	scene.spotLights.clear();
+	spawnedBenchmarkLights = 0;
+
+	indirectDrawInitialized = false;
+	cullingData.clear();
+	visibleDraws.clear();
+	drawBatches.clear();
+	batchDrawCounts.clear();
+	objectFirstLods.clear();
+	opaqueBatchCount = 0;
+	clusterCount = 0;
+}
+
+void VulkanEngine::spawnBenchmarkLights(int const count)
+{
+	// Spread through the scene's bounds, or around the camera when there's nothing loaded
+	glm::vec3 boundsMin = mainCamera.position - glm::vec3(20.0f);
+	glm::vec3 boundsMax = mainCamera.position + glm::vec3(20.0f);
+	if (cullingData.size() > 0)
+	{
+		boundsMin = glm::vec3(std::numeric_limits<float>::max());
+		boundsMax = glm::vec3(std::numeric_limits<float>::lowest());
+		for (size_t i = 0; i < cullingData.size(); i++)
+		{
+			glm::vec3 const center = { cullingData.centerX[i], cullingData.centerY[i], cullingData.centerZ[i] };
+			glm::vec3 const extent = { cullingData.extentX[i], cullingData.extentY[i], cullingData.extentZ[i] };
+			boundsMin = glm::min(boundsMin, center - extent);
+			boundsMax = glm::max(boundsMax, center + extent);
+		}
+	}
+
+	// Seeded by how many are already out, so the same counts give the same layout between runs
+	std::mt19937 rng(static_cast<uint32_t>(spawnedBenchmarkLights));
+	std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+
+	for (int i = 0; i < count; i++)
 	{
-		destroyImage(*scene.skybox.environmentMap);
-		scene.skybox.environmentMap = std::nullopt;
+		PointLight pl;
+		pl.position = glm::mix(boundsMin, boundsMax, glm::vec3(unit(rng), unit(rng), unit(rng)));
+		pl.color = glm::vec3(unit(rng), unit(rng), unit(rng));
+		// Short range, a few units at most, so each one only touches a handful of tiles
+		pl.constant = 1.0f;
+		pl.linear = 0.7f;
+		pl.quadratic = 1.8f;
+		scene.pointLights.push_back(pl);
 	}
-	if (scene.skybox.irradianceMap.has_value())
+	spawnedBenchmarkLights += count;
+}
+
+void VulkanEngine::removeBenchmarkLights()
+{
+	// PointLight's padding is const, so the lights are popped rather than erased
+	for (; spawnedBenchmarkLights > 0 && !scene.pointLights.empty(); spawnedBenchmarkLights--)
 	{
-		destroyImage(*scene.skybox.irradianceMap);
-		scene.skybox.irradianceMap = std::nullopt;
+		scene.pointLights.pop_back();
 	}
-	if (scene.skybox.prefilterEnvironmentMap.has_value())
+	spawnedBenchmarkLights = 0;
+}
+
+void VulkanEngine::retireSceneBuffers()
+{
+	if (sceneDeletionQueue.functions.empty())
 	{
-		destroyImage(*scene.skybox.prefilterEnvironmentMap);
-		scene.skybox.prefilterEnvironmentMap = std::nullopt;
+		return;
 	}
-	scene.directionalLights.clear();
-	scene.pointLights.clear();
-	scene.spotLights.clear();
 
-	scene.staticGeometry = nullptr;
-	indirectDrawInitialized = false;
+	deferDestruction([oldSceneQueue = std::exchange(sceneDeletionQueue, {})]() mutable
+		{
+			oldSceneQueue.flush();
+		});
+}
+
+void VulkanEngine::destroySkybox(Skybox& skybox) const
+{
+	if (skybox.environmentMap.has_value())
+	{
+		destroyImage(*skybox.environmentMap);
+		skybox.environmentMap = std::nullopt;
+	}
+	if (skybox.irradianceMap.has_value())
+	{
+		destroyImage(*skybox.irradianceMap);
+		skybox.irradianceMap = std::nullopt;
+	}
+	if (skybox.prefilterEnvironmentMap.has_value())
+	{
+		destroyImage(*skybox.prefilterEnvironmentMap);
+		skybox.prefilterEnvironmentMap = std::nullopt;
+	}
 }
 
 void VulkanEngine::initVulkan()
@@ -902,14 +1636,25 @@ void VulkanEngine::initVulkan()
 		.dynamicRendering = true
 	};
 
+	// The descriptor indexing features are what BindlessMaterials' set needs
 	VkPhysicalDeviceVulkan12Features features12
 	{
+		.drawIndirectCount = true,
 		.descriptorIndexing = true,
+		.shaderSampledImageArrayNonUniformIndexing = true,
+		.descriptorBindingSampledImageUpdateAfterBind = true,
+		.descriptorBindingUpdateUnusedWhilePending = true,
+		.descriptorBindingPartiallyBound = true,
+		.descriptorBindingVariableDescriptorCount = true,
+		.runtimeDescriptorArray = true,
+		.timelineSemaphore = true,
 		.bufferDeviceAddress = true
 	};
 
 	VkPhysicalDeviceFeatures features
 	{
+		.multiDrawIndirect = VK_TRUE,
+		.drawIndirectFirstInstance = VK_TRUE,
 		.samplerAnisotropy = VK_TRUE
 	};
 
@@ -923,16 +1668,62 @@ void VulkanEngine::initVulkan()
 		.select()
 		.value();
 
+	// Optional, without it the meshlets are drawn through the cluster cull compute pass
+	VkPhysicalDeviceMeshShaderFeaturesEXT meshShaderFeatures{ .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MESH_SHADER_FEATURES_EXT };
+	if (physicalDevice.enable_extension_if_present(VK_EXT_MESH_SHADER_EXTENSION_NAME))
+	{
+		VkPhysicalDeviceFeatures2 supportedFeatures{ .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2, .pNext = &meshShaderFeatures };
+		vkGetPhysicalDeviceFeatures2(physicalDevice.physical_device, &supportedFeatures);
+		meshShadingSupported = meshShaderFeatures.taskShader && meshShaderFeatures.meshShader;
+
+		// Only what the meshlet pipelines use
+		meshShaderFeatures =
+		{
+			.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MESH_SHADER_FEATURES_EXT,
+			.taskShader = VK_TRUE,
+			.meshShader = VK_TRUE
+		};
+	}
+
+	// The selector only carries over required features, so optional core ones are added to the selected device
+	VkPhysicalDeviceFeatures supportedCoreFeatures;
+	vkGetPhysicalDeviceFeatures(physicalDevice.physical_device, &supportedCoreFeatures);
+	textureCompressionBCSupported = supportedCoreFeatures.textureCompressionBC;
+	physicalDevice.features.textureCompressionBC = supportedCoreFeatures.textureCompressionBC;
+
 	vkb::DeviceBuilder deviceBuilder{ physicalDevice };
+	if (meshShadingSupported)
+	{
+		deviceBuilder.add_pNext(&meshShaderFeatures);
+	}
 
 	vkb::Device vkbDevice = deviceBuilder.build().value();
 
 	device = vkbDevice.device;
 	selectedGPU = physicalDevice.physical_device;
 
+	if (meshShadingSupported)
+	{
+		cmdDrawMeshTasks = reinterpret_cast<PFN_vkCmdDrawMeshTasksEXT>(vkGetDeviceProcAddr(device, "vkCmdDrawMeshTasksEXT"));
+	}
+	std::cout << "Mesh shaders " << (meshShadingSupported ? "supported" : "not supported, meshlets use the cluster cull pass") << "." << std::endl;
+	std::cout << "BC textures " << (textureCompressionBCSupported ? "supported" : "not supported, glTF textures are decoded to RGBA8") << "." << std::endl;
+
 	graphicsQueue = vkbDevice.get_queue(vkb::QueueType::graphics).value();
 	graphicsQueueFamily = vkbDevice.get_queue_index(vkb::QueueType::graphics).value();
 
+	// A transfer-only family maps to the copy engines, so uploads don't queue up behind frame work
+	if (auto const dedicatedTransfer = vkbDevice.get_dedicated_queue(vkb::QueueType::transfer); dedicatedTransfer.has_value())
+	{
+		transferQueue = dedicatedTransfer.value();
+		transferQueueFamily = vkbDevice.get_dedicated_queue_index(vkb::QueueType::transfer).value();
+	}
+	else
+	{
+		transferQueue = graphicsQueue;
+		transferQueueFamily = graphicsQueueFamily;
+	}
+
 	VmaAllocatorCreateInfo const allocatorInfo
 	{
 		.flags = VMA_ALLOCATOR_CREATE_BUFFER_DEVICE_ADDRESS_BIT,
@@ -998,6 +1789,7 @@ void VulkanEngine::initSwapchain()
 	depthImage.imageExtent = drawImageExtent;
 	VkImageUsageFlags depthImageUsages{};
 	depthImageUsages |= VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT;
+	depthImageUsages |= VK_IMAGE_USAGE_SAMPLED_BIT;
 
 	VkImageCreateInfo const dImgCreateInfo = vkInit::image_create_info(depthImage.imageFormat, depthImageUsages, drawImageExtent);
 
@@ -1040,6 +1832,13 @@ void VulkanEngine::initCommands()
 	{
 		vkDestroyCommandPool(device, immCommandPool, nullptr);
 	});
+
+	uploader.init(this, transferQueue, transferQueueFamily, 64 * 1024 * 1024);
+
+	mainDeletionQueue.pushFunction([this]()
+	{
+		uploader.cleanup();
+	});
 }
 
 void VulkanEngine::initSyncStructs()
@@ -1061,7 +1860,7 @@ void VulkanEngine::initSyncStructs()
 
 void VulkanEngine::initDescriptors()
 {
-	std::vector<DescriptorAllocatorGrowable::PoolSizeRatio> sizes = { {VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 1}, {VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 3} };
+	std::vector<DescriptorAllocatorGrowable::PoolSizeRatio> sizes = { {VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 1}, {VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 3}, {VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1} };
 
 	globalDescriptorAllocator.init(device, 10, sizes);
 
@@ -1078,7 +1877,8 @@ void VulkanEngine::initDescriptors()
 		builder.addBinding(3, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
 		builder.addBinding(4, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
 		builder.addBinding(5, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
-		gpuSceneDataDescriptorLayout = builder.build(device, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT);
+		VkShaderStageFlags const meshStage = meshShadingSupported ? VK_SHADER_STAGE_MESH_BIT_EXT : 0;
+		gpuSceneDataDescriptorLayout = builder.build(device, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT | meshStage);
 	}
 	{
 		/*DescriptorLayoutBuilder builder;
@@ -1118,12 +1918,52 @@ void VulkanEngine::initDescriptors()
 	});
 }
 
+void VulkanEngine::initUploadArenas()
+{
+	VkPhysicalDeviceProperties properties;
+	vkGetPhysicalDeviceProperties(selectedGPU, &properties);
+
+	// Buffer references to the light and cull structs want 16 byte alignment whatever the device limits are
+	VkDeviceSize const alignment = std::max({ properties.limits.minUniformBufferOffsetAlignment, properties.limits.minStorageBufferOffsetAlignment, VkDeviceSize{ 16 } });
+
+	for (unsigned int i = 0; i < FRAME_OVERLAP; i++)
+	{
+		// Grows if a frame needs more, e.g. with many lights
+		frames[i].uploadArena.init(this, 1 << 20, alignment);
+	}
+
+	mainDeletionQueue.pushFunction([this]()
+		{
+			for (unsigned int i = 0; i < FRAME_OVERLAP; i++)
+			{
+				frames[i].uploadArena.cleanup();
+			}
+		});
+}
+
+void VulkanEngine::initBindlessMaterials()
+{
+	// Clamped to the device's update-after-bind limits. Few materials need an extension.
+	bindlessMaterials.init(this, 1 << 12, 64, 1 << 12, 1 << 10);
+
+	mainDeletionQueue.pushFunction([this]()
+		{
+			bindlessMaterials.cleanup();
+		});
+}
+
 void VulkanEngine::initPipelines()
 {
 	//initBackgroundPipelines();
 
 	pbrMaterial.buildPipelines(this);
 
+	initCullPipeline();
+	initClusterCullPipeline();
+	initDepthPyramidPipeline();
+	initLightCullPipeline();
+	initDeferredPipelines();
+	initSkyboxPipeline();
 	initDebugPipelines();
 }
 
@@ -1214,110 +2054,662 @@ void VulkanEngine::initBackgroundPipelines()
 	});
 }
 
-void VulkanEngine::initDebugPipelines()
+void VulkanEngine::initCullPipeline()
 {
-	VkShaderModule defaultVertShader;
-	if (!vkUtil::load_shader_module((baseAppPath + "shaders/default.vert.spv").c_str(), device, &defaultVertShader))
+	VkPushConstantRange constexpr pushConstant
 	{
-		std::cerr << "Error when building default vertex shader module";
-	}
+		.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+		.offset = 0,
+		.size = sizeof(GPUCullPushConstants)
+	};
 
-	VkShaderModule defaultFragShader;
-	if (!vkUtil::load_shader_module((baseAppPath + "shaders/default.frag.spv").c_str(), device, &defaultFragShader))
+	VkPipelineLayoutCreateInfo const cullLayout
 	{
-		std::cerr << "Error when building default fragment shader module";
+		.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+		.pNext = nullptr,
+		.setLayoutCount = 1,
+		.pSetLayouts = &depthPyramidDescriptorLayout,
+		.pushConstantRangeCount = 1,
+		.pPushConstantRanges = &pushConstant
+	};
+	VK_CHECK(vkCreatePipelineLayout(device, &cullLayout, nullptr, &cullPipelineLayout));
+
+	VkShaderModule cullShader;
+	if (!vkUtil::load_shader_module((baseAppPath + "shaders/cull.comp.spv").c_str(), device, &cullShader))
+	{
+		std::cerr << "Error when building the cull compute shader module\n";
 	}
 
-	VkPushConstantRange matrixRange
+	VkComputePipelineCreateInfo const computePipelineCreateInfo
 	{
-		.stageFlags = VK_SHADER_STAGE_VERTEX_BIT,
-		.offset = 0,
-		.size = sizeof(GPUDrawPushConstants)
+		.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO,
+		.pNext = nullptr,
+		.stage
+		{
+			.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+			.pNext = nullptr,
+			.stage = VK_SHADER_STAGE_COMPUTE_BIT,
+			.module = cullShader,
+			.pName = "main"
+		},
+		.layout = cullPipelineLayout
 	};
+	VK_CHECK(vkCreateComputePipelines(device, VK_NULL_HANDLE, 1, &computePipelineCreateInfo, nullptr, &cullPipeline));
 
-	DescriptorLayoutBuilder layoutBuilder;
-	layoutBuilder.addBinding(0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER);
-
-	defaultDescriptorLayout = layoutBuilder.build(device, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT);
-
-	VkDescriptorSetLayout layouts[] = { gpuSceneDataDescriptorLayout, defaultDescriptorLayout };
-
-	VkPipelineLayoutCreateInfo defaultLayoutInfo = vkInit::pipeline_layout_create_info();
-	defaultLayoutInfo.setLayoutCount = 2;
-	defaultLayoutInfo.pSetLayouts = layouts;
-	defaultLayoutInfo.pPushConstantRanges = &matrixRange;
-	defaultLayoutInfo.pushConstantRangeCount = 1;
-
-	VkPipelineLayout newLayout;
-	VK_CHECK(vkCreatePipelineLayout(device, &defaultLayoutInfo, nullptr, &newLayout));
+	vkDestroyShaderModule(device, cullShader, nullptr);
 
-	defaultPipeline.layout = newLayout;
+	mainDeletionQueue.pushFunction([&]()
+		{
+			vkDestroyPipelineLayout(device, cullPipelineLayout, nullptr);
+			vkDestroyPipeline(device, cullPipeline, nullptr);
+		});
+}
 
-	PipelineBuilder pipelineBuilder;
-	pipelineBuilder.setShaders(defaultVertShader, defaultFragShader);
-	pipelineBuilder.setInputTopology(VK_PRIMITIVE_TOPOLOGY_LINE_LIST);
-	pipelineBuilder.setPolygonMode(VK_POLYGON_MODE_FILL);
-	pipelineBuilder.setCullMode(VK_CULL_MODE_NONE, VK_FRONT_FACE_CLOCKWISE);
-	pipelineBuilder.setMultisamplingNone();
-	pipelineBuilder.enableBlendingSubtract();
-	pipelineBuilder.enableDepthTest(false, VK_COMPARE_OP_ALWAYS);
+void VulkanEngine::initClusterCullPipeline()
+{
+	VkPushConstantRange constexpr pushConstant
+	{
+		.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+		.offset = 0,
+		.size = sizeof(GPUClusterCullPushConstants)
+	};
 
-	pipelineBuilder.setColorAttachmentFormat(drawImage.imageFormat);
-	pipelineBuilder.setDepthFormat(depthImage.imageFormat);
+	VkPipelineLayoutCreateInfo const clusterCullLayout
+	{
+		.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+		.pNext = nullptr,
+		.setLayoutCount = 0,
+		.pSetLayouts = nullptr,
+		.pushConstantRangeCount = 1,
+		.pPushConstantRanges = &pushConstant
+	};
+	VK_CHECK(vkCreatePipelineLayout(device, &clusterCullLayout, nullptr, &clusterCullPipelineLayout));
 
-	pipelineBuilder.pipelineLayout = newLayout;
+	VkShaderModule clusterCullShader;
+	if (!vkUtil::load_shader_module((baseAppPath + "shaders/cluster_cull.comp.spv").c_str(), device, &clusterCullShader))
+	{
+		std::cerr << "Error when building the cluster cull compute shader module\n";
+	}
 
-	defaultPipeline.pipeline = pipelineBuilder.buildPipeline(device);
+	VkComputePipelineCreateInfo const computePipelineCreateInfo
+	{
+		.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO,
+		.pNext = nullptr,
+		.stage
+		{
+			.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+			.pNext = nullptr,
+			.stage = VK_SHADER_STAGE_COMPUTE_BIT,
+			.module = clusterCullShader,
+			.pName = "main"
+		},
+		.layout = clusterCullPipelineLayout
+	};
+	VK_CHECK(vkCreateComputePipelines(device, VK_NULL_HANDLE, 1, &computePipelineCreateInfo, nullptr, &clusterCullPipeline));
 
-	vkDestroyShaderModule(device, defaultVertShader, nullptr);
-	vkDestroyShaderModule(device, defaultFragShader, nullptr);
+	vkDestroyShaderModule(device, clusterCullShader, nullptr);
 
 	mainDeletionQueue.pushFunction([&]()
-	{
-		vkDestroyDescriptorSetLayout(device, defaultDescriptorLayout, nullptr);
-		vkDestroyPipelineLayout(device, defaultPipeline.layout, nullptr);
-		vkDestroyPipeline(device, defaultPipeline.pipeline, nullptr);
-	});
+		{
+			vkDestroyPipelineLayout(device, clusterCullPipelineLayout, nullptr);
+			vkDestroyPipeline(device, clusterCullPipeline, nullptr);
+		});
 }
 
-void VulkanEngine::initDefaultData()
+void VulkanEngine::initDepthPyramid()
 {
-	uint32_t const white = glm::packUnorm4x8(glm::vec4(1, 1, 1, 1));
-	whiteImage = createImage(&white, VkExtent3D{ 1, 1, 1 }, VK_FORMAT_R8G8B8A8_UNORM,
-		VK_IMAGE_USAGE_SAMPLED_BIT);
+	auto previousPowerOfTwo = [](uint32_t const value)
+	{
+		uint32_t result = 1;
+		while (result * 2 <= value)
+		{
+			result *= 2;
+		}
+		return result;
+	};
 
-	uint32_t const gray = glm::packUnorm4x8(glm::vec4(0.66f, 0.66f, 0.66f, 1));
-	grayImage = createImage(&gray, VkExtent3D{ 1, 1, 1 }, VK_FORMAT_R8G8B8A8_UNORM,
-		VK_IMAGE_USAGE_SAMPLED_BIT);
+	// Every level above 0 is exactly half the one below
+	depthPyramidExtent = { previousPowerOfTwo(depthImage.imageExtent.width), previousPowerOfTwo(depthImage.imageExtent.height) };
+	depthPyramid = createImage(VkExtent3D{ depthPyramidExtent.width, depthPyramidExtent.height, 1 }, VK_FORMAT_R32_SFLOAT, VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, true);
+	depthPyramidLevels = static_cast<uint32_t>(std::floor(std::log2(std::max(depthPyramidExtent.width, depthPyramidExtent.height)))) + 1;
 
-	uint32_t const black = glm::packUnorm4x8(glm::vec4(0, 0, 0, 1));
-	blackImage = createImage(&black, VkExtent3D{ 1, 1, 1 }, VK_FORMAT_R8G8B8A8_UNORM,
-		VK_IMAGE_USAGE_SAMPLED_BIT);
-	
-	uint32_t const magenta = glm::packUnorm4x8(glm::vec4(1, 0, 1, 1));
-	std::array<uint32_t, static_cast<size_t>(16 * 16) > pixels{};
-	for (int x = 0; x < 16; x++) {
-		for (int y = 0; y < 16; y++) {
-			pixels[y * 16 + x] = ((x % 2) ^ (y % 2)) ? magenta : black;
-		}
+	depthPyramidMips.resize(depthPyramidLevels);
+	for (uint32_t level = 0; level < depthPyramidLevels; level++)
+	{
+		VkImageViewCreateInfo viewInfo = vkInit::image_view_create_info(depthPyramid.imageFormat, depthPyramid.image, VK_IMAGE_ASPECT_COLOR_BIT);
+		viewInfo.subresourceRange.baseMipLevel = level;
+		VK_CHECK(vkCreateImageView(device, &viewInfo, nullptr, &depthPyramidMips[level]));
 	}
-	errorCheckerboardImage = createImage(pixels.data(), VkExtent3D{ 16, 16, 1 }, VK_FORMAT_R8G8B8A8_UNORM,
-		VK_IMAGE_USAGE_SAMPLED_BIT);
 
-	uint32_t const defaultNormal = glm::packUnorm4x8(glm::vec4(0.5f, 0.5f, 1.0f, 1.0f));
-	defaultNormalImage = createImage(&defaultNormal, VkExtent3D{ 1, 1, 1 }, VK_FORMAT_R8G8B8A8_UNORM,
-		VK_IMAGE_USAGE_SAMPLED_BIT);
+	// Only read with texelFetch, but the sampler still has to allow every level
+	VkSamplerCreateInfo const samplerInfo
+	{
+		.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO,
+		.magFilter = VK_FILTER_NEAREST,
+		.minFilter = VK_FILTER_NEAREST,
+		.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST,
+		.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+		.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+		.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+		.minLod = 0.0f,
+		.maxLod = VK_LOD_CLAMP_NONE
+	};
+	VK_CHECK(vkCreateSampler(device, &samplerInfo, nullptr, &depthPyramidSampler));
 
-	uint32_t const defaultMrao = glm::packUnorm4x8(glm::vec4(1.0f, 0.5f, 0.0f, 1.0f));
-	defaultMraoImage = createImage(&defaultMrao, VkExtent3D{ 1, 1, 1 }, VK_FORMAT_R8G8B8A8_UNORM,
-		VK_IMAGE_USAGE_SAMPLED_BIT);
+	{
+		DescriptorLayoutBuilder builder;
+		builder.addBinding(0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
+		depthPyramidDescriptorLayout = builder.build(device, VK_SHADER_STAGE_COMPUTE_BIT);
+	}
+	{
+		DescriptorLayoutBuilder builder;
+		builder.addBinding(0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
+		builder.addBinding(1, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE);
+		depthPyramidBuildDescriptorLayout = builder.build(device, VK_SHADER_STAGE_COMPUTE_BIT);
+	}
 
+	depthPyramidDescriptors = globalDescriptorAllocator.allocate(device, depthPyramidDescriptorLayout);
 	{
-		VkExtent3D size
-		{
-			.width = 1,
-			.height = 1,
-			.depth = 6
+		DescriptorWriter writer;
+		writer.writeImage(0, depthPyramid.imageView, depthPyramidSampler, VK_IMAGE_LAYOUT_GENERAL, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
+		writer.updateSet(device, depthPyramidDescriptors);
+	}
+
+	// Level 0 reads the depth image, which is only in the read only layout while the pyramid is built
+	depthPyramidBuildDescriptors.resize(depthPyramidLevels);
+	for (uint32_t level = 0; level < depthPyramidLevels; level++)
+	{
+		depthPyramidBuildDescriptors[level] = globalDescriptorAllocator.allocate(device, depthPyramidBuildDescriptorLayout);
+
+		DescriptorWriter writer;
+		if (level == 0)
+		{
+			writer.writeImage(0, depthImage.imageView, depthPyramidSampler, VK_IMAGE_LAYOUT_DEPTH_READ_ONLY_OPTIMAL, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
+		}
+		else
+		{
+			writer.writeImage(0, depthPyramidMips[level - 1], depthPyramidSampler, VK_IMAGE_LAYOUT_GENERAL, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
+		}
+		writer.writeImage(1, depthPyramidMips[level], VK_NULL_HANDLE, VK_IMAGE_LAYOUT_GENERAL, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE);
+		writer.updateSet(device, depthPyramidBuildDescriptors[level]);
+	}
+
+	immediateSubmit([&](VkCommandBuffer const cmd)
+		{
+			vkUtil::transition_image(cmd, depthPyramid.image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL);
+		});
+
+	mainDeletionQueue.pushFunction([this]()
+		{
+			for (VkImageView const view : depthPyramidMips)
+			{
+				vkDestroyImageView(device, view, nullptr);
+			}
+			destroyImage(depthPyramid);
+			vkDestroySampler(device, depthPyramidSampler, nullptr);
+			vkDestroyDescriptorSetLayout(device, depthPyramidDescriptorLayout, nullptr);
+			vkDestroyDescriptorSetLayout(device, depthPyramidBuildDescriptorLayout, nullptr);
+		});
+}
+
+void VulkanEngine::initDepthPyramidPipeline()
+{
+	VkPushConstantRange constexpr pushConstant
+	{
+		.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+		.offset = 0,
+		.size = sizeof(GPUDepthPyramidPushConstants)
+	};
+
+	VkPipelineLayoutCreateInfo const depthPyramidLayout
+	{
+		.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+		.pNext = nullptr,
+		.setLayoutCount = 1,
+		.pSetLayouts = &depthPyramidBuildDescriptorLayout,
+		.pushConstantRangeCount = 1,
+		.pPushConstantRanges = &pushConstant
+	};
+	VK_CHECK(vkCreatePipelineLayout(device, &depthPyramidLayout, nullptr, &depthPyramidPipelineLayout));
+
+	VkShaderModule depthPyramidShader;
+	if (!vkUtil::load_shader_module((baseAppPath + "shaders/depth_pyramid.comp.spv").c_str(), device, &depthPyramidShader))
+	{
+		std::cerr << "Error when building the depth pyramid compute shader module\n";
+	}
+
+	VkComputePipelineCreateInfo const computePipelineCreateInfo
+	{
+		.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO,
+		.pNext = nullptr,
+		.stage
+		{
+			.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+			.pNext = nullptr,
+			.stage = VK_SHADER_STAGE_COMPUTE_BIT,
+			.module = depthPyramidShader,
+			.pName = "main"
+		},
+		.layout = depthPyramidPipelineLayout
+	};
+	VK_CHECK(vkCreateComputePipelines(device, VK_NULL_HANDLE, 1, &computePipelineCreateInfo, nullptr, &depthPyramidPipeline));
+
+	vkDestroyShaderModule(device, depthPyramidShader, nullptr);
+
+	mainDeletionQueue.pushFunction([&]()
+		{
+			vkDestroyPipelineLayout(device, depthPyramidPipelineLayout, nullptr);
+			vkDestroyPipeline(device, depthPyramidPipeline, nullptr);
+		});
+}
+
+void VulkanEngine::initLightClusters()
+{
+	for (unsigned int i = 0; i < FRAME_OVERLAP; i++)
+	{
+		frames[i].lightClusterBuffer = createBuffer(lightClusterCount * sizeof(GPULightCluster), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT, VMA_MEMORY_USAGE_GPU_ONLY);
+	}
+
+	mainDeletionQueue.pushFunction([this]()
+		{
+			for (unsigned int i = 0; i < FRAME_OVERLAP; i++)
+			{
+				destroyBuffer(frames[i].lightClusterBuffer);
+			}
+
+			// Created by uploadDirtyLights once there are lights to hold
+			for (ResidentLightBuffer const* resident : { &directionalLightBuffer, &pointLightBuffer, &spotLightBuffer })
+			{
+				if (resident->capacity > 0)
+				{
+					destroyBuffer(resident->buffer);
+				}
+			}
+		});
+}
+
+void VulkanEngine::initLightCullPipeline()
+{
+	VkPushConstantRange constexpr pushConstant
+	{
+		.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+		.offset = 0,
+		.size = sizeof(GPULightCullPushConstants)
+	};
+
+	VkPipelineLayoutCreateInfo const lightCullLayout
+	{
+		.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+		.pNext = nullptr,
+		.setLayoutCount = 0,
+		.pSetLayouts = nullptr,
+		.pushConstantRangeCount = 1,
+		.pPushConstantRanges = &pushConstant
+	};
+	VK_CHECK(vkCreatePipelineLayout(device, &lightCullLayout, nullptr, &lightCullPipelineLayout));
+
+	VkShaderModule lightCullShader;
+	if (!vkUtil::load_shader_module((baseAppPath + "shaders/light_cull.comp.spv").c_str(), device, &lightCullShader))
+	{
+		std::cerr << "Error when building the light cull compute shader module\n";
+	}
+
+	VkComputePipelineCreateInfo const computePipelineCreateInfo
+	{
+		.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO,
+		.pNext = nullptr,
+		.stage
+		{
+			.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+			.pNext = nullptr,
+			.stage = VK_SHADER_STAGE_COMPUTE_BIT,
+			.module = lightCullShader,
+			.pName = "main"
+		},
+		.layout = lightCullPipelineLayout
+	};
+	VK_CHECK(vkCreateComputePipelines(device, VK_NULL_HANDLE, 1, &computePipelineCreateInfo, nullptr, &lightCullPipeline));
+
+	vkDestroyShaderModule(device, lightCullShader, nullptr);
+
+	mainDeletionQueue.pushFunction([&]()
+		{
+			vkDestroyPipelineLayout(device, lightCullPipelineLayout, nullptr);
+			vkDestroyPipeline(device, lightCullPipeline, nullptr);
+		});
+}
+
+void VulkanEngine::initGBuffer()
+{
+	for (size_t i = 0; i < gBuffer.size(); i++)
+	{
+		gBuffer[i] = createImage(drawImage.imageExtent, gBufferFormats[i], VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT);
+	}
+
+	// Enough tiles for the whole draw image, whatever the render scale
+	uint32_t const maxTileCount = ((drawImage.imageExtent.width + deferredTileSize - 1) / deferredTileSize) * ((drawImage.imageExtent.height + deferredTileSize - 1) / deferredTileSize);
+	for (unsigned int i = 0; i < FRAME_OVERLAP; i++)
+	{
+		frames[i].tileLightBuffer = createBuffer(maxTileCount * sizeof(GPULightCluster), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT, VMA_MEMORY_USAGE_GPU_ONLY);
+	}
+
+	// Only read with texelFetch
+	VkSamplerCreateInfo const samplerInfo
+	{
+		.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO,
+		.magFilter = VK_FILTER_NEAREST,
+		.minFilter = VK_FILTER_NEAREST,
+		.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST,
+		.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+		.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+		.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE
+	};
+	VK_CHECK(vkCreateSampler(device, &samplerInfo, nullptr, &gBufferSampler));
+
+	{
+		DescriptorLayoutBuilder builder;
+		builder.addBinding(0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
+		builder.addBinding(1, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
+		builder.addBinding(2, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
+		builder.addBinding(3, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
+		gBufferDescriptorLayout = builder.build(device, VK_SHADER_STAGE_COMPUTE_BIT | VK_SHADER_STAGE_FRAGMENT_BIT);
+	}
+
+	gBufferDescriptors = globalDescriptorAllocator.allocate(device, gBufferDescriptorLayout);
+	{
+		DescriptorWriter writer;
+		writer.writeImage(0, depthImage.imageView, gBufferSampler, VK_IMAGE_LAYOUT_DEPTH_READ_ONLY_OPTIMAL, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
+		for (size_t i = 0; i < gBuffer.size(); i++)
+		{
+			writer.writeImage(static_cast<uint32_t>(i + 1), gBuffer[i].imageView, gBufferSampler, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
+		}
+		writer.updateSet(device, gBufferDescriptors);
+	}
+
+	mainDeletionQueue.pushFunction([this]()
+		{
+			for (AllocatedImage const& image : gBuffer)
+			{
+				destroyImage(image);
+			}
+			for (unsigned int i = 0; i < FRAME_OVERLAP; i++)
+			{
+				destroyBuffer(frames[i].tileLightBuffer);
+			}
+			vkDestroySampler(device, gBufferSampler, nullptr);
+			vkDestroyDescriptorSetLayout(device, gBufferDescriptorLayout, nullptr);
+		});
+}
+
+void VulkanEngine::initDeferredPipelines()
+{
+	{
+		VkPushConstantRange constexpr pushConstant
+		{
+			.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+			.offset = 0,
+			.size = sizeof(GPUTileLightCullPushConstants)
+		};
+
+		VkPipelineLayoutCreateInfo const tileLightCullLayout
+		{
+			.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+			.pNext = nullptr,
+			.setLayoutCount = 1,
+			.pSetLayouts = &gBufferDescriptorLayout,
+			.pushConstantRangeCount = 1,
+			.pPushConstantRanges = &pushConstant
+		};
+		VK_CHECK(vkCreatePipelineLayout(device, &tileLightCullLayout, nullptr, &tileLightCullPipelineLayout));
+
+		VkShaderModule tileLightCullShader;
+		if (!vkUtil::load_shader_module((baseAppPath + "shaders/tile_light_cull.comp.spv").c_str(), device, &tileLightCullShader))
+		{
+			std::cerr << "Error when building the tile light cull compute shader module\n";
+		}
+
+		VkComputePipelineCreateInfo const computePipelineCreateInfo
+		{
+			.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO,
+			.pNext = nullptr,
+			.stage
+			{
+				.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+				.pNext = nullptr,
+				.stage = VK_SHADER_STAGE_COMPUTE_BIT,
+				.module = tileLightCullShader,
+				.pName = "main"
+			},
+			.layout = tileLightCullPipelineLayout
+		};
+		VK_CHECK(vkCreateComputePipelines(device, VK_NULL_HANDLE, 1, &computePipelineCreateInfo, nullptr, &tileLightCullPipeline));
+
+		vkDestroyShaderModule(device, tileLightCullShader, nullptr);
+	}
+
+	VkShaderModule fullscreenVertShader;
+	if (!vkUtil::load_shader_module((baseAppPath + "shaders/fullscreen.vert.spv").c_str(), device, &fullscreenVertShader))
+	{
+		std::cerr << "Error when building fullscreen vertex shader module";
+	}
+
+	VkShaderModule deferredLightingFragShader;
+	if (!vkUtil::load_shader_module((baseAppPath + "shaders/deferred_lighting.frag.spv").c_str(), device, &deferredLightingFragShader))
+	{
+		std::cerr << "Error when building deferred lighting fragment shader module";
+	}
+
+	VkPushConstantRange constexpr lightingRange
+	{
+		.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT,
+		.offset = 0,
+		.size = sizeof(GPUDeferredLightingPushConstants)
+	};
+
+	// The same scene set as the forward path, for the lights and IBL
+	VkDescriptorSetLayout const layouts[] = { gpuSceneDataDescriptorLayout, gBufferDescriptorLayout };
+
+	VkPipelineLayoutCreateInfo lightingLayoutInfo = vkInit::pipeline_layout_create_info();
+	lightingLayoutInfo.setLayoutCount = 2;
+	lightingLayoutInfo.pSetLayouts = layouts;
+	lightingLayoutInfo.pPushConstantRanges = &lightingRange;
+	lightingLayoutInfo.pushConstantRangeCount = 1;
+
+	VK_CHECK(vkCreatePipelineLayout(device, &lightingLayoutInfo, nullptr, &deferredLightingPipeline.layout));
+
+	// Depth is sampled rather than attached, pixels with nothing drawn are discarded so the skybox shows through
+	PipelineBuilder pipelineBuilder;
+	pipelineBuilder.setShaders(fullscreenVertShader, deferredLightingFragShader);
+	pipelineBuilder.setInputTopology(VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST);
+	pipelineBuilder.setPolygonMode(VK_POLYGON_MODE_FILL);
+	pipelineBuilder.setCullMode(VK_CULL_MODE_NONE, VK_FRONT_FACE_CLOCKWISE);
+	pipelineBuilder.setMultisamplingNone();
+	pipelineBuilder.disableBlending();
+	pipelineBuilder.disableDepthTest();
+	pipelineBuilder.setColorAttachmentFormat(drawImage.imageFormat);
+	pipelineBuilder.pipelineLayout = deferredLightingPipeline.layout;
+
+	deferredLightingPipeline.pipeline = pipelineBuilder.buildPipeline(device);
+
+	vkDestroyShaderModule(device, fullscreenVertShader, nullptr);
+	vkDestroyShaderModule(device, deferredLightingFragShader, nullptr);
+
+	mainDeletionQueue.pushFunction([&]()
+		{
+			vkDestroyPipelineLayout(device, tileLightCullPipelineLayout, nullptr);
+			vkDestroyPipeline(device, tileLightCullPipeline, nullptr);
+			vkDestroyPipelineLayout(device, deferredLightingPipeline.layout, nullptr);
+			vkDestroyPipeline(device, deferredLightingPipeline.pipeline, nullptr);
+		});
+}
+
+void VulkanEngine::initSkyboxPipeline()
+{
+	VkShaderModule envVertShader;
+	if (!vkUtil::load_shader_module((baseAppPath + "shaders/environment.vert.spv").c_str(), device, &envVertShader))
+	{
+		std::cerr << "Error when building environment vertex shader module";
+	}
+
+	VkShaderModule envFragShader;
+	if (!vkUtil::load_shader_module((baseAppPath + "shaders/environment.frag.spv").c_str(), device, &envFragShader))
+	{
+		std::cerr << "Error when building environment fragment shader module";
+	}
+
+	DescriptorLayoutBuilder layoutBuilder;
+	layoutBuilder.addBinding(0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
+	skyboxDescriptorLayout = layoutBuilder.build(device, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT);
+
+	VkPushConstantRange matrixRange
+	{
+		.stageFlags = VK_SHADER_STAGE_VERTEX_BIT,
+		.offset = 0,
+		.size = sizeof(glm::vec4)
+	};
+
+	VkDescriptorSetLayout layouts[] = { gpuSceneDataDescriptorLayout, skyboxDescriptorLayout };
+
+	VkPipelineLayoutCreateInfo envLayoutInfo = vkInit::pipeline_layout_create_info();
+	envLayoutInfo.setLayoutCount = 2;
+	envLayoutInfo.pSetLayouts = layouts;
+	envLayoutInfo.pPushConstantRanges = &matrixRange;
+	envLayoutInfo.pushConstantRangeCount = 1;
+
+	VK_CHECK(vkCreatePipelineLayout(device, &envLayoutInfo, nullptr, &skyboxPipeline.layout));
+
+	PipelineBuilder pipelineBuilder;
+	pipelineBuilder.setShaders(envVertShader, envFragShader);
+	pipelineBuilder.setInputTopology(VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST);
+	pipelineBuilder.setPolygonMode(VK_POLYGON_MODE_FILL);
+	pipelineBuilder.setCullMode(VK_CULL_MODE_NONE, VK_FRONT_FACE_CLOCKWISE);
+	pipelineBuilder.setMultisamplingNone();
+	pipelineBuilder.disableBlending();
+	pipelineBuilder.enableDepthTest(true, VK_COMPARE_OP_GREATER_OR_EQUAL);
+
+	// draw and depth image formats are fixed at init, so swapchain recreation never invalidates this
+	pipelineBuilder.setColorAttachmentFormat(drawImage.imageFormat);
+	pipelineBuilder.setDepthFormat(depthImage.imageFormat);
+
+	pipelineBuilder.pipelineLayout = skyboxPipeline.layout;
+
+	skyboxPipeline.pipeline = pipelineBuilder.buildPipeline(device);
+
+	vkDestroyShaderModule(device, envVertShader, nullptr);
+	vkDestroyShaderModule(device, envFragShader, nullptr);
+
+	mainDeletionQueue.pushFunction([&]()
+	{
+		vkDestroyDescriptorSetLayout(device, skyboxDescriptorLayout, nullptr);
+		vkDestroyPipelineLayout(device, skyboxPipeline.layout, nullptr);
+		vkDestroyPipeline(device, skyboxPipeline.pipeline, nullptr);
+	});
+}
+
+void VulkanEngine::initDebugPipelines()
+{
+	VkShaderModule defaultVertShader;
+	if (!vkUtil::load_shader_module((baseAppPath + "shaders/default.vert.spv").c_str(), device, &defaultVertShader))
+	{
+		std::cerr << "Error when building default vertex shader module";
+	}
+
+	VkShaderModule defaultFragShader;
+	if (!vkUtil::load_shader_module((baseAppPath + "shaders/default.frag.spv").c_str(), device, &defaultFragShader))
+	{
+		std::cerr << "Error when building default fragment shader module";
+	}
+
+	VkPushConstantRange matrixRange
+	{
+		.stageFlags = VK_SHADER_STAGE_VERTEX_BIT,
+		.offset = 0,
+		.size = sizeof(GPUDrawPushConstants)
+	};
+
+	DescriptorLayoutBuilder layoutBuilder;
+	layoutBuilder.addBinding(0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER);
+
+	defaultDescriptorLayout = layoutBuilder.build(device, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT);
+
+	VkDescriptorSetLayout layouts[] = { gpuSceneDataDescriptorLayout, defaultDescriptorLayout };
+
+	VkPipelineLayoutCreateInfo defaultLayoutInfo = vkInit::pipeline_layout_create_info();
+	defaultLayoutInfo.setLayoutCount = 2;
+	defaultLayoutInfo.pSetLayouts = layouts;
+	defaultLayoutInfo.pPushConstantRanges = &matrixRange;
+	defaultLayoutInfo.pushConstantRangeCount = 1;
+
+	VkPipelineLayout newLayout;
+	VK_CHECK(vkCreatePipelineLayout(device, &defaultLayoutInfo, nullptr, &newLayout));
+
+	defaultPipeline.layout = newLayout;
+
+	PipelineBuilder pipelineBuilder;
+	pipelineBuilder.setShaders(defaultVertShader, defaultFragShader);
+	pipelineBuilder.setInputTopology(VK_PRIMITIVE_TOPOLOGY_LINE_LIST);
+	pipelineBuilder.setPolygonMode(VK_POLYGON_MODE_FILL);
+	pipelineBuilder.setCullMode(VK_CULL_MODE_NONE, VK_FRONT_FACE_CLOCKWISE);
+	pipelineBuilder.setMultisamplingNone();
+	pipelineBuilder.enableBlendingSubtract();
+	pipelineBuilder.enableDepthTest(false, VK_COMPARE_OP_ALWAYS);
+
+	pipelineBuilder.setColorAttachmentFormat(drawImage.imageFormat);
+	pipelineBuilder.setDepthFormat(depthImage.imageFormat);
+
+	pipelineBuilder.pipelineLayout = newLayout;
+
+	defaultPipeline.pipeline = pipelineBuilder.buildPipeline(device);
+
+	vkDestroyShaderModule(device, defaultVertShader, nullptr);
+	vkDestroyShaderModule(device, defaultFragShader, nullptr);
+
+	mainDeletionQueue.pushFunction([&]()
+	{
+		vkDestroyDescriptorSetLayout(device, defaultDescriptorLayout, nullptr);
+		vkDestroyPipelineLayout(device, defaultPipeline.layout, nullptr);
+		vkDestroyPipeline(device, defaultPipeline.pipeline, nullptr);
+	});
+}
+
+void VulkanEngine::initDefaultData()
+{
+	uint32_t const white = glm::packUnorm4x8(glm::vec4(1, 1, 1, 1));
+	whiteImage = createImage(&white, VkExtent3D{ 1, 1, 1 }, VK_FORMAT_R8G8B8A8_UNORM,
+		VK_IMAGE_USAGE_SAMPLED_BIT);
+
+	uint32_t const gray = glm::packUnorm4x8(glm::vec4(0.66f, 0.66f, 0.66f, 1));
+	grayImage = createImage(&gray, VkExtent3D{ 1, 1, 1 }, VK_FORMAT_R8G8B8A8_UNORM,
+		VK_IMAGE_USAGE_SAMPLED_BIT);
+
+	uint32_t const black = glm::packUnorm4x8(glm::vec4(0, 0, 0, 1));
+	blackImage = createImage(&black, VkExtent3D{ 1, 1, 1 }, VK_FORMAT_R8G8B8A8_UNORM,
+		VK_IMAGE_USAGE_SAMPLED_BIT);
+	
+	uint32_t const magenta = glm::packUnorm4x8(glm::vec4(1, 0, 1, 1));
+	std::array<uint32_t, static_cast<size_t>(16 * 16) > pixels{};
+	for (int x = 0; x < 16; x++) {
+		for (int y = 0; y < 16; y++) {
+			pixels[y * 16 + x] = ((x % 2) ^ (y % 2)) ? magenta : black;
+		}
+	}
+	errorCheckerboardImage = createImage(pixels.data(), VkExtent3D{ 16, 16, 1 }, VK_FORMAT_R8G8B8A8_UNORM,
+		VK_IMAGE_USAGE_SAMPLED_BIT);
+
+	uint32_t const defaultNormal = glm::packUnorm4x8(glm::vec4(0.5f, 0.5f, 1.0f, 1.0f));
+	defaultNormalImage = createImage(&defaultNormal, VkExtent3D{ 1, 1, 1 }, VK_FORMAT_R8G8B8A8_UNORM,
+		VK_IMAGE_USAGE_SAMPLED_BIT);
+
+	uint32_t const defaultMrao = glm::packUnorm4x8(glm::vec4(1.0f, 0.5f, 0.0f, 1.0f));
+	defaultMraoImage = createImage(&defaultMrao, VkExtent3D{ 1, 1, 1 }, VK_FORMAT_R8G8B8A8_UNORM,
+		VK_IMAGE_USAGE_SAMPLED_BIT);
+
+	{
+		VkExtent3D size
+		{
+			.width = 1,
+			.height = 1,
+			.depth = 6
 		};
 		unsigned char defaultCube[] = {0, 0, 0, 255, 0, 0, 0, 255, 0, 0, 0, 255, 0, 0, 0, 255, 0, 0, 0, 255, 0, 0, 0, 255};
 		size_t const dataSize = 24;
@@ -1461,25 +2853,27 @@ void VulkanEngine::initDefaultData()
 	materialResources.metalRoughAOImage = whiteImage;
 	materialResources.metalRoughAOSampler = defaultSamplerLinear;
 
-	AllocatedBuffer materialConstants = createBuffer(sizeof(PBRMaterial::MaterialConstants), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
-
-	PBRMaterial::MaterialConstants* sceneUniformData = static_cast<PBRMaterial::MaterialConstants*>(materialConstants.allocation->GetMappedData());
-	sceneUniformData->colorFactors = glm::vec4{ 1,1,1,1 };
-	sceneUniformData->metalRoughFactors = glm::vec4{ 1, 0.5f, 0, 0 };
-
-	mainDeletionQueue.pushFunction([=, this]()
-		{
-			destroyBuffer(materialConstants);
-		});
-
-	materialResources.dataBuffer = materialConstants.buffer;
-	materialResources.dataBufferOffset = 0;
+	PBRMaterial::MaterialConstants const materialConstants
+	{
+		.colorFactors = glm::vec4{ 1,1,1,1 },
+		.metalRoughFactors = glm::vec2{ 1, 0.5f },
+		.flags = 0
+	};
 
 	defaultData = pbrMaterial.writeMaterial(device, MaterialPass::MainColor, materialResources, globalDescriptorAllocator);
+	// Registered first, so bindless material 0 is the default and the first texture slot is white
+	defaultData.materialIndex = PBRMaterial::writeBindlessMaterial(bindlessMaterials, materialConstants, std::nullopt, materialResources);
 	
 	defaultMaterial = std::make_shared<GLTFMaterial>();
 	defaultMaterial->data = defaultData;
 
+	// 64 MB of vertices and 16 MB of indices up front, grows if a scene needs more
+	geometryPool.init(this, 64 << 20, 1 << 22, 1 << 16, 1 << 23);
+	mainDeletionQueue.pushFunction([&]()
+		{
+			geometryPool.cleanup();
+		});
+
 	// Make debug shapes
 	// line cube
 	{
@@ -1530,6 +2924,7 @@ void VulkanEngine::initDefaultData()
 
 		lineCube.indexCount = 24;
 		lineCube.firstIndex = 0;
+		lineCube.vertexOffset = 0;
 
 		mainDeletionQueue.pushFunction([=, this]()
 			{
@@ -1587,6 +2982,7 @@ void VulkanEngine::initDefaultData()
 
 		cube.indexCount = 36;
 		cube.firstIndex = 0;
+		cube.vertexOffset = 0;
 
 		mainDeletionQueue.pushFunction([=, this]()
 			{
@@ -1721,103 +3117,505 @@ void VulkanEngine::drawBackground(VkCommandBuffer const cmd) const
 	}
 }
 
-void VulkanEngine::drawGeometry(VkCommandBuffer const cmd)
+void VulkanEngine::uploadDirtyLights(VkCommandBuffer const cmd)
 {
-	stats.drawCallCount = 0;
-	stats.triangleCount = 0;
-	auto const start = std::chrono::high_resolution_clock::now();
-
-	/*std::vector<uint32_t> opaqueDraws;
-	opaqueDraws.reserve(mainDrawContext.OpaqueSurfaces.size());
+	// Light culling and shading read the buffers
+	VkPipelineStageFlags2 constexpr lightReadStages = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT;
 
-	for (uint32_t i = 0; i < mainDrawContext.OpaqueSurfaces.size(); i++) 
+	bool copied = false;
+	auto upload = [&]<typename T>(LightStore<T>& store, ResidentLightBuffer& resident)
 	{
-		if (is_visible(mainDrawContext.OpaqueSurfaces[i], sceneData.cullViewProj))
+		if (store.getVersion() == resident.version)
 		{
-			opaqueDraws.push_back(i);
+			return;
 		}
-	}*/
+		resident.version = store.getVersion();
+		auto [first, last] = store.takeDirtyRange();
 
-	VkRenderingAttachmentInfo const colorAttachment = vkInit::attachment_info(drawImage.imageView, nullptr, VK_IMAGE_LAYOUT_GENERAL);
-	VkRenderingAttachmentInfo const depthAttachment = vkInit::depth_attachment_info(depthImage.imageView, VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL);
+		if (store.size() > resident.capacity)
+		{
+			if (resident.capacity > 0)
+			{
+				deferDestruction([this, oldBuffer = resident.buffer]()
+					{
+						destroyBuffer(oldBuffer);
+					});
+			}
+			resident.capacity = std::max(store.size(), resident.capacity * 2);
+			resident.buffer = createBuffer(resident.capacity * sizeof(T), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT, VMA_MEMORY_USAGE_GPU_ONLY);
 
-	VkRenderingInfo const renderInfo = vkInit::rendering_info(windowExtent, &colorAttachment, &depthAttachment);
-	vkCmdBeginRendering(cmd, &renderInfo);
+			VkBufferDeviceAddressInfo const deviceAddressInfo{ .sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO, .buffer = resident.buffer.buffer };
+			resident.address = vkGetBufferDeviceAddress(device, &deviceAddressInfo);
+
+			// The new buffer starts out empty
+			first = 0;
+			last = store.size();
+		}
 
-	AllocatedBuffer const gpuSceneDataBuffer = createBuffer(sizeof(GPUSceneData), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
-	getCurrentFrame().deletionQueue.pushFunction([=, this]()
+		if (first == last)
 		{
-			destroyBuffer(gpuSceneDataBuffer);
-		});
-	GPUSceneData* sceneUniformData = static_cast<GPUSceneData*>(gpuSceneDataBuffer.allocation->GetMappedData());
-	memcpy(sceneUniformData, &sceneData, sizeof(GPUSceneData));
+			return;
+		}
 
-	GPULightData lightData =
+		if (!copied)
+		{
+			// The previous frame may still be reading the light buffers
+			VkMemoryBarrier2 const readBarrier
+			{
+				.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2,
+				.pNext = nullptr,
+				.srcStageMask = lightReadStages,
+				.srcAccessMask = VK_ACCESS_2_NONE,
+				.dstStageMask = VK_PIPELINE_STAGE_2_COPY_BIT,
+				.dstAccessMask = VK_ACCESS_2_NONE
+			};
+			VkDependencyInfo const readDependency
+			{
+				.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
+				.pNext = nullptr,
+				.memoryBarrierCount = 1,
+				.pMemoryBarriers = &readBarrier
+			};
+			vkCmdPipelineBarrier2(cmd, &readDependency);
+			copied = true;
+		}
+
+		UploadAllocation const staging = getCurrentFrame().uploadArena.upload(store.getLights().subspan(first, last - first));
+		VkBufferCopy const region
+		{
+			.srcOffset = staging.offset,
+			.dstOffset = first * sizeof(T),
+			.size = (last - first) * sizeof(T)
+		};
+		vkCmdCopyBuffer(cmd, staging.buffer, resident.buffer.buffer, 1, &region);
+	};
+
+	upload(scene.directionalLights, directionalLightBuffer);
+	upload(scene.pointLights, pointLightBuffer);
+	upload(scene.spotLights, spotLightBuffer);
+
+	if (!copied)
 	{
-		.directionalLightCount = static_cast<unsigned int>(scene.directionalLights.size()),
-		.pointLightCount = static_cast<unsigned int>(scene.pointLights.size()),
-		.spotLightCount = static_cast<unsigned int>(scene.spotLights.size()),
+		return;
+	}
 
-		.directionalLights = 0,
-		.pointLights = 0,
-		.spotLights = 0
+	VkMemoryBarrier2 const copyBarrier
+	{
+		.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2,
+		.pNext = nullptr,
+		.srcStageMask = VK_PIPELINE_STAGE_2_COPY_BIT,
+		.srcAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT,
+		.dstStageMask = lightReadStages,
+		.dstAccessMask = VK_ACCESS_2_SHADER_STORAGE_READ_BIT
+	};
+	VkDependencyInfo const copyDependency
+	{
+		.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
+		.pNext = nullptr,
+		.memoryBarrierCount = 1,
+		.pMemoryBarriers = &copyBarrier
 	};
+	vkCmdPipelineBarrier2(cmd, &copyDependency);
+}
+
+void VulkanEngine::uploadDirtyObjects(VkCommandBuffer const cmd)
+{
+	if (dirtyObjects.empty())
+	{
+		return;
+	}
+
+	std::ranges::sort(dirtyObjects);
+	auto const [first, last] = std::ranges::unique(dirtyObjects);
+	dirtyObjects.erase(first, last);
 
-	if (lightData.directionalLightCount > 0)
+	UploadAllocation const staging = getCurrentFrame().uploadArena.allocate(dirtyObjects.size() * sizeof(GPUObjectData));
+
+	GPUObjectData* stagingData = static_cast<GPUObjectData*>(staging.data);
+	std::vector<VkBufferCopy> copies;
+	copies.reserve(dirtyObjects.size());
+	for (size_t i = 0; i < dirtyObjects.size(); i++)
 	{
-		AllocatedBuffer const directionalLightBuffer = createBuffer(scene.directionalLights.size() * sizeof(DirectionalLight), VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
-		getCurrentFrame().deletionQueue.pushFunction([=, this]()
+		stagingData[i] = make_object_data(mainDrawContext.getSurface(dirtyObjects[i]), geometryPool.getVertexBufferAddress());
+		DrawBatch const& batch = *std::ranges::prev(std::ranges::upper_bound(drawBatches, dirtyObjects[i], {}, &DrawBatch::firstObject));
+		stagingData[i].batchIndex = static_cast<uint32_t>(&batch - drawBatches.data());
+		stagingData[i].batchFirstObject = batch.firstObject;
+		stagingData[i].batchFirstCluster = batch.firstCluster;
+		stagingData[i].firstLod = objectFirstLods[dirtyObjects[i]];
+		stagingData[i].lodCount = static_cast<uint32_t>(mainDrawContext.getSurface(dirtyObjects[i]).meshData.lods.size());
+		copies.push_back(VkBufferCopy
 			{
-				destroyBuffer(directionalLightBuffer);
+				.srcOffset = staging.offset + i * sizeof(GPUObjectData),
+				.dstOffset = dirtyObjects[i] * sizeof(GPUObjectData),
+				.size = sizeof(GPUObjectData)
 			});
-		DirectionalLight* directionalLightData = static_cast<DirectionalLight*>(directionalLightBuffer.allocation->GetMappedData());
-		memcpy(directionalLightData, scene.directionalLights.data(), lightData.directionalLightCount * sizeof(DirectionalLight));
-		
-		VkBufferDeviceAddressInfo const deviceAddressInfo{ .sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO, .buffer = directionalLightBuffer.buffer };
-		lightData.directionalLights = vkGetBufferDeviceAddress(device, &deviceAddressInfo);
 	}
 
-	if (lightData.pointLightCount > 0)
+	// Task and mesh shaders read objects too, but their stages can only be named when the extension is enabled
+	VkPipelineStageFlags2 const objectReadStages = VK_PIPELINE_STAGE_2_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT
+		| (meshShadingSupported ? VK_PIPELINE_STAGE_2_TASK_SHADER_BIT_EXT | VK_PIPELINE_STAGE_2_MESH_SHADER_BIT_EXT : VK_PIPELINE_STAGE_2_NONE);
+
+	// The previous frame may still be reading the object buffer
+	VkMemoryBarrier2 const readBarrier
+	{
+		.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2,
+		.pNext = nullptr,
+		.srcStageMask = objectReadStages,
+		.srcAccessMask = VK_ACCESS_2_NONE,
+		.dstStageMask = VK_PIPELINE_STAGE_2_COPY_BIT,
+		.dstAccessMask = VK_ACCESS_2_NONE
+	};
+	VkDependencyInfo const readDependency
+	{
+		.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
+		.pNext = nullptr,
+		.memoryBarrierCount = 1,
+		.pMemoryBarriers = &readBarrier
+	};
+	vkCmdPipelineBarrier2(cmd, &readDependency);
+
+	vkCmdCopyBuffer(cmd, staging.buffer, objectBuffer.buffer, static_cast<uint32_t>(copies.size()), copies.data());
+
+	VkMemoryBarrier2 const copyBarrier
+	{
+		.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2,
+		.pNext = nullptr,
+		.srcStageMask = VK_PIPELINE_STAGE_2_COPY_BIT,
+		.srcAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT,
+		.dstStageMask = objectReadStages,
+		.dstAccessMask = VK_ACCESS_2_SHADER_STORAGE_READ_BIT
+	};
+	VkDependencyInfo const copyDependency
+	{
+		.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
+		.pNext = nullptr,
+		.memoryBarrierCount = 1,
+		.pMemoryBarriers = &copyBarrier
+	};
+	vkCmdPipelineBarrier2(cmd, &copyDependency);
+
+	dirtyObjects.clear();
+}
+
+void VulkanEngine::cullGeometry(VkCommandBuffer const cmd)
+{
+	size_t const objectCount = cullingData.size();
+
+	auto const start = std::chrono::high_resolution_clock::now();
+
+	// An error of errorScale / distance world units at the culling camera covers one lodErrorPixels
+	lodSettings = LodSettings
+	{
+		.cameraPosition = mainCamera.position,
+		.errorScale = lodEnabled ? 0.5f * static_cast<float>(drawExtent.height) * std::abs(sceneData.proj[1][1]) / lodErrorPixels : 0.0f
+	};
+	stats.lodSavedTriangleCount = 0;
+	stats.occludedCount = 0;
+
+	// The depth pyramid is built from what is drawn, which only matches the culling frustum with the default camera
+	occlusionActive = occlusionCulling && cullingMode == GPUCulling && cameraMode == Default && objectCount > 0;
+
+	bool const clusterCulling = cullingMode == ClusterCulling || cullingMode == MeshShading;
+	size_t const cullCount = clusterCulling ? clusterCount : objectCount;
+	if ((cullingMode == GPUCulling || clusterCulling) && cullCount > 0)
 	{
-		AllocatedBuffer const pointLightBuffer = createBuffer(scene.pointLights.size() * sizeof(PointLight), VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
-		getCurrentFrame().deletionQueue.pushFunction([=, this]()
+		FrameData& frame = getCurrentFrame();
+
+		// The counts are from the last time this frame was recorded, which the render fence has already waited on.
+		// Cluster modes count meshlets rather than objects.
+		vmaInvalidateAllocation(allocator, frame.cullStatsBuffer.allocation, 0, VK_WHOLE_SIZE);
+		GPUDrawCountHeader const gpuCounts = *static_cast<GPUDrawCountHeader*>(frame.cullStatsBuffer.allocation->GetMappedData());
+		stats.visibleCount = std::min(static_cast<int>(gpuCounts.visibleCount), static_cast<int>(cullCount));
+		stats.culledCount = static_cast<int>(cullCount) - stats.visibleCount;
+		visibleTriangleCount = static_cast<int>(gpuCounts.triangleCount);
+		stats.lodSavedTriangleCount = static_cast<int>(gpuCounts.lodSavedTriangleCount);
+		stats.occludedCount = static_cast<int>(gpuCounts.occludedCount);
+
+		// GPUDrawCountHeader followed by one draw count per batch
+		vkCmdFillBuffer(cmd, frame.drawCountBuffer.buffer, 0, VK_WHOLE_SIZE, 0);
+
+		// Also orders the early pass after the previous frame's late pass and depth pyramid, which share its buffers
+		VkMemoryBarrier2 const clearBarrier
+		{
+			.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2,
+			.pNext = nullptr,
+			.srcStageMask = VK_PIPELINE_STAGE_2_CLEAR_BIT | VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+			.srcAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT | VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT,
+			.dstStageMask = cullingMode == MeshShading ? VK_PIPELINE_STAGE_2_TASK_SHADER_BIT_EXT : VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+			.dstAccessMask = VK_ACCESS_2_SHADER_STORAGE_READ_BIT | VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT | VK_ACCESS_2_SHADER_SAMPLED_READ_BIT
+		};
+		VkDependencyInfo const clearDependency
+		{
+			.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
+			.pNext = nullptr,
+			.memoryBarrierCount = 1,
+			.pMemoryBarriers = &clearBarrier
+		};
+		vkCmdPipelineBarrier2(cmd, &clearDependency);
+
+		if (clusterCulling)
+		{
+			Frustum const frustum = extract_frustum(sceneData.cullViewProj);
+
+			VkBufferDeviceAddressInfo const drawCountAddressInfo{ .sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO, .buffer = frame.drawCountBuffer.buffer };
+
+			// Too big for push constants and shared by the task shader of every batch, so it goes in a buffer
+			UploadAllocation const cullDataUpload = frame.uploadArena.allocate(sizeof(GPUClusterCullData));
+
+			VkBufferDeviceAddressInfo const clusterCommandAddressInfo{ .sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO, .buffer = frame.clusterCommandBuffer.buffer };
+			VkBufferDeviceAddressInfo const clusterIndexAddressInfo{ .sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO, .buffer = frame.clusterIndexBuffer.buffer };
+
+			GPUClusterCullData* cullData = static_cast<GPUClusterCullData*>(cullDataUpload.data);
+			*cullData = GPUClusterCullData
 			{
-				destroyBuffer(pointLightBuffer);
-			});
-		PointLight* pointLightData = static_cast<PointLight*>(pointLightBuffer.allocation->GetMappedData());
-		memcpy(pointLightData, scene.pointLights.data(), lightData.pointLightCount * sizeof(PointLight));
-		
-		VkBufferDeviceAddressInfo const deviceAddressInfo{ .sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO, .buffer = pointLightBuffer.buffer };
-		lightData.pointLights = vkGetBufferDeviceAddress(device, &deviceAddressInfo);
+				.cameraPosition = glm::vec4(mainCamera.position, 1.0f),
+				.objects = objectBufferAddress,
+				.meshlets = geometryPool.getMeshletBufferAddress(),
+				.meshletData = geometryPool.getMeshletDataBufferAddress(),
+				.clusters = clusterBufferAddress,
+				.drawCommands = vkGetBufferDeviceAddress(device, &clusterCommandAddressInfo),
+				.drawCounts = vkGetBufferDeviceAddress(device, &drawCountAddressInfo),
+				.indices = vkGetBufferDeviceAddress(device, &clusterIndexAddressInfo),
+				.clusterCount = clusterCount,
+				.cullingEnabled = 1
+			};
+			std::ranges::copy(frustum.planes, cullData->frustumPlanes);
+			clusterCullDataAddress = cullDataUpload.address;
+
+			// Mesh shading culls in the task shader as it draws
+			if (cullingMode == ClusterCulling)
+			{
+				GPUClusterCullPushConstants const pushConstants{ .cullData = clusterCullDataAddress };
+				vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, clusterCullPipeline);
+				vkCmdPushConstants(cmd, clusterCullPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(GPUClusterCullPushConstants), &pushConstants);
+				vkCmdDispatch(cmd, (clusterCount + 63) / 64, 1, 1);
+			}
+		}
+		else
+		{
+			// With occlusion culling this only draws what passes against last frame's depth, see drawGeometry
+			cullObjects(cmd, occlusionActive ? CullPass::Early : CullPass::Single);
+		}
+
+		if (cullingMode != MeshShading)
+		{
+			waitForCull(cmd);
+
+			// The late occlusion pass adds to the counts, it copies them once it's done
+			if (!occlusionActive)
+			{
+				copyCullStats(cmd);
+			}
+		}
+	}
+	else if (cullingMode == CPUCulling)
+	{
+		cull_frustum(cullingData, extract_frustum(sceneData.cullViewProj), workerPool, visibleDraws);
+		stats.visibleCount = static_cast<int>(visibleDraws.size());
+		stats.culledCount = static_cast<int>(objectCount - visibleDraws.size());
+		visibleTriangleCount = 0;
+
+		// Compact the visible commands of each batch to the front of its range, at the level of detail picked for each
+		batchDrawCounts.assign(drawBatches.size(), 0);
+		if (!visibleDraws.empty())
+		{
+			VkDrawIndexedIndirectCommand* commands = static_cast<VkDrawIndexedIndirectCommand*>(getCurrentFrame().visibleCommandBuffer.allocation->GetMappedData());
+			size_t batchIdx = 0;
+			for (uint32_t const objectIdx : visibleDraws)
+			{
+				while (objectIdx >= drawBatches[batchIdx].firstObject + drawBatches[batchIdx].objectCount)
+				{
+					batchIdx++;
+				}
+				MeshData const& mesh = mainDrawContext.getSurface(objectIdx).meshData;
+				uint32_t indexCount = mesh.indexCount;
+				uint32_t firstIndex = mesh.firstIndex;
+				if (uint32_t const lod = select_lod(cullingData, objectIdx, lodSettings, mesh.lods); lod > 0)
+				{
+					indexCount = mesh.lods[lod - 1].count;
+					firstIndex = mesh.firstIndex + mesh.lods[lod - 1].indexOffset;
+				}
+				visibleTriangleCount += static_cast<int>(indexCount / 3);
+				stats.lodSavedTriangleCount += static_cast<int>((mesh.indexCount - indexCount) / 3);
+
+				commands[drawBatches[batchIdx].firstObject + batchDrawCounts[batchIdx]++] = VkDrawIndexedIndirectCommand
+				{
+					.indexCount = indexCount,
+					.instanceCount = 1,
+					.firstIndex = firstIndex,
+					.vertexOffset = mesh.vertexOffset,
+					.firstInstance = objectIdx
+				};
+			}
+		}
+	}
+	else
+	{
+		batchDrawCounts.resize(drawBatches.size());
+		visibleTriangleCount = 0;
+		for (size_t i = 0; i < drawBatches.size(); i++)
+		{
+			batchDrawCounts[i] = drawBatches[i].objectCount;
+			visibleTriangleCount += static_cast<int>(drawBatches[i].indexCount / 3);
+		}
+		stats.visibleCount = static_cast<int>(objectCount);
+		stats.culledCount = 0;
+	}
+
+	auto const end = std::chrono::high_resolution_clock::now();
+	stats.cullTime = static_cast<float>(std::chrono::duration_cast<std::chrono::microseconds>(end - start).count()) / 1000.0f;
+}
+
+void VulkanEngine::cullObjects(VkCommandBuffer const cmd, CullPass const pass)
+{
+	FrameData& frame = getCurrentFrame();
+	size_t const objectCount = cullingData.size();
+
+	// The LOD camera pushed the frustum planes past the push constant limit
+	UploadAllocation const cullDataUpload = frame.uploadArena.allocate(sizeof(GPUCullData));
+
+	VkBufferDeviceAddressInfo const drawCommandAddressInfo{ .sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO, .buffer = frame.drawCommandBuffer.buffer };
+	VkBufferDeviceAddressInfo const drawCountAddressInfo{ .sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO, .buffer = frame.drawCountBuffer.buffer };
+
+	// The early pass tests against the pyramid as it was drawn last frame, the late pass against the one just built
+	bool const late = pass == CullPass::Late;
+	glm::mat4 const& occlusionProj = late ? sceneData.proj : depthPyramidProj;
+
+	GPUCullData* cullData = static_cast<GPUCullData*>(cullDataUpload.data);
+	*cullData = GPUCullData
+	{
+		.lodCamera = glm::vec4(lodSettings.cameraPosition, lodSettings.errorScale),
+		.occlusionView = late ? sceneData.view : depthPyramidView,
+		.occlusionProj = glm::vec4(occlusionProj[0][0], occlusionProj[1][1], occlusionProj[2][2], occlusionProj[3][2]),
+		.objects = objectBufferAddress,
+		.drawCommands = vkGetBufferDeviceAddress(device, &drawCommandAddressInfo),
+		.drawCounts = vkGetBufferDeviceAddress(device, &drawCountAddressInfo),
+		.lods = lodBufferAddress,
+		.drawnEarly = drawnEarlyBufferAddress,
+		.objectCount = static_cast<uint32_t>(objectCount),
+		.cullingEnabled = 1,
+		.pass = static_cast<uint32_t>(pass),
+		.occlusionEnabled = late || (pass == CullPass::Early && depthPyramidValid) ? 1u : 0u,
+		.batchCount = static_cast<uint32_t>(drawBatches.size()),
+		.opaqueCount = static_cast<uint32_t>(mainDrawContext.OpaqueSurfaces.size())
+	};
+	std::ranges::copy(extract_frustum(sceneData.cullViewProj).planes, cullData->frustumPlanes);
+
+	GPUCullPushConstants const pushConstants{ .cullData = cullDataUpload.address };
+
+	vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, cullPipeline);
+	vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, cullPipelineLayout, 0, 1, &depthPyramidDescriptors, 0, nullptr);
+	vkCmdPushConstants(cmd, cullPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(GPUCullPushConstants), &pushConstants);
+	vkCmdDispatch(cmd, static_cast<uint32_t>((objectCount + 63) / 64), 1, 1);
+}
+
+void VulkanEngine::waitForCull(VkCommandBuffer const cmd) const
+{
+	// Cluster culling also writes the index buffer the draws read, and the late occlusion pass reads what the early
+	// pass wrote
+	VkMemoryBarrier2 const cullBarrier
+	{
+		.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2,
+		.pNext = nullptr,
+		.srcStageMask = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+		.srcAccessMask = VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT,
+		.dstStageMask = VK_PIPELINE_STAGE_2_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_2_INDEX_INPUT_BIT | VK_PIPELINE_STAGE_2_COPY_BIT | VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+		.dstAccessMask = VK_ACCESS_2_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_2_INDEX_READ_BIT | VK_ACCESS_2_TRANSFER_READ_BIT | VK_ACCESS_2_SHADER_STORAGE_READ_BIT | VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT
+	};
+	VkDependencyInfo const cullDependency
+	{
+		.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
+		.pNext = nullptr,
+		.memoryBarrierCount = 1,
+		.pMemoryBarriers = &cullBarrier
+	};
+	vkCmdPipelineBarrier2(cmd, &cullDependency);
+}
+
+void VulkanEngine::copyCullStats(VkCommandBuffer const cmd) const
+{
+	FrameData const& frame = frames[frameNumber % FRAME_OVERLAP];
+
+	VkBufferCopy const statsCopy
+	{
+		.srcOffset = 0,
+		.dstOffset = 0,
+		.size = sizeof(GPUDrawCountHeader)
+	};
+	vkCmdCopyBuffer(cmd, frame.drawCountBuffer.buffer, frame.cullStatsBuffer.buffer, 1, &statsCopy);
+
+	VkMemoryBarrier2 const statsBarrier
+	{
+		.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2,
+		.pNext = nullptr,
+		.srcStageMask = VK_PIPELINE_STAGE_2_COPY_BIT,
+		.srcAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT,
+		.dstStageMask = VK_PIPELINE_STAGE_2_HOST_BIT,
+		.dstAccessMask = VK_ACCESS_2_HOST_READ_BIT
+	};
+	VkDependencyInfo const statsDependency
+	{
+		.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
+		.pNext = nullptr,
+		.memoryBarrierCount = 1,
+		.pMemoryBarriers = &statsBarrier
+	};
+	vkCmdPipelineBarrier2(cmd, &statsDependency);
+}
+
+void VulkanEngine::drawGeometry(VkCommandBuffer const cmd)
+{
+	stats.drawCallCount = 0;
+	stats.triangleCount = 0;
+	auto const start = std::chrono::high_resolution_clock::now();
+
+	size_t const objectCount = mainDrawContext.surfaceCount();
+
+	// The cull paths write compacted per-batch command ranges into this frame's buffers
+	VkBuffer indirectBuffer = drawIndirectCommandBuffer.buffer;
+	if (cullingMode == GPUCulling)
+	{
+		indirectBuffer = getCurrentFrame().drawCommandBuffer.buffer;
+	}
+	else if (cullingMode == CPUCulling)
+	{
+		indirectBuffer = getCurrentFrame().visibleCommandBuffer.buffer;
+	}
+	else if (cullingMode == ClusterCulling)
+	{
+		indirectBuffer = getCurrentFrame().clusterCommandBuffer.buffer;
 	}
+	bool const clusterCulling = cullingMode == ClusterCulling || cullingMode == MeshShading;
 
-	if (lightData.spotLightCount > 0)
+	VkRenderingAttachmentInfo const colorAttachment = vkInit::attachment_info(drawImage.imageView, nullptr, VK_IMAGE_LAYOUT_GENERAL);
+	VkRenderingAttachmentInfo const depthAttachment = vkInit::depth_attachment_info(depthImage.imageView, VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL);
+
+	UploadArena& uploadArena = getCurrentFrame().uploadArena;
+
+	UploadAllocation const sceneDataUpload = uploadArena.upload(sceneData);
+
+	GPULightData lightData =
 	{
-		AllocatedBuffer const spotLightBuffer = createBuffer(scene.spotLights.size() * sizeof(SpotLight), VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
-		getCurrentFrame().deletionQueue.pushFunction([=, this]()
-			{
-				destroyBuffer(spotLightBuffer);
-			});
-		SpotLight* spotLightData = static_cast<SpotLight*>(spotLightBuffer.allocation->GetMappedData());
-		memcpy(spotLightData, scene.spotLights.data(), lightData.spotLightCount * sizeof(SpotLight));
+		.directionalLightCount = static_cast<unsigned int>(scene.directionalLights.size()),
+		.pointLightCount = static_cast<unsigned int>(scene.pointLights.size()),
+		.spotLightCount = static_cast<unsigned int>(scene.spotLights.size()),
 
-		VkBufferDeviceAddressInfo const deviceAddressInfo{ .sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO, .buffer = spotLightBuffer.buffer };
-		lightData.spotLights = vkGetBufferDeviceAddress(device, &deviceAddressInfo);
-	}
+		// Kept up to date by uploadDirtyLights
+		.directionalLights = scene.directionalLights.empty() ? 0 : directionalLightBuffer.address,
+		.pointLights = scene.pointLights.empty() ? 0 : pointLightBuffer.address,
+		.spotLights = scene.spotLights.empty() ? 0 : spotLightBuffer.address
+	};
 
-	AllocatedBuffer const gpuLightDataBuffer = createBuffer(sizeof(GPULightData), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
-	getCurrentFrame().deletionQueue.pushFunction([=, this]()
-		{
-			destroyBuffer(gpuLightDataBuffer);
-		});
-	GPULightData* lightUniformData = static_cast<GPULightData*>(gpuLightDataBuffer.allocation->GetMappedData());
-	memcpy(lightUniformData, &lightData, sizeof(GPULightData));
+	// Compute can't run inside the render pass, so lights are binned before it begins
+	cullLights(cmd, lightData);
+
+	UploadAllocation const lightDataUpload = uploadArena.upload(lightData);
 
 	VkDescriptorSet globalDescriptor = getCurrentFrame().frameDescriptors.allocate(device, gpuSceneDataDescriptorLayout);
 
 	DescriptorWriter writer;
-	writer.writeBuffer(0, gpuSceneDataBuffer.buffer, sizeof(GPUSceneData), 0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER);
-	writer.writeBuffer(1, gpuLightDataBuffer.buffer, sizeof(GPULightData), 0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER);
+	writer.writeBuffer(0, sceneDataUpload.buffer, sizeof(GPUSceneData), sceneDataUpload.offset, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER);
+	writer.writeBuffer(1, lightDataUpload.buffer, sizeof(GPULightData), lightDataUpload.offset, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER);
 	writer.writeImage(2, scene.skybox.environmentMap.has_value() ? scene.skybox.environmentMap->imageView : defaultCubeImage.imageView, defaultSamplerLinear, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
 	writer.writeImage(3, scene.skybox.irradianceMap.has_value() ? scene.skybox.irradianceMap->imageView : defaultCubeImage.imageView, defaultSamplerLinear, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
 	writer.writeImage(4, scene.skybox.prefilterEnvironmentMap.has_value() ? scene.skybox.prefilterEnvironmentMap->imageView : defaultCubeImage.imageView, defaultSamplerLinear, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
@@ -1825,75 +3623,22 @@ void VulkanEngine::drawGeometry(VkCommandBuffer const cmd)
 	
 	writer.updateSet(device, globalDescriptor);
 
+	VkRenderingInfo const renderInfo = vkInit::rendering_info(windowExtent, &colorAttachment, &depthAttachment);
+	vkCmdBeginRendering(cmd, &renderInfo);
+
 	// skybox
 	if (scene.skybox.environmentMap.has_value() && drawSkybox)
 	{
-		VkShaderModule envVertShader;
-		if (!vkUtil::load_shader_module((baseAppPath + "shaders/environment.vert.spv").c_str(), device, &envVertShader))
-		{
-			std::cerr << "Error when building environment vertex shader module";
-		}
-
-		VkShaderModule envFragShader;
-		if (!vkUtil::load_shader_module((baseAppPath + "shaders/environment.frag.spv").c_str(), device, &envFragShader))
-		{
-			std::cerr << "Error when building environment fragment shader module";
-		}
-
-		DescriptorLayoutBuilder layoutBuilder;
-		layoutBuilder.addBinding(0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
-		VkDescriptorSetLayout environmentLayout = layoutBuilder.build(device, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT);
-
-		VkPushConstantRange matrixRange
-		{
-			.stageFlags = VK_SHADER_STAGE_VERTEX_BIT,
-			.offset = 0,
-			.size = sizeof(glm::vec4)
-		};
-
-		VkDescriptorSetLayout layouts[] = { gpuSceneDataDescriptorLayout, environmentLayout };
-
-		VkPipelineLayoutCreateInfo meshLayoutInfo = vkInit::pipeline_layout_create_info();
-		meshLayoutInfo.setLayoutCount = 2;
-		meshLayoutInfo.pSetLayouts = layouts;
-		meshLayoutInfo.pPushConstantRanges = &matrixRange;
-		meshLayoutInfo.pushConstantRangeCount = 1;
-
-		VkPipelineLayout newLayout;
-		VK_CHECK(vkCreatePipelineLayout(device, &meshLayoutInfo, nullptr, &newLayout));
-
-		PipelineBuilder pipelineBuilder;
-		pipelineBuilder.setShaders(envVertShader, envFragShader);
-		pipelineBuilder.setInputTopology(VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST);
-		pipelineBuilder.setPolygonMode(VK_POLYGON_MODE_FILL);
-		pipelineBuilder.setCullMode(VK_CULL_MODE_NONE, VK_FRONT_FACE_CLOCKWISE);
-		pipelineBuilder.setMultisamplingNone();
-		pipelineBuilder.disableBlending();
-		pipelineBuilder.enableDepthTest(true, VK_COMPARE_OP_GREATER_OR_EQUAL);
-
-		pipelineBuilder.setColorAttachmentFormat(drawImage.imageFormat);
-		pipelineBuilder.setDepthFormat(depthImage.imageFormat);
-
-		pipelineBuilder.pipelineLayout = newLayout;
-
-		VkPipeline newPipeline = pipelineBuilder.buildPipeline(device);
-
-		vkDestroyShaderModule(device, envVertShader, nullptr);
-		vkDestroyShaderModule(device, envFragShader, nullptr);
+		auto const skyboxStart = std::chrono::high_resolution_clock::now();
 
 		DescriptorWriter writer;
-		writer.writeBuffer(0, gpuSceneDataBuffer.buffer, sizeof(GPUSceneData), 0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER);
-		writer.updateSet(device, globalDescriptor);
-
-		writer.clear();
-
-		VkDescriptorSet environmentDescriptor = getCurrentFrame().frameDescriptors.allocate(device, environmentLayout);
+		VkDescriptorSet environmentDescriptor = getCurrentFrame().frameDescriptors.allocate(device, skyboxDescriptorLayout);
 		writer.writeImage(0, scene.skybox.environmentMap->imageView, defaultSamplerLinear, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
 		writer.updateSet(device, environmentDescriptor);
 
 		// Draw
-		vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, newPipeline);
-		vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, newLayout, 0, 1, &globalDescriptor, 0, nullptr);
+		vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, skyboxPipeline.pipeline);
+		vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, skyboxPipeline.layout, 0, 1, &globalDescriptor, 0, nullptr);
 
 		VkViewport const viewport
 		{
@@ -1921,77 +3666,69 @@ void VulkanEngine::drawGeometry(VkCommandBuffer const cmd)
 		};
 		vkCmdSetScissor(cmd, 0, 1, &scissor);
 
-		vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, newLayout, 1, 1, &environmentDescriptor, 0, nullptr);
+		vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, skyboxPipeline.layout, 1, 1, &environmentDescriptor, 0, nullptr);
 
 		vkCmdBindIndexBuffer(cmd, cube.indexBuffer, 0, VK_INDEX_TYPE_UINT32);
 
-		vkCmdPushConstants(cmd, newLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(VkDeviceAddress), &cube.vertexBufferAddress);
+		vkCmdPushConstants(cmd, skyboxPipeline.layout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(VkDeviceAddress), &cube.vertexBufferAddress);
 
 		vkCmdDrawIndexed(cmd, cube.indexCount, 1, 0, 0, 0);
 
 		stats.drawCallCount++;
 		stats.triangleCount += static_cast<int>(cube.indexCount) / 3;
 
-		getCurrentFrame().deletionQueue.pushFunction([=, this]()
-			{
-				vkDestroyDescriptorSetLayout(device, environmentLayout, nullptr);
-				vkDestroyPipelineLayout(device, newLayout, nullptr);
-				vkDestroyPipeline(device, newPipeline, nullptr);
-			});
-		
+		auto const skyboxEnd = std::chrono::high_resolution_clock::now();
+		stats.skyboxDrawTime = static_cast<float>(std::chrono::duration_cast<std::chrono::microseconds>(skyboxEnd - skyboxStart).count()) / 1000.0f;
+	}
+	else
+	{
+		stats.skyboxDrawTime = 0.0f;
 	}
 
 	MaterialPipeline* lastPipeline = nullptr;
 	MaterialInstance* lastMaterial = nullptr;
 	VkBuffer lastIndexBuffer = VK_NULL_HANDLE;
 
-	auto drawIndirect = [&](RenderObject const& object, size_t cmdIdx)
+	bool const deferredActive = renderPath == DeferredRendering && cullingMode != MeshShading && !debugDrawNormals;
+	// Follows the batches, which updateScene built for one or the other
+	bool const bindlessActive = batchesBindless && cullingMode != MeshShading && !debugDrawNormals;
+	bool const prepassActive = depthPrepass && !deferredActive && !bindlessActive && cullingMode != MeshShading;
+
+	auto drawBatch = [&](DrawBatch const& batch, size_t const batchIdx, bool const late, bool const depthOnly)
 	{
-		if (object.material != lastMaterial)
+		if (batch.material != lastMaterial)
 		{
-			lastMaterial = object.material;
-			if (debugDrawNormals)
+			lastMaterial = batch.material;
+			MaterialPipeline* pipeline = debugDrawNormals ? &pbrMaterial.normalsPipeline : batch.material->pipeline;
+			if (cullingMode == MeshShading)
 			{
-				if (lastPipeline != &pbrMaterial.normalsPipeline)
-				{
-					lastPipeline = &pbrMaterial.normalsPipeline;
-					vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, pbrMaterial.normalsPipeline.pipeline);
-					vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, pbrMaterial.normalsPipeline.layout, 0, 1, &globalDescriptor, 0, nullptr);
-
-					VkViewport const viewport
-					{
-						.x = 0.0f,
-						.y = 0.0f,
-						.width = static_cast<float>(drawExtent.width),
-						.height = static_cast<float>(drawExtent.height),
-						.minDepth = 0.0f,
-						.maxDepth = 1.0f
-					};
-					vkCmdSetViewport(cmd, 0, 1, &viewport);
-
-					VkRect2D const scissor
-					{
-						.offset
-						{
-							.x = 0,
-							.y = 0
-						},
-						.extent
-						{
-							.width = drawExtent.width,
-							.height = drawExtent.height
-						}
-					};
-					vkCmdSetScissor(cmd, 0, 1, &scissor);
-
-					vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, pbrMaterial.normalsPipeline.layout, 1, 1, &object.material->materialSet, 0, nullptr); // this part only works cause all materials have same layout
-				}
+				pipeline = pbrMaterial.getMeshletPipeline(pipeline);
+			}
+			else if (depthOnly)
+			{
+				pipeline = &pbrMaterial.depthPrepassPipeline;
+			}
+			else if (bindlessActive)
+			{
+				pipeline = pipeline == &pbrMaterial.transparentPipeline ? &pbrMaterial.bindlessTransparentPipeline
+					: deferredActive ? &pbrMaterial.bindlessGBufferPipeline : &pbrMaterial.bindlessOpaquePipeline;
+			}
+			else if (deferredActive && pipeline == &pbrMaterial.opaquePipeline)
+			{
+				pipeline = &pbrMaterial.gBufferPipeline;
+			}
+			else if (prepassActive && pipeline == &pbrMaterial.opaquePipeline)
+			{
+				pipeline = &pbrMaterial.opaqueDepthEqualPipeline;
 			}
-			else if (object.material->pipeline != lastPipeline)
+
+			if (pipeline != lastPipeline)
 			{
-				lastPipeline = object.material->pipeline;
-				vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, object.material->pipeline->pipeline);
-				vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, object.material->pipeline->layout, 0, 1, &globalDescriptor, 0, nullptr);
+				lastPipeline = pipeline;
+				vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline->pipeline);
+				// The bindless set holds every material, so it's bound along with the scene data
+				VkDescriptorSet const sets[] = { globalDescriptor, bindlessMaterials.getSet() };
+				vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline->layout, 0, bindlessActive ? 2 : 1, sets, 0, nullptr);
 
 				VkViewport const viewport
 				{
@@ -2019,43 +3756,174 @@ void VulkanEngine::drawGeometry(VkCommandBuffer const cmd)
 				};
 				vkCmdSetScissor(cmd, 0, 1, &scissor);
 			}
-			vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, object.material->pipeline->layout, 1, 1, &object.material->materialSet, 0, nullptr);
+			// All materials share the same set layout, whichever pipeline draws them
+			if (!bindlessActive)
+			{
+				vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline->layout, 1, 1, &batch.material->materialSet, 0, nullptr);
+			}
 		}
 
-		if (object.meshData.indexBuffer != lastIndexBuffer)
+		if (cullingMode == MeshShading)
 		{
-			lastIndexBuffer = object.meshData.indexBuffer;
-			vkCmdBindIndexBuffer(cmd, object.meshData.indexBuffer, 0, VK_INDEX_TYPE_UINT32);
+			// One task workgroup per meshletTaskWorkgroupSize clusters of the batch, each launching a mesh workgroup per visible one
+			GPUMeshletPushConstants const meshletPushConstants
+			{
+				.cullData = clusterCullDataAddress,
+				.firstCluster = batch.firstCluster,
+				.clusterCount = batch.clusterCount
+			};
+			vkCmdPushConstants(cmd, lastPipeline->layout, VK_SHADER_STAGE_TASK_BIT_EXT | VK_SHADER_STAGE_MESH_BIT_EXT, 0, sizeof(GPUMeshletPushConstants), &meshletPushConstants);
+			cmdDrawMeshTasks(cmd, (batch.clusterCount + meshletTaskWorkgroupSize - 1) / meshletTaskWorkgroupSize, 1, 1);
+			stats.drawCallCount++;
+			return;
 		}
 
-		GPUDrawPushConstants pushConstants{};
-		pushConstants.modelMatrix = object.transform;
-		pushConstants.normalMatrix = glm::transpose(glm::inverse(glm::mat3(object.transform)));
-		pushConstants.vertexBuffer = object.meshData.vertexBufferAddress;
+		// Each batch owns the command range starting at its first object, or its first cluster when culling meshlets,
+		// compacted to the visible ones when culling. The late occlusion pass's ranges and counts follow all of those.
+		uint32_t constexpr stride = sizeof(VkDrawIndexedIndirectCommand);
 
-		vkCmdPushConstants(cmd, object.material->pipeline->layout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(GPUDrawPushConstants), &pushConstants);
+		if (cullingMode == GPUCulling || cullingMode == ClusterCulling)
+		{
+			uint32_t const firstCommand = (cullingMode == ClusterCulling ? batch.firstCluster : batch.firstObject) + (late ? static_cast<uint32_t>(objectCount) : 0);
+			uint32_t const maxDrawCount = cullingMode == ClusterCulling ? batch.clusterCount : batch.objectCount;
+			VkDeviceSize const countOffset = sizeof(GPUDrawCountHeader) + ((late ? drawBatches.size() : 0) + batchIdx) * sizeof(uint32_t);
+			vkCmdDrawIndexedIndirectCount(cmd, indirectBuffer, firstCommand * stride, getCurrentFrame().drawCountBuffer.buffer, countOffset, maxDrawCount, stride);
+		}
+		else
+		{
+			vkCmdDrawIndexedIndirect(cmd, indirectBuffer, batch.firstObject * stride, batchDrawCounts[batchIdx], stride);
+		}
 
-		VkDeviceSize indirectOffset = cmdIdx * sizeof(VkDrawIndexedIndirectCommand);
-		uint32_t stride = sizeof(VkDrawIndexedIndirectCommand);
+		stats.drawCallCount++;
+	};
 
-		vkCmdDrawIndexedIndirect(cmd, drawIndirectCommandBuffer.buffer, indirectOffset, 1, stride);
+	auto bindGeometry = [&]()
+	{
+		// Every scene mesh lives in the geometry pool, so its index buffer is bound once. Cluster culling rewrites the
+		// visible triangles' indices into a per-frame buffer instead.
+		lastIndexBuffer = cullingMode == ClusterCulling ? getCurrentFrame().clusterIndexBuffer.buffer : geometryPool.getIndexBuffer();
+		vkCmdBindIndexBuffer(cmd, lastIndexBuffer, 0, VK_INDEX_TYPE_UINT32);
+
+		// All vertex shader mesh pipelines share one layout, so the object buffer only needs pushing once. So do the
+		// bindless ones, whose fragment shaders read the material's texture slots as well.
+		if (bindlessActive)
+		{
+			GPUBindlessPushConstants const bindlessPushConstants{ .objectBuffer = objectBufferAddress, .materialTextures = bindlessMaterials.getTextureBufferAddress() };
+			vkCmdPushConstants(cmd, pbrMaterial.bindlessOpaquePipeline.layout, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(GPUBindlessPushConstants), &bindlessPushConstants);
+		}
+		else if (cullingMode != MeshShading)
+		{
+			GPUMeshPushConstants const meshPushConstants{ .objectBuffer = objectBufferAddress };
+			vkCmdPushConstants(cmd, pbrMaterial.opaquePipeline.layout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(GPUMeshPushConstants), &meshPushConstants);
+		}
+	};
+	bindGeometry();
 
-		stats.drawCallCount++;
-		stats.triangleCount += static_cast<int>(object.meshData.indexCount) / 3;
+	// Opaque batches come first, so the pre-pass, the early occlusion pass and the G-buffer pass only draw up to
+	// opaqueBatchCount
+	auto drawBatchRange = [&](size_t const firstBatch, size_t const lastBatch, bool const late, bool const depthOnly)
+	{
+		for (size_t i = firstBatch; i < lastBatch; i++)
+		{
+			// CPU culling knows up front which batches ended up empty, and batches without meshlets have nothing to cull
+			if ((clusterCulling && drawBatches[i].clusterCount == 0) || (cullingMode != GPUCulling && !clusterCulling && batchDrawCounts[i] == 0))
+			{
+				continue;
+			}
+			drawBatch(drawBatches[i], i, late, depthOnly);
+		}
+		// The next range binds different pipelines for the same materials
+		lastMaterial = nullptr;
 	};
 
-	size_t cmdIdx = 0;
-	for (auto const &r : mainDrawContext.OpaqueSurfaces)
+	// Continues the pass the skybox was drawn in, except on the deferred path where opaque surfaces go to the G-buffer
+	auto beginOpaquePass = [&]()
 	{
-		drawIndirect(r, cmdIdx);
-		++cmdIdx;
+		VkRenderingAttachmentInfo const loadDepthAttachment = vkInit::depth_attachment_info(depthImage.imageView, VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL, VK_ATTACHMENT_LOAD_OP_LOAD);
+		if (deferredActive)
+		{
+			std::array<VkRenderingAttachmentInfo, gBufferFormats.size()> gBufferAttachments;
+			for (size_t i = 0; i < gBuffer.size(); i++)
+			{
+				gBufferAttachments[i] = vkInit::attachment_info(gBuffer[i].imageView, nullptr);
+			}
+			VkRenderingInfo gBufferRenderInfo = vkInit::rendering_info(windowExtent, gBufferAttachments.data(), &loadDepthAttachment);
+			gBufferRenderInfo.colorAttachmentCount = static_cast<uint32_t>(gBufferAttachments.size());
+			vkCmdBeginRendering(cmd, &gBufferRenderInfo);
+		}
+		else
+		{
+			VkRenderingInfo const forwardRenderInfo = vkInit::rendering_info(windowExtent, &colorAttachment, &loadDepthAttachment);
+			vkCmdBeginRendering(cmd, &forwardRenderInfo);
+		}
+
+		// Compute passes in between disturb the push constants
+		lastMaterial = nullptr;
+		lastPipeline = nullptr;
+		bindGeometry();
+	};
+
+	if (deferredActive)
+	{
+		vkCmdEndRendering(cmd);
+		for (AllocatedImage const& image : gBuffer)
+		{
+			vkUtil::transition_image(cmd, image.image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
+		}
+		beginOpaquePass();
 	}
-	for (auto const &r : mainDrawContext.TransparentSurfaces)
+
+	if (prepassActive)
 	{
-		drawIndirect(r, cmdIdx);
-		++cmdIdx;
+		drawBatchRange(0, opaqueBatchCount, false, true);
+	}
+	// The early occlusion pass leaves transparent objects to the late one
+	drawBatchRange(0, occlusionActive || deferredActive ? opaqueBatchCount : drawBatches.size(), false, false);
+
+	if (occlusionActive)
+	{
+		// The pyramid is built from what the early pass drew, everything it left out is tested against that
+		vkCmdEndRendering(cmd);
+
+		buildDepthPyramid(cmd);
+		cullObjects(cmd, CullPass::Late);
+		waitForCull(cmd);
+		copyCullStats(cmd);
+
+		beginOpaquePass();
+
+		if (prepassActive)
+		{
+			drawBatchRange(0, opaqueBatchCount, true, true);
+		}
+		drawBatchRange(0, deferredActive ? opaqueBatchCount : drawBatches.size(), true, false);
+	}
+
+	if (deferredActive)
+	{
+		vkCmdEndRendering(cmd);
+
+		drawDeferredLighting(cmd, lightData, globalDescriptor);
+
+		// Transparent surfaces are forward shaded on top, from the light clusters
+		VkRenderingAttachmentInfo const loadDepthAttachment = vkInit::depth_attachment_info(depthImage.imageView, VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL, VK_ATTACHMENT_LOAD_OP_LOAD);
+		VkRenderingInfo const transparentRenderInfo = vkInit::rendering_info(windowExtent, &colorAttachment, &loadDepthAttachment);
+		vkCmdBeginRendering(cmd, &transparentRenderInfo);
+
+		lastMaterial = nullptr;
+		lastPipeline = nullptr;
+		bindGeometry();
+
+		drawBatchRange(opaqueBatchCount, drawBatches.size(), occlusionActive, false);
 	}
 
+	// The GPU paths' count is read back from this frame's last use, like the visible count
+	stats.triangleCount += visibleTriangleCount;
+	// Cluster modes cull meshlets, not whole surfaces
+	stats.surfaceCount = cullingMode == NoCulling || clusterCulling ? static_cast<int>(objectCount) : stats.visibleCount;
+
+	size_t cmdIdx = objectCount;
+
 	bool boundDebugPipeline = false;
 	auto debugDraw = [&](RenderObject const& object, size_t cmdIdx)
 	{
@@ -2121,11 +3989,244 @@ void VulkanEngine::drawGeometry(VkCommandBuffer const cmd)
 
 	vkCmdEndRendering(cmd);
 
+	if (cullingMode == MeshShading && clusterCount > 0)
+	{
+		VkMemoryBarrier2 const taskBarrier
+		{
+			.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2,
+			.pNext = nullptr,
+			.srcStageMask = VK_PIPELINE_STAGE_2_TASK_SHADER_BIT_EXT,
+			.srcAccessMask = VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT,
+			.dstStageMask = VK_PIPELINE_STAGE_2_COPY_BIT,
+			.dstAccessMask = VK_ACCESS_2_TRANSFER_READ_BIT
+		};
+		VkDependencyInfo const taskDependency
+		{
+			.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
+			.pNext = nullptr,
+			.memoryBarrierCount = 1,
+			.pMemoryBarriers = &taskBarrier
+		};
+		vkCmdPipelineBarrier2(cmd, &taskDependency);
+
+		copyCullStats(cmd);
+	}
+
 	auto const end = std::chrono::high_resolution_clock::now();
 	auto const elapsed = std::chrono::duration_cast<std::chrono::microseconds>(end - start);
 	stats.meshDrawTime = static_cast<float>(elapsed.count()) / 1000.0f;
 }
 
+void VulkanEngine::buildDepthPyramid(VkCommandBuffer const cmd)
+{
+	vkUtil::transition_image(cmd, depthImage.image, VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL, VK_IMAGE_LAYOUT_DEPTH_READ_ONLY_OPTIMAL);
+
+	vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, depthPyramidPipeline);
+
+	// Level 0 covers only the part of the depth image that was drawn to
+	VkExtent2D inputSize = drawExtent;
+	for (uint32_t level = 0; level < depthPyramidLevels; level++)
+	{
+		VkExtent2D const outputSize = { std::max(depthPyramidExtent.width >> level, 1u), std::max(depthPyramidExtent.height >> level, 1u) };
+
+		GPUDepthPyramidPushConstants const pushConstants
+		{
+			.inputSize = { inputSize.width, inputSize.height },
+			.outputSize = { outputSize.width, outputSize.height }
+		};
+		vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, depthPyramidPipelineLayout, 0, 1, &depthPyramidBuildDescriptors[level], 0, nullptr);
+		vkCmdPushConstants(cmd, depthPyramidPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(GPUDepthPyramidPushConstants), &pushConstants);
+		vkCmdDispatch(cmd, (outputSize.width + 7) / 8, (outputSize.height + 7) / 8, 1);
+
+		// The next level and the late cull pass read this one
+		VkMemoryBarrier2 const levelBarrier
+		{
+			.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2,
+			.pNext = nullptr,
+			.srcStageMask = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+			.srcAccessMask = VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT,
+			.dstStageMask = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+			.dstAccessMask = VK_ACCESS_2_SHADER_SAMPLED_READ_BIT
+		};
+		VkDependencyInfo const levelDependency
+		{
+			.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
+			.pNext = nullptr,
+			.memoryBarrierCount = 1,
+			.pMemoryBarriers = &levelBarrier
+		};
+		vkCmdPipelineBarrier2(cmd, &levelDependency);
+
+		inputSize = outputSize;
+	}
+
+	vkUtil::transition_image(cmd, depthImage.image, VK_IMAGE_LAYOUT_DEPTH_READ_ONLY_OPTIMAL, VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL);
+
+	// Next frame's early pass reprojects into this view
+	depthPyramidValid = true;
+	depthPyramidView = sceneData.view;
+	depthPyramidProj = sceneData.proj;
+}
+
+void VulkanEngine::cullLights(VkCommandBuffer const cmd, GPULightData& lightData)
+{
+	VkBufferDeviceAddressInfo const clusterAddressInfo{ .sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO, .buffer = getCurrentFrame().lightClusterBuffer.buffer };
+
+	// Tiles cover the part of the draw image being drawn to, so fragment coordinates map straight to them
+	glm::vec2 const tileSize =
+	{
+		std::ceil(static_cast<float>(drawExtent.width) / lightClusterCountX),
+		std::ceil(static_cast<float>(drawExtent.height) / lightClusterCountY)
+	};
+	float const depthScale = lightClusterCountZ / std::log(lightClusterFar / lightClusterNear);
+
+	lightData.lightClusters = vkGetBufferDeviceAddress(device, &clusterAddressInfo);
+	lightData.clusterTileSize = tileSize;
+	lightData.clusterDepthScale = depthScale;
+	lightData.clusterDepthBias = -std::log(lightClusterNear) * depthScale;
+
+	// Depth is reversed, the far plane is where the projection's near parameter went
+	GPULightCullPushConstants const pushConstants
+	{
+		.view = sceneData.view,
+		.projScale = { sceneData.proj[0][0], sceneData.proj[1][1] },
+		.ndcTileSize = tileSize * 2.0f / glm::vec2(drawExtent.width, drawExtent.height),
+		.pointLights = lightData.pointLights,
+		.spotLights = lightData.spotLights,
+		.clusters = lightData.lightClusters,
+		.pointLightCount = lightData.pointLightCount,
+		.spotLightCount = lightData.spotLightCount,
+		.depthScale = lightData.clusterDepthScale,
+		.depthBias = lightData.clusterDepthBias,
+		.farPlane = sceneData.proj[3][2] / sceneData.proj[2][2]
+	};
+
+	vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, lightCullPipeline);
+	vkCmdPushConstants(cmd, lightCullPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(GPULightCullPushConstants), &pushConstants);
+	vkCmdDispatch(cmd, lightClusterCount, 1, 1);
+
+	VkMemoryBarrier2 const clusterBarrier
+	{
+		.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2,
+		.pNext = nullptr,
+		.srcStageMask = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+		.srcAccessMask = VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT,
+		.dstStageMask = VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT,
+		.dstAccessMask = VK_ACCESS_2_SHADER_STORAGE_READ_BIT
+	};
+	VkDependencyInfo const clusterDependency
+	{
+		.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
+		.pNext = nullptr,
+		.memoryBarrierCount = 1,
+		.pMemoryBarriers = &clusterBarrier
+	};
+	vkCmdPipelineBarrier2(cmd, &clusterDependency);
+}
+
+void VulkanEngine::drawDeferredLighting(VkCommandBuffer const cmd, GPULightData const& lightData, VkDescriptorSet const globalDescriptor)
+{
+	for (AllocatedImage const& image : gBuffer)
+	{
+		vkUtil::transition_image(cmd, image.image, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+	}
+	vkUtil::transition_image(cmd, depthImage.image, VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL, VK_IMAGE_LAYOUT_DEPTH_READ_ONLY_OPTIMAL);
+
+	uint32_t const tileCountX = (drawExtent.width + deferredTileSize - 1) / deferredTileSize;
+	uint32_t const tileCountY = (drawExtent.height + deferredTileSize - 1) / deferredTileSize;
+
+	VkBufferDeviceAddressInfo const tileAddressInfo{ .sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO, .buffer = getCurrentFrame().tileLightBuffer.buffer };
+	VkDeviceAddress const tileAddress = vkGetBufferDeviceAddress(device, &tileAddressInfo);
+
+	// Each tile's lights are tested against the depth range of what was actually drawn there
+	GPUTileLightCullPushConstants const cullPushConstants
+	{
+		.view = sceneData.view,
+		.projection = { sceneData.proj[0][0], sceneData.proj[1][1], sceneData.proj[2][2], sceneData.proj[3][2] },
+		.pointLights = lightData.pointLights,
+		.spotLights = lightData.spotLights,
+		.tiles = tileAddress,
+		.pointLightCount = lightData.pointLightCount,
+		.spotLightCount = lightData.spotLightCount,
+		.drawExtent = { drawExtent.width, drawExtent.height },
+		.tileCountX = tileCountX
+	};
+
+	vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, tileLightCullPipeline);
+	vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, tileLightCullPipelineLayout, 0, 1, &gBufferDescriptors, 0, nullptr);
+	vkCmdPushConstants(cmd, tileLightCullPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(GPUTileLightCullPushConstants), &cullPushConstants);
+	vkCmdDispatch(cmd, tileCountX, tileCountY, 1);
+
+	VkMemoryBarrier2 const tileBarrier
+	{
+		.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2,
+		.pNext = nullptr,
+		.srcStageMask = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+		.srcAccessMask = VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT,
+		.dstStageMask = VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT,
+		.dstAccessMask = VK_ACCESS_2_SHADER_STORAGE_READ_BIT
+	};
+	VkDependencyInfo const tileDependency
+	{
+		.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
+		.pNext = nullptr,
+		.memoryBarrierCount = 1,
+		.pMemoryBarriers = &tileBarrier
+	};
+	vkCmdPipelineBarrier2(cmd, &tileDependency);
+
+	// One fullscreen triangle shades every covered pixel on top of the skybox
+	VkRenderingAttachmentInfo const colorAttachment = vkInit::attachment_info(drawImage.imageView, nullptr, VK_IMAGE_LAYOUT_GENERAL);
+	VkRenderingInfo const renderInfo = vkInit::rendering_info(windowExtent, &colorAttachment, nullptr);
+	vkCmdBeginRendering(cmd, &renderInfo);
+
+	vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, deferredLightingPipeline.pipeline);
+	vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, deferredLightingPipeline.layout, 0, 1, &globalDescriptor, 0, nullptr);
+	vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, deferredLightingPipeline.layout, 1, 1, &gBufferDescriptors, 0, nullptr);
+
+	VkViewport const viewport
+	{
+		.x = 0.0f,
+		.y = 0.0f,
+		.width = static_cast<float>(drawExtent.width),
+		.height = static_cast<float>(drawExtent.height),
+		.minDepth = 0.0f,
+		.maxDepth = 1.0f
+	};
+	vkCmdSetViewport(cmd, 0, 1, &viewport);
+
+	VkRect2D const scissor
+	{
+		.offset
+		{
+			.x = 0,
+			.y = 0
+		},
+		.extent
+		{
+			.width = drawExtent.width,
+			.height = drawExtent.height
+		}
+	};
+	vkCmdSetScissor(cmd, 0, 1, &scissor);
+
+	GPUDeferredLightingPushConstants const lightingPushConstants
+	{
+		.tiles = tileAddress,
+		.drawExtent = { drawExtent.width, drawExtent.height },
+		.tileCountX = tileCountX
+	};
+	vkCmdPushConstants(cmd, deferredLightingPipeline.layout, VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(GPUDeferredLightingPushConstants), &lightingPushConstants);
+
+	vkCmdDraw(cmd, 3, 1, 0, 0);
+	stats.drawCallCount++;
+
+	vkCmdEndRendering(cmd);
+
+	// Transparent surfaces still test against it
+	vkUtil::transition_image(cmd, depthImage.image, VK_IMAGE_LAYOUT_DEPTH_READ_ONLY_OPTIMAL, VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL);
+}
+
 void VulkanEngine::drawImgui(VkCommandBuffer const cmd, VkImageView const targetImageView) const
 {
 	VkRenderingAttachmentInfo const colorAttachment = vkInit::attachment_info(targetImageView, nullptr, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
@@ -2169,53 +4270,17 @@ void VulkanEngine::destroyBuffer(AllocatedBuffer const& buffer) const
 	vmaDestroyBuffer(allocator, buffer.buffer, buffer.allocation);
 }
 
-GPUMeshBuffers VulkanEngine::uploadMesh(std::span<uint32_t> const indices, std::span<Vertex> const vertices) const
+AllocatedImage VulkanEngine::createImage(VkExtent3D const size, VkFormat const format, VkImageUsageFlags const usage, bool const mipmapped) const
 {
-	size_t const vertexBufferSize = vertices.size() * sizeof(Vertex);
-	size_t const indexBufferSize = indices.size() * sizeof(uint32_t);
-
-	GPUMeshBuffers newSurface{};
-
-	newSurface.vertexBuffer = createBuffer(vertexBufferSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
-		VMA_MEMORY_USAGE_GPU_ONLY);
-
-	VkBufferDeviceAddressInfo const deviceAddressInfo{ .sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO, .buffer = newSurface.vertexBuffer.buffer };
-	newSurface.vertexBufferAddress = vkGetBufferDeviceAddress(device, &deviceAddressInfo);
-
-	newSurface.indexBuffer = createBuffer(indexBufferSize, VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VMA_MEMORY_USAGE_GPU_ONLY);
-
-	AllocatedBuffer const staging = createBuffer(vertexBufferSize + indexBufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VMA_MEMORY_USAGE_CPU_ONLY);
-
-	void* data = staging.allocation->GetMappedData();
-
-	memcpy(data, vertices.data(), vertexBufferSize);
-	memcpy(static_cast<char*>(data) + vertexBufferSize, indices.data(), indexBufferSize);
-
-	immediateSubmit([&](VkCommandBuffer const cmd)
+	uint32_t mipLevels = 1;
+	if (mipmapped)
 	{
-		VkBufferCopy const vertexCopy
-		{
-			.srcOffset = 0,
-			.dstOffset = 0,
-			.size = vertexBufferSize
-		};
-		vkCmdCopyBuffer(cmd, staging.buffer, newSurface.vertexBuffer.buffer, 1, &vertexCopy);
-
-		VkBufferCopy const indexCopy
-		{
-			.srcOffset = vertexBufferSize,
-			.dstOffset = 0,
-			.size = indexBufferSize
-		};
-		vkCmdCopyBuffer(cmd, staging.buffer, newSurface.indexBuffer.buffer, 1, &indexCopy);
-	});
-
-	destroyBuffer(staging);
-
-	return newSurface;
+		mipLevels = static_cast<uint32_t>(std::floor(std::log2(std::max(size.width, size.height)))) + 1;
+	}
+	return allocateImage(size, format, usage, mipLevels);
 }
 
-AllocatedImage VulkanEngine::createImage(VkExtent3D const size, VkFormat const format, VkImageUsageFlags const usage, bool const mipmapped) const
+AllocatedImage VulkanEngine::allocateImage(VkExtent3D const size, VkFormat const format, VkImageUsageFlags const usage, uint32_t const mipLevels) const
 {
 	AllocatedImage newImage
 	{
@@ -2224,10 +4289,7 @@ AllocatedImage VulkanEngine::createImage(VkExtent3D const size, VkFormat const f
 	};
 
 	VkImageCreateInfo imgInfo = vkInit::image_create_info(format, usage, size);
-	if (mipmapped)
-	{
-		imgInfo.mipLevels = static_cast<uint32_t>(std::floor(std::log2(std::max(size.width, size.height)))) + 1;
-	}
+	imgInfo.mipLevels = mipLevels;
 	if (size.depth == 6)
 	{
 		imgInfo.flags = VK_IMAGE_CREATE_CUBE_COMPATIBLE_BIT;
@@ -2263,47 +4325,27 @@ AllocatedImage VulkanEngine::createImage(VkExtent3D const size, VkFormat const f
 	return newImage;
 }
 
-AllocatedImage VulkanEngine::createImage(void const* data, VkExtent3D const size, VkFormat const format, VkImageUsageFlags const usage, bool const mipmapped) const
+AllocatedImage VulkanEngine::createImage(void const* data, VkExtent3D const size, VkFormat const format, VkImageUsageFlags const usage, bool const mipmapped, ImageConversion const conversion)
 {
-	size_t const dataSize = static_cast<size_t>(size.depth) * static_cast<size_t>(size.width) * static_cast<size_t>(size.height) * 4 * (format == VK_FORMAT_R32G32B32A32_SFLOAT ? 4 : 1);
-	AllocatedBuffer const uploadBuffer = createBuffer(dataSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
-
-	memcpy(uploadBuffer.info.pMappedData, data, dataSize);
+	size_t const dataSize = static_cast<size_t>(size.depth) * static_cast<size_t>(size.width) * static_cast<size_t>(size.height) * get_source_texel_size(format, conversion);
 
 	AllocatedImage const newImage = createImage(size, format, usage | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT, mipmapped);
 
-	immediateSubmit([&](VkCommandBuffer const cmd)
-	{
-		vkUtil::transition_image(cmd, newImage.image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+	uploader.uploadImage(newImage, data, dataSize, conversion, mipmapped);
 
-		VkBufferImageCopy const copyRegion
-		{
-			.bufferOffset = 0,
-			.bufferRowLength = 0,
-			.bufferImageHeight = 0,
-			.imageSubresource
-			{
-				.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
-				.mipLevel = 0,
-				.baseArrayLayer = 0,
-				.layerCount = 1,
-			},
-			.imageExtent = size
-		};
+	return newImage;
+}
 
-		vkCmdCopyBufferToImage(cmd, uploadBuffer.buffer, newImage.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &copyRegion);
+AllocatedImage VulkanEngine::createImage(CompressedTexture const& texture)
+{
+	return createImage(texture.data, texture.size, texture.format, texture.regions);
+}
 
-		if (mipmapped)
-		{
-			vkUtil::generate_mipmaps(cmd, newImage.image, VkExtent2D{ newImage.imageExtent.width, newImage.imageExtent.height });
-		}
-		else
-		{
-			vkUtil::transition_image(cmd, newImage.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
-		}
-	});
+AllocatedImage VulkanEngine::createImage(std::span<uint8_t const> const data, VkExtent3D const size, VkFormat const format, std::span<VkBufferImageCopy const> const regions)
+{
+	AllocatedImage const newImage = allocateImage(size, format, VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT, static_cast<uint32_t>(regions.size()));
 
-	destroyBuffer(uploadBuffer);
+	uploader.uploadImage(newImage, data.data(), data.size(), regions, false);
 
 	return newImage;
 }
@@ -3,14 +3,24 @@
 #pragma once
 
 #include "camera.h"
+#include "compressed_texture.h"
 
+#include "culling.h"
 #include "scene.h"
+#include "thread_pool.h"
+#include "vk_bindless.h"
 #include "vk_descriptors.h"
+#include "vk_geometry_pool.h"
 #include "vk_loader.h"
 #include "vk_types.h"
+#include "vk_upload_arena.h"
+#include "vk_uploader.h"
 
 unsigned int constexpr FRAME_OVERLAP = 2;
 
+// Albedo, world space normal, and AO/roughness/metallic like the material textures, matches gbuffer.frag
+std::array<VkFormat, 3> constexpr gBufferFormats = { VK_FORMAT_R8G8B8A8_SRGB, VK_FORMAT_R16G16B16A16_SFLOAT, VK_FORMAT_R8G8B8A8_UNORM };
+
 struct CallbackQueue
 {
 	std::deque<std::function<void()>> functions;
@@ -49,10 +59,26 @@ struct MeshData
 {
 	uint32_t indexCount;
 	uint32_t firstIndex;
+	int32_t vertexOffset;
+
+	// Where the mesh's vertices start in the geometry pool and how they are stored, shaders index from there
+	VkDeviceSize vertexDataOffset;
+	VertexFormat vertexFormat;
+
+	// Only set for meshes outside the geometry pool, like the debug and skybox cubes
 	VkBuffer indexBuffer;
 	VkDeviceAddress vertexBufferAddress;
+
+	// The surface's meshlets in the geometry pool, none for meshes outside it
+	uint32_t firstMeshlet;
+	uint32_t meshletCount;
+
+	// Simplified versions of the surface, their indices start at firstIndex + indexOffset
+	std::span<SurfaceLod const> lods;
 };
 
+struct MeshNode;
+
 struct RenderObject 
 {
 	MeshData meshData;
@@ -60,6 +86,8 @@ struct RenderObject
 	MaterialInstance* material;
 	Bounds bounds;
 	glm::mat4 transform;
+
+	MeshNode* node;
 };
 
 struct FrameData
@@ -74,18 +102,69 @@ struct FrameData
 	DescriptorAllocatorGrowable frameDescriptors;
 
 	CallbackQueue postFrameQueue;
+
+	// Scene and light uniforms, light arrays, cull data and staging, reset once the frame's fence signals
+	UploadArena uploadArena;
+
+	// Written by the cull pass, one command per RenderObject in draw order
+	AllocatedBuffer drawCommandBuffer;
+	AllocatedBuffer drawCountBuffer;
+	AllocatedBuffer cullStatsBuffer;
+
+	// Compacted commands written by the CPU cull path
+	AllocatedBuffer visibleCommandBuffer;
+
+	// Written by the cluster cull pass, one command and one range of indices per cluster
+	AllocatedBuffer clusterCommandBuffer;
+	AllocatedBuffer clusterIndexBuffer;
+
+	// Each light cluster's point and spot lights, written by the light cull pass
+	AllocatedBuffer lightClusterBuffer;
+	// Same for each screen tile of the deferred path, written by the tile light cull pass
+	AllocatedBuffer tileLightBuffer;
+};
+
+// Device-local copy of one of the scene's LightStores, grown as needed and updated from its dirty range
+struct ResidentLightBuffer
+{
+	AllocatedBuffer buffer{};
+	size_t capacity = 0;
+	VkDeviceAddress address = 0;
+	// Of the store when it was last uploaded
+	uint64_t version = UINT64_MAX;
 };
 
 struct DrawContext
 {
 	std::vector<RenderObject> OpaqueSurfaces;
 	std::vector<RenderObject> TransparentSurfaces;
+
+	// Indexed in draw command order: opaques, then transparents
+	RenderObject& getSurface(size_t const index)
+	{
+		return index < OpaqueSurfaces.size() ? OpaqueSurfaces[index] : TransparentSurfaces[index - OpaqueSurfaces.size()];
+	}
+	size_t surfaceCount() const { return OpaqueSurfaces.size() + TransparentSurfaces.size(); }
+};
+
+// A run of consecutive draw commands that share pipeline and material set
+struct DrawBatch
+{
+	MaterialInstance* material;
+	uint32_t firstObject;
+	uint32_t objectCount;
+	uint32_t indexCount;
+	uint32_t firstCluster;
+	uint32_t clusterCount;
 };
 
 struct MeshNode : public Node
 {
 	std::shared_ptr<MeshAsset> mesh;
 
+	// Indices into the engine's object buffer, one per surface, assigned when the draw context is built
+	std::vector<uint32_t> objectIndices;
+
 	virtual void draw(glm::mat4 const& topMatrix, DrawContext& ctx) override;
 };
 
@@ -95,14 +174,33 @@ struct PBRMaterial
 	MaterialPipeline transparentPipeline;
 	MaterialPipeline normalsPipeline; // should be material-independent maybe
 
+	// Depth pre-pass: the opaque surfaces' depth first, then lit.frag only runs where its depth matches
+	MaterialPipeline depthPrepassPipeline;
+	MaterialPipeline opaqueDepthEqualPipeline;
+
+	// Writes opaque surfaces into the G-buffer for the deferred path
+	MaterialPipeline gBufferPipeline;
+
+	// Same as the above with meshlet.task and meshlet.mesh in place of mesh.vert, only built when mesh shaders are supported
+	MaterialPipeline meshletOpaquePipeline{};
+	MaterialPipeline meshletTransparentPipeline{};
+	MaterialPipeline meshletNormalsPipeline{};
+
+	// Read every material from BindlessMaterials, so batches only split by pass. Set 1 is the bindless set.
+	MaterialPipeline bindlessOpaquePipeline;
+	MaterialPipeline bindlessTransparentPipeline;
+	MaterialPipeline bindlessGBufferPipeline;
+
 	VkDescriptorSetLayout materialLayout;
 
-	struct MaterialConstants
-	{
-		glm::vec4 colorFactors;
-		glm::vec4 metalRoughFactors;
+	// 32 bytes per material in one storage buffer, rather than a uniform buffer range padded to the offset alignment
+	using MaterialConstants = GPUMaterialConstants;
 
-		glm::vec4 extra[14];
+	// Mirrored in material_structures.glsl
+	enum MaterialFlags : uint32_t
+	{
+		// Albedo wasn't premultiplied on upload, which block-compressed textures can't be
+		MATERIAL_FLAG_STRAIGHT_ALPHA = 1 << 0
 	};
 
 	struct MaterialResources
@@ -113,16 +211,18 @@ struct PBRMaterial
 		VkSampler normalSampler;
 		AllocatedImage metalRoughAOImage;
 		VkSampler metalRoughAOSampler;
-		VkBuffer dataBuffer;
-		uint32_t dataBufferOffset;
 	};
 
-	DescriptorWriter writer;
-
 	void buildPipelines(VulkanEngine* engine);
 	void clearResources(VkDevice device);
 
+	MaterialPipeline* getMeshletPipeline(MaterialPipeline const* pipeline);
+
 	MaterialInstance writeMaterial(VkDevice device, MaterialPass pass, MaterialResources const& resources, DescriptorAllocatorGrowable& descriptorAllocator);
+	// Stores the material's constants for every pipeline and its textures for the bindless ones.
+	// Returns the material's index for GPUObjectData::materialIndex.
+	static uint32_t writeBindlessMaterial(BindlessMaterials& bindlessMaterials, MaterialConstants const& constants,
+		std::optional<GPUMaterialExtension> const& extension, MaterialResources const& resources);
 };
 
 struct EngineStats
@@ -131,8 +231,18 @@ struct EngineStats
 	float frameTime;
 	int triangleCount;
 	int drawCallCount;
+	int surfaceCount;
 	float sceneUpdateTime;
 	float meshDrawTime;
+	float skyboxDrawTime;
+	float cullTime;
+	int visibleCount;
+	int culledCount;
+	int occludedCount;
+	int lodSavedTriangleCount;
+	uint32_t uploadAllocationCount;
+	size_t uploadBytes;
+	size_t uploadCapacity;
 };
 
 class VulkanEngine
@@ -152,8 +262,43 @@ public:
 	bool debugDrawFrustum = false;
 	bool debugDrawNormals = false;
 
+	enum CullingMode : int
+	{
+		NoCulling,
+		CPUCulling,  // SIMD frustum test on the worker pool, invisible objects are skipped when recording
+		GPUCulling,  // Compute pass zeroes instanceCount of invisible objects in the per-frame command buffer
+		ClusterCulling, // Compute pass culls every meshlet and writes the triangles of visible ones into a per-frame index buffer
+		MeshShading  // Task shader culls meshlets and the mesh shader draws them, only when meshShadingSupported
+	} cullingMode = GPUCulling;
+
+	enum RenderPath : int
+	{
+		ForwardRendering,  // lit.frag shades every fragment from its light cluster
+		DeferredRendering  // Opaque surfaces go to the G-buffer and are shaded once per pixel from their screen tile's lights,
+		                   // transparent ones are still forward. Not with mesh shaders or normal shading.
+	} renderPath = ForwardRendering;
+
+	// VK_EXT_mesh_shader is optional, ClusterCulling gives the same result with a compute pass everywhere else
+	bool meshShadingSupported = false;
+	PFN_vkCmdDrawMeshTasksEXT cmdDrawMeshTasks = nullptr;
+	// Optional as well, without it glTF textures skip their KTX2 and DDS sources and cooked scenes can't be loaded
+	bool textureCompressionBCSupported = false;
+
 	bool vSyncEnabled = false;
 	bool drawSkybox = true;
+	// Only the CPU and GPU cull paths pick LODs, the others always draw full detail
+	bool lodEnabled = true;
+	float lodErrorPixels = 1.0f;
+	// Two-phase depth pyramid test on top of GPUCulling, only when the main camera is also the one drawn
+	bool occlusionCulling = true;
+	// Opaque depth is laid down first so lit.frag shades each pixel once, not with mesh shaders or bindless materials
+	bool depthPrepass = false;
+	// Draws through the bindless pipelines, one multi-draw per pass whatever the material count. Not with mesh shaders
+	// or normal shading, which still bind a material set per batch.
+	bool bindlessMaterialsEnabled = false;
+	// Read by the loading thread when a glTF is loaded, cooked scenes are always optimized and have LODs
+	std::atomic<bool> optimizeMeshes = true;
+	std::atomic<bool> generateLods = true;
 	glm::vec3 clearColor = { 0.01f, 0.01f, 0.01f };
 
 	EngineStats stats;
@@ -189,6 +334,42 @@ public:
 	VkExtent2D drawExtent = { 1, 1 };
 	float renderScale = 1.0f;
 
+	// Min depth mip chain of the last frame's early pass, level 0 covers drawExtent at the largest power of two that
+	// fits in depthImage. Stays in VK_IMAGE_LAYOUT_GENERAL.
+	AllocatedImage depthPyramid;
+	VkExtent2D depthPyramidExtent;
+	uint32_t depthPyramidLevels;
+	std::vector<VkImageView> depthPyramidMips;
+	VkSampler depthPyramidSampler;
+	// Read by the cull pass, and one set per level for building it
+	VkDescriptorSetLayout depthPyramidDescriptorLayout;
+	VkDescriptorSet depthPyramidDescriptors;
+	VkDescriptorSetLayout depthPyramidBuildDescriptorLayout;
+	std::vector<VkDescriptorSet> depthPyramidBuildDescriptors;
+	// Nothing has been drawn into it yet, or not since the view and projection below
+	bool depthPyramidValid = false;
+	glm::mat4 depthPyramidView;
+	glm::mat4 depthPyramidProj;
+
+	// Sized like drawImage, written by the deferred path's opaque pass and read by its lighting pass
+	std::array<AllocatedImage, 3> gBuffer;
+	VkSampler gBufferSampler;
+	// Depth, then the G-buffer images in order
+	VkDescriptorSetLayout gBufferDescriptorLayout;
+	VkDescriptorSet gBufferDescriptors;
+
+	// Shared by every frame, only copied to when a light changes
+	ResidentLightBuffer directionalLightBuffer;
+	ResidentLightBuffer pointLightBuffer;
+	ResidentLightBuffer spotLightBuffer;
+
+	// Point lights spawned by the Scene window's benchmark, kept at the end of scene.pointLights
+	int benchmarkLightCount = 1000;
+	size_t spawnedBenchmarkLights = 0;
+
+	// Node of the static scene moved from the Scene window, through updateNodeTransform
+	std::string selectedNodeName;
+
 	std::vector<VkImage> swapchainImages;
 	std::vector<VkImageView> swapchainImageViews;
 	VkExtent2D swapchainExtent;
@@ -201,6 +382,12 @@ public:
 
 	VkQueue graphicsQueue;
 	uint32_t graphicsQueueFamily;
+	// Queues are externally synchronized, and the uploader can submit from loading threads
+	std::mutex graphicsQueueMutex;
+
+	VkQueue transferQueue;
+	uint32_t transferQueueFamily;
+	UploadManager uploader;
 
 	CallbackQueue mainDeletionQueue;
 	CallbackQueue sceneDeletionQueue;
@@ -210,6 +397,10 @@ public:
 	VkFence immFence;
 	VkCommandBuffer immCommandBuffer;
 	VkCommandPool immCommandPool;
+	std::mutex immediateSubmitMutex;
+
+	// Timeline value of the uploads the render thread itself depends on
+	uint64_t frameUploadValue = 0;
 
 	std::vector<ComputeEffect> backgroundEffects;
 	int currentBackgroundEffect = 0;
@@ -237,15 +428,81 @@ public:
 
 	MaterialPipeline defaultPipeline;
 	VkDescriptorSetLayout defaultDescriptorLayout;
+
+	VkPipeline cullPipeline;
+	VkPipelineLayout cullPipelineLayout;
+
+	VkPipeline clusterCullPipeline;
+	VkPipelineLayout clusterCullPipelineLayout;
+
+	VkPipeline depthPyramidPipeline;
+	VkPipelineLayout depthPyramidPipelineLayout;
+
+	VkPipeline lightCullPipeline;
+	VkPipelineLayout lightCullPipelineLayout;
+
+	VkPipeline tileLightCullPipeline;
+	VkPipelineLayout tileLightCullPipelineLayout;
+	MaterialPipeline deferredLightingPipeline;
+
+	MaterialPipeline skyboxPipeline;
+	VkDescriptorSetLayout skyboxDescriptorLayout;
 	MeshData lineCube;
 	MeshData cube;
 
+	GeometryPool geometryPool;
+	BindlessMaterials bindlessMaterials;
+
 	DrawContext mainDrawContext;
 
 	Scene scene;
 	bool indirectDrawInitialized = false;
 
 	AllocatedBuffer drawIndirectCommandBuffer;
+	AllocatedBuffer objectBuffer;
+	VkDeviceAddress objectBufferAddress;
+	std::vector<uint32_t> dirtyObjects;
+	std::vector<DrawBatch> drawBatches;
+	std::vector<uint32_t> batchDrawCounts;
+	// Opaque batches come first and never share a batch with transparent objects
+	size_t opaqueBatchCount = 0;
+	// Whether the batches were built for the bindless pipelines, split by pass rather than by material
+	bool batchesBindless = false;
+
+	// Whether each object was drawn by this frame's early occlusion pass
+	AllocatedBuffer drawnEarlyBuffer;
+	VkDeviceAddress drawnEarlyBufferAddress;
+	// Set by cullGeometry, drawGeometry then builds the depth pyramid and runs the late pass between two render passes
+	bool occlusionActive = false;
+	LodSettings lodSettings;
+
+	// Every object's GPUSurfaceLods, firstLod into this for each object
+	AllocatedBuffer lodBuffer;
+	VkDeviceAddress lodBufferAddress;
+	std::vector<uint32_t> objectFirstLods;
+
+	AllocatedBuffer clusterBuffer;
+	VkDeviceAddress clusterBufferAddress;
+	uint32_t clusterCount = 0;
+	// This frame's GPUClusterCullData, written by cullGeometry and read by the task shader in drawGeometry
+	VkDeviceAddress clusterCullDataAddress = 0;
+
+	ThreadPool workerPool;
+	CullingData cullingData;
+	std::vector<uint32_t> visibleDraws;
+	// Triangles drawn this frame, summed by the CPU cull path or read back from the GPU with the visible count
+	int visibleTriangleCount = 0;
+
+	// Scenes and HDRIs load on their own thread and are swapped in at the start of a frame
+	ThreadPool loaderPool;
+	LoadProgress loadProgress;
+	std::atomic<int> loadsInFlight = 0;
+	std::mutex pendingLoadMutex;
+	std::string currentLoadName;
+	std::optional<std::shared_ptr<LoadedGLTF>> pendingScene;
+	std::string pendingSceneName;
+	std::optional<Skybox> pendingSkybox;
+	std::string currentSceneName = "default";
 
 	void init();
 	void cleanup();
@@ -253,29 +510,45 @@ public:
 	void loadScene(std::string_view filePath);
 	void queueLoadHDRI(std::string filePath);
 	void loadHDRI(std::string_view filePath);
-	void saveScene(std::shared_ptr<LoadedGLTF> scene) {}
+	void applyPendingLoads();
+	// Runs the function once every frame in flight has finished with the resources it destroys
+	void deferDestruction(std::function<void()>&& function);
+	// Cooks the glTF the scene came from into a .pscn next to it, on the loader thread
+	void saveScene(std::shared_ptr<LoadedGLTF> scene);
 	void draw();
 	void drawBackground(VkCommandBuffer cmd) const;
+	void uploadDirtyObjects(VkCommandBuffer cmd);
+	void uploadDirtyLights(VkCommandBuffer cmd);
+	void cullGeometry(VkCommandBuffer cmd);
 	void drawGeometry(VkCommandBuffer cmd);
 	void drawImgui(VkCommandBuffer cmd, VkImageView targetImageView) const;
 	void updateScene(float delta);
+	void updateNodeTransform(Node& node, glm::mat4 const& localTransform);
 	void run();
 
-	void immediateSubmit(std::function<void(VkCommandBuffer cmd)>&& function) const;
-
-	GPUMeshBuffers uploadMesh(std::span<uint32_t> indices, std::span<Vertex> vertices) const;
+	void immediateSubmit(std::function<void(VkCommandBuffer cmd)>&& function);
 
 	AllocatedBuffer createBuffer(size_t allocSize, VkBufferUsageFlags usage, VmaMemoryUsage memoryUsage) const;
 	void destroyBuffer(AllocatedBuffer const& buffer) const;
 
 	AllocatedImage createImage(VkExtent3D size, VkFormat format, VkImageUsageFlags usage, bool mipmapped = false) const;
-	AllocatedImage createImage(void const* data, VkExtent3D size, VkFormat format, VkImageUsageFlags usage, bool mipmapped = false) const;
+	// Data is in the source layout of the conversion, see ImageConversion
+	AllocatedImage createImage(void const* data, VkExtent3D size, VkFormat format, VkImageUsageFlags usage, bool mipmapped = false, ImageConversion conversion = ImageConversion::None);
+	// Uploads every mip stored in the texture, nothing is generated
+	AllocatedImage createImage(CompressedTexture const& texture);
+	// Same for block-compressed mips that live somewhere else, e.g. a mapped .pscn. Region offsets are relative to data.
+	AllocatedImage createImage(std::span<uint8_t const> data, VkExtent3D size, VkFormat format, std::span<VkBufferImageCopy const> regions);
 	void destroyImage(AllocatedImage const& img) const;
 
 private:
 
 	void initScene(std::shared_ptr<LoadedGLTF> newScene);
 	void cleanupScene();
+	void retireScene();
+	void retireSceneBuffers();
+	void destroySkybox(Skybox& skybox) const;
+
+	AllocatedImage allocateImage(VkExtent3D size, VkFormat format, VkImageUsageFlags usage, uint32_t mipLevels) const;
 
 	void initVulkan();
 	void initSwapchain();
@@ -283,9 +556,28 @@ private:
 	void initSyncStructs();
 
 	void initDescriptors();
+	void initUploadArenas();
+	void initBindlessMaterials();
 
 	void initPipelines();
 	void initBackgroundPipelines();
+	void initCullPipeline();
+	void initClusterCullPipeline();
+	void initDepthPyramid();
+	void initDepthPyramidPipeline();
+	void cullObjects(VkCommandBuffer cmd, CullPass pass);
+	void waitForCull(VkCommandBuffer cmd) const;
+	void copyCullStats(VkCommandBuffer cmd) const;
+	void buildDepthPyramid(VkCommandBuffer cmd);
+	void initLightClusters();
+	void initLightCullPipeline();
+	void cullLights(VkCommandBuffer cmd, GPULightData& lightData);
+	void initGBuffer();
+	void initDeferredPipelines();
+	void drawDeferredLighting(VkCommandBuffer cmd, GPULightData const& lightData, VkDescriptorSet globalDescriptor);
+	void spawnBenchmarkLights(int count);
+	void removeBenchmarkLights();
+	void initSkyboxPipeline();
 	void initDebugPipelines();
 	//void initMeshPipeline();
 
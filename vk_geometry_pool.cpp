@@ -0,0 +1,297 @@
+#include "vk_geometry_pool.h"
+
+#include <algorithm>
+#include <iostream>
+#include <utility>
+
+#include "vk_engine.h"
+
+void RangeAllocator::init(uint32_t const capacity)
+{
+	this->capacity = capacity;
+	used = 0;
+	freeRanges.clear();
+	if (capacity > 0)
+	{
+		freeRanges.push_back({ .offset = 0, .count = capacity });
+	}
+}
+
+std::optional<uint32_t> RangeAllocator::allocate(uint32_t const count)
+{
+	// e.g. a mesh with no triangles has no meshlets, which shouldn't need a free range
+	if (count == 0)
+	{
+		return 0;
+	}
+
+	for (auto it = freeRanges.begin(); it != freeRanges.end(); ++it)
+	{
+		if (it->count >= count)
+		{
+			uint32_t const offset = it->offset;
+			it->offset += count;
+			it->count -= count;
+			if (it->count == 0)
+			{
+				freeRanges.erase(it);
+			}
+			used += count;
+			return offset;
+		}
+	}
+	return std::nullopt;
+}
+
+void RangeAllocator::release(GeometryRange const range)
+{
+	if (range.count == 0)
+	{
+		return;
+	}
+
+	used -= range.count;
+
+	auto const next = std::ranges::lower_bound(freeRanges, range.offset, {}, &GeometryRange::offset);
+	auto const inserted = freeRanges.insert(next, range);
+
+	// merge with the following range, then the preceding one
+	if (auto const after = inserted + 1; after != freeRanges.end() && inserted->offset + inserted->count == after->offset)
+	{
+		inserted->count += after->count;
+		freeRanges.erase(after);
+	}
+	if (inserted != freeRanges.begin())
+	{
+		if (auto const before = inserted - 1; before->offset + before->count == inserted->offset)
+		{
+			before->count += inserted->count;
+			freeRanges.erase(inserted);
+		}
+	}
+}
+
+void RangeAllocator::grow(uint32_t const newCapacity)
+{
+	if (newCapacity <= capacity)
+	{
+		return;
+	}
+
+	GeometryRange const added{ .offset = capacity, .count = newCapacity - capacity };
+	capacity = newCapacity;
+	// release() counts the range as previously used
+	used += added.count;
+	release(added);
+}
+
+VkDeviceSize GeometryAllocation::getVertexDataOffset() const
+{
+	return static_cast<VkDeviceSize>(vertices.offset) * GeometryPool::vertexBlockSize;
+}
+
+void GeometryPool::init(VulkanEngine* engine, size_t const vertexDataCapacity, uint32_t const indexCapacity, uint32_t const meshletCapacity,
+	uint32_t const meshletDataCapacity)
+{
+	this->engine = engine;
+	Capacities const capacities
+	{
+		.vertexBlocks = static_cast<uint32_t>(vertexDataCapacity / vertexBlockSize),
+		.indices = indexCapacity,
+		.meshlets = meshletCapacity,
+		.meshletData = meshletDataCapacity
+	};
+	vertexRanges.init(capacities.vertexBlocks);
+	indexRanges.init(capacities.indices);
+	meshletRanges.init(capacities.meshlets);
+	meshletDataRanges.init(capacities.meshletData);
+	createBuffers(capacities, false);
+}
+
+void GeometryPool::cleanup()
+{
+	for (AllocatedBuffer const& buffer : retiredBuffers)
+	{
+		engine->destroyBuffer(buffer);
+	}
+	retiredBuffers.clear();
+
+	engine->destroyBuffer(vertexBuffer);
+	engine->destroyBuffer(indexBuffer);
+	engine->destroyBuffer(meshletBuffer);
+	engine->destroyBuffer(meshletDataBuffer);
+	vertexBufferAddress = 0;
+	meshletBufferAddress = 0;
+	meshletDataBufferAddress = 0;
+}
+
+void GeometryPool::createBuffers(Capacities const& capacities, bool const copyExisting)
+{
+	VkBufferUsageFlags constexpr storageUsage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT;
+
+	// Meshes are uploaded on the transfer queue into ranges next to ones being drawn, so the buffers are shared between queues
+	AllocatedBuffer const newVertexBuffer = engine->uploader.createBuffer(static_cast<size_t>(capacities.vertexBlocks) * vertexBlockSize, storageUsage);
+	AllocatedBuffer const newIndexBuffer = engine->uploader.createBuffer(static_cast<size_t>(capacities.indices) * sizeof(uint32_t), VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT);
+	AllocatedBuffer const newMeshletBuffer = engine->uploader.createBuffer(static_cast<size_t>(capacities.meshlets) * sizeof(Meshlet), storageUsage);
+	AllocatedBuffer const newMeshletDataBuffer = engine->uploader.createBuffer(static_cast<size_t>(capacities.meshletData) * sizeof(uint32_t), storageUsage);
+
+	// Existing contents have to be in the new buffers before the render thread can see them
+	if (copyExisting)
+	{
+		engine->immediateSubmit([&](VkCommandBuffer const cmd)
+			{
+				auto copy = [&](AllocatedBuffer const& from, AllocatedBuffer const& to, VkDeviceSize const size)
+				{
+					if (size == 0)
+					{
+						return;
+					}
+					VkBufferCopy const region
+					{
+						.srcOffset = 0,
+						.dstOffset = 0,
+						.size = size
+					};
+					vkCmdCopyBuffer(cmd, from.buffer, to.buffer, 1, &region);
+				};
+
+				copy(vertexBuffer, newVertexBuffer, static_cast<VkDeviceSize>(vertexRanges.getCapacity()) * vertexBlockSize);
+				copy(indexBuffer, newIndexBuffer, static_cast<VkDeviceSize>(indexRanges.getCapacity()) * sizeof(uint32_t));
+				copy(meshletBuffer, newMeshletBuffer, static_cast<VkDeviceSize>(meshletRanges.getCapacity()) * sizeof(Meshlet));
+				copy(meshletDataBuffer, newMeshletDataBuffer, static_cast<VkDeviceSize>(meshletDataRanges.getCapacity()) * sizeof(uint32_t));
+			});
+
+		retiredBuffers.insert(retiredBuffers.end(), { vertexBuffer, indexBuffer, meshletBuffer, meshletDataBuffer });
+	}
+
+	auto getAddress = [&](AllocatedBuffer const& buffer)
+	{
+		VkBufferDeviceAddressInfo const deviceAddressInfo{ .sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO, .buffer = buffer.buffer };
+		return vkGetBufferDeviceAddress(engine->device, &deviceAddressInfo);
+	};
+	VkDeviceAddress const newVertexBufferAddress = getAddress(newVertexBuffer);
+	VkDeviceAddress const newMeshletBufferAddress = getAddress(newMeshletBuffer);
+	VkDeviceAddress const newMeshletDataBufferAddress = getAddress(newMeshletDataBuffer);
+
+	std::scoped_lock lock(bufferMutex);
+	vertexBuffer = newVertexBuffer;
+	indexBuffer = newIndexBuffer;
+	meshletBuffer = newMeshletBuffer;
+	meshletDataBuffer = newMeshletDataBuffer;
+	vertexBufferAddress = newVertexBufferAddress;
+	meshletBufferAddress = newMeshletBufferAddress;
+	meshletDataBufferAddress = newMeshletDataBufferAddress;
+}
+
+void GeometryPool::grow(Capacities const& minCapacities)
+{
+	Capacities const newCapacities
+	{
+		.vertexBlocks = std::max(minCapacities.vertexBlocks, vertexRanges.getCapacity() * 2),
+		.indices = std::max(minCapacities.indices, indexRanges.getCapacity() * 2),
+		.meshlets = std::max(minCapacities.meshlets, meshletRanges.getCapacity() * 2),
+		.meshletData = std::max(minCapacities.meshletData, meshletDataRanges.getCapacity() * 2)
+	};
+
+	std::cout << "> geometry pool grown to " << static_cast<size_t>(newCapacities.vertexBlocks) * vertexBlockSize / 1024 << " KiB of vertices, "
+		<< newCapacities.indices << " indices, " << newCapacities.meshlets << " meshlets." << std::endl;
+
+	createBuffers(newCapacities, true);
+
+	vertexRanges.grow(newCapacities.vertexBlocks);
+	indexRanges.grow(newCapacities.indices);
+	meshletRanges.grow(newCapacities.meshlets);
+	meshletDataRanges.grow(newCapacities.meshletData);
+}
+
+std::vector<AllocatedBuffer> GeometryPool::takeRetiredBuffers()
+{
+	std::scoped_lock lock(mutex);
+	return std::exchange(retiredBuffers, {});
+}
+
+GeometryAllocation GeometryPool::upload(std::span<uint32_t const> const indices, std::span<Vertex const> const vertices, VertexFormat const vertexFormat,
+	MeshletData const& meshlets)
+{
+	std::vector<uint8_t> const vertexData = encode_vertices(vertices, vertexFormat);
+	return upload(indices, vertexData, vertexFormat, meshlets.meshlets, meshlets.data);
+}
+
+GeometryAllocation GeometryPool::upload(std::span<uint32_t const> const indices, std::span<uint8_t const> const vertexData, VertexFormat const vertexFormat,
+	std::span<Meshlet const> const meshlets, std::span<uint32_t const> const meshletData)
+{
+	std::scoped_lock lock(mutex);
+
+	Capacities const counts
+	{
+		.vertexBlocks = static_cast<uint32_t>((vertexData.size() + vertexBlockSize - 1) / vertexBlockSize),
+		.indices = static_cast<uint32_t>(indices.size()),
+		.meshlets = static_cast<uint32_t>(meshlets.size()),
+		.meshletData = static_cast<uint32_t>(meshletData.size())
+	};
+
+	std::optional<uint32_t> vertexOffset = vertexRanges.allocate(counts.vertexBlocks);
+	std::optional<uint32_t> indexOffset = indexRanges.allocate(counts.indices);
+	std::optional<uint32_t> meshletOffset = meshletRanges.allocate(counts.meshlets);
+	std::optional<uint32_t> meshletDataOffset = meshletDataRanges.allocate(counts.meshletData);
+	if (!vertexOffset.has_value() || !indexOffset.has_value() || !meshletOffset.has_value() || !meshletDataOffset.has_value())
+	{
+		auto releaseIfAllocated = [](RangeAllocator& ranges, std::optional<uint32_t> const offset, uint32_t const count)
+		{
+			if (offset.has_value())
+			{
+				ranges.release({ .offset = *offset, .count = count });
+			}
+		};
+		releaseIfAllocated(vertexRanges, vertexOffset, counts.vertexBlocks);
+		releaseIfAllocated(indexRanges, indexOffset, counts.indices);
+		releaseIfAllocated(meshletRanges, meshletOffset, counts.meshlets);
+		releaseIfAllocated(meshletDataRanges, meshletDataOffset, counts.meshletData);
+
+		grow(Capacities
+			{
+				.vertexBlocks = vertexRanges.getCapacity() + counts.vertexBlocks,
+				.indices = indexRanges.getCapacity() + counts.indices,
+				.meshlets = meshletRanges.getCapacity() + counts.meshlets,
+				.meshletData = meshletDataRanges.getCapacity() + counts.meshletData
+			});
+
+		vertexOffset = vertexRanges.allocate(counts.vertexBlocks);
+		indexOffset = indexRanges.allocate(counts.indices);
+		meshletOffset = meshletRanges.allocate(counts.meshlets);
+		meshletDataOffset = meshletDataRanges.allocate(counts.meshletData);
+	}
+
+	GeometryAllocation const allocation
+	{
+		.vertices = { .offset = *vertexOffset, .count = counts.vertexBlocks },
+		.indices = { .offset = *indexOffset, .count = counts.indices },
+		.meshlets = { .offset = *meshletOffset, .count = counts.meshlets },
+		.meshletData = { .offset = *meshletDataOffset, .count = counts.meshletData },
+		.vertexFormat = vertexFormat
+	};
+
+	std::vector<Meshlet> rebasedMeshlets(meshlets.begin(), meshlets.end());
+	for (Meshlet& meshlet : rebasedMeshlets)
+	{
+		meshlet.dataOffset += allocation.meshletData.offset;
+	}
+
+	// Recorded into the uploader's current batch, the data is usable once its timeline value is reached
+	engine->uploader.uploadBuffer(vertexBuffer.buffer, allocation.getVertexDataOffset(), vertexData.data(), vertexData.size());
+	engine->uploader.uploadBuffer(indexBuffer.buffer, static_cast<VkDeviceSize>(allocation.indices.offset) * sizeof(uint32_t), indices.data(), indices.size_bytes());
+	engine->uploader.uploadBuffer(meshletBuffer.buffer, static_cast<VkDeviceSize>(allocation.meshlets.offset) * sizeof(Meshlet), rebasedMeshlets.data(), rebasedMeshlets.size() * sizeof(Meshlet));
+	engine->uploader.uploadBuffer(meshletDataBuffer.buffer, static_cast<VkDeviceSize>(allocation.meshletData.offset) * sizeof(uint32_t), meshletData.data(), meshletData.size_bytes());
+
+	return allocation;
+}
+
+void GeometryPool::free(GeometryAllocation const& allocation)
+{
+	std::scoped_lock lock(mutex);
+
+	vertexRanges.release(allocation.vertices);
+	indexRanges.release(allocation.indices);
+	meshletRanges.release(allocation.meshlets);
+	meshletDataRanges.release(allocation.meshletData);
+}
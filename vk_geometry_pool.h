@@ -0,0 +1,117 @@
+#pragma once
+
+#include <mutex>
+
+#include "meshlet.h"
+#include "vertex_format.h"
+#include "vk_types.h"
+
+class VulkanEngine;
+
+struct GeometryRange
+{
+	uint32_t offset;
+	uint32_t count;
+};
+
+// First-fit free list over [0, capacity). Ranges are kept sorted by offset and neighbours are merged on release.
+class RangeAllocator
+{
+public:
+	void init(uint32_t capacity);
+
+	std::optional<uint32_t> allocate(uint32_t count);
+	void release(GeometryRange range);
+	void grow(uint32_t newCapacity);
+
+	uint32_t getCapacity() const { return capacity; }
+	uint32_t getUsed() const { return used; }
+
+private:
+	std::vector<GeometryRange> freeRanges;
+	uint32_t capacity = 0;
+	uint32_t used = 0;
+};
+
+struct GeometryAllocation
+{
+	// in vertexBlockSize blocks, each mesh's vertex data starts on a block
+	GeometryRange vertices;
+	GeometryRange indices;
+	GeometryRange meshlets;
+	// in uint32s
+	GeometryRange meshletData;
+	VertexFormat vertexFormat;
+
+	VkDeviceSize getVertexDataOffset() const;
+};
+
+// One device-local vertex buffer and one index buffer shared by every loaded mesh, plus the meshlets of every mesh.
+// Meshes store their vertices in different formats, so the vertex buffer is handed out in blocks and shaders
+// get the address of a mesh's first vertex. Indices stay relative to their mesh, draws use firstIndex = indices.offset
+// and no vertexOffset. Meshlet data offsets are rebased onto the pool's meshlet data buffer on upload.
+// Uploads may come from the loading thread while the render thread draws from the pool. When the pool grows,
+// the old buffers are kept until the render thread collects them with takeRetiredBuffers.
+class GeometryPool
+{
+public:
+	static uint32_t constexpr vertexBlockSize = 16;
+
+	void init(VulkanEngine* engine, size_t vertexDataCapacity, uint32_t indexCapacity, uint32_t meshletCapacity, uint32_t meshletDataCapacity);
+	void cleanup();
+
+	// Encodes the vertices in the given format
+	GeometryAllocation upload(std::span<uint32_t const> indices, std::span<Vertex const> vertices, VertexFormat vertexFormat,
+		MeshletData const& meshlets);
+	// Vertex data already in the given format, e.g. from a cooked scene
+	GeometryAllocation upload(std::span<uint32_t const> indices, std::span<uint8_t const> vertexData, VertexFormat vertexFormat,
+		std::span<Meshlet const> meshlets, std::span<uint32_t const> meshletData);
+	void free(GeometryAllocation const& allocation);
+
+	VkBuffer getIndexBuffer() const { std::scoped_lock lock(bufferMutex); return indexBuffer.buffer; }
+	VkDeviceAddress getVertexBufferAddress() const { std::scoped_lock lock(bufferMutex); return vertexBufferAddress; }
+	VkDeviceAddress getMeshletBufferAddress() const { std::scoped_lock lock(bufferMutex); return meshletBufferAddress; }
+	VkDeviceAddress getMeshletDataBufferAddress() const { std::scoped_lock lock(bufferMutex); return meshletDataBufferAddress; }
+
+	// Returns the buffers replaced by a grow since the last call, anything built from their handles is stale
+	std::vector<AllocatedBuffer> takeRetiredBuffers();
+
+	size_t getVertexDataCapacity() const { std::scoped_lock lock(mutex); return static_cast<size_t>(vertexRanges.getCapacity()) * vertexBlockSize; }
+	size_t getVertexDataUsed() const { std::scoped_lock lock(mutex); return static_cast<size_t>(vertexRanges.getUsed()) * vertexBlockSize; }
+	uint32_t getIndexCapacity() const { std::scoped_lock lock(mutex); return indexRanges.getCapacity(); }
+	uint32_t getIndicesUsed() const { std::scoped_lock lock(mutex); return indexRanges.getUsed(); }
+	uint32_t getMeshletsUsed() const { std::scoped_lock lock(mutex); return meshletRanges.getUsed(); }
+
+private:
+	struct Capacities
+	{
+		uint32_t vertexBlocks;
+		uint32_t indices;
+		uint32_t meshlets;
+		uint32_t meshletData;
+	};
+
+	void createBuffers(Capacities const& capacities, bool copyExisting);
+	void grow(Capacities const& minCapacities);
+
+	VulkanEngine* engine = nullptr;
+
+	AllocatedBuffer vertexBuffer;
+	AllocatedBuffer indexBuffer;
+	AllocatedBuffer meshletBuffer;
+	AllocatedBuffer meshletDataBuffer;
+	VkDeviceAddress vertexBufferAddress = 0;
+	VkDeviceAddress meshletBufferAddress = 0;
+	VkDeviceAddress meshletDataBufferAddress = 0;
+
+	RangeAllocator vertexRanges;
+	RangeAllocator indexRanges;
+	RangeAllocator meshletRanges;
+	RangeAllocator meshletDataRanges;
+
+	std::vector<AllocatedBuffer> retiredBuffers;
+
+	// mutex guards the allocators and uploads, bufferMutex only the current buffer handles
+	mutable std::mutex mutex;
+	mutable std::mutex bufferMutex;
+};
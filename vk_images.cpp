@@ -19,7 +19,8 @@ void vkUtil::transition_image(VkCommandBuffer const cmd, VkImage const image, Vk
 		.newLayout = newLayout
 	};
 
-	VkImageAspectFlags const aspectMask = (newLayout == VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL) ? VK_IMAGE_ASPECT_DEPTH_BIT : VK_IMAGE_ASPECT_COLOR_BIT;
+	bool const depthLayout = newLayout == VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL || newLayout == VK_IMAGE_LAYOUT_DEPTH_READ_ONLY_OPTIMAL;
+	VkImageAspectFlags const aspectMask = depthLayout ? VK_IMAGE_ASPECT_DEPTH_BIT : VK_IMAGE_ASPECT_COLOR_BIT;
 	imageBarrier.subresourceRange = vkInit::image_subresource_range(aspectMask);
 	imageBarrier.image = image;
 
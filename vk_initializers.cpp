@@ -177,7 +177,7 @@ VkRenderingAttachmentInfo vkInit::attachment_info(VkImageView const view, VkClea
 	return colorAttachment;
 }
 
-VkRenderingAttachmentInfo vkInit::depth_attachment_info(VkImageView const view, VkImageLayout const layout)
+VkRenderingAttachmentInfo vkInit::depth_attachment_info(VkImageView const view, VkImageLayout const layout, VkAttachmentLoadOp const loadOp)
 {
 	VkRenderingAttachmentInfo const depthAttachment
 	{
@@ -185,7 +185,7 @@ VkRenderingAttachmentInfo vkInit::depth_attachment_info(VkImageView const view,
 		.pNext = nullptr,
 		.imageView = view,
 		.imageLayout = layout,
-		.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR,
+		.loadOp = loadOp,
 		.storeOp = VK_ATTACHMENT_STORE_OP_STORE,
 		.clearValue =
 		{
@@ -1,9 +1,21 @@
 #include "vk_loader.h"
 
 #include "stb_image.h"
+#include <algorithm>
 #include <chrono>
+#include <condition_variable>
+#include <format>
+#include <fstream>
 #include <iostream>
-
+#include <map>
+#include <mutex>
+
+#include "compressed_texture.h"
+#include "image_kernels.h"
+#include "mapped_file.h"
+#include "mesh_optimizer.h"
+#include "meshlet.h"
+#include "pscn_format.h"
 #include "vk_engine.h"
 #include "vk_initializers.h"
 #include "vk_images.h"
@@ -15,113 +27,97 @@
 #include "fastgltf/core.hpp"
 #include "fastgltf/tools.hpp"
 
-// could be handled on GPU, maybe in VulkanEngine::CreateImage instead
-void premultiply_alpha(unsigned char* data, VkExtent3D const size)
+struct DecodedImage
+{
+	// RGBA8 from stb_image, freed with stbi_image_free. Null when the source was a compressed container.
+	unsigned char* pixels = nullptr;
+	std::optional<CompressedTexture> compressed;
+	VkExtent3D size;
+	bool mipmapped;
+};
+
+static bool has_compressed_texture_extension(std::filesystem::path const& path)
 {
-	size_t const dataSize = static_cast<size_t>(size.depth) * static_cast<size_t>(size.width) * static_cast<size_t>(size.height) * 4;
+	std::string extension = path.extension().string();
+	std::transform(extension.begin(), extension.end(), extension.begin(), [](char const c) { return static_cast<char>(std::tolower(c)); });
+	return extension == ".ktx2" || extension == ".dds";
+}
 
-	for (int i = 0; i < dataSize; i += 4)
+static std::vector<uint8_t> read_file_bytes(std::string const& filePath)
+{
+	std::ifstream file(filePath, std::ios::binary | std::ios::ate);
+	if (!file.is_open())
 	{
-		uint16_t r = static_cast<uint16_t>(data[i]);
-		uint16_t g = static_cast<uint16_t>(data[i + 1]);
-		uint16_t b = static_cast<uint16_t>(data[i + 2]);
-		uint16_t a = static_cast<uint16_t>(data[i + 3]);
-
-		r = r * a / 255;
-		g = g * a / 255;
-		b = b * a / 255;
-
-		data[i] = static_cast<unsigned char>(r);
-		data[i + 1] = static_cast<unsigned char>(g);
-		data[i + 2] = static_cast<unsigned char>(b);
+		return {};
 	}
+
+	std::vector<uint8_t> bytes(static_cast<size_t>(file.tellg()));
+	file.seekg(0);
+	file.read(reinterpret_cast<char*>(bytes.data()), static_cast<std::streamsize>(bytes.size()));
+	return bytes;
 }
 
-std::optional<AllocatedImage> load_image(VulkanEngine const* engine, fastgltf::Asset& asset, fastgltf::Image& image, std::filesystem::path directory, bool isSrgb = false)
+// Only touches the asset and stb_image, so it is safe to run on any thread.
+// KTX2 and DDS sources are kept block-compressed, everything else is decoded to RGBA8.
+std::optional<DecodedImage> decode_image(fastgltf::Asset const& asset, fastgltf::Image const& image, std::filesystem::path const& directory)
 {
-	AllocatedImage newImage{};
+	unsigned char* data = nullptr;
+	std::optional<CompressedTexture> compressed;
+	bool mipmapped = false;
 
 	int width, height, nrChannels;
 
-	VkFormat imageFormat = isSrgb ? VK_FORMAT_R8G8B8A8_SRGB : VK_FORMAT_R8G8B8A8_UNORM;
+	auto const decodeMemory = [&](uint8_t const* bytes, size_t const size)
+	{
+		if (is_compressed_texture_container(std::span(bytes, size)))
+		{
+			compressed = parse_compressed_texture(std::vector<uint8_t>(bytes, bytes + size));
+		}
+		else
+		{
+			data = stbi_load_from_memory(bytes, static_cast<int>(size), &width, &height, &nrChannels, 4);
+		}
+	};
 
 	std::visit(
 		fastgltf::visitor
 		{
-			[](auto& arg) {},
-			[&](fastgltf::sources::URI& filePath)
+			[](auto const& arg) {},
+			[&](fastgltf::sources::URI const& filePath)
 			{
 				assert(filePath.fileByteOffset == 0); // We don't support offsets with stbi.
 				assert(filePath.uri.isLocalPath()); // We're only capable of loading local files.\
 
-				std::string const fixedPath = std::move(directory).string() + "/" + std::string(filePath.uri.path());
+				std::string const fixedPath = directory.string() + "/" + std::string(filePath.uri.path());
 
-				unsigned char* data = stbi_load(fixedPath.c_str(), &width, &height, &nrChannels, 4);
-				if (data)
+				if (has_compressed_texture_extension(fixedPath))
 				{
-					VkExtent3D const imageSize
-					{
-						.width = static_cast<uint32_t>(width),
-						.height = static_cast<uint32_t>(height),
-						.depth = 1
-					};
-
-					premultiply_alpha(data, imageSize);
-					newImage = engine->createImage(data, imageSize, imageFormat, VK_IMAGE_USAGE_SAMPLED_BIT,false);
-
-					stbi_image_free(data);
+					compressed = parse_compressed_texture(read_file_bytes(fixedPath));
 				}
-			},
-			[&](fastgltf::sources::Array& vector)
-			{
-				unsigned char* data = stbi_load_from_memory(vector.bytes.data(), static_cast<int>(vector.bytes.size()),
-					&width, &height, &nrChannels, 4);
-				if (data)
+				else
 				{
-					VkExtent3D const imageSize
-					{
-						.width = static_cast<uint32_t>(width),
-						.height = static_cast<uint32_t>(height),
-						.depth = 1
-					};
-
-					premultiply_alpha(data, imageSize);
-					newImage = engine->createImage(data, imageSize, imageFormat, VK_IMAGE_USAGE_SAMPLED_BIT,false);
-
-					stbi_image_free(data);
+					data = stbi_load(fixedPath.c_str(), &width, &height, &nrChannels, 4);
 				}
 			},
-			[&](fastgltf::sources::BufferView& view)
+			[&](fastgltf::sources::Array const& vector)
+			{
+				decodeMemory(vector.bytes.data(), vector.bytes.size());
+			},
+			[&](fastgltf::sources::BufferView const& view)
 			{
 				auto const& bufferView = asset.bufferViews[view.bufferViewIndex];
-				auto& buffer = asset.buffers[bufferView.bufferIndex];
+				auto const& buffer = asset.buffers[bufferView.bufferIndex];
 
 				std::visit(fastgltf::visitor
 				{
 					// We only care about VectorWithMime here, because we
 					// specify LoadExternalBuffers, meaning all buffers
 					// are already loaded into a vector.
-					[](auto& arg) {},
-					[&](fastgltf::sources::Array& vector)
+					[](auto const& arg) {},
+					[&](fastgltf::sources::Array const& vector)
 					{
-						unsigned char* data = stbi_load_from_memory(vector.bytes.data() + bufferView.byteOffset,
-							static_cast<int>(bufferView.byteLength),
-							&width, &height, &nrChannels, 4);
-						if (data)
-						{
-							VkExtent3D const imageSize
-							{
-								.width = static_cast<uint32_t>(width),
-								.height = static_cast<uint32_t>(height),
-								.depth = 1
-							};
-
-							premultiply_alpha(data, imageSize);
-							newImage = engine->createImage(data, imageSize, imageFormat,
-								VK_IMAGE_USAGE_SAMPLED_BIT, true);
-
-							stbi_image_free(data);
-						}
+						decodeMemory(vector.bytes.data() + bufferView.byteOffset, bufferView.byteLength);
+						mipmapped = true;
 					}
 				},
 				buffer.data);
@@ -129,14 +125,47 @@ std::optional<AllocatedImage> load_image(VulkanEngine const* engine, fastgltf::A
 		},
 		image.data);
 
-	// if any of the attempts to load the data failed, we haven't written the image
-	// so handle is null
-	if (newImage.image == VK_NULL_HANDLE) {
+	if (compressed.has_value())
+	{
+		VkExtent3D const compressedSize = compressed->size;
+		bool const hasMips = compressed->regions.size() > 1;
+		return DecodedImage{ .compressed = std::move(compressed), .size = compressedSize, .mipmapped = hasMips };
+	}
+
+	// if any of the attempts to load the data failed, we haven't got any pixels
+	if (!data) {
 		return {};
 	}
-	else {
-		return newImage;
+
+	VkExtent3D const imageSize
+	{
+		.width = static_cast<uint32_t>(width),
+		.height = static_cast<uint32_t>(height),
+		.depth = 1
+	};
+
+	return DecodedImage{ .pixels = data, .size = imageSize, .mipmapped = mipmapped };
+}
+
+// Images a texture can use, best first. The compressed sources from KHR_texture_basisu and MSFT_texture_dds
+// come before the plain image, which is only decoded when none of them loaded. They are left out entirely when
+// the device can't sample BC formats.
+static std::vector<size_t> get_texture_image_candidates(fastgltf::Texture const& texture, bool const compressedSupported)
+{
+	std::vector<size_t> candidates;
+	if (texture.basisuImageIndex.has_value() && compressedSupported)
+	{
+		candidates.push_back(texture.basisuImageIndex.value());
+	}
+	if (texture.ddsImageIndex.has_value() && compressedSupported)
+	{
+		candidates.push_back(texture.ddsImageIndex.value());
+	}
+	if (texture.imageIndex.has_value())
+	{
+		candidates.push_back(texture.imageIndex.value());
 	}
+	return candidates;
 }
 
 VkFilter extract_filter(fastgltf::Filter const filter)
@@ -171,36 +200,304 @@ VkSamplerMipmapMode extract_mipmap_mode(fastgltf::Filter const filter)
 	}
 }
 
-std::optional<std::shared_ptr<LoadedGLTF>> load_gltf(VulkanEngine* engine, std::string_view filePath)
+// Appends one primitive in the engine's vertex format, indices are offset to stay relative to the start of vertices
+static void load_primitive(fastgltf::Asset const& gltf, fastgltf::Primitive const& p, std::vector<uint32_t>& indices, std::vector<Vertex>& vertices)
 {
-	VkPhysicalDeviceProperties deviceProperties{};
-	vkGetPhysicalDeviceProperties(engine->selectedGPU, &deviceProperties);
+	size_t const initialVtx = vertices.size();
 
-	std::cout << "Loading glTF: " << filePath << "\n";
+	// load indexes
+	{
+		fastgltf::Accessor const& indexAccessor = gltf.accessors[p.indicesAccessor.value()];
+		indices.reserve(indices.size() + indexAccessor.count);
 
-	auto const startTime = std::chrono::high_resolution_clock::now();
-	auto lastTime = startTime;
+		fastgltf::iterateAccessor<std::uint32_t>(gltf, indexAccessor,
+			[&](uint32_t const idx) 
+			{
+				indices.push_back(idx + static_cast<uint32_t>(initialVtx));
+			});
+	}
 
-	auto scene = std::make_shared<LoadedGLTF>();
-	scene->creator = engine;
-	LoadedGLTF& file = *scene.get();
+	// load vertex positions
+	fastgltf::Accessor const& posAccessor = gltf.accessors[p.findAttribute("POSITION")->second];
+	{
+		vertices.resize(vertices.size() + posAccessor.count);
 
-	fastgltf::Parser parser{};
+		fastgltf::iterateAccessorWithIndex<glm::vec3>(gltf, posAccessor,
+			[&](glm::vec3 const v, size_t const index) 
+			{
+				Vertex newVtx{};
+				newVtx.position = v;
+				newVtx.normal = { 1, 0, 0 };
+				newVtx.color = glm::vec4{ 1.f };
+				newVtx.uv_x = 0;
+				newVtx.uv_y = 0;
+				vertices[initialVtx + index] = newVtx;
+			});
+	}
 
-	auto constexpr gltfOptions = fastgltf::Options::DontRequireValidAssetMember | fastgltf::Options::AllowDouble | fastgltf::Options::LoadGLBBuffers | fastgltf::Options::LoadExternalBuffers;
+	// load vertex normals
+	auto normals = p.findAttribute("NORMAL");
+	if (normals != p.attributes.end()) 
+	{
 
-	fastgltf::GltfDataBuffer data;
-	data.loadFromFile(filePath);
+		fastgltf::iterateAccessorWithIndex<glm::vec3>(gltf, gltf.accessors[(*normals).second],
+			[&](glm::vec3 const v, size_t const index) 
+			{
+				vertices[initialVtx + index].normal = v;
+			});
+	}
 
-	auto currentTime = std::chrono::high_resolution_clock::now();
-	auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(currentTime - lastTime);
-	lastTime = currentTime;
+	// load UVs
+	auto uv = p.findAttribute("TEXCOORD_0");
+	if (uv != p.attributes.end()) 
+	{
+
+		fastgltf::iterateAccessorWithIndex<glm::vec2>(gltf, gltf.accessors[(*uv).second],
+			[&](glm::vec2 const v, size_t const index) 
+			{
+				vertices[initialVtx + index].uv_x = v.x;
+				vertices[initialVtx + index].uv_y = v.y;
+			});
+	}
+
+	// load vertex colors
+	auto colors = p.findAttribute("COLOR_0");
+	if (colors != p.attributes.end()) 
+	{
+		fastgltf::iterateAccessorWithIndex<glm::vec4>(gltf, gltf.accessors[(*colors).second],
+			[&](glm::vec4 const v, size_t const index) 
+			{
+				vertices[initialVtx + index].color = v;
+			});
+	}
 
-	std::cout << "> file loaded in " << elapsed << "." << std::endl;
+	auto tangents = p.findAttribute("TANGENT");
+	if (tangents != p.attributes.end())
+	{
+		fastgltf::iterateAccessorWithIndex<glm::vec4>(gltf, gltf.accessors[(*tangents).second],
+			[&](glm::vec4 const v, size_t const index)
+			{
+				vertices[initialVtx + index].surfaceTangent = v;
+			});
+	}
+	else
+	{
+		// calculate tangents ourselves
+		// perhaps should just use mikktspace instead
+		fastgltf::iterateAccessorWithIndex<glm::vec3>(gltf, posAccessor,
+			[&](glm::vec3 const v, size_t const index)
+			{
+				if (index % 3 == 0 && index + 2 < posAccessor.count)
+				{
+					Vertex& v0 = vertices[initialVtx + index];
+					Vertex& v1 = vertices[initialVtx + index + 1];
+					Vertex& v2 = vertices[initialVtx + index + 2];
 
-	fastgltf::Asset gltf;
+					glm::vec3 const e1 = v1.position - v0.position;
+					glm::vec3 const e2 = v2.position - v0.position;
+					glm::vec2 const dUV1 = { v1.uv_x - v0.uv_x, v1.uv_y - v0.uv_y };
+					glm::vec2 const dUV2 = { v2.uv_x - v0.uv_x, v2.uv_y - v0.uv_y };
 
-	std::filesystem::path path = filePath;
+					float const det = (dUV1.x * dUV2.y - dUV2.x * dUV1.y);
+					if (det == 0)
+					{
+						// Degenerate triangle
+						v0.surfaceTangent = { 1.0f, 0, 0, 0 };
+						v1.surfaceTangent = { 1.0f, 0, 0, 0 };
+						v2.surfaceTangent = { 1.0f, 0, 0, 0 };
+					}
+					else
+					{
+						float const invDet = 1.0f / det;
+						glm::vec3 const tangent = invDet * (dUV2.y * e1 - dUV1.y * e2);
+						// This tangent is not actually orthogonal to normal vector, since vertices have their own normals not necessarily equal to surface normal.
+						// We will perform Gram-Schmidt in vertex shader to fix this.
+						v0.surfaceTangent = glm::vec4(tangent, 0);
+						v1.surfaceTangent = glm::vec4(tangent, 0);
+						v2.surfaceTangent = glm::vec4(tangent, 0);
+					}
+				}
+			});
+	}
+}
+
+static Bounds compute_bounds(std::span<Vertex const> const vertices)
+{
+	glm::vec3 minPos = vertices[0].position;
+	glm::vec3 maxPos = vertices[0].position;
+	for (Vertex const& vertex : vertices)
+	{
+		minPos = glm::min(minPos, vertex.position);
+		maxPos = glm::max(maxPos, vertex.position);
+	}
+
+	Bounds bounds;
+	bounds.origin = (maxPos + minPos) / 2.f;
+	bounds.extents = (maxPos - minPos) / 2.f;
+	bounds.sphereRadius = glm::length(bounds.extents);
+	return bounds;
+}
+
+// Runs the mesh optimizer on the primitive load_primitive just appended. Its indices are relative to the mesh,
+// so they are shifted onto the primitive's own vertices and back. Cache stats before and after are added to the totals.
+static void optimize_primitive(std::span<uint32_t> const indices, std::span<Vertex> const vertices, uint32_t const firstVertex,
+	VertexCacheStats& before, VertexCacheStats& after)
+{
+	for (uint32_t& idx : indices)
+	{
+		idx -= firstVertex;
+	}
+
+	before += analyze_vertex_cache(indices, vertices.size());
+	optimize_mesh(indices, vertices);
+	after += analyze_vertex_cache(indices, vertices.size());
+
+	for (uint32_t& idx : indices)
+	{
+		idx += firstVertex;
+	}
+}
+
+// At most this many levels below the full surface
+static size_t constexpr maxSurfaceLods = 4;
+// Relative to the bounding sphere radius, coarser levels aren't worth drawing even far away
+static float constexpr lodMaxError = 0.1f;
+// Levels that keep more triangles than this of the level before aren't worth storing
+static float constexpr lodMinReduction = 0.85f;
+
+// Appends coarser versions of the surface just loaded to indices, each simplified from the one before to about half
+// its triangles. The chain stops at the first level that would move the surface further than lodMaxError of its
+// bounding sphere, or that barely gets any smaller. Indices are relative to the mesh like the surface's.
+static void build_primitive_lods(std::vector<uint32_t>& indices, uint32_t const startIndex, uint32_t const count,
+	std::span<Vertex const> const vertices, uint32_t const firstVertex, float const sphereRadius, std::vector<SurfaceLod>& lods)
+{
+	lods.clear();
+	if (sphereRadius <= 0.0f)
+	{
+		return;
+	}
+
+	std::vector<uint32_t> level(indices.begin() + startIndex, indices.begin() + startIndex + count);
+	for (uint32_t& idx : level)
+	{
+		idx -= firstVertex;
+	}
+
+	// Each level is measured against the one it was simplified from, so errors add up along the chain
+	float error = 0.0f;
+	while (lods.size() < maxSurfaceLods)
+	{
+		float const errorLeft = lodMaxError * sphereRadius - error;
+		if (errorLeft <= 0.0f)
+		{
+			break;
+		}
+
+		float levelError = 0.0f;
+		std::vector<uint32_t> simplified = simplify_mesh(level, vertices, level.size() / 6 * 3, errorLeft, &levelError);
+		if (simplified.empty() || static_cast<float>(simplified.size()) > static_cast<float>(level.size()) * lodMinReduction)
+		{
+			break;
+		}
+		error += levelError;
+
+		optimize_vertex_cache(simplified, vertices.size());
+
+		lods.push_back(SurfaceLod
+			{
+				.indexOffset = static_cast<uint32_t>(indices.size()) - startIndex,
+				.count = static_cast<uint32_t>(simplified.size()),
+				.error = error / sphereRadius
+			});
+		for (uint32_t const idx : simplified)
+		{
+			indices.push_back(idx + firstVertex);
+		}
+		level = std::move(simplified);
+	}
+}
+
+static void print_cache_stats(std::string_view const name, VertexCacheStats const& before, VertexCacheStats const& after)
+{
+	std::cout << std::format(">   {}: ACMR {:.3f} -> {:.3f}, ATVR {:.3f} -> {:.3f}\n", name, before.getAcmr(), after.getAcmr(), before.getAtvr(), after.getAtvr());
+}
+
+// Only materials that glow get an extension record
+static std::optional<GPUMaterialExtension> make_material_extension(glm::vec3 const emissive)
+{
+	if (emissive == glm::vec3(0.0f))
+	{
+		return std::nullopt;
+	}
+	return GPUMaterialExtension{ .emissive = glm::vec4(emissive, 0.0f) };
+}
+
+static glm::mat4 get_local_transform(fastgltf::Node const& node)
+{
+	glm::mat4 localTransform;
+	std::visit(fastgltf::visitor
+		{
+			[&](fastgltf::Node::TransformMatrix const matrix) 
+			{
+				memcpy(&localTransform, matrix.data(), sizeof(matrix));
+			},
+			[&](fastgltf::TRS const transform)
+			{
+				glm::vec3 const tl(transform.translation[0], transform.translation[1], transform.translation[2]);
+				glm::quat const rot(transform.rotation[3], transform.rotation[0], transform.rotation[1], transform.rotation[2]);
+				glm::vec3 const sc(transform.scale[0], transform.scale[1], transform.scale[2]);
+
+				glm::mat4 const tm = glm::translate(glm::mat4(1.f), tl);
+				glm::mat4 const rm = glm::toMat4(rot);
+				glm::mat4 const sm = glm::scale(glm::mat4(1.f), sc);
+
+				localTransform = tm * rm * sm;
+			}
+		},
+		node.transform);
+	return localTransform;
+}
+
+// Appends " (n)" to names already in use, warning about it
+template <typename Names>
+static std::string get_unique_name(Names const& names, std::string name, char const* kind)
+{
+	if (!names.contains(name))
+	{
+		return name;
+	}
+
+	std::string newName = name;
+	newName.append(" (1)");
+	int i = 1;
+	while (names.contains(newName))
+	{
+		// Remove end chars to give room for parentheses
+		newName.pop_back();
+		for (int j = 0; j <= i / 10; j++)
+		{
+			newName.pop_back();
+		}
+		++i;
+		newName.append(std::to_string(i) + ")");
+	}
+	std::cerr << "Warning: " << kind << " name " + name + " already in use. Renaming to ";
+	std::cerr << newName + ".\n";
+	return newName;
+}
+
+// Reads and parses a .gltf or .glb, with external buffers loaded. Shared by load_gltf and cook_gltf.
+static std::optional<fastgltf::Asset> parse_gltf(std::string_view const filePath)
+{
+	// Compressed texture sources are preferred when the asset provides them, see get_texture_image_candidates
+	fastgltf::Parser parser{ fastgltf::Extensions::KHR_texture_basisu | fastgltf::Extensions::MSFT_texture_dds };
+
+	auto constexpr gltfOptions = fastgltf::Options::DontRequireValidAssetMember | fastgltf::Options::AllowDouble | fastgltf::Options::LoadGLBBuffers | fastgltf::Options::LoadExternalBuffers;
+
+	fastgltf::GltfDataBuffer data;
+	data.loadFromFile(filePath);
+
+	std::filesystem::path const path = filePath;
 
 	auto type = fastgltf::determineGltfFileType(&data);
 	if (type == fastgltf::GltfType::glTF)
@@ -208,43 +505,72 @@ std::optional<std::shared_ptr<LoadedGLTF>> load_gltf(VulkanEngine* engine, std::
 		auto load = parser.loadGltf(&data, path.parent_path(), gltfOptions);
 		if (load)
 		{
-			gltf = std::move(load.get());
-		}
-		else
-		{
-			std::cerr << "Failed to load glTF: " << fastgltf::to_underlying(load.error());
-			return {};
+			return std::move(load.get());
 		}
+		std::cerr << "Failed to load glTF: " << fastgltf::to_underlying(load.error());
+		return {};
 	}
 	else if (type == fastgltf::GltfType::GLB)
 	{
 		auto load = parser.loadGltfBinary(&data, path.parent_path(), gltfOptions);
 		if (load)
 		{
-			gltf = std::move(load.get());
+			return std::move(load.get());
 		}
-		else
+		std::cerr << "Failed to load glTF: " << fastgltf::to_underlying(load.error());
+		return {};
+	}
+
+	std::cerr << "Failed to determine glTF container\n";
+	return {};
+}
+
+std::optional<std::shared_ptr<LoadedGLTF>> load_gltf(VulkanEngine* engine, std::string_view filePath, LoadProgress* progress)
+{
+	auto reportProgress = [progress](char const* stage, float const fraction)
+	{
+		if (progress)
 		{
-			std::cerr << "Failed to load glTF: " << fastgltf::to_underlying(load.error());
-			return {};
+			progress->set(stage, fraction);
 		}
-	}
-	else
+	};
+	reportProgress("Parsing", 0.0f);
+
+	VkPhysicalDeviceProperties deviceProperties{};
+	vkGetPhysicalDeviceProperties(engine->selectedGPU, &deviceProperties);
+
+	std::cout << "Loading glTF: " << filePath << "\n";
+
+	auto const startTime = std::chrono::high_resolution_clock::now();
+	auto lastTime = startTime;
+
+	size_t const uploadBatchesBefore = engine->uploader.getBatchCount();
+	size_t const uploadBytesBefore = engine->uploader.getBytesUploaded();
+
+	auto scene = std::make_shared<LoadedGLTF>();
+	scene->creator = engine;
+	LoadedGLTF& file = *scene.get();
+	file.sourcePath = filePath;
+
+	std::filesystem::path path = filePath;
+
+	std::optional<fastgltf::Asset> parsed = parse_gltf(filePath);
+	if (!parsed.has_value())
 	{
-		std::cerr << "Failed to determine glTF container\n";
 		return {};
 	}
+	fastgltf::Asset& gltf = *parsed;
 
-	currentTime = std::chrono::high_resolution_clock::now();
-	elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(currentTime - lastTime);
+	auto currentTime = std::chrono::high_resolution_clock::now();
+	auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(currentTime - lastTime);
 	lastTime = currentTime;
 
 	std::cout << "> glTF loaded in " << elapsed << "." << std::endl;
 
-	std::vector<DescriptorAllocatorGrowable::PoolSizeRatio> sizes =
-	{ {VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 3},
-		{VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 3},
-		{VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1} };
+	reportProgress("Samplers", 0.1f);
+
+	// Material sets only hold textures, the constants live in the engine's material buffer
+	std::vector<DescriptorAllocatorGrowable::PoolSizeRatio> sizes = { {VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 3} };
 
 	if (gltf.samplers.empty())
 	{
@@ -303,114 +629,273 @@ std::optional<std::shared_ptr<LoadedGLTF>> load_gltf(VulkanEngine* engine, std::
 	{
 		if (mat.pbrData.baseColorTexture.has_value())
 		{
-			size_t img = gltf.textures[mat.pbrData.baseColorTexture.value().textureIndex].imageIndex.value();
-			srgbImages.emplace(img);
+			for (size_t const img : get_texture_image_candidates(gltf.textures[mat.pbrData.baseColorTexture.value().textureIndex], engine->textureCompressionBCSupported))
+			{
+				srgbImages.emplace(img);
+			}
 		}
 	}
 
-	// load all textures
-	for (size_t idx = 0; idx < gltf.images.size(); idx++)
+	// Only the best candidate of each texture is loaded at first, fallbacks are added in later passes for the ones that failed.
+	// Images no texture refers to are still loaded so they show up in the scene's image list.
+	std::vector<bool> requestedImages(gltf.images.size(), true);
+	for (fastgltf::Texture const& texture : gltf.textures)
 	{
-		fastgltf::Image& image = gltf.images[idx];
-		std::optional<AllocatedImage> img = load_image(engine, gltf, image, path.parent_path(), srgbImages.contains(idx));
-
-		if (img.has_value()) {
-			images.push_back(*img);
-			// We should require images to be uniquely named
-			// But for now I'll just warn and add parentheses. 
-			// This is really slow but don't give me bad gltf files.
-			if (file.images.contains(image.name.c_str()))
+		std::vector<size_t> const candidates = get_texture_image_candidates(texture, engine->textureCompressionBCSupported);
+		for (size_t i = 1; i < candidates.size(); i++)
+		{
+			requestedImages[candidates[i]] = false;
+		}
+		// compressed sources the device can't sample are never loaded
+		if (!engine->textureCompressionBCSupported)
+		{
+			for (auto const& compressedImage : { texture.basisuImageIndex, texture.ddsImageIndex })
 			{
-				std::string newName = image.name.c_str();
-				newName.append(" (1)");
-				int i = 1;
-				while (file.images.contains(newName))
+				if (compressedImage.has_value())
 				{
-					// Remove end chars to give room for parentheses
-					newName.pop_back();
-					for (int j = 0; j <= i / 10; j++)
-					{
-						newName.pop_back();
-					}
-					++i;
-					newName.append(std::to_string(i) + ")");
+					requestedImages[compressedImage.value()] = false;
 				}
-				std::cerr << "Warning: image name " + image.name + " already in use. Renaming to ";
-				std::cerr << newName + ".\n";
-				image.name = newName;
 			}
-			file.images[image.name.c_str()] = *img;
 		}
-		else {
-			// we failed to load, so lets give the slot a default white texture to not
-			// completely break loading
-			images.push_back(engine->errorCheckerboardImage);
-			std::cout << "gltf failed to load texture " << image.name << std::endl;
+	}
+	for (fastgltf::Texture const& texture : gltf.textures)
+	{
+		std::vector<size_t> const candidates = get_texture_image_candidates(texture, engine->textureCompressionBCSupported);
+		if (!candidates.empty())
+		{
+			requestedImages[candidates.front()] = true;
 		}
 	}
 
-	currentTime = std::chrono::high_resolution_clock::now();
-	elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(currentTime - lastTime);
-	lastTime = currentTime;
+	// load all textures
+	// Decoding runs on the worker pool, one job per image, and this thread uploads them as they finish
+	struct DecodeResult
+	{
+		size_t index;
+		std::optional<DecodedImage> image;
+		std::chrono::microseconds decodeTime;
+	};
 
-	std::cout << "> textures loaded in " << elapsed << "." << std::endl;
+	std::mutex decodeMutex;
+	std::condition_variable decodeCondition;
+	std::deque<DecodeResult> decodedImages;
 
-	if (!gltf.materials.empty())
-	{
-		file.descriptorPool.init(engine->device, static_cast<uint32_t>(gltf.materials.size()), sizes);
-		file.materialDataBuffer = engine->createBuffer(sizeof(PBRMaterial::MaterialConstants) * gltf.materials.size(),
-			VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
-		int data_index = 0;
-		auto sceneMaterialConstants = static_cast<PBRMaterial::MaterialConstants*>(file.materialDataBuffer.info.pMappedData);
+	std::filesystem::path const directory = path.parent_path();
 
-		for (fastgltf::Material& mat : gltf.materials)
+	std::vector<std::optional<AllocatedImage>> loadedImages(gltf.images.size());
+	std::vector<bool> attemptedImages(gltf.images.size(), false);
+	std::set<size_t> compressedImages;
+	size_t compressedBytes = 0;
+	std::chrono::microseconds totalDecodeTime{ 0 };
+	std::chrono::microseconds uploadTime{ 0 };
+
+	auto const loadImages = [&](std::vector<size_t> const& indices)
+	{
+		for (size_t const idx : indices)
 		{
-			auto newMat = std::make_shared<GLTFMaterial>();
-			materials.push_back(newMat);
-			file.materials[mat.name.c_str()] = newMat;
+			attemptedImages[idx] = true;
+			engine->workerPool.pushJob([&, idx]()
+				{
+					auto const decodeStart = std::chrono::high_resolution_clock::now();
+					std::optional<DecodedImage> decoded = decode_image(gltf, gltf.images[idx], directory);
+					auto const decodeTime = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::high_resolution_clock::now() - decodeStart);
 
-			PBRMaterial::MaterialConstants constants{};
-			constants.colorFactors.x = mat.pbrData.baseColorFactor[0];
-			constants.colorFactors.y = mat.pbrData.baseColorFactor[1];
-			constants.colorFactors.z = mat.pbrData.baseColorFactor[2];
-			constants.colorFactors.w = mat.pbrData.baseColorFactor[3];
+					{
+						std::scoped_lock lock(decodeMutex);
+						decodedImages.push_back({ .index = idx, .image = std::move(decoded), .decodeTime = decodeTime });
+					}
+					decodeCondition.notify_one();
+				});
+		}
 
-			constants.metalRoughFactors.x = mat.pbrData.metallicFactor;
-			constants.metalRoughFactors.y = mat.pbrData.roughnessFactor;
-			// write material parameters to buffer
-			sceneMaterialConstants[data_index] = constants;
+		for (size_t uploaded = 0; uploaded < indices.size(); uploaded++)
+		{
+			reportProgress("Textures", 0.1f + 0.5f * static_cast<float>(uploaded) / static_cast<float>(indices.size()));
 
-			auto passType = MaterialPass::MainColor;
-			if (mat.alphaMode == fastgltf::AlphaMode::Blend)
+			DecodeResult result;
 			{
-				passType = MaterialPass::Transparent;
+				std::unique_lock lock(decodeMutex);
+				decodeCondition.wait(lock, [&]() { return !decodedImages.empty(); });
+				result = std::move(decodedImages.front());
+				decodedImages.pop_front();
 			}
+			totalDecodeTime += result.decodeTime;
 
-			PBRMaterial::MaterialResources materialResources{};
-			// default the material textures
-			materialResources.albedoImage = engine->whiteImage;
-			materialResources.albedoSampler = engine->defaultSamplerLinear;
-			materialResources.normalImage = engine->defaultNormalImage;
-			materialResources.normalSampler = engine->defaultSamplerLinear;
-			materialResources.metalRoughAOImage = engine->defaultMraoImage;
+			if (result.image.has_value())
+			{
+				auto const uploadStart = std::chrono::high_resolution_clock::now();
+
+				bool const srgb = srgbImages.contains(result.index);
+				if (result.image->compressed.has_value() && !engine->textureCompressionBCSupported)
+				{
+					// a plain image source that turned out to be KTX2 or DDS, left unloaded so the texture moves on
+					std::cerr << "BC textures are not supported, skipping image " << gltf.images[result.index].name << "\n";
+				}
+				else if (result.image->compressed.has_value())
+				{
+					CompressedTexture& compressed = *result.image->compressed;
+					compressed.format = get_color_space_variant(compressed.format, srgb);
+					loadedImages[result.index] = engine->createImage(compressed);
+					compressedImages.emplace(result.index);
+					compressedBytes += compressed.data.size();
+				}
+				else
+				{
+					VkFormat const imageFormat = srgb ? VK_FORMAT_R8G8B8A8_SRGB : VK_FORMAT_R8G8B8A8_UNORM;
+					loadedImages[result.index] = engine->createImage(result.image->pixels, result.image->size, imageFormat, VK_IMAGE_USAGE_SAMPLED_BIT, result.image->mipmapped, ImageConversion::PremultiplyAlpha);
+					stbi_image_free(result.image->pixels);
+				}
+
+				uploadTime += std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::high_resolution_clock::now() - uploadStart);
+			}
+		}
+	};
+
+	std::vector<size_t> pendingImages;
+	for (size_t idx = 0; idx < gltf.images.size(); idx++)
+	{
+		if (requestedImages[idx])
+		{
+			pendingImages.push_back(idx);
+		}
+	}
+	while (!pendingImages.empty())
+	{
+		loadImages(pendingImages);
+		pendingImages.clear();
+
+		// a texture whose best loaded candidate is missing moves on to its next untried one
+		std::set<size_t> fallbacks;
+		for (fastgltf::Texture const& texture : gltf.textures)
+		{
+			for (size_t const img : get_texture_image_candidates(texture, engine->textureCompressionBCSupported))
+			{
+				if (loadedImages[img].has_value())
+				{
+					break;
+				}
+				if (!attemptedImages[img])
+				{
+					fallbacks.emplace(img);
+					break;
+				}
+			}
+		}
+		pendingImages.assign(fallbacks.begin(), fallbacks.end());
+	}
+
+	// Names are resolved in glTF order so renaming stays deterministic
+	for (size_t idx = 0; idx < gltf.images.size(); idx++)
+	{
+		fastgltf::Image& image = gltf.images[idx];
+		std::optional<AllocatedImage> const& img = loadedImages[idx];
+
+		if (img.has_value()) {
+			images.push_back(*img);
+			// We should require images to be uniquely named
+			// But for now I'll just warn and add parentheses. 
+			// This is really slow but don't give me bad gltf files.
+			image.name = get_unique_name(file.images, image.name.c_str(), "image");
+			file.images[image.name.c_str()] = *img;
+		}
+		else {
+			// we failed to load, so lets give the slot a default white texture to not
+			// completely break loading
+			images.push_back(engine->errorCheckerboardImage);
+			if (attemptedImages[idx])
+			{
+				std::cout << "gltf failed to load texture " << image.name << std::endl;
+			}
+		}
+	}
+
+	// The image a texture ends up sampling, the first of its candidates that loaded
+	auto const resolveTextureImage = [&](size_t const textureIndex) -> std::optional<size_t>
+	{
+		std::vector<size_t> const candidates = get_texture_image_candidates(gltf.textures[textureIndex], engine->textureCompressionBCSupported);
+		for (size_t const img : candidates)
+		{
+			if (loadedImages[img].has_value())
+			{
+				return img;
+			}
+		}
+		// nothing loaded, the best candidate's slot holds the error texture
+		if (!candidates.empty())
+		{
+			return candidates.front();
+		}
+		return {};
+	};
+
+	currentTime = std::chrono::high_resolution_clock::now();
+	elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(currentTime - lastTime);
+	lastTime = currentTime;
+
+	size_t const decodedCount = static_cast<size_t>(std::count(attemptedImages.begin(), attemptedImages.end(), true));
+	std::cout << "> " << decodedCount << " of " << gltf.images.size() << " textures decoded, " << compressedImages.size() << " block-compressed ("
+		<< compressedBytes / 1024 << " KiB)." << std::endl;
+	std::cout << "> textures decoded on " << engine->workerPool.getThreadCount() << " threads ("
+		<< std::chrono::duration_cast<std::chrono::milliseconds>(totalDecodeTime) << " of decode work), "
+		<< std::chrono::duration_cast<std::chrono::milliseconds>(uploadTime) << " spent uploading." << std::endl;
+	std::cout << "> textures loaded in " << elapsed << "." << std::endl;
+
+	reportProgress("Materials", 0.6f);
+
+	if (!gltf.materials.empty())
+	{
+		file.descriptorPool.init(engine->device, static_cast<uint32_t>(gltf.materials.size()), sizes);
+
+		for (fastgltf::Material& mat : gltf.materials)
+		{
+			auto newMat = std::make_shared<GLTFMaterial>();
+			materials.push_back(newMat);
+			file.materials[mat.name.c_str()] = newMat;
+
+			PBRMaterial::MaterialConstants constants{};
+			constants.colorFactors.x = mat.pbrData.baseColorFactor[0];
+			constants.colorFactors.y = mat.pbrData.baseColorFactor[1];
+			constants.colorFactors.z = mat.pbrData.baseColorFactor[2];
+			constants.colorFactors.w = mat.pbrData.baseColorFactor[3];
+
+			constants.metalRoughFactors.x = mat.pbrData.metallicFactor;
+			constants.metalRoughFactors.y = mat.pbrData.roughnessFactor;
+
+			glm::vec3 const emissive = glm::vec3(mat.emissiveFactor[0], mat.emissiveFactor[1], mat.emissiveFactor[2]) * static_cast<float>(mat.emissiveStrength);
+
+			auto passType = MaterialPass::MainColor;
+			if (mat.alphaMode == fastgltf::AlphaMode::Blend)
+			{
+				passType = MaterialPass::Transparent;
+			}
+
+			PBRMaterial::MaterialResources materialResources{};
+			// default the material textures
+			materialResources.albedoImage = engine->whiteImage;
+			materialResources.albedoSampler = engine->defaultSamplerLinear;
+			materialResources.normalImage = engine->defaultNormalImage;
+			materialResources.normalSampler = engine->defaultSamplerLinear;
+			materialResources.metalRoughAOImage = engine->defaultMraoImage;
 			materialResources.metalRoughAOSampler = engine->defaultSamplerLinear;
 
-			// set the uniform buffer for the material data
-			materialResources.dataBuffer = file.materialDataBuffer.buffer;
-			materialResources.dataBufferOffset = data_index * sizeof(PBRMaterial::MaterialConstants);
 			// grab textures from gltf file
 			if (mat.pbrData.baseColorTexture.has_value())
 			{
-				size_t img = gltf.textures[mat.pbrData.baseColorTexture.value().textureIndex].imageIndex.value();
+				size_t img = resolveTextureImage(mat.pbrData.baseColorTexture.value().textureIndex).value();
 				size_t sample = gltf.textures[mat.pbrData.baseColorTexture.value().textureIndex].samplerIndex.has_value() ?
 					gltf.textures[mat.pbrData.baseColorTexture.value().textureIndex].samplerIndex.value() : 0;
 
 				materialResources.albedoImage = images[img];
 				materialResources.albedoSampler = file.samplers[sample];
+
+				if (compressedImages.contains(img))
+				{
+					constants.flags |= PBRMaterial::MATERIAL_FLAG_STRAIGHT_ALPHA;
+				}
 			}
 			if (mat.normalTexture.has_value())
 			{
-				size_t img = gltf.textures[mat.normalTexture.value().textureIndex].imageIndex.value();
+				size_t img = resolveTextureImage(mat.normalTexture.value().textureIndex).value();
 				size_t sample = gltf.textures[mat.normalTexture.value().textureIndex].samplerIndex.has_value() ?
 					gltf.textures[mat.normalTexture.value().textureIndex].samplerIndex.value() : 0;
 
@@ -419,7 +904,7 @@ std::optional<std::shared_ptr<LoadedGLTF>> load_gltf(VulkanEngine* engine, std::
 			}
 			if (mat.pbrData.metallicRoughnessTexture.has_value())
 			{
-				size_t img = gltf.textures[mat.pbrData.metallicRoughnessTexture.value().textureIndex].imageIndex.value();
+				size_t img = resolveTextureImage(mat.pbrData.metallicRoughnessTexture.value().textureIndex).value();
 				size_t sample = gltf.textures[mat.pbrData.metallicRoughnessTexture.value().textureIndex].samplerIndex.has_value() ?
 					gltf.textures[mat.pbrData.metallicRoughnessTexture.value().textureIndex].samplerIndex.value() : 0;
 
@@ -428,8 +913,8 @@ std::optional<std::shared_ptr<LoadedGLTF>> load_gltf(VulkanEngine* engine, std::
 			}
 			// build material
 			newMat->data = engine->pbrMaterial.writeMaterial(engine->device, passType, materialResources, file.descriptorPool);
-
-			data_index++;
+			newMat->data.materialIndex = PBRMaterial::writeBindlessMaterial(engine->bindlessMaterials, constants, make_material_extension(emissive), materialResources);
+			file.bindlessMaterialIndices.push_back(newMat->data.materialIndex);
 		}
 	}
 	
@@ -443,40 +928,40 @@ std::optional<std::shared_ptr<LoadedGLTF>> load_gltf(VulkanEngine* engine, std::
 	// often
 	std::vector<uint32_t> indices;
 	std::vector<Vertex> vertices;
-
-	for (fastgltf::Mesh& mesh : gltf.meshes) 
+	MeshletData meshlets;
+	size_t vertexBytes = 0;
+	size_t fullVertexBytes = 0;
+	size_t meshletCount = 0;
+
+	bool const optimizeMeshes = engine->optimizeMeshes;
+	bool const generateLods = engine->generateLods;
+	size_t lodCount = 0;
+	size_t lodIndexCount = 0;
+	VertexCacheStats sceneCacheBefore;
+	VertexCacheStats sceneCacheAfter;
+
+	for (size_t meshIdx = 0; meshIdx < gltf.meshes.size(); meshIdx++)
 	{
+		reportProgress("Meshes", 0.65f + 0.3f * static_cast<float>(meshIdx) / static_cast<float>(gltf.meshes.size()));
+
+		fastgltf::Mesh& mesh = gltf.meshes[meshIdx];
 		auto newMesh = std::make_shared<MeshAsset>();
 		meshes.push_back(newMesh);
 		// We should require meshes to be uniquely named
 		// But for now I'll just warn and add parentheses. 
 		// This is really slow but don't give me bad gltf files.
-		if (file.meshes.contains(mesh.name.c_str()))
-		{
-			std::string newName = mesh.name.c_str();
-			newName.append(" (1)");
-			int i = 1;
-			while (file.meshes.contains(newName))
-			{
-				// Remove end chars to give room for parentheses
-				newName.pop_back();
-				for (int j = 0; j <= i / 10; j++)
-				{
-					newName.pop_back();
-				}
-				++i;
-				newName.append(std::to_string(i) + ")");
-			}
-			std::cerr << "Warning: mesh name " + mesh.name + " already in use. Renaming to ";
-			std::cerr << newName + ".\n";
-			mesh.name = newName;
-		}
+		mesh.name = get_unique_name(file.meshes, mesh.name.c_str(), "mesh");
 		file.meshes[mesh.name.c_str()] = newMesh;
 		newMesh->name = mesh.name;
 
 		// clear the mesh arrays each mesh, we don't want to merge them by error
 		indices.clear();
 		vertices.clear();
+		meshlets.meshlets.clear();
+		meshlets.data.clear();
+
+		VertexCacheStats cacheBefore;
+		VertexCacheStats cacheAfter;
 
 		for (auto&& p : mesh.primitives) 
 		{
@@ -484,121 +969,12 @@ std::optional<std::shared_ptr<LoadedGLTF>> load_gltf(VulkanEngine* engine, std::
 			newSurface.startIndex = static_cast<uint32_t>(indices.size());
 			newSurface.count = static_cast<uint32_t>(gltf.accessors[p.indicesAccessor.value()].count);
 
-			size_t initialVtx = vertices.size();
-
-			// load indexes
-			{
-				fastgltf::Accessor& indexAccessor = gltf.accessors[p.indicesAccessor.value()];
-				indices.reserve(indices.size() + indexAccessor.count);
-
-				fastgltf::iterateAccessor<std::uint32_t>(gltf, indexAccessor,
-					[&](uint32_t const idx) 
-					{
-						indices.push_back(idx + static_cast<uint32_t>(initialVtx));
-					});
-			}
-
-			// load vertex positions
-			fastgltf::Accessor& posAccessor = gltf.accessors[p.findAttribute("POSITION")->second];
-			{
-				vertices.resize(vertices.size() + posAccessor.count);
-
-				fastgltf::iterateAccessorWithIndex<glm::vec3>(gltf, posAccessor,
-					[&](glm::vec3 const v, size_t const index) 
-					{
-						Vertex newVtx{};
-						newVtx.position = v;
-						newVtx.normal = { 1, 0, 0 };
-						newVtx.color = glm::vec4{ 1.f };
-						newVtx.uv_x = 0;
-						newVtx.uv_y = 0;
-						vertices[initialVtx + index] = newVtx;
-					});
-			}
-
-			// load vertex normals
-			auto normals = p.findAttribute("NORMAL");
-			if (normals != p.attributes.end()) 
-			{
-
-				fastgltf::iterateAccessorWithIndex<glm::vec3>(gltf, gltf.accessors[(*normals).second],
-					[&](glm::vec3 const v, size_t const index) 
-					{
-						vertices[initialVtx + index].normal = v;
-					});
-			}
-
-			// load UVs
-			auto uv = p.findAttribute("TEXCOORD_0");
-			if (uv != p.attributes.end()) 
-			{
-
-				fastgltf::iterateAccessorWithIndex<glm::vec2>(gltf, gltf.accessors[(*uv).second],
-					[&](glm::vec2 const v, size_t const index) 
-					{
-						vertices[initialVtx + index].uv_x = v.x;
-						vertices[initialVtx + index].uv_y = v.y;
-					});
-			}
-
-			// load vertex colors
-			auto colors = p.findAttribute("COLOR_0");
-			if (colors != p.attributes.end()) 
-			{
-				fastgltf::iterateAccessorWithIndex<glm::vec4>(gltf, gltf.accessors[(*colors).second],
-					[&](glm::vec4 const v, size_t const index) 
-					{
-						vertices[initialVtx + index].color = v;
-					});
-			}
-
-			auto tangents = p.findAttribute("TANGENT");
-			if (tangents != p.attributes.end())
-			{
-				fastgltf::iterateAccessorWithIndex<glm::vec4>(gltf, gltf.accessors[(*tangents).second],
-					[&](glm::vec4 const v, size_t const index)
-					{
-						vertices[initialVtx + index].surfaceTangent = v;
-					});
-			}
-			else
+			size_t const initialVtx = vertices.size();
+			load_primitive(gltf, p, indices, vertices);
+			if (optimizeMeshes)
 			{
-				// calculate tangents ourselves
-				// perhaps should just use mikktspace instead
-				fastgltf::iterateAccessorWithIndex<glm::vec3>(gltf, posAccessor,
-					[&](glm::vec3 const v, size_t const index)
-					{
-						if (index % 3 == 0 && index + 2 < posAccessor.count)
-						{
-							Vertex& v0 = vertices[initialVtx + index];
-							Vertex& v1 = vertices[initialVtx + index + 1];
-							Vertex& v2 = vertices[initialVtx + index + 2];
-
-							glm::vec3 const e1 = v1.position - v0.position;
-							glm::vec3 const e2 = v2.position - v0.position;
-							glm::vec2 const dUV1 = { v1.uv_x - v0.uv_x, v1.uv_y - v0.uv_y };
-							glm::vec2 const dUV2 = { v2.uv_x - v0.uv_x, v2.uv_y - v0.uv_y };
-
-							float const det = (dUV1.x * dUV2.y - dUV2.x * dUV1.y);
-							if (det == 0)
-							{
-								// Degenerate triangle
-								v0.surfaceTangent = { 1.0f, 0, 0, 0 };
-								v1.surfaceTangent = { 1.0f, 0, 0, 0 };
-								v2.surfaceTangent = { 1.0f, 0, 0, 0 };
-							}
-							else
-							{
-								float const invDet = 1.0f / det;
-								glm::vec3 const tangent = invDet * (dUV2.y * e1 - dUV1.y * e2);
-								// This tangent is not actually orthogonal to normal vector, since vertices have their own normals not necessarily equal to surface normal.
-								// We will perform Gram-Schmidt in vertex shader to fix this.
-								v0.surfaceTangent = glm::vec4(tangent, 0);
-								v1.surfaceTangent = glm::vec4(tangent, 0);
-								v2.surfaceTangent = glm::vec4(tangent, 0);
-							}
-						}
-					});
+				optimize_primitive(std::span(indices).subspan(newSurface.startIndex), std::span(vertices).subspan(initialVtx),
+					static_cast<uint32_t>(initialVtx), cacheBefore, cacheAfter);
 			}
 
 			if (p.materialIndex.has_value())
@@ -614,28 +990,50 @@ std::optional<std::shared_ptr<LoadedGLTF>> load_gltf(VulkanEngine* engine, std::
 				newSurface.material = engine->defaultMaterial;
 			}
 
-			glm::vec3 minPos = vertices[initialVtx].position;
-			glm::vec3 maxPos = vertices[initialVtx].position;
-			for (size_t i = initialVtx; i < vertices.size(); i++) 
+			newSurface.bounds = compute_bounds(std::span(vertices).subspan(initialVtx));
+
+			newSurface.firstMeshlet = static_cast<uint32_t>(meshlets.meshlets.size());
+			build_meshlets(std::span(indices).subspan(newSurface.startIndex, newSurface.count), vertices, meshlets);
+			newSurface.meshletCount = static_cast<uint32_t>(meshlets.meshlets.size()) - newSurface.firstMeshlet;
+
+			if (generateLods)
 			{
-				minPos = glm::min(minPos, vertices[i].position);
-				maxPos = glm::max(maxPos, vertices[i].position);
+				build_primitive_lods(indices, newSurface.startIndex, newSurface.count, std::span(vertices).subspan(initialVtx),
+					static_cast<uint32_t>(initialVtx), newSurface.bounds.sphereRadius, newSurface.lods);
+				lodCount += newSurface.lods.size();
+				lodIndexCount += indices.size() - newSurface.startIndex - newSurface.count;
 			}
 
-			newSurface.bounds.origin = (maxPos + minPos) / 2.f;
-			newSurface.bounds.extents = (maxPos - minPos) / 2.f;
-			newSurface.bounds.sphereRadius = glm::length(newSurface.bounds.extents);
 			newMesh->surfaces.push_back(newSurface);
 		}
 
-		newMesh->meshBuffers = engine->uploadMesh(indices, vertices);
+		VertexFormat const vertexFormat = choose_vertex_format(vertices);
+		newMesh->geometry = engine->geometryPool.upload(indices, vertices, vertexFormat, meshlets);
+		vertexBytes += vertices.size() * get_vertex_stride(vertexFormat);
+		fullVertexBytes += vertices.size_bytes();
+		meshletCount += meshlets.meshlets.size();
+
+		if (optimizeMeshes)
+		{
+			print_cache_stats(newMesh->name, cacheBefore, cacheAfter);
+			sceneCacheBefore += cacheBefore;
+			sceneCacheAfter += cacheAfter;
+		}
 	}
 
 	currentTime = std::chrono::high_resolution_clock::now();
 	elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(currentTime - lastTime);
 	lastTime = currentTime;
 
-	std::cout << "> meshes loaded in " << elapsed << "." << std::endl;
+	std::cout << "> meshes loaded in " << elapsed << " (" << vertexBytes / 1024 << " KiB of vertices, "
+		<< fullVertexBytes / 1024 << " KiB unpacked, " << meshletCount << " meshlets, " << lodCount << " LODs with "
+		<< lodIndexCount / 3 << " triangles)." << std::endl;
+	if (optimizeMeshes)
+	{
+		print_cache_stats("all meshes", sceneCacheBefore, sceneCacheAfter);
+	}
+
+	reportProgress("Nodes", 0.95f);
 
 	// load all nodes and their meshes
 	for (fastgltf::Node& node : gltf.nodes) 
@@ -655,26 +1053,7 @@ std::optional<std::shared_ptr<LoadedGLTF>> load_gltf(VulkanEngine* engine, std::
 		nodes.push_back(newNode);
 		file.nodes[node.name.c_str()];
 
-		std::visit(fastgltf::visitor
-			{
-				[&](fastgltf::Node::TransformMatrix const matrix) 
-				{
-					memcpy(&newNode->localTransform, matrix.data(), sizeof(matrix));
-				},
-				[&](fastgltf::TRS const transform)
-				{
-					glm::vec3 const tl(transform.translation[0], transform.translation[1], transform.translation[2]);
-					glm::quat const rot(transform.rotation[3], transform.rotation[0], transform.rotation[1], transform.rotation[2]);
-					glm::vec3 const sc(transform.scale[0], transform.scale[1], transform.scale[2]);
-
-					glm::mat4 const tm = glm::translate(glm::mat4(1.f), tl);
-					glm::mat4 const rm = glm::toMat4(rot);
-					glm::mat4 const sm = glm::scale(glm::mat4(1.f), sc);
-
-					newNode->localTransform = tm * rm * sm;
-				}
-			},
-			node.transform);
+		newNode->localTransform = get_local_transform(node);
 	}
 
 	// run loop again to setup transform hierarchy
@@ -700,6 +1079,10 @@ std::optional<std::shared_ptr<LoadedGLTF>> load_gltf(VulkanEngine* engine, std::
 		}
 	}
 
+	engine->uploader.flush();
+	std::cout << "> " << (engine->uploader.getBytesUploaded() - uploadBytesBefore) / 1024 << " KiB uploaded in "
+		<< engine->uploader.getBatchCount() - uploadBatchesBefore << " batches." << std::endl;
+
 	currentTime = std::chrono::high_resolution_clock::now();
 	elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(currentTime - startTime);
 
@@ -720,12 +1103,15 @@ void LoadedGLTF::clearAll()
 	VkDevice const dv = creator->device;
 
 	descriptorPool.destroyPools(dv);
-	creator->destroyBuffer(materialDataBuffer);
+
+	for (uint32_t const index : bindlessMaterialIndices)
+	{
+		creator->bindlessMaterials.removeMaterial(index);
+	}
 
 	for (auto& [k, v] : meshes) {
 
-		creator->destroyBuffer(v->meshBuffers.indexBuffer);
-		creator->destroyBuffer(v->meshBuffers.vertexBuffer);
+		creator->geometryPool.free(v->geometry);
 	}
 
 	for (auto& [k, v] : images) {
@@ -742,14 +1128,23 @@ void LoadedGLTF::clearAll()
 	}
 }
 
-std::optional<Skybox> load_cubemap_from_hdri(VulkanEngine* engine, std::string_view filePath)
+std::optional<Skybox> load_cubemap_from_hdri(VulkanEngine* engine, std::string_view filePath, LoadProgress* progress)
 {
+	auto reportProgress = [progress](char const* stage, float const fraction)
+	{
+		if (progress)
+		{
+			progress->set(stage, fraction);
+		}
+	};
+	reportProgress("Decoding", 0.0f);
+
 	static unsigned int const envMapSize = 2048;
 	static unsigned int const prefilterMapSize = 128;
 	static unsigned int const irrMapSize = 32;
 
 	int width, height, nrChannels;
-	float* data = stbi_loadf(filePath.data(), &width, &height, &nrChannels, 0);
+	float* data = stbi_loadf(filePath.data(), &width, &height, &nrChannels, 3);
 	if (data)
 	{
 		VkPhysicalDeviceProperties deviceProperties{};
@@ -764,38 +1159,9 @@ std::optional<Skybox> load_cubemap_from_hdri(VulkanEngine* engine, std::string_v
 				.depth = 1
 			};
 
-			VkExtent2D const imageSize2D
-			{
-				.width = imageSize.width,
-				.height = imageSize.height
-			};
-
-			float* rgbaData = new float[imageSize.width * imageSize.height * 4]();
-			for (uint32_t i = 0; i < imageSize.width * imageSize.height; i++)
-			{
-				rgbaData[4 * i + 0] = data[3 * i + 0];
-				rgbaData[4 * i + 1] = data[3 * i + 1];
-				rgbaData[4 * i + 2] = data[3 * i + 2];
-				rgbaData[4 * i + 3] = 1.0f;
-			}
+			// Staged as raw RGB floats, alpha and the conversion to half are added on the GPU
+			hdrImage = engine->createImage(data, imageSize, VK_FORMAT_R16G16B16A16_SFLOAT, VK_IMAGE_USAGE_SAMPLED_BIT, false, ImageConversion::ExpandRGB);
 			stbi_image_free(data);
-
-			AllocatedImage const uploadImage = engine->createImage(rgbaData, imageSize, VK_FORMAT_R32G32B32A32_SFLOAT, VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT);
-
-			hdrImage = engine->createImage(imageSize, VK_FORMAT_R16G16B16A16_SFLOAT, VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT);
-
-			engine->immediateSubmit([&](VkCommandBuffer const cmd)
-				{
-					vkUtil::transition_image(cmd, uploadImage.image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL);
-					vkUtil::transition_image(cmd, hdrImage.image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
-
-					vkUtil::copy_image_to_image(cmd, uploadImage.image, hdrImage.image, imageSize2D, imageSize2D);
-
-					vkUtil::transition_image(cmd, hdrImage.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
-				});
-
-			engine->destroyImage(uploadImage);
-			delete[] rgbaData;
 		}
 		
 		AllocatedImage envMapImage{};
@@ -980,6 +1346,8 @@ std::optional<Skybox> load_cubemap_from_hdri(VulkanEngine* engine, std::string_v
 
 		// render to cubemap here
 		{
+			reportProgress("Environment map", 0.4f);
+
 			DescriptorWriter writer;
 			writer.writeImage(0, hdrImage.imageView, hdriSampler, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
 			writer.writeImage(1, envMapImage.imageView, VK_NULL_HANDLE, VK_IMAGE_LAYOUT_GENERAL, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE);
@@ -1000,6 +1368,8 @@ std::optional<Skybox> load_cubemap_from_hdri(VulkanEngine* engine, std::string_v
 					vkUtil::transition_image(cmd, envMapImage.image, VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
 				});
 
+			reportProgress("Irradiance map", 0.6f);
+
 			writer.writeImage(0, envMapImage.imageView, hdriSampler, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
 			writer.writeImage(1, irrMapImage.imageView, VK_NULL_HANDLE, VK_IMAGE_LAYOUT_GENERAL, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE);
 			writer.updateSet(engine->device, computeDescriptor);
@@ -1018,6 +1388,8 @@ std::optional<Skybox> load_cubemap_from_hdri(VulkanEngine* engine, std::string_v
 			unsigned int maxMipLevels = static_cast<uint32_t>(std::floor(std::log2(static_cast<float>(prefilterMapSize)))) + 1;
 			for (unsigned int mip = 0; mip < maxMipLevels; mip++)
 			{
+				reportProgress("Prefiltering", 0.7f + 0.3f * static_cast<float>(mip) / static_cast<float>(maxMipLevels));
+
 				unsigned int mipSize = static_cast<unsigned int>(static_cast<float>(prefilterMapSize) * std::pow(0.5, mip));
 
 				VkImageView mipView;
@@ -1053,12 +1425,10 @@ std::optional<Skybox> load_cubemap_from_hdri(VulkanEngine* engine, std::string_v
 						vkCmdDispatch(cmd, static_cast<uint32_t>(std::ceil(static_cast<float>(mipSize) / 16.0f)), static_cast<uint32_t>(std::ceil(static_cast<float>(mipSize) / 16.0f)), 6);
 					});
 
+				// immediateSubmit has already waited for the dispatch
 				if (mip != 0)
 				{
-					engine->getCurrentFrame().deletionQueue.pushFunction([=]()
-						{
-							vkDestroyImageView(engine->device, mipView, nullptr);
-						});
+					vkDestroyImageView(engine->device, mipView, nullptr);
 				}
 			}
 			engine->immediateSubmit([&](VkCommandBuffer cmd)
@@ -1085,7 +1455,844 @@ std::optional<Skybox> load_cubemap_from_hdri(VulkanEngine* engine, std::string_v
 	}
 }
 
-std::optional<std::shared_ptr<LoadedGLTF>> load_pscn(VulkanEngine* engine, std::string_view filePath) 
+// Material slot a texture is cooked for, it decides the block format
+enum class TextureRole : uint32_t
+{
+	Albedo,
+	Normal,
+	MetalRoughAO
+};
+
+struct CookedTexture
+{
+	size_t textureIndex;
+	TextureRole role;
+	std::string name;
+	std::optional<CompressedTexture> texture;
+	bool premultiplied = false;
+};
+
+static VkFormat get_cooked_format(TextureRole const role, bool const hasAlpha)
+{
+	switch (role)
+	{
+	case TextureRole::Albedo:
+		return hasAlpha ? VK_FORMAT_BC3_SRGB_BLOCK : VK_FORMAT_BC1_RGB_SRGB_BLOCK;
+	case TextureRole::Normal:
+		// z is rebuilt in the shader
+		return VK_FORMAT_BC5_UNORM_BLOCK;
+	case TextureRole::MetalRoughAO:
+	default:
+		return VK_FORMAT_BC1_RGB_UNORM_BLOCK;
+	}
+}
+
+// Decodes the first candidate image that loads and encodes it with its mips. Safe to run on any thread.
+static void cook_texture(fastgltf::Asset const& gltf, std::filesystem::path const& directory, CookedTexture& cooked)
+{
+	// Cooked textures are BC either way, whatever the cooking device supports
+	for (size_t const img : get_texture_image_candidates(gltf.textures[cooked.textureIndex], true))
+	{
+		std::optional<DecodedImage> decoded = decode_image(gltf, gltf.images[img], directory);
+		if (!decoded.has_value())
+		{
+			continue;
+		}
+		cooked.name = gltf.images[img].name.c_str();
+
+		// Already block-compressed sources are copied as they are, which means they stay straight alpha
+		if (decoded->compressed.has_value())
+		{
+			cooked.texture = std::move(decoded->compressed);
+			cooked.texture->format = get_color_space_variant(cooked.texture->format, cooked.role == TextureRole::Albedo);
+			return;
+		}
+
+		size_t const pixelCount = static_cast<size_t>(decoded->size.width) * decoded->size.height;
+		bool hasAlpha = false;
+		if (cooked.role == TextureRole::Albedo)
+		{
+			// Premultiplied before the mips are built, so edges of cutouts don't pick up the color of transparent texels
+			premultiply_alpha_rgba8(decoded->pixels, pixelCount);
+			cooked.premultiplied = true;
+			for (size_t i = 0; i < pixelCount && !hasAlpha; i++)
+			{
+				hasAlpha = decoded->pixels[i * 4 + 3] < 255;
+			}
+		}
+
+		cooked.texture = compress_texture(decoded->pixels, decoded->size.width, decoded->size.height, get_cooked_format(cooked.role, hasAlpha));
+		stbi_image_free(decoded->pixels);
+		return;
+	}
+}
+
+bool cook_gltf(std::string_view gltfPath, std::string_view pscnPath)
 {
-	return std::nullopt;
+	std::cout << "Cooking glTF: " << gltfPath << "\n";
+
+	auto const startTime = std::chrono::high_resolution_clock::now();
+	auto lastTime = startTime;
+
+	std::optional<fastgltf::Asset> parsed = parse_gltf(gltfPath);
+	if (!parsed.has_value())
+	{
+		return false;
+	}
+	fastgltf::Asset const& gltf = *parsed;
+	std::filesystem::path const directory = std::filesystem::path(gltfPath).parent_path();
+
+	std::string strings;
+	auto const addString = [&strings](std::string_view const str)
+	{
+		uint32_t const offset = static_cast<uint32_t>(strings.size());
+		strings.append(str);
+		strings.push_back('\0');
+		return offset;
+	};
+
+	std::vector<PscnSampler> samplers;
+	if (gltf.samplers.empty())
+	{
+		samplers.push_back({ VK_FILTER_LINEAR, VK_FILTER_LINEAR, VK_SAMPLER_MIPMAP_MODE_LINEAR, 1 });
+	}
+	for (fastgltf::Sampler const& sampler : gltf.samplers)
+	{
+		samplers.push_back(
+			{
+				static_cast<uint32_t>(extract_filter(sampler.magFilter.value_or(fastgltf::Filter::Nearest))),
+				static_cast<uint32_t>(extract_filter(sampler.minFilter.value_or(fastgltf::Filter::Nearest))),
+				static_cast<uint32_t>(extract_mipmap_mode(sampler.minFilter.value_or(fastgltf::Filter::Nearest))),
+				0
+			});
+	}
+
+	// One cooked texture per texture and role, the same image can need a different encoding in another slot
+	std::vector<CookedTexture> cookedTextures;
+	std::map<std::pair<size_t, TextureRole>, uint32_t> cookedTextureIds;
+	auto const requestTexture = [&](size_t const textureIndex, TextureRole const role)
+	{
+		auto const [it, inserted] = cookedTextureIds.try_emplace({ textureIndex, role }, static_cast<uint32_t>(cookedTextures.size()));
+		if (inserted)
+		{
+			cookedTextures.push_back({ .textureIndex = textureIndex, .role = role });
+		}
+		return it->second;
+	};
+
+	for (fastgltf::Material const& mat : gltf.materials)
+	{
+		if (mat.pbrData.baseColorTexture.has_value())
+		{
+			requestTexture(mat.pbrData.baseColorTexture.value().textureIndex, TextureRole::Albedo);
+		}
+		if (mat.normalTexture.has_value())
+		{
+			requestTexture(mat.normalTexture.value().textureIndex, TextureRole::Normal);
+		}
+		if (mat.pbrData.metallicRoughnessTexture.has_value())
+		{
+			requestTexture(mat.pbrData.metallicRoughnessTexture.value().textureIndex, TextureRole::MetalRoughAO);
+		}
+	}
+
+	// Encoding dominates cooking time, so textures are spread over every core
+	ThreadPool cookPool;
+	unsigned int const hardwareThreads = std::thread::hardware_concurrency();
+	cookPool.init(hardwareThreads > 1 ? hardwareThreads - 1 : 1);
+	cookPool.parallelFor(cookedTextures.size(), 1, [&](size_t const begin, size_t const end)
+		{
+			for (size_t i = begin; i < end; i++)
+			{
+				cook_texture(gltf, directory, cookedTextures[i]);
+			}
+		});
+	unsigned int const cookThreads = cookPool.getThreadCount() + 1;
+	cookPool.shutdown();
+
+	// Textures that failed are left out, their material slots fall back to the engine defaults
+	std::vector<PscnTexture> textures;
+	std::vector<PscnMip> mips;
+	std::vector<uint8_t> textureData;
+	std::vector<uint32_t> textureIds(cookedTextures.size(), pscnNone);
+	std::set<std::string> textureNames;
+	for (size_t i = 0; i < cookedTextures.size(); i++)
+	{
+		CookedTexture const& cooked = cookedTextures[i];
+		if (!cooked.texture.has_value())
+		{
+			std::cerr << "Warning: failed to cook texture " << cooked.textureIndex << ", the material will use a default.\n";
+			continue;
+		}
+
+		std::string const name = get_unique_name(textureNames, cooked.name, "texture");
+		textureNames.emplace(name);
+
+		textureIds[i] = static_cast<uint32_t>(textures.size());
+		textures.push_back(
+			{
+				.name = addString(name),
+				.format = static_cast<uint32_t>(cooked.texture->format),
+				.width = cooked.texture->size.width,
+				.height = cooked.texture->size.height,
+				.firstMip = static_cast<uint32_t>(mips.size()),
+				.mipCount = static_cast<uint32_t>(cooked.texture->regions.size()),
+				.flags = cooked.premultiplied ? PSCN_TEXTURE_PREMULTIPLIED : 0u
+			});
+
+		for (VkBufferImageCopy const& region : cooked.texture->regions)
+		{
+			size_t const levelSize = get_compressed_level_size(cooked.texture->format, region.imageExtent.width, region.imageExtent.height);
+			size_t const offset = (textureData.size() + pscnAlignment - 1) / pscnAlignment * pscnAlignment;
+			textureData.resize(offset + levelSize);
+			memcpy(textureData.data() + offset, cooked.texture->data.data() + region.bufferOffset, levelSize);
+			mips.push_back({ offset, levelSize });
+		}
+	}
+
+	auto currentTime = std::chrono::high_resolution_clock::now();
+	auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(currentTime - lastTime);
+	lastTime = currentTime;
+
+	std::cout << "> " << textures.size() << " textures cooked on " << cookThreads << " threads in " << elapsed << " ("
+		<< textureData.size() / 1024 << " KiB)." << std::endl;
+
+	auto const getTextureSlot = [&](size_t const textureIndex, TextureRole const role, uint32_t& texture, uint32_t& sampler)
+	{
+		texture = textureIds[cookedTextureIds.at({ textureIndex, role })];
+		sampler = gltf.textures[textureIndex].samplerIndex.has_value() ? static_cast<uint32_t>(gltf.textures[textureIndex].samplerIndex.value()) : 0;
+	};
+
+	std::vector<PscnMaterial> materials;
+	for (fastgltf::Material const& mat : gltf.materials)
+	{
+		PscnMaterial material
+		{
+			.name = addString(mat.name.c_str()),
+			.passType = static_cast<uint32_t>(mat.alphaMode == fastgltf::AlphaMode::Blend ? MaterialPass::Transparent : MaterialPass::MainColor),
+			.colorFactors = glm::vec4(mat.pbrData.baseColorFactor[0], mat.pbrData.baseColorFactor[1], mat.pbrData.baseColorFactor[2], mat.pbrData.baseColorFactor[3]),
+			.metalRoughFactors = glm::vec4(mat.pbrData.metallicFactor, mat.pbrData.roughnessFactor, 0.0f, 0.0f),
+			.emissiveFactor = glm::vec4(glm::vec3(mat.emissiveFactor[0], mat.emissiveFactor[1], mat.emissiveFactor[2]) * static_cast<float>(mat.emissiveStrength), 0.0f),
+			.albedoTexture = pscnNone,
+			.albedoSampler = pscnNone,
+			.normalTexture = pscnNone,
+			.normalSampler = pscnNone,
+			.metalRoughAOTexture = pscnNone,
+			.metalRoughAOSampler = pscnNone
+		};
+
+		if (mat.pbrData.baseColorTexture.has_value())
+		{
+			getTextureSlot(mat.pbrData.baseColorTexture.value().textureIndex, TextureRole::Albedo, material.albedoTexture, material.albedoSampler);
+		}
+		if (mat.normalTexture.has_value())
+		{
+			getTextureSlot(mat.normalTexture.value().textureIndex, TextureRole::Normal, material.normalTexture, material.normalSampler);
+		}
+		if (mat.pbrData.metallicRoughnessTexture.has_value())
+		{
+			getTextureSlot(mat.pbrData.metallicRoughnessTexture.value().textureIndex, TextureRole::MetalRoughAO, material.metalRoughAOTexture, material.metalRoughAOSampler);
+		}
+
+		materials.push_back(material);
+	}
+
+	std::vector<PscnMesh> meshes;
+	std::vector<PscnSurface> surfaces;
+	std::vector<uint8_t> vertexData;
+	std::vector<uint32_t> indices;
+	size_t vertexCount = 0;
+	std::set<std::string> meshNames;
+
+	// per mesh, indices stay relative to the mesh's first vertex like in the geometry pool
+	std::vector<uint32_t> meshIndices;
+	std::vector<Vertex> meshVertices;
+	MeshletData meshMeshlets;
+	std::vector<Meshlet> meshlets;
+	std::vector<uint32_t> meshletData;
+	std::vector<SurfaceLod> surfaceLods;
+	std::vector<PscnLod> lods;
+
+	// Cooking is offline, so meshes are always optimized and get LODs
+	VertexCacheStats sceneCacheBefore;
+	VertexCacheStats sceneCacheAfter;
+
+	for (fastgltf::Mesh const& mesh : gltf.meshes)
+	{
+		std::string const name = get_unique_name(meshNames, mesh.name.c_str(), "mesh");
+		meshNames.emplace(name);
+
+		meshIndices.clear();
+		meshVertices.clear();
+		meshMeshlets.meshlets.clear();
+		meshMeshlets.data.clear();
+
+		VertexCacheStats cacheBefore;
+		VertexCacheStats cacheAfter;
+
+		PscnMesh cookedMesh
+		{
+			.name = addString(name),
+			.firstSurface = static_cast<uint32_t>(surfaces.size()),
+			.surfaceCount = static_cast<uint32_t>(mesh.primitives.size()),
+			.vertexDataOffset = vertexData.size(),
+			.firstIndex = indices.size()
+		};
+
+		for (fastgltf::Primitive const& p : mesh.primitives)
+		{
+			PscnSurface surface
+			{
+				.startIndex = static_cast<uint32_t>(meshIndices.size()),
+				.count = static_cast<uint32_t>(gltf.accessors[p.indicesAccessor.value()].count)
+			};
+
+			size_t const initialVtx = meshVertices.size();
+			load_primitive(gltf, p, meshIndices, meshVertices);
+			optimize_primitive(std::span(meshIndices).subspan(surface.startIndex), std::span(meshVertices).subspan(initialVtx),
+				static_cast<uint32_t>(initialVtx), cacheBefore, cacheAfter);
+
+			if (p.materialIndex.has_value())
+			{
+				surface.material = static_cast<uint32_t>(p.materialIndex.value());
+			}
+			else
+			{
+				surface.material = materials.empty() ? pscnNone : 0;
+			}
+
+			Bounds const bounds = compute_bounds(std::span(meshVertices).subspan(initialVtx));
+			surface.sphereRadius = bounds.sphereRadius;
+			surface.boundsOrigin = glm::vec4(bounds.origin, 0.0f);
+			surface.boundsExtents = glm::vec4(bounds.extents, 0.0f);
+
+			surface.firstMeshlet = static_cast<uint32_t>(meshMeshlets.meshlets.size());
+			build_meshlets(std::span(meshIndices).subspan(surface.startIndex, surface.count), meshVertices, meshMeshlets);
+			surface.meshletCount = static_cast<uint32_t>(meshMeshlets.meshlets.size()) - surface.firstMeshlet;
+
+			build_primitive_lods(meshIndices, surface.startIndex, surface.count, std::span(meshVertices).subspan(initialVtx),
+				static_cast<uint32_t>(initialVtx), bounds.sphereRadius, surfaceLods);
+			surface.firstLod = static_cast<uint32_t>(lods.size());
+			surface.lodCount = static_cast<uint32_t>(surfaceLods.size());
+			for (SurfaceLod const& lod : surfaceLods)
+			{
+				lods.push_back({ .indexOffset = lod.indexOffset, .count = lod.count, .error = lod.error });
+			}
+
+			surfaces.push_back(surface);
+		}
+
+		VertexFormat const vertexFormat = choose_vertex_format(meshVertices);
+		std::vector<uint8_t> const encoded = encode_vertices(meshVertices, vertexFormat);
+
+		cookedMesh.vertexFormat = static_cast<uint32_t>(vertexFormat);
+		cookedMesh.vertexCount = meshVertices.size();
+		cookedMesh.indexCount = meshIndices.size();
+		cookedMesh.firstMeshlet = static_cast<uint32_t>(meshlets.size());
+		cookedMesh.meshletCount = static_cast<uint32_t>(meshMeshlets.meshlets.size());
+		cookedMesh.meshletDataOffset = meshletData.size();
+		cookedMesh.meshletDataCount = meshMeshlets.data.size();
+		meshlets.insert(meshlets.end(), meshMeshlets.meshlets.begin(), meshMeshlets.meshlets.end());
+		meshletData.insert(meshletData.end(), meshMeshlets.data.begin(), meshMeshlets.data.end());
+		vertexData.insert(vertexData.end(), encoded.begin(), encoded.end());
+		vertexCount += meshVertices.size();
+		indices.insert(indices.end(), meshIndices.begin(), meshIndices.end());
+		meshes.push_back(cookedMesh);
+
+		print_cache_stats(name, cacheBefore, cacheAfter);
+		sceneCacheBefore += cacheBefore;
+		sceneCacheAfter += cacheAfter;
+	}
+
+	currentTime = std::chrono::high_resolution_clock::now();
+	elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(currentTime - lastTime);
+	lastTime = currentTime;
+
+	std::cout << "> " << meshes.size() << " meshes cooked in " << elapsed << " (" << vertexCount << " vertices in "
+		<< vertexData.size() / 1024 << " KiB, "
+		<< indices.size() / 3 << " triangles with LODs, " << meshlets.size() << " meshlets, " << lods.size() << " LODs)." << std::endl;
+	print_cache_stats("all meshes", sceneCacheBefore, sceneCacheAfter);
+
+	// Nodes keep their local transforms rather than baking them into the vertices, meshes can be instanced by several nodes
+	std::vector<PscnNode> nodes;
+	for (fastgltf::Node const& node : gltf.nodes)
+	{
+		nodes.push_back(
+			{
+				.name = addString(node.name.c_str()),
+				.parent = pscnNone,
+				.mesh = node.meshIndex.has_value() ? static_cast<uint32_t>(node.meshIndex.value()) : pscnNone,
+				.localTransform = get_local_transform(node)
+			});
+	}
+	for (size_t i = 0; i < gltf.nodes.size(); i++)
+	{
+		for (size_t const c : gltf.nodes[i].children)
+		{
+			nodes[c].parent = static_cast<uint32_t>(i);
+		}
+	}
+
+	// The whole file is assembled in memory and written once
+	std::vector<uint8_t> fileBytes(sizeof(PscnHeader));
+	auto const appendTable = [&fileBytes](void const* data, size_t const elementSize, size_t const count)
+	{
+		size_t const offset = (fileBytes.size() + pscnAlignment - 1) / pscnAlignment * pscnAlignment;
+		fileBytes.resize(offset + elementSize * count);
+		if (count > 0)
+		{
+			memcpy(fileBytes.data() + offset, data, elementSize * count);
+		}
+		return PscnRange{ offset, count };
+	};
+
+	PscnHeader const header
+	{
+		.magic = pscnMagic,
+		.version = pscnVersion,
+		.vertexSize = sizeof(Vertex),
+		.strings = appendTable(strings.data(), 1, strings.size()),
+		.samplers = appendTable(samplers.data(), sizeof(PscnSampler), samplers.size()),
+		.textures = appendTable(textures.data(), sizeof(PscnTexture), textures.size()),
+		.mips = appendTable(mips.data(), sizeof(PscnMip), mips.size()),
+		.materials = appendTable(materials.data(), sizeof(PscnMaterial), materials.size()),
+		.meshes = appendTable(meshes.data(), sizeof(PscnMesh), meshes.size()),
+		.surfaces = appendTable(surfaces.data(), sizeof(PscnSurface), surfaces.size()),
+		.nodes = appendTable(nodes.data(), sizeof(PscnNode), nodes.size()),
+		.vertexData = appendTable(vertexData.data(), 1, vertexData.size()),
+		.indices = appendTable(indices.data(), sizeof(uint32_t), indices.size()),
+		.textureData = appendTable(textureData.data(), 1, textureData.size()),
+		.meshlets = appendTable(meshlets.data(), sizeof(Meshlet), meshlets.size()),
+		.meshletData = appendTable(meshletData.data(), sizeof(uint32_t), meshletData.size()),
+		.lods = appendTable(lods.data(), sizeof(PscnLod), lods.size())
+	};
+	memcpy(fileBytes.data(), &header, sizeof(PscnHeader));
+
+	std::ofstream file(std::string(pscnPath), std::ios::binary | std::ios::trunc);
+	file.write(reinterpret_cast<char const*>(fileBytes.data()), static_cast<std::streamsize>(fileBytes.size()));
+	if (!file)
+	{
+		std::cerr << "Error when writing " << pscnPath << "\n";
+		return false;
+	}
+
+	elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::high_resolution_clock::now() - startTime);
+	std::cout << "> wrote " << fileBytes.size() / 1024 << " KiB to " << pscnPath << ", cooked in " << elapsed << " (total)." << std::endl;
+	return true;
+}
+
+// View of one table of a mapped .pscn, nothing when the range doesn't fit in the file
+template <typename T>
+static std::optional<std::span<T const>> get_pscn_table(std::span<uint8_t const> const bytes, PscnRange const& range)
+{
+	if (range.offset % alignof(T) != 0 || range.offset > bytes.size() || range.count > (bytes.size() - range.offset) / sizeof(T))
+	{
+		return {};
+	}
+	return std::span(reinterpret_cast<T const*>(bytes.data() + range.offset), static_cast<size_t>(range.count));
+}
+
+std::optional<std::shared_ptr<LoadedGLTF>> load_pscn(VulkanEngine* engine, std::string_view filePath, LoadProgress* progress)
+{
+	auto reportProgress = [progress](char const* stage, float const fraction)
+	{
+		if (progress)
+		{
+			progress->set(stage, fraction);
+		}
+	};
+	reportProgress("Mapping", 0.0f);
+
+	VkPhysicalDeviceProperties deviceProperties{};
+	vkGetPhysicalDeviceProperties(engine->selectedGPU, &deviceProperties);
+
+	std::cout << "Loading pscn: " << filePath << "\n";
+
+	auto const startTime = std::chrono::high_resolution_clock::now();
+	auto lastTime = startTime;
+
+	size_t const uploadBatchesBefore = engine->uploader.getBatchCount();
+	size_t const uploadBytesBefore = engine->uploader.getBytesUploaded();
+
+	// Everything below reads straight out of the mapping, the uploader copies what the GPU needs into staging
+	MappedFile mapped;
+	if (!mapped.open(std::string(filePath)))
+	{
+		std::cerr << "Error when mapping " << filePath << "\n";
+		return {};
+	}
+	std::span<uint8_t const> const bytes = mapped.getBytes();
+
+	if (bytes.size() < sizeof(PscnHeader) || reinterpret_cast<PscnHeader const*>(bytes.data())->magic != pscnMagic)
+	{
+		std::cerr << "Error when loading " << filePath << ": not a pscn file\n";
+		return {};
+	}
+	PscnHeader const& header = *reinterpret_cast<PscnHeader const*>(bytes.data());
+	if (header.version != pscnVersion || header.vertexSize != sizeof(Vertex))
+	{
+		std::cerr << "Error when loading " << filePath << ": cooked by another version of the engine, cook it again\n";
+		return {};
+	}
+
+	auto const stringTable = get_pscn_table<char>(bytes, header.strings);
+	auto const samplerTable = get_pscn_table<PscnSampler>(bytes, header.samplers);
+	auto const textureTable = get_pscn_table<PscnTexture>(bytes, header.textures);
+	auto const mipTable = get_pscn_table<PscnMip>(bytes, header.mips);
+	auto const materialTable = get_pscn_table<PscnMaterial>(bytes, header.materials);
+	auto const meshTable = get_pscn_table<PscnMesh>(bytes, header.meshes);
+	auto const surfaceTable = get_pscn_table<PscnSurface>(bytes, header.surfaces);
+	auto const nodeTable = get_pscn_table<PscnNode>(bytes, header.nodes);
+	auto const vertexData = get_pscn_table<uint8_t>(bytes, header.vertexData);
+	auto const indexTable = get_pscn_table<uint32_t>(bytes, header.indices);
+	auto const textureData = get_pscn_table<uint8_t>(bytes, header.textureData);
+	auto const meshletTable = get_pscn_table<Meshlet>(bytes, header.meshlets);
+	auto const meshletDataTable = get_pscn_table<uint32_t>(bytes, header.meshletData);
+	auto const lodTable = get_pscn_table<PscnLod>(bytes, header.lods);
+	if (!stringTable || !samplerTable || !textureTable || !mipTable || !materialTable || !meshTable
+		|| !surfaceTable || !nodeTable || !vertexData || !indexTable || !textureData || !meshletTable || !meshletDataTable || !lodTable)
+	{
+		std::cerr << "Error when loading " << filePath << ": table out of bounds\n";
+		return {};
+	}
+
+	std::span<char const> const strings = *stringTable;
+	std::span<PscnSampler const> const cookedSamplers = *samplerTable;
+	std::span<PscnTexture const> const cookedTextures = *textureTable;
+	std::span<PscnMip const> const mips = *mipTable;
+	std::span<PscnMaterial const> const cookedMaterials = *materialTable;
+	std::span<PscnMesh const> const cookedMeshes = *meshTable;
+	std::span<PscnSurface const> const surfaces = *surfaceTable;
+	std::span<PscnNode const> const cookedNodes = *nodeTable;
+	std::span<PscnLod const> const cookedLods = *lodTable;
+
+	if (!cookedTextures.empty() && !engine->textureCompressionBCSupported)
+	{
+		std::cerr << "Error when loading " << filePath << ": cooked textures are BC compressed, which this device can't sample\n";
+		return {};
+	}
+
+	// Every reference is checked before anything is created, so a bad file can't leave half a scene on the GPU.
+	// Index values themselves aren't checked, nor the contents of meshlets, a bad one only reads the wrong vertex of the geometry pool.
+	auto const inRange = [](uint64_t const first, uint64_t const count, size_t const size)
+	{
+		return first <= size && count <= size - first;
+	};
+	auto const isSlot = [](uint32_t const index, size_t const size)
+	{
+		return index == pscnNone || index < size;
+	};
+	auto const isName = [&](uint32_t const offset)
+	{
+		return offset < strings.size();
+	};
+
+	bool valid = strings.empty() || strings.back() == '\0';
+	for (PscnTexture const& texture : cookedTextures)
+	{
+		auto const format = static_cast<VkFormat>(texture.format);
+		valid = valid && isName(texture.name) && texture.width > 0 && texture.height > 0
+			&& texture.mipCount > 0 && texture.mipCount <= get_full_mip_count(texture.width, texture.height)
+			&& inRange(texture.firstMip, texture.mipCount, mips.size()) && get_compressed_level_size(format, 1, 1) > 0;
+		// Each mip has to hold a whole level on a block boundary, the copy regions read that much from it
+		for (uint32_t i = 0; valid && i < texture.mipCount; i++)
+		{
+			PscnMip const& mip = mips[texture.firstMip + i];
+			valid = inRange(mip.offset, mip.size, textureData->size()) && mip.offset >= mips[texture.firstMip].offset
+				&& (mip.offset - mips[texture.firstMip].offset) % get_compressed_level_size(format, 1, 1) == 0
+				&& mip.size >= get_compressed_level_size(format, std::max(texture.width >> i, 1u), std::max(texture.height >> i, 1u));
+		}
+	}
+	for (PscnMaterial const& material : cookedMaterials)
+	{
+		valid = valid && isName(material.name) && material.passType <= static_cast<uint32_t>(MaterialPass::Other)
+			&& isSlot(material.albedoTexture, cookedTextures.size()) && isSlot(material.albedoSampler, cookedSamplers.size())
+			&& isSlot(material.normalTexture, cookedTextures.size()) && isSlot(material.normalSampler, cookedSamplers.size())
+			&& isSlot(material.metalRoughAOTexture, cookedTextures.size()) && isSlot(material.metalRoughAOSampler, cookedSamplers.size());
+	}
+	for (PscnMesh const& mesh : cookedMeshes)
+	{
+		valid = valid && isName(mesh.name) && inRange(mesh.firstSurface, mesh.surfaceCount, surfaces.size())
+			&& mesh.vertexFormat <= static_cast<uint32_t>(VertexFormat::PackedColor) && mesh.vertexCount <= vertexData->size()
+			&& inRange(mesh.vertexDataOffset, mesh.vertexCount * get_vertex_stride(static_cast<VertexFormat>(mesh.vertexFormat)), vertexData->size())
+			&& inRange(mesh.firstIndex, mesh.indexCount, indexTable->size())
+			&& inRange(mesh.firstMeshlet, mesh.meshletCount, meshletTable->size())
+			&& inRange(mesh.meshletDataOffset, mesh.meshletDataCount, meshletDataTable->size());
+		for (uint32_t i = 0; valid && i < mesh.surfaceCount; i++)
+		{
+			PscnSurface const& surface = surfaces[mesh.firstSurface + i];
+			valid = inRange(surface.startIndex, surface.count, mesh.indexCount) && isSlot(surface.material, cookedMaterials.size())
+				&& inRange(surface.firstMeshlet, surface.meshletCount, mesh.meshletCount)
+				&& inRange(surface.firstLod, surface.lodCount, cookedLods.size());
+			for (uint32_t l = 0; valid && l < surface.lodCount; l++)
+			{
+				PscnLod const& lod = cookedLods[surface.firstLod + l];
+				valid = inRange(static_cast<uint64_t>(surface.startIndex) + lod.indexOffset, lod.count, mesh.indexCount);
+			}
+		}
+		for (uint32_t i = 0; valid && i < mesh.meshletCount; i++)
+		{
+			Meshlet const& meshlet = (*meshletTable)[mesh.firstMeshlet + i];
+			valid = meshlet.vertexCount <= maxMeshletVertices && meshlet.triangleCount <= maxMeshletTriangles
+				&& inRange(meshlet.dataOffset, meshlet.vertexCount + meshlet.triangleCount, mesh.meshletDataCount);
+		}
+	}
+	for (PscnNode const& node : cookedNodes)
+	{
+		valid = valid && isName(node.name) && isSlot(node.parent, cookedNodes.size()) && isSlot(node.mesh, cookedMeshes.size());
+	}
+	// Every parent chain has to end at a top node, nodes on a cycle would link to each other and never be drawn
+	enum class NodeCheck : uint8_t { Unchecked, OnChain, ReachesTop };
+	std::vector<NodeCheck> nodeChecks(valid ? cookedNodes.size() : 0, NodeCheck::Unchecked);
+	std::vector<uint32_t> chain;
+	for (uint32_t first = 0; valid && first < nodeChecks.size(); first++)
+	{
+		chain.clear();
+		uint32_t node = first;
+		while (node != pscnNone && nodeChecks[node] == NodeCheck::Unchecked)
+		{
+			nodeChecks[node] = NodeCheck::OnChain;
+			chain.push_back(node);
+			node = cookedNodes[node].parent;
+		}
+		valid = node == pscnNone || nodeChecks[node] == NodeCheck::ReachesTop;
+		for (uint32_t const checked : chain)
+		{
+			nodeChecks[checked] = NodeCheck::ReachesTop;
+		}
+	}
+	if (!valid)
+	{
+		std::cerr << "Error when loading " << filePath << ": bad reference in cooked data\n";
+		return {};
+	}
+
+	auto scene = std::make_shared<LoadedGLTF>();
+	scene->creator = engine;
+	LoadedGLTF& file = *scene.get();
+	file.sourcePath = filePath;
+
+	auto currentTime = std::chrono::high_resolution_clock::now();
+	auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(currentTime - lastTime);
+	lastTime = currentTime;
+
+	std::cout << "> pscn mapped and checked in " << elapsed << " (" << bytes.size() / 1024 << " KiB)." << std::endl;
+
+	reportProgress("Samplers", 0.1f);
+
+	for (PscnSampler const& sampler : cookedSamplers)
+	{
+		VkSamplerCreateInfo samplerInfo
+		{
+			.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO,
+			.pNext = nullptr,
+			.magFilter = static_cast<VkFilter>(sampler.magFilter),
+			.minFilter = static_cast<VkFilter>(sampler.minFilter),
+			.mipmapMode = static_cast<VkSamplerMipmapMode>(sampler.mipmapMode),
+			.anisotropyEnable = sampler.anisotropic ? VK_TRUE : VK_FALSE,
+			.maxAnisotropy = sampler.anisotropic ? deviceProperties.limits.maxSamplerAnisotropy : 1.0f,
+			.minLod = 0,
+			.maxLod = VK_LOD_CLAMP_NONE,
+		};
+
+		VkSampler newSampler;
+		vkCreateSampler(engine->device, &samplerInfo, nullptr, &newSampler);
+
+		file.samplers.push_back(newSampler);
+	}
+
+	std::vector<AllocatedImage> images;
+	std::vector<VkBufferImageCopy> regions;
+	for (size_t textureIdx = 0; textureIdx < cookedTextures.size(); textureIdx++)
+	{
+		reportProgress("Textures", 0.1f + 0.5f * static_cast<float>(textureIdx) / static_cast<float>(cookedTextures.size()));
+
+		PscnTexture const& texture = cookedTextures[textureIdx];
+		std::span<PscnMip const> const textureMips = mips.subspan(texture.firstMip, texture.mipCount);
+
+		regions.clear();
+		uint64_t dataEnd = 0;
+		for (uint32_t level = 0; level < texture.mipCount; level++)
+		{
+			regions.push_back(
+				{
+					.bufferOffset = textureMips[level].offset - textureMips[0].offset,
+					.imageSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, level, 0, 1 },
+					.imageExtent = { std::max(texture.width >> level, 1u), std::max(texture.height >> level, 1u), 1 }
+				});
+			dataEnd = std::max(dataEnd, textureMips[level].offset + textureMips[level].size);
+		}
+
+		AllocatedImage const newImage = engine->createImage(textureData->subspan(textureMips[0].offset, dataEnd - textureMips[0].offset),
+			VkExtent3D{ texture.width, texture.height, 1 }, static_cast<VkFormat>(texture.format), regions);
+		images.push_back(newImage);
+		file.images[get_unique_name(file.images, &strings[texture.name], "image")] = newImage;
+	}
+
+	currentTime = std::chrono::high_resolution_clock::now();
+	elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(currentTime - lastTime);
+	lastTime = currentTime;
+
+	std::cout << "> " << cookedTextures.size() << " textures loaded in " << elapsed << " (" << textureData->size() / 1024 << " KiB)." << std::endl;
+
+	reportProgress("Materials", 0.6f);
+
+	std::vector<DescriptorAllocatorGrowable::PoolSizeRatio> sizes = { {VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 3} };
+
+	std::vector<std::shared_ptr<GLTFMaterial>> materials;
+	if (!cookedMaterials.empty())
+	{
+		file.descriptorPool.init(engine->device, static_cast<uint32_t>(cookedMaterials.size()), sizes);
+
+		auto const getSampler = [&](uint32_t const sampler)
+		{
+			return sampler == pscnNone ? engine->defaultSamplerLinear : file.samplers[sampler];
+		};
+
+		for (size_t data_index = 0; data_index < cookedMaterials.size(); data_index++)
+		{
+			PscnMaterial const& material = cookedMaterials[data_index];
+
+			auto newMat = std::make_shared<GLTFMaterial>();
+			materials.push_back(newMat);
+			file.materials[&strings[material.name]] = newMat;
+
+			PBRMaterial::MaterialConstants constants{};
+			constants.colorFactors = material.colorFactors;
+			constants.metalRoughFactors = glm::vec2(material.metalRoughFactors);
+
+			PBRMaterial::MaterialResources materialResources{};
+			materialResources.albedoImage = engine->whiteImage;
+			materialResources.albedoSampler = getSampler(material.albedoSampler);
+			materialResources.normalImage = engine->defaultNormalImage;
+			materialResources.normalSampler = getSampler(material.normalSampler);
+			materialResources.metalRoughAOImage = engine->defaultMraoImage;
+			materialResources.metalRoughAOSampler = getSampler(material.metalRoughAOSampler);
+
+			if (material.albedoTexture != pscnNone)
+			{
+				materialResources.albedoImage = images[material.albedoTexture];
+				// compressed sources are copied through by the cooker without premultiplying
+				if (!(cookedTextures[material.albedoTexture].flags & PSCN_TEXTURE_PREMULTIPLIED))
+				{
+					constants.flags |= PBRMaterial::MATERIAL_FLAG_STRAIGHT_ALPHA;
+				}
+			}
+			if (material.normalTexture != pscnNone)
+			{
+				materialResources.normalImage = images[material.normalTexture];
+			}
+			if (material.metalRoughAOTexture != pscnNone)
+			{
+				materialResources.metalRoughAOImage = images[material.metalRoughAOTexture];
+			}
+
+			newMat->data = engine->pbrMaterial.writeMaterial(engine->device, static_cast<MaterialPass>(material.passType), materialResources, file.descriptorPool);
+			newMat->data.materialIndex = PBRMaterial::writeBindlessMaterial(engine->bindlessMaterials, constants, make_material_extension(glm::vec3(material.emissiveFactor)),
+				materialResources);
+			file.bindlessMaterialIndices.push_back(newMat->data.materialIndex);
+		}
+	}
+
+	currentTime = std::chrono::high_resolution_clock::now();
+	elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(currentTime - lastTime);
+	lastTime = currentTime;
+
+	std::cout << "> materials loaded in " << elapsed << "." << std::endl;
+
+	std::vector<std::shared_ptr<MeshAsset>> meshes;
+	for (size_t meshIdx = 0; meshIdx < cookedMeshes.size(); meshIdx++)
+	{
+		reportProgress("Meshes", 0.65f + 0.3f * static_cast<float>(meshIdx) / static_cast<float>(cookedMeshes.size()));
+
+		PscnMesh const& mesh = cookedMeshes[meshIdx];
+		auto newMesh = std::make_shared<MeshAsset>();
+		meshes.push_back(newMesh);
+		newMesh->name = get_unique_name(file.meshes, &strings[mesh.name], "mesh");
+		file.meshes[newMesh->name] = newMesh;
+
+		for (PscnSurface const& surface : surfaces.subspan(mesh.firstSurface, mesh.surfaceCount))
+		{
+			std::vector<SurfaceLod> lods;
+			for (PscnLod const& lod : cookedLods.subspan(surface.firstLod, surface.lodCount))
+			{
+				lods.push_back({ .indexOffset = lod.indexOffset, .count = lod.count, .error = lod.error });
+			}
+
+			newMesh->surfaces.push_back(
+				{
+					.startIndex = surface.startIndex,
+					.count = surface.count,
+					.firstMeshlet = surface.firstMeshlet,
+					.meshletCount = surface.meshletCount,
+					.lods = std::move(lods),
+					.bounds =
+					{
+						.origin = glm::vec3(surface.boundsOrigin),
+						.sphereRadius = surface.sphereRadius,
+						.extents = glm::vec3(surface.boundsExtents)
+					},
+					.material = surface.material == pscnNone ? engine->defaultMaterial : materials[surface.material]
+				});
+		}
+
+		newMesh->geometry = engine->geometryPool.upload(indexTable->subspan(mesh.firstIndex, mesh.indexCount),
+			vertexData->subspan(mesh.vertexDataOffset, mesh.vertexCount * get_vertex_stride(static_cast<VertexFormat>(mesh.vertexFormat))),
+			static_cast<VertexFormat>(mesh.vertexFormat), meshletTable->subspan(mesh.firstMeshlet, mesh.meshletCount),
+			meshletDataTable->subspan(mesh.meshletDataOffset, mesh.meshletDataCount));
+	}
+
+	currentTime = std::chrono::high_resolution_clock::now();
+	elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(currentTime - lastTime);
+	lastTime = currentTime;
+
+	std::cout << "> meshes loaded in " << elapsed << " (" << vertexData->size() / 1024 << " KiB of vertices)." << std::endl;
+
+	reportProgress("Nodes", 0.95f);
+
+	std::vector<std::shared_ptr<Node>> nodes;
+	for (PscnNode const& node : cookedNodes)
+	{
+		std::shared_ptr<Node> newNode;
+		if (node.mesh != pscnNone)
+		{
+			newNode = std::make_shared<MeshNode>();
+			dynamic_cast<MeshNode*>(newNode.get())->mesh = meshes[node.mesh];
+		}
+		else
+		{
+			newNode = std::make_shared<Node>();
+		}
+
+		newNode->localTransform = node.localTransform;
+		nodes.push_back(newNode);
+		file.nodes[&strings[node.name]] = newNode;
+	}
+
+	for (size_t i = 0; i < cookedNodes.size(); i++)
+	{
+		if (cookedNodes[i].parent != pscnNone)
+		{
+			nodes[cookedNodes[i].parent]->children.push_back(nodes[i]);
+			nodes[i]->parent = nodes[cookedNodes[i].parent];
+		}
+	}
+
+	for (size_t i = 0; i < cookedNodes.size(); i++)
+	{
+		if (cookedNodes[i].parent == pscnNone)
+		{
+			file.topNodes.push_back(nodes[i]);
+			nodes[i]->refreshTransform(glm::mat4{ 1.f });
+		}
+	}
+
+	engine->uploader.flush();
+	std::cout << "> " << (engine->uploader.getBytesUploaded() - uploadBytesBefore) / 1024 << " KiB uploaded in "
+		<< engine->uploader.getBatchCount() - uploadBatchesBefore << " batches." << std::endl;
+
+	elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::high_resolution_clock::now() - startTime);
+
+	std::cout << "> scene ready in " << elapsed << " (total)." << std::endl;
+	return scene;
 }
\ No newline at end of file
@@ -1,13 +1,28 @@
 #pragma once
 
+#include <atomic>
 #include <unordered_map>
 #include <filesystem>
 
 #include "vk_descriptors.h"
+#include "vk_geometry_pool.h"
 #include "vk_types.h"
 
 class VulkanEngine;
 
+// Written by the loading thread, read by the UI
+struct LoadProgress
+{
+	std::atomic<char const*> stage = "";
+	std::atomic<float> fraction = 0.0f;
+
+	void set(char const* newStage, float const newFraction)
+	{
+		stage = newStage;
+		fraction = newFraction;
+	}
+};
+
 struct GLTFMaterial
 {
 	MaterialInstance data;
@@ -20,10 +35,25 @@ struct Bounds
 	glm::vec3 extents;
 };
 
+// A simplified version of a surface, drawn instead of it when the difference would be under a pixel or so
+struct SurfaceLod
+{
+	// from the surface's startIndex, the level's indices follow the surface's in the mesh
+	uint32_t indexOffset;
+	uint32_t count;
+	// How far the simplification moved the surface at most, relative to its bounding sphere radius
+	float error;
+};
+
 struct GeoSurface
 {
 	uint32_t startIndex;
 	uint32_t count;
+	// relative to the mesh's meshlets in the geometry pool
+	uint32_t firstMeshlet;
+	uint32_t meshletCount;
+	// Coarser and coarser, empty for surfaces that don't simplify
+	std::vector<SurfaceLod> lods;
 	Bounds bounds;
 	std::shared_ptr<GLTFMaterial> material;
 };
@@ -33,7 +63,7 @@ struct MeshAsset
 	std::string name;
 
 	std::vector<GeoSurface> surfaces;
-	GPUMeshBuffers meshBuffers;
+	GeometryAllocation geometry;
 };
 
 struct LoadedGLTF : public IRenderable
@@ -49,10 +79,14 @@ struct LoadedGLTF : public IRenderable
 
 	DescriptorAllocatorGrowable descriptorPool;
 
-	AllocatedBuffer materialDataBuffer;
+	// The materials' indices in the engine's BindlessMaterials, released with the scene
+	std::vector<uint32_t> bindlessMaterialIndices;
 
 	VulkanEngine* creator;
 
+	// The .gltf/.glb or .pscn the scene was loaded from
+	std::string sourcePath;
+
 	virtual ~LoadedGLTF() { clearAll(); }
 
 	void draw(glm::mat4 const& topMatrix, DrawContext& ctx) override;
@@ -62,8 +96,12 @@ private:
 	void clearAll();
 };
 
-std::optional<std::shared_ptr<LoadedGLTF>> load_gltf(VulkanEngine* engine, std::string_view filePath);
+std::optional<std::shared_ptr<LoadedGLTF>> load_gltf(VulkanEngine* engine, std::string_view filePath, LoadProgress* progress = nullptr);
+
+std::optional<Skybox> load_cubemap_from_hdri(VulkanEngine* engine, std::string_view filePath, LoadProgress* progress = nullptr);
 
-std::optional<Skybox> load_cubemap_from_hdri(VulkanEngine* engine, std::string_view filePath);
+// Writes a glTF out as a .pscn (see pscn_format.h): geometry in the engine's vertex format and textures block-compressed
+// with their mips, so loading it is mapping the file and uploading. Needs no device, cooking runs offline.
+bool cook_gltf(std::string_view gltfPath, std::string_view pscnPath);
 
-std::optional<std::shared_ptr<LoadedGLTF>> load_pscn(VulkanEngine* engine, std::string_view filePath);
\ No newline at end of file
+std::optional<std::shared_ptr<LoadedGLTF>> load_pscn(VulkanEngine* engine, std::string_view filePath, LoadProgress* progress = nullptr);
\ No newline at end of file
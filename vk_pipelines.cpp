@@ -49,6 +49,7 @@ void PipelineBuilder::clear()
 	pipelineLayout = {};
 	depthStencil = { .sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO };
 	renderInfo = { .sType = VK_STRUCTURE_TYPE_PIPELINE_RENDERING_CREATE_INFO };
+	colorAttachmentFormats.clear();
 	shaderStages.clear();
 }
 
@@ -62,16 +63,21 @@ VkPipeline PipelineBuilder::buildPipeline(VkDevice const device)
 		.scissorCount = 1
 	};
 
+	std::vector<VkPipelineColorBlendAttachmentState> const blendAttachments(colorAttachmentFormats.size(), colorBlendAttachment);
+
 	VkPipelineColorBlendStateCreateInfo colorBlending
 	{
 		.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO,
 		.pNext = nullptr,
 		.logicOpEnable = VK_FALSE,
 		.logicOp = VK_LOGIC_OP_COPY,
-		.attachmentCount = 1,
-		.pAttachments = &colorBlendAttachment
+		.attachmentCount = static_cast<uint32_t>(blendAttachments.size()),
+		.pAttachments = blendAttachments.data()
 	};
 
+	renderInfo.colorAttachmentCount = static_cast<uint32_t>(colorAttachmentFormats.size());
+	renderInfo.pColorAttachmentFormats = colorAttachmentFormats.data();
+
 	VkPipelineVertexInputStateCreateInfo vertexInputInfo = { .sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO };
 
 	VkDynamicState state[] = { VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR };
@@ -120,6 +126,14 @@ void PipelineBuilder::setShaders(VkShaderModule const vertexShader, VkShaderModu
 	shaderStages.push_back(vkInit::pipeline_shader_stage_create_info(VK_SHADER_STAGE_FRAGMENT_BIT, fragmentShader));
 }
 
+void PipelineBuilder::setMeshShaders(VkShaderModule const taskShader, VkShaderModule const meshShader, VkShaderModule const fragmentShader)
+{
+	shaderStages.clear();
+	shaderStages.push_back(vkInit::pipeline_shader_stage_create_info(VK_SHADER_STAGE_TASK_BIT_EXT, taskShader));
+	shaderStages.push_back(vkInit::pipeline_shader_stage_create_info(VK_SHADER_STAGE_MESH_BIT_EXT, meshShader));
+	shaderStages.push_back(vkInit::pipeline_shader_stage_create_info(VK_SHADER_STAGE_FRAGMENT_BIT, fragmentShader));
+}
+
 void PipelineBuilder::setInputTopology(VkPrimitiveTopology const topology)
 {
 	inputAssembly.topology = topology;
@@ -190,11 +204,20 @@ void PipelineBuilder::disableBlending()
 	colorBlendAttachment.blendEnable = VK_FALSE;
 }
 
+void PipelineBuilder::disableColorWrite()
+{
+	colorBlendAttachment.colorWriteMask = 0;
+	colorBlendAttachment.blendEnable = VK_FALSE;
+}
+
 void PipelineBuilder::setColorAttachmentFormat(VkFormat const format)
 {
-	colorAttachmentFormat = format;
-	renderInfo.colorAttachmentCount = 1;
-	renderInfo.pColorAttachmentFormats = &colorAttachmentFormat;
+	colorAttachmentFormats.assign(1, format);
+}
+
+void PipelineBuilder::setColorAttachmentFormats(std::span<VkFormat const> const formats)
+{
+	colorAttachmentFormats.assign(formats.begin(), formats.end());
 }
 
 void PipelineBuilder::setDepthFormat(VkFormat const format)
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <span>
 #include <vector>
 
 #include "vk_types.h"
@@ -21,7 +22,7 @@ public:
 	VkPipelineLayout pipelineLayout;
 	VkPipelineDepthStencilStateCreateInfo depthStencil;
 	VkPipelineRenderingCreateInfo renderInfo;
-	VkFormat colorAttachmentFormat;
+	std::vector<VkFormat> colorAttachmentFormats;
 
 	PipelineBuilder() { clear(); }
 
@@ -30,6 +31,8 @@ public:
 	VkPipeline buildPipeline(VkDevice device);
 
 	void setShaders(VkShaderModule vertexShader, VkShaderModule fragmentShader);
+	// Vertex input and input assembly are ignored by mesh shader pipelines
+	void setMeshShaders(VkShaderModule taskShader, VkShaderModule meshShader, VkShaderModule fragmentShader);
 	void setInputTopology(VkPrimitiveTopology topology);
 	void setPolygonMode(VkPolygonMode mode);
 	void setCullMode(VkCullModeFlags cullMode, VkFrontFace frontFace);
@@ -38,7 +41,10 @@ public:
 	void enableBlendingAlphaBlend();
 	void enableBlendingSubtract();
 	void disableBlending();
+	void disableColorWrite();
 	void setColorAttachmentFormat(VkFormat format);
+	// Every attachment gets the same blend state
+	void setColorAttachmentFormats(std::span<VkFormat const> formats);
 	void setDepthFormat(VkFormat format);
 	void enableDepthTest(bool depthWriteEnable, VkCompareOp op);
 	void disableDepthTest();
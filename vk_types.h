@@ -15,6 +15,7 @@
 #include "vk_mem_alloc.h"
 
 #include <glm/mat4x4.hpp>
+#include <glm/vec2.hpp>
 #include <glm/vec4.hpp>
 
 #ifdef _DEBUG
@@ -60,18 +61,175 @@ struct Vertex
 	glm::vec4 surfaceTangent; // w ignored
 };
 
-struct GPUMeshBuffers
+struct GPUDrawPushConstants
 {
-	AllocatedBuffer indexBuffer;
-	AllocatedBuffer vertexBuffer;
-	VkDeviceAddress vertexBufferAddress;
+	glm::mat4 modelMatrix;
+	glm::mat4 normalMatrix;
+	VkDeviceAddress vertexBuffer;
 };
 
-struct GPUDrawPushConstants
+struct GPUMeshPushConstants
+{
+	VkDeviceAddress objectBuffer;
+};
+
+// mesh.vert's push constants plus the material texture slots, for the bindless pipelines
+struct GPUBindlessPushConstants
+{
+	VkDeviceAddress objectBuffer;
+	VkDeviceAddress materialTextures;
+};
+
+// One material's parameters in BindlessMaterials' material buffer, indexed by GPUObjectData::materialIndex.
+// Matches material_structures.glsl.
+struct GPUMaterialConstants
+{
+	glm::vec4 colorFactors;
+	glm::vec2 metalRoughFactors;
+	uint32_t flags;
+	uint32_t extension; // noMaterialExtension, or the material's GPUMaterialExtension
+};
+static_assert(sizeof(GPUMaterialConstants) == 32);
+
+static uint32_t constexpr noMaterialExtension = ~0u;
+
+// Parameters only some materials have, kept out of GPUMaterialConstants so the common record stays small
+struct GPUMaterialExtension
+{
+	glm::vec4 emissive; // rgb is the emissive factor times its strength, w unused
+};
+
+// A material's slots in the bindless texture and sampler arrays, indexed like GPUMaterialConstants.
+// Matches bindless_structures.glsl.
+struct GPUBindlessTextures
+{
+	uint32_t albedoTexture;
+	uint32_t albedoSampler;
+	uint32_t normalTexture;
+	uint32_t normalSampler;
+	uint32_t metalRoughAOTexture;
+	uint32_t metalRoughAOSampler;
+	uint32_t pad0[2];
+};
+
+// Per-object data shared by the cull pass and mesh.vert, indexed by the draw's firstInstance
+struct GPUObjectData
 {
 	glm::mat4 modelMatrix;
 	glm::mat4 normalMatrix;
 	VkDeviceAddress vertexBuffer;
+	uint32_t materialIndex;
+	uint32_t batchIndex;
+	glm::vec4 boundsOrigin; // w is the bounding sphere radius
+	glm::vec4 boundsExtents; // w ignored
+	uint32_t indexCount;
+	uint32_t firstIndex;
+	uint32_t batchFirstObject;
+	int32_t vertexOffset;
+	uint32_t vertexFormat; // VertexFormat
+	uint32_t batchFirstCluster;
+	// The object's simplified levels in the scene's LOD buffer, the cull pass picks one per frame
+	uint32_t firstLod;
+	uint32_t lodCount;
+};
+
+// One SurfaceLod of one object, with its indices resolved to the geometry pool
+struct GPUSurfaceLod
+{
+	uint32_t firstIndex;
+	uint32_t indexCount;
+	float error; // relative to the bounding sphere radius
+	uint32_t pad0;
+};
+
+// Start of the draw count buffer written by the cull passes, one draw count per batch follows.
+// The cull stats buffer gets a copy of it to read back.
+struct GPUDrawCountHeader
+{
+	uint32_t visibleCount;
+	uint32_t triangleCount;
+	uint32_t lodSavedTriangleCount;
+	uint32_t occludedCount; // in the frustum but behind the depth pyramid
+};
+
+// With occlusion culling the cull pass runs twice a frame, CULL_PASS_* in cull.comp.
+// Early draws the opaque objects that pass against the previous frame's depth pyramid, then the pyramid is rebuilt
+// from what was drawn and Late draws everything else that passes against it, transparent objects included.
+enum class CullPass : uint32_t
+{
+	Single,
+	Early,
+	Late
+};
+
+// Written once per pass for the cull pass, matches CullData in cull.comp
+struct GPUCullData
+{
+	glm::vec4 frustumPlanes[6];
+	// xyz is the culling camera, w the LOD error scale from LodSettings, 0 to always draw the full surfaces
+	glm::vec4 lodCamera;
+	// View and projection the depth pyramid was rendered with, the projection as P00, P11, P22 and P32
+	glm::mat4 occlusionView;
+	glm::vec4 occlusionProj;
+	VkDeviceAddress objects;
+	VkDeviceAddress drawCommands;
+	VkDeviceAddress drawCounts;
+	VkDeviceAddress lods;
+	VkDeviceAddress drawnEarly; // one uint per object, written by the early pass
+	uint32_t objectCount;
+	uint32_t cullingEnabled;
+	uint32_t pass; // CullPass
+	uint32_t occlusionEnabled; // the early pass has no pyramid to test against on the first frame
+	uint32_t batchCount;
+	uint32_t opaqueCount;
+};
+
+struct GPUDepthPyramidPushConstants
+{
+	glm::uvec2 inputSize;
+	glm::uvec2 outputSize;
+};
+
+struct GPUCullPushConstants
+{
+	VkDeviceAddress cullData;
+};
+
+// One meshlet of one object, listed in object order so every batch's clusters are contiguous
+struct GPUCluster
+{
+	uint32_t objectIndex;
+	uint32_t meshletIndex;
+	// First index of the object's triangles in the per-frame cluster index buffer, meshlets write theirs after it
+	uint32_t firstIndex;
+};
+
+// Written once per frame for the cluster cull pass and the mesh shader path, matches ClusterCullData in meshlet_structures.glsl
+struct GPUClusterCullData
+{
+	glm::vec4 frustumPlanes[6];
+	glm::vec4 cameraPosition; // w unused
+	VkDeviceAddress objects;
+	VkDeviceAddress meshlets;
+	VkDeviceAddress meshletData;
+	VkDeviceAddress clusters;
+	VkDeviceAddress drawCommands;
+	VkDeviceAddress drawCounts;
+	VkDeviceAddress indices;
+	uint32_t clusterCount;
+	uint32_t cullingEnabled;
+};
+
+struct GPUClusterCullPushConstants
+{
+	VkDeviceAddress cullData;
+};
+
+struct GPUMeshletPushConstants
+{
+	VkDeviceAddress cullData;
+	uint32_t firstCluster;
+	uint32_t clusterCount;
 };
 
 enum class MaterialPass :uint8_t
@@ -92,6 +250,7 @@ struct MaterialInstance
 	MaterialPipeline* pipeline;
 	VkDescriptorSet materialSet;
 	MaterialPass passType;
+	uint32_t materialIndex;
 };
 
 struct DrawContext;
@@ -134,6 +293,9 @@ struct GPUSceneData
 	glm::mat4 proj;
 	glm::mat4 viewProj;
 	glm::mat4 cullViewProj;
+	// Every material's GPUMaterialConstants and GPUMaterialExtensions, indexed by GPUObjectData::materialIndex
+	VkDeviceAddress materials;
+	VkDeviceAddress materialExtensions;
 };
 
 struct GPULightData
@@ -147,6 +309,66 @@ struct GPULightData
 	VkDeviceAddress directionalLights;
 	VkDeviceAddress pointLights;
 	VkDeviceAddress spotLights;
+
+	// Point and spot lights are read from the fragment's cluster, built each frame by light_cull.comp
+	VkDeviceAddress lightClusters;
+	glm::vec2 clusterTileSize;
+	float clusterDepthScale;
+	float clusterDepthBias;
+};
+
+// Froxel grid the point and spot lights are binned into, matches light_structures.glsl
+static uint32_t constexpr lightClusterCountX = 16;
+static uint32_t constexpr lightClusterCountY = 9;
+static uint32_t constexpr lightClusterCountZ = 24;
+static uint32_t constexpr lightClusterCount = lightClusterCountX * lightClusterCountY * lightClusterCountZ;
+static uint32_t constexpr maxLightsPerCluster = 256;
+// Depth slices are spaced exponentially between these, the first and last slices also cover whatever is nearer or farther
+static float constexpr lightClusterNear = 0.1f;
+static float constexpr lightClusterFar = 1000.0f;
+
+struct GPULightCluster
+{
+	uint32_t count;
+	uint32_t lights[maxLightsPerCluster]; // spot light indices have the top bit set
+};
+
+struct GPULightCullPushConstants
+{
+	glm::mat4 view;
+	glm::vec2 projScale;
+	glm::vec2 ndcTileSize;
+	VkDeviceAddress pointLights;
+	VkDeviceAddress spotLights;
+	VkDeviceAddress clusters;
+	uint32_t pointLightCount;
+	uint32_t spotLightCount;
+	float depthScale;
+	float depthBias;
+	float farPlane;
+};
+
+// Screen tiles the deferred path culls its lights in, one tile_light_cull.comp workgroup each
+static uint32_t constexpr deferredTileSize = 16;
+
+struct GPUTileLightCullPushConstants
+{
+	glm::mat4 view;
+	glm::vec4 projection; // P00, P11, P22 and P32
+	VkDeviceAddress pointLights;
+	VkDeviceAddress spotLights;
+	VkDeviceAddress tiles;
+	uint32_t pointLightCount;
+	uint32_t spotLightCount;
+	glm::uvec2 drawExtent;
+	uint32_t tileCountX;
+};
+
+struct GPUDeferredLightingPushConstants
+{
+	VkDeviceAddress tiles;
+	glm::uvec2 drawExtent;
+	uint32_t tileCountX;
 };
 
 struct Skybox
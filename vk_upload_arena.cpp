@@ -0,0 +1,97 @@
+#include "vk_upload_arena.h"
+
+#include <algorithm>
+#include <iostream>
+
+#include "vk_engine.h"
+
+void UploadArena::init(VulkanEngine* engine, VkDeviceSize const capacity, VkDeviceSize const alignment)
+{
+	this->engine = engine;
+	this->alignment = alignment;
+	blocks.push_back(createBlock(capacity));
+	head = 0;
+	allocationCount = 0;
+	used = 0;
+}
+
+void UploadArena::cleanup()
+{
+	for (Block const& block : blocks)
+	{
+		engine->destroyBuffer(block.buffer);
+	}
+	blocks.clear();
+}
+
+void UploadArena::reset()
+{
+	if (blocks.size() > 1)
+	{
+		VkDeviceSize capacity = 0;
+		for (Block const& block : blocks)
+		{
+			capacity += block.size;
+			engine->destroyBuffer(block.buffer);
+		}
+		blocks.clear();
+		blocks.push_back(createBlock(capacity));
+
+		std::cout << "> upload arena grown to " << capacity / 1024 << " KiB." << std::endl;
+	}
+
+	head = 0;
+	allocationCount = 0;
+	used = 0;
+}
+
+UploadAllocation UploadArena::allocate(VkDeviceSize const size)
+{
+	VkDeviceSize offset = (head + alignment - 1) / alignment * alignment;
+	if (offset + size > blocks.back().size)
+	{
+		// At least as big as the last one, so a frame that keeps growing doesn't end up with many small blocks
+		blocks.push_back(createBlock(std::max(size, blocks.back().size)));
+		offset = 0;
+	}
+	head = offset + size;
+
+	allocationCount++;
+	used += size;
+
+	Block const& block = blocks.back();
+	return UploadAllocation
+	{
+		.buffer = block.buffer.buffer,
+		.offset = offset,
+		.address = block.address + offset,
+		.data = static_cast<std::byte*>(block.buffer.info.pMappedData) + offset
+	};
+}
+
+VkDeviceSize UploadArena::getCapacity() const
+{
+	VkDeviceSize capacity = 0;
+	for (Block const& block : blocks)
+	{
+		capacity += block.size;
+	}
+	return capacity;
+}
+
+UploadArena::Block UploadArena::createBlock(VkDeviceSize const size) const
+{
+	// Scene and light data are read as uniforms, everything else through device addresses or as copy sources
+	VkBufferUsageFlags constexpr usage = VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT;
+
+	Block block
+	{
+		.buffer = engine->createBuffer(size, usage, VMA_MEMORY_USAGE_CPU_TO_GPU),
+		.address = 0,
+		.size = size
+	};
+
+	VkBufferDeviceAddressInfo const deviceAddressInfo{ .sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO, .buffer = block.buffer.buffer };
+	block.address = vkGetBufferDeviceAddress(engine->device, &deviceAddressInfo);
+	return block;
+}
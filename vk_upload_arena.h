@@ -0,0 +1,71 @@
+#pragma once
+
+#include <cstring>
+
+#include "vk_types.h"
+
+class VulkanEngine;
+
+// Part of an UploadArena block, valid until the arena is next reset
+struct UploadAllocation
+{
+	VkBuffer buffer;
+	VkDeviceSize offset;
+	VkDeviceAddress address; // of the first byte, not the buffer
+	void* data;
+};
+
+// Linear allocator over persistently mapped host-visible memory, one per FrameData. Everything a frame uploads is
+// bumped out of the current block, and the whole arena is reset once the frame's fence has signalled.
+// A frame that needs more than the block holds gets overflow blocks, which the next reset folds into one block
+// big enough for the whole frame.
+class UploadArena
+{
+public:
+	// Every allocation starts on alignment, which has to cover the uniform and storage buffer offset alignments
+	void init(VulkanEngine* engine, VkDeviceSize capacity, VkDeviceSize alignment);
+	void cleanup();
+
+	// Only once the GPU is done with everything allocated since the last reset
+	void reset();
+
+	UploadAllocation allocate(VkDeviceSize size);
+
+	template <typename T>
+	UploadAllocation upload(std::span<T const> data)
+	{
+		UploadAllocation const allocation = allocate(data.size_bytes());
+		memcpy(allocation.data, data.data(), data.size_bytes());
+		return allocation;
+	}
+
+	template <typename T>
+	UploadAllocation upload(T const& value)
+	{
+		return upload(std::span<T const>(&value, 1));
+	}
+
+	uint32_t getAllocationCount() const { return allocationCount; }
+	VkDeviceSize getUsed() const { return used; }
+	VkDeviceSize getCapacity() const;
+
+private:
+	struct Block
+	{
+		AllocatedBuffer buffer;
+		VkDeviceAddress address;
+		VkDeviceSize size;
+	};
+
+	Block createBlock(VkDeviceSize size) const;
+
+	VulkanEngine* engine = nullptr;
+
+	// The last block is the one being allocated from
+	std::vector<Block> blocks;
+	VkDeviceSize alignment = 1;
+	VkDeviceSize head = 0;
+
+	uint32_t allocationCount = 0;
+	VkDeviceSize used = 0;
+};
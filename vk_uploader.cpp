@@ -0,0 +1,662 @@
+#include "vk_uploader.h"
+
+#include <cassert>
+#include <iostream>
+
+#include "compressed_texture.h"
+#include "vk_engine.h"
+#include "vk_images.h"
+#include "vk_initializers.h"
+#include "vk_pipelines.h"
+
+// Covers the texel size of every format we upload, and the usual optimalBufferCopyOffsetAlignment
+static size_t constexpr stagingAlignment = 16;
+
+// Staging memory is also read directly by the conversion shader
+static VkBufferUsageFlags constexpr stagingUsage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT;
+
+struct ConversionPushConstants
+{
+	VkDeviceAddress src;
+	VkDeviceAddress dst;
+	uint32_t width;
+	uint32_t height;
+	uint32_t conversion;
+	uint32_t halfOutput;
+};
+
+size_t get_source_texel_size(VkFormat const format, ImageConversion const conversion)
+{
+	switch (conversion)
+	{
+	case ImageConversion::PremultiplyAlpha:
+		return 4;
+	case ImageConversion::ExpandRGB:
+		return 12;
+	case ImageConversion::FloatToHalf:
+		return 16;
+	case ImageConversion::None:
+		break;
+	}
+
+	switch (format)
+	{
+	case VK_FORMAT_R32G32B32A32_SFLOAT:
+		return 16;
+	case VK_FORMAT_R16G16B16A16_SFLOAT:
+		return 8;
+	default:
+		return 4;
+	}
+}
+
+void UploadManager::init(VulkanEngine* engine, VkQueue const transferQueue, uint32_t const transferQueueFamily, size_t const stagingSize)
+{
+	this->engine = engine;
+	this->transferQueue = transferQueue;
+	this->transferQueueFamily = transferQueueFamily;
+	graphicsQueueFamily = engine->graphicsQueueFamily;
+
+	VkSemaphoreTypeCreateInfo const timelineInfo
+	{
+		.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO,
+		.pNext = nullptr,
+		.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE,
+		.initialValue = 0
+	};
+	VkSemaphoreCreateInfo semaphoreInfo = vkInit::semaphore_create_info();
+	semaphoreInfo.pNext = &timelineInfo;
+	VK_CHECK(vkCreateSemaphore(engine->device, &semaphoreInfo, nullptr, &timelineSemaphore));
+
+	// Copies read the ring on the transfer queue and conversions on the graphics queue, so it is shared between both
+	ringCapacity = stagingSize;
+	uint32_t const queueFamilies[] = { transferQueueFamily, graphicsQueueFamily };
+	VkBufferCreateInfo const ringInfo
+	{
+		.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+		.pNext = nullptr,
+		.size = ringCapacity,
+		.usage = stagingUsage,
+		.sharingMode = hasDedicatedTransferQueue() ? VK_SHARING_MODE_CONCURRENT : VK_SHARING_MODE_EXCLUSIVE,
+		.queueFamilyIndexCount = hasDedicatedTransferQueue() ? 2u : 0u,
+		.pQueueFamilyIndices = hasDedicatedTransferQueue() ? queueFamilies : nullptr
+	};
+	VmaAllocationCreateInfo constexpr ringAllocInfo
+	{
+		.flags = VMA_ALLOCATION_CREATE_MAPPED_BIT,
+		.usage = VMA_MEMORY_USAGE_CPU_ONLY
+	};
+	VK_CHECK(vmaCreateBuffer(engine->allocator, &ringInfo, &ringAllocInfo, &ringBuffer.buffer, &ringBuffer.allocation, &ringBuffer.info));
+
+	initConversionPipeline();
+}
+
+void UploadManager::initConversionPipeline()
+{
+	VkPushConstantRange constexpr pushConstant
+	{
+		.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+		.offset = 0,
+		.size = sizeof(ConversionPushConstants)
+	};
+
+	VkPipelineLayoutCreateInfo const layoutInfo
+	{
+		.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+		.pNext = nullptr,
+		.setLayoutCount = 0,
+		.pSetLayouts = nullptr,
+		.pushConstantRangeCount = 1,
+		.pPushConstantRanges = &pushConstant
+	};
+	VK_CHECK(vkCreatePipelineLayout(engine->device, &layoutInfo, nullptr, &conversionPipelineLayout));
+
+	VkShaderModule conversionShader;
+	if (!vkUtil::load_shader_module((engine->baseAppPath + "shaders/convert_image.comp.spv").c_str(), engine->device, &conversionShader))
+	{
+		std::cerr << "Error when building the image conversion compute shader module\n";
+	}
+
+	VkComputePipelineCreateInfo const pipelineInfo
+	{
+		.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO,
+		.pNext = nullptr,
+		.stage
+		{
+			.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+			.pNext = nullptr,
+			.stage = VK_SHADER_STAGE_COMPUTE_BIT,
+			.module = conversionShader,
+			.pName = "main"
+		},
+		.layout = conversionPipelineLayout
+	};
+	VK_CHECK(vkCreateComputePipelines(engine->device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &conversionPipeline));
+
+	vkDestroyShaderModule(engine->device, conversionShader, nullptr);
+}
+
+void UploadManager::cleanup()
+{
+	{
+		std::scoped_lock lock(mutex);
+		flushLocked();
+	}
+	wait(submittedValue);
+	retireCompleted(false);
+
+	for (Batch const& batch : freeBatches)
+	{
+		vkDestroyCommandPool(engine->device, batch.transferPool, nullptr);
+		if (batch.graphicsPool != batch.transferPool)
+		{
+			vkDestroyCommandPool(engine->device, batch.graphicsPool, nullptr);
+		}
+	}
+	freeBatches.clear();
+
+	vkDestroyPipeline(engine->device, conversionPipeline, nullptr);
+	vkDestroyPipelineLayout(engine->device, conversionPipelineLayout, nullptr);
+
+	engine->destroyBuffer(ringBuffer);
+	vkDestroySemaphore(engine->device, timelineSemaphore, nullptr);
+}
+
+void UploadManager::beginBatch()
+{
+	if (freeBatches.empty())
+	{
+		Batch newBatch{};
+
+		VkCommandPoolCreateInfo const transferPoolInfo = vkInit::command_pool_create_info(transferQueueFamily, VK_COMMAND_POOL_CREATE_TRANSIENT_BIT);
+		VK_CHECK(vkCreateCommandPool(engine->device, &transferPoolInfo, nullptr, &newBatch.transferPool));
+		VkCommandBufferAllocateInfo const transferCmdInfo = vkInit::command_buffer_allocate_info(newBatch.transferPool, 1);
+		VK_CHECK(vkAllocateCommandBuffers(engine->device, &transferCmdInfo, &newBatch.transferCmd));
+
+		if (hasDedicatedTransferQueue())
+		{
+			VkCommandPoolCreateInfo const graphicsPoolInfo = vkInit::command_pool_create_info(graphicsQueueFamily, VK_COMMAND_POOL_CREATE_TRANSIENT_BIT);
+			VK_CHECK(vkCreateCommandPool(engine->device, &graphicsPoolInfo, nullptr, &newBatch.graphicsPool));
+			VkCommandBufferAllocateInfo const graphicsCmdInfo = vkInit::command_buffer_allocate_info(newBatch.graphicsPool, 1);
+			VK_CHECK(vkAllocateCommandBuffers(engine->device, &graphicsCmdInfo, &newBatch.graphicsCmd));
+		}
+		else
+		{
+			newBatch.graphicsPool = newBatch.transferPool;
+			newBatch.graphicsCmd = newBatch.transferCmd;
+		}
+
+		freeBatches.push_back(std::move(newBatch));
+	}
+
+	recording = std::move(freeBatches.back());
+	freeBatches.pop_back();
+
+	VK_CHECK(vkResetCommandPool(engine->device, recording->transferPool, 0));
+	if (recording->graphicsPool != recording->transferPool)
+	{
+		VK_CHECK(vkResetCommandPool(engine->device, recording->graphicsPool, 0));
+	}
+
+	VkCommandBufferBeginInfo const cmdBeginInfo = vkInit::command_buffer_begin_info(VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
+	VK_CHECK(vkBeginCommandBuffer(recording->transferCmd, &cmdBeginInfo));
+	if (recording->graphicsCmd != recording->transferCmd)
+	{
+		VK_CHECK(vkBeginCommandBuffer(recording->graphicsCmd, &cmdBeginInfo));
+	}
+}
+
+UploadManager::Batch& UploadManager::getRecordingBatch()
+{
+	if (!recording.has_value())
+	{
+		beginBatch();
+	}
+	return *recording;
+}
+
+void UploadManager::retireCompleted(bool const waitForOldest)
+{
+	if (waitForOldest && !inFlight.empty())
+	{
+		wait(inFlight.front().completionValue);
+	}
+
+	uint64_t completedValue;
+	VK_CHECK(vkGetSemaphoreCounterValue(engine->device, timelineSemaphore, &completedValue));
+
+	while (!inFlight.empty() && inFlight.front().completionValue <= completedValue)
+	{
+		Batch& batch = inFlight.front();
+
+		ringTail = batch.ringEnd;
+		ringUsed -= batch.ringBytes;
+
+		for (AllocatedBuffer const& buffer : batch.transientBuffers)
+		{
+			engine->destroyBuffer(buffer);
+		}
+		batch.transientBuffers.clear();
+
+		freeBatches.push_back(std::move(batch));
+		inFlight.pop_front();
+	}
+}
+
+std::optional<size_t> UploadManager::allocateStaging(size_t size)
+{
+	size = (size + stagingAlignment - 1) & ~(stagingAlignment - 1);
+	if (size > ringCapacity)
+	{
+		return std::nullopt;
+	}
+
+	while (true)
+	{
+		retireCompleted(false);
+
+		if (ringUsed == 0)
+		{
+			ringHead = 0;
+			ringTail = 0;
+		}
+
+		if (ringUsed == 0 || ringHead > ringTail)
+		{
+			// used region is [tail, head), free space at the end and before tail
+			if (ringHead + size <= ringCapacity)
+			{
+				size_t const offset = ringHead;
+				ringHead += size;
+				ringUsed += size;
+				recordingRingBytes += size;
+				return offset;
+			}
+			if (size <= ringTail)
+			{
+				// skip the end of the ring, the wasted bytes are released with this batch
+				size_t const wasted = ringCapacity - ringHead;
+				ringHead = size;
+				ringUsed += wasted + size;
+				recordingRingBytes += wasted + size;
+				return 0;
+			}
+		}
+		else if (ringHead < ringTail && ringHead + size <= ringTail)
+		{
+			size_t const offset = ringHead;
+			ringHead += size;
+			ringUsed += size;
+			recordingRingBytes += size;
+			return offset;
+		}
+
+		// Out of space: make sure our own copies are submitted, then wait for the oldest batch
+		if (inFlight.empty())
+		{
+			flushLocked();
+		}
+		retireCompleted(true);
+	}
+}
+
+std::pair<VkBuffer, VkDeviceSize> UploadManager::stage(Batch& batch, std::optional<size_t> const stagingOffset, void const* data, size_t const size)
+{
+	if (stagingOffset.has_value())
+	{
+		memcpy(static_cast<char*>(ringBuffer.allocation->GetMappedData()) + *stagingOffset, data, size);
+		return { ringBuffer.buffer, *stagingOffset };
+	}
+
+	// only ever used by one queue, conversions read it on the graphics queue and plain copies on the transfer queue
+	AllocatedBuffer const overflow = engine->createBuffer(size, stagingUsage, VMA_MEMORY_USAGE_CPU_ONLY);
+	memcpy(overflow.allocation->GetMappedData(), data, size);
+	batch.transientBuffers.push_back(overflow);
+	return { overflow.buffer, 0 };
+}
+
+VkDeviceAddress UploadManager::getBufferAddress(VkBuffer const buffer) const
+{
+	VkBufferDeviceAddressInfo const addressInfo{ .sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO, .buffer = buffer };
+	return vkGetBufferDeviceAddress(engine->device, &addressInfo);
+}
+
+AllocatedBuffer UploadManager::createBuffer(size_t const size, VkBufferUsageFlags const usage) const
+{
+	uint32_t const queueFamilies[] = { transferQueueFamily, graphicsQueueFamily };
+	VkBufferCreateInfo const bufferInfo
+	{
+		.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+		.pNext = nullptr,
+		.size = size,
+		.usage = usage | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+		.sharingMode = hasDedicatedTransferQueue() ? VK_SHARING_MODE_CONCURRENT : VK_SHARING_MODE_EXCLUSIVE,
+		.queueFamilyIndexCount = hasDedicatedTransferQueue() ? 2u : 0u,
+		.pQueueFamilyIndices = hasDedicatedTransferQueue() ? queueFamilies : nullptr
+	};
+	VmaAllocationCreateInfo constexpr allocInfo
+	{
+		.usage = VMA_MEMORY_USAGE_GPU_ONLY
+	};
+
+	AllocatedBuffer newBuffer{};
+	VK_CHECK(vmaCreateBuffer(engine->allocator, &bufferInfo, &allocInfo, &newBuffer.buffer, &newBuffer.allocation, &newBuffer.info));
+	return newBuffer;
+}
+
+void UploadManager::uploadBuffer(VkBuffer const dst, VkDeviceSize const dstOffset, void const* data, size_t const size)
+{
+	if (size == 0)
+	{
+		return;
+	}
+
+	std::scoped_lock lock(mutex);
+
+	std::optional<size_t> const stagingOffset = allocateStaging(size);
+	Batch& batch = getRecordingBatch();
+
+	auto const [srcBuffer, srcOffset] = stage(batch, stagingOffset, data, size);
+
+	VkBufferCopy const copy
+	{
+		.srcOffset = srcOffset,
+		.dstOffset = dstOffset,
+		.size = size
+	};
+	// dst is shared between both queues, the timeline wait in front of its readers is all the synchronization it needs
+	vkCmdCopyBuffer(batch.transferCmd, srcBuffer, dst, 1, &copy);
+
+	bytesUploaded += size;
+}
+
+void UploadManager::uploadImage(AllocatedImage const& image, void const* data, size_t const size, std::span<VkBufferImageCopy const> const regions, bool const generateMipmaps)
+{
+	std::scoped_lock lock(mutex);
+
+	std::optional<size_t> const stagingOffset = allocateStaging(size);
+	Batch& batch = getRecordingBatch();
+
+	auto const [srcBuffer, srcOffset] = stage(batch, stagingOffset, data, size);
+
+	vkUtil::transition_image(batch.transferCmd, image.image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+
+	// Staging offsets are 16 byte aligned, which covers every block size, so the regions have to be block aligned themselves
+	[[maybe_unused]] size_t const blockSize = get_compressed_level_size(image.imageFormat, 1, 1);
+	std::vector<VkBufferImageCopy> copies(regions.begin(), regions.end());
+	for (VkBufferImageCopy& copy : copies)
+	{
+		assert(blockSize == 0 || copy.bufferOffset % blockSize == 0);
+		copy.bufferOffset += srcOffset;
+	}
+	vkCmdCopyBufferToImage(batch.transferCmd, srcBuffer, image.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, static_cast<uint32_t>(copies.size()), copies.data());
+
+	if (hasDedicatedTransferQueue())
+	{
+		// Mip generation needs blits, so those images stay in TRANSFER_DST until the graphics queue owns them
+		VkImageMemoryBarrier2 barrier
+		{
+			.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2,
+			.pNext = nullptr,
+			.srcStageMask = VK_PIPELINE_STAGE_2_COPY_BIT,
+			.srcAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT,
+			.dstStageMask = VK_PIPELINE_STAGE_2_NONE,
+			.dstAccessMask = VK_ACCESS_2_NONE,
+			.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+			.newLayout = generateMipmaps ? VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL : VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+			.srcQueueFamilyIndex = transferQueueFamily,
+			.dstQueueFamilyIndex = graphicsQueueFamily,
+			.image = image.image,
+			.subresourceRange = vkInit::image_subresource_range(VK_IMAGE_ASPECT_COLOR_BIT)
+		};
+		imageReleases.push_back(barrier);
+
+		barrier.srcStageMask = VK_PIPELINE_STAGE_2_NONE;
+		barrier.srcAccessMask = VK_ACCESS_2_NONE;
+		barrier.dstStageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT;
+		barrier.dstAccessMask = VK_ACCESS_2_MEMORY_READ_BIT | VK_ACCESS_2_MEMORY_WRITE_BIT;
+		imageAcquires.push_back(barrier);
+
+		if (generateMipmaps)
+		{
+			pendingImages.push_back({ .image = image.image, .extent = { image.imageExtent.width, image.imageExtent.height }, .generateMipmaps = true });
+		}
+	}
+	else
+	{
+		pendingImages.push_back({ .image = image.image, .extent = { image.imageExtent.width, image.imageExtent.height }, .generateMipmaps = generateMipmaps });
+	}
+
+	bytesUploaded += size;
+}
+
+void UploadManager::uploadImage(AllocatedImage const& image, void const* data, size_t const size, bool const generateMipmaps)
+{
+	VkBufferImageCopy const copyRegion
+	{
+		.bufferOffset = 0,
+		.bufferRowLength = 0,
+		.bufferImageHeight = 0,
+		.imageSubresource
+		{
+			.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+			.mipLevel = 0,
+			.baseArrayLayer = 0,
+			.layerCount = 1,
+		},
+		.imageExtent = image.imageExtent
+	};
+	uploadImage(image, data, size, std::span(&copyRegion, 1), generateMipmaps);
+}
+
+void UploadManager::uploadImage(AllocatedImage const& image, void const* data, size_t const size, ImageConversion const conversion, bool const generateMipmaps)
+{
+	if (conversion == ImageConversion::None)
+	{
+		uploadImage(image, data, size, generateMipmaps);
+		return;
+	}
+
+	std::scoped_lock lock(mutex);
+
+	std::optional<size_t> const stagingOffset = allocateStaging(size);
+	Batch& batch = getRecordingBatch();
+
+	auto const [srcBuffer, srcOffset] = stage(batch, stagingOffset, data, size);
+
+	VkExtent3D const extent = image.imageExtent;
+	bool const halfOutput = image.imageFormat == VK_FORMAT_R16G16B16A16_SFLOAT;
+	size_t texelSize = 4;
+	if (conversion != ImageConversion::PremultiplyAlpha)
+	{
+		texelSize = halfOutput ? 8 : 16;
+	}
+	size_t const convertedSize = static_cast<size_t>(extent.width) * extent.height * texelSize;
+
+	AllocatedBuffer const scratch = engine->createBuffer(convertedSize,
+		VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT, VMA_MEMORY_USAGE_GPU_ONLY);
+	batch.transientBuffers.push_back(scratch);
+
+	// Everything happens on the graphics command buffer, which already runs after the transfer half of the batch
+	VkCommandBuffer const cmd = batch.graphicsCmd;
+
+	ConversionPushConstants const pushConstants
+	{
+		.src = getBufferAddress(srcBuffer) + srcOffset,
+		.dst = getBufferAddress(scratch.buffer),
+		.width = extent.width,
+		.height = extent.height,
+		.conversion = static_cast<uint32_t>(conversion),
+		.halfOutput = halfOutput ? 1u : 0u
+	};
+	vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, conversionPipeline);
+	vkCmdPushConstants(cmd, conversionPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(ConversionPushConstants), &pushConstants);
+	vkCmdDispatch(cmd, (extent.width + 63) / 64, extent.height, 1);
+
+	VkBufferMemoryBarrier2 const scratchBarrier
+	{
+		.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER_2,
+		.pNext = nullptr,
+		.srcStageMask = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+		.srcAccessMask = VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT,
+		.dstStageMask = VK_PIPELINE_STAGE_2_COPY_BIT,
+		.dstAccessMask = VK_ACCESS_2_TRANSFER_READ_BIT,
+		.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+		.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+		.buffer = scratch.buffer,
+		.offset = 0,
+		.size = VK_WHOLE_SIZE
+	};
+	VkDependencyInfo const scratchDependency
+	{
+		.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
+		.pNext = nullptr,
+		.bufferMemoryBarrierCount = 1,
+		.pBufferMemoryBarriers = &scratchBarrier
+	};
+	vkCmdPipelineBarrier2(cmd, &scratchDependency);
+
+	vkUtil::transition_image(cmd, image.image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+
+	VkBufferImageCopy const copyRegion
+	{
+		.bufferOffset = 0,
+		.bufferRowLength = 0,
+		.bufferImageHeight = 0,
+		.imageSubresource
+		{
+			.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+			.mipLevel = 0,
+			.baseArrayLayer = 0,
+			.layerCount = 1,
+		},
+		.imageExtent = extent
+	};
+	vkCmdCopyBufferToImage(cmd, scratch.buffer, image.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &copyRegion);
+
+	// never owned by the transfer queue, so it only needs the usual mip generation or transition at flush
+	pendingImages.push_back({ .image = image.image, .extent = { extent.width, extent.height }, .generateMipmaps = generateMipmaps });
+
+	bytesUploaded += size;
+}
+
+uint64_t UploadManager::flush()
+{
+	std::scoped_lock lock(mutex);
+	return flushLocked();
+}
+
+uint64_t UploadManager::flushLocked()
+{
+	if (!recording.has_value())
+	{
+		return submittedValue;
+	}
+
+	Batch batch = std::move(*recording);
+	recording.reset();
+
+	auto submit = [&](VkQueue const queue, VkCommandBuffer const cmd, uint64_t const waitValue, uint64_t const signalValue)
+	{
+		VkCommandBufferSubmitInfo const cmdInfo = vkInit::command_buffer_submit_info(cmd);
+
+		VkSemaphoreSubmitInfo waitInfo = vkInit::semaphore_submit_info(VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT, timelineSemaphore);
+		waitInfo.value = waitValue;
+		VkSemaphoreSubmitInfo signalInfo = vkInit::semaphore_submit_info(VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT, timelineSemaphore);
+		signalInfo.value = signalValue;
+
+		VkSubmitInfo2 const submitInfo = vkInit::submit_info(&cmdInfo, &signalInfo, waitValue > 0 ? &waitInfo : nullptr);
+
+		if (queue == engine->graphicsQueue)
+		{
+			std::scoped_lock queueLock(engine->graphicsQueueMutex);
+			VK_CHECK(vkQueueSubmit2(queue, 1, &submitInfo, VK_NULL_HANDLE));
+		}
+		else
+		{
+			VK_CHECK(vkQueueSubmit2(queue, 1, &submitInfo, VK_NULL_HANDLE));
+		}
+	};
+
+	if (hasDedicatedTransferQueue())
+	{
+		VkDependencyInfo const releaseInfo
+		{
+			.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
+			.pNext = nullptr,
+			.imageMemoryBarrierCount = static_cast<uint32_t>(imageReleases.size()),
+			.pImageMemoryBarriers = imageReleases.data()
+		};
+		vkCmdPipelineBarrier2(batch.transferCmd, &releaseInfo);
+		VK_CHECK(vkEndCommandBuffer(batch.transferCmd));
+
+		VkDependencyInfo const acquireInfo
+		{
+			.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
+			.pNext = nullptr,
+			.imageMemoryBarrierCount = static_cast<uint32_t>(imageAcquires.size()),
+			.pImageMemoryBarriers = imageAcquires.data()
+		};
+		vkCmdPipelineBarrier2(batch.graphicsCmd, &acquireInfo);
+	}
+
+	for (PendingImage const& pending : pendingImages)
+	{
+		if (pending.generateMipmaps)
+		{
+			vkUtil::generate_mipmaps(batch.graphicsCmd, pending.image, pending.extent);
+		}
+		else
+		{
+			vkUtil::transition_image(batch.graphicsCmd, pending.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+		}
+	}
+	VK_CHECK(vkEndCommandBuffer(batch.graphicsCmd));
+
+	if (hasDedicatedTransferQueue())
+	{
+		// transfer queue signals the first value, the graphics queue takes ownership and signals the second.
+		// Timeline signals have to increase, so the transfer half also waits for the previous batch's graphics half.
+		submit(transferQueue, batch.transferCmd, submittedValue, submittedValue + 1);
+		submit(engine->graphicsQueue, batch.graphicsCmd, submittedValue + 1, submittedValue + 2);
+		submittedValue += 2;
+	}
+	else
+	{
+		submit(engine->graphicsQueue, batch.graphicsCmd, 0, submittedValue + 1);
+		submittedValue += 1;
+	}
+
+	batch.completionValue = submittedValue;
+	batch.ringEnd = ringHead;
+	batch.ringBytes = recordingRingBytes;
+	recordingRingBytes = 0;
+	inFlight.push_back(std::move(batch));
+
+	imageReleases.clear();
+	imageAcquires.clear();
+	pendingImages.clear();
+
+	batchCount++;
+
+	return submittedValue;
+}
+
+void UploadManager::wait(uint64_t const value)
+{
+	if (value == 0)
+	{
+		return;
+	}
+
+	VkSemaphoreWaitInfo const waitInfo
+	{
+		.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO,
+		.pNext = nullptr,
+		.flags = 0,
+		.semaphoreCount = 1,
+		.pSemaphores = &timelineSemaphore,
+		.pValues = &value
+	};
+	VK_CHECK(vkWaitSemaphores(engine->device, &waitInfo, UINT64_MAX));
+}
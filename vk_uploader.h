@@ -0,0 +1,121 @@
+#pragma once
+
+#include <mutex>
+
+#include "vk_types.h"
+
+class VulkanEngine;
+
+// Done by a compute pass on the graphics queue between staging and the image copy, so the CPU never touches the pixels.
+// Values are mirrored in shaders/convert_image.comp.
+enum class ImageConversion : uint32_t
+{
+	None = 0,
+	PremultiplyAlpha = 1, // RGBA8 source, rgb = rgb * a / 255
+	ExpandRGB = 2, // RGB32F source into an RGBA32F or RGBA16F image, alpha = 1
+	FloatToHalf = 3 // RGBA32F source into an RGBA16F image
+};
+
+// Bytes per pixel of the data handed to uploadImage
+size_t get_source_texel_size(VkFormat format, ImageConversion conversion);
+
+// Batches buffer and image uploads through a persistent ring staging buffer. Copies are recorded
+// into one command buffer per batch and submitted on the dedicated transfer queue when the device has
+// one, with image ownership handed to the graphics queue afterwards. Completion is tracked with a timeline
+// semaphore so nothing on the render thread has to wait on a per-upload fence.
+class UploadManager
+{
+public:
+	void init(VulkanEngine* engine, VkQueue transferQueue, uint32_t transferQueueFamily, size_t stagingSize);
+	void cleanup();
+
+	// Device local and shared between the transfer and graphics queues, so ranges can be uploaded while others are drawn
+	AllocatedBuffer createBuffer(size_t size, VkBufferUsageFlags usage) const;
+	// dst has to come from createBuffer
+	void uploadBuffer(VkBuffer dst, VkDeviceSize dstOffset, void const* data, size_t size);
+
+	// Regions are relative to the start of data. The image ends up in SHADER_READ_ONLY_OPTIMAL.
+	void uploadImage(AllocatedImage const& image, void const* data, size_t size, std::span<VkBufferImageCopy const> regions, bool generateMipmaps);
+	void uploadImage(AllocatedImage const& image, void const* data, size_t size, bool generateMipmaps);
+	// Single mip, single layer. The image needs no extra usage flags, the converted pixels reach it through a buffer copy.
+	void uploadImage(AllocatedImage const& image, void const* data, size_t size, ImageConversion conversion, bool generateMipmaps);
+
+	// Submits everything recorded so far, returns the timeline value that signals once it is usable on the graphics queue
+	uint64_t flush();
+	void wait(uint64_t value);
+
+	VkSemaphore getTimelineSemaphore() const { return timelineSemaphore; }
+	uint64_t getSubmittedValue() const { return submittedValue; }
+	bool hasDedicatedTransferQueue() const { return transferQueueFamily != graphicsQueueFamily; }
+
+	size_t getBatchCount() const { return batchCount; }
+	size_t getBytesUploaded() const { return bytesUploaded; }
+
+private:
+	struct Batch
+	{
+		VkCommandPool transferPool;
+		VkCommandBuffer transferCmd;
+		VkCommandPool graphicsPool;
+		VkCommandBuffer graphicsCmd;
+
+		uint64_t completionValue = 0;
+		size_t ringEnd = 0;
+		size_t ringBytes = 0;
+		// overflow staging and conversion scratch buffers, destroyed when the batch retires
+		std::vector<AllocatedBuffer> transientBuffers;
+	};
+
+	struct PendingImage
+	{
+		VkImage image;
+		VkExtent2D extent;
+		bool generateMipmaps;
+	};
+
+	Batch& getRecordingBatch();
+	void beginBatch();
+	uint64_t flushLocked();
+	void retireCompleted(bool waitForOldest);
+
+	// Returns the offset into the ring, or nothing if the data has to go through its own staging buffer
+	std::optional<size_t> allocateStaging(size_t size);
+	// Copies data into the ring or an overflow buffer, returns the buffer and offset it landed at
+	std::pair<VkBuffer, VkDeviceSize> stage(Batch& batch, std::optional<size_t> stagingOffset, void const* data, size_t size);
+	VkDeviceAddress getBufferAddress(VkBuffer buffer) const;
+
+	void initConversionPipeline();
+
+	VulkanEngine* engine = nullptr;
+
+	VkQueue transferQueue;
+	uint32_t transferQueueFamily;
+	uint32_t graphicsQueueFamily;
+
+	VkSemaphore timelineSemaphore;
+	uint64_t submittedValue = 0;
+
+	AllocatedBuffer ringBuffer;
+	size_t ringCapacity = 0;
+	size_t ringHead = 0;
+	size_t ringTail = 0;
+	size_t ringUsed = 0;
+	// Ring bytes taken by the batch being recorded, handed back when it retires
+	size_t recordingRingBytes = 0;
+
+	VkPipelineLayout conversionPipelineLayout;
+	VkPipeline conversionPipeline;
+
+	std::optional<Batch> recording;
+	std::deque<Batch> inFlight;
+	std::vector<Batch> freeBatches;
+
+	std::vector<VkImageMemoryBarrier2> imageReleases;
+	std::vector<VkImageMemoryBarrier2> imageAcquires;
+	std::vector<PendingImage> pendingImages;
+
+	size_t batchCount = 0;
+	size_t bytesUploaded = 0;
+
+	std::mutex mutex;
+};